@@ -2,7 +2,156 @@
 //
 
 #include "stdafx.h"
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include "geo/geo_utils.h"
+#include "geo/way_manager.h"
+#include "common/common_utils.h"
+
+#ifndef M_PI
+#define M_PI       3.14159265358979323846
+#endif
+
+// count global heap allocations for the memory benchmarks below
+static std::atomic<long long> g_new_count(0);
+
+void* operator new(size_t size)
+{
+    ++g_new_count;
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+// simple LCG shared by the tests, rand() may lock. uniform in [0, 1)
+static double rand01(unsigned int &seed)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 8) / 16777216.0;
+}
+
+// a grid of two-way roads of rows x cols nodes, step degrees apart from (lat0, lng0). each row
+// and each column is a way with a pair of segments between the adjacent nodes
+static std::vector<geo::SEGMENT> make_grid_segs(int rows, int cols, double step = 0.001,
+    double lat0 = 31.2, double lng0 = 121.4)
+{
+    std::vector<geo::SEGMENT> segs;
+    auto add_way = [&segs](geo::WAY_ID_T way_id, const std::vector<geo::NODE_ID_T> &nd_ids,
+        const std::vector<geo::GeoPoint> &points, const std::string &name) {
+        for (size_t i = 0; i + 1 < nd_ids.size(); ++i) {
+            for (int dir = 1; dir >= -1; dir -= 2) {
+                const size_t from = (dir > 0) ? i : i + 1;
+                const size_t to = (dir > 0) ? i + 1 : i;
+                geo::SEGMENT seg;
+                seg.way_id = way_id;
+                seg.way_sub_seq = (short)(dir * (int)(i + 1));
+                seg.seg_id = geo::Segment::GenerateSegID(way_id, seg.way_sub_seq, 0);
+                seg.from_nd = nd_ids[from];
+                seg.to_nd = nd_ids[to];
+                seg.from_lat = points[from].lat;
+                seg.from_lng = points[from].lng;
+                seg.to_lat = points[to].lat;
+                seg.to_lng = points[to].lng;
+                seg.length = geo::distance_in_meter(points[from], points[to]);
+                seg.way_type = geo::HIGHWAY_SECONDARY;
+                seg.way_name = name;
+                segs.push_back(seg);
+            }
+        }
+    };
+
+    std::vector<geo::NODE_ID_T> nd_ids;
+    std::vector<geo::GeoPoint> points;
+    for (int r = 0; r < rows; ++r) {
+        nd_ids.clear();
+        points.clear();
+        for (int c = 0; c < cols; ++c) {
+            nd_ids.push_back(r * cols + c + 1);
+            points.push_back(geo::GeoPoint(lat0 + r * step, lng0 + c * step));
+        }
+        add_way(1000 + r, nd_ids, points, "row" + std::to_string(r));
+    }
+    for (int c = 0; c < cols; ++c) {
+        nd_ids.clear();
+        points.clear();
+        for (int r = 0; r < rows; ++r) {
+            nd_ids.push_back(r * cols + c + 1);
+            points.push_back(geo::GeoPoint(lat0 + r * step, lng0 + c * step));
+        }
+        add_way(2000 + c, nd_ids, points, "col" + std::to_string(c));
+    }
+    return segs;
+}
+
+static geo::Bound get_segs_bound(const std::vector<geo::SEGMENT> &segs)
+{
+    geo::Bound bound(segs[0].from_lat, segs[0].from_lng, segs[0].from_lat, segs[0].from_lng);
+    for (const auto &seg : segs) {
+        bound.minlat = std::min(bound.minlat, std::min(seg.from_lat, seg.to_lat));
+        bound.minlng = std::min(bound.minlng, std::min(seg.from_lng, seg.to_lng));
+        bound.maxlat = std::max(bound.maxlat, std::max(seg.from_lat, seg.to_lat));
+        bound.maxlng = std::max(bound.maxlng, std::max(seg.from_lng, seg.to_lng));
+    }
+    return bound;
+}
+
+// loaded and initialized for routing and segment services
+static bool init_way_manager(geo::WayManager &way_manager, const std::vector<geo::SEGMENT> &segs)
+{
+    const geo::Bound bound = get_segs_bound(segs);
+    way_manager.SetBoundries(bound);
+    if (!way_manager.LoadSegments(segs) || !way_manager.InitForRouting() ||
+        !way_manager.InitSegServices(bound)) {
+        printf("failed to init way manager: %s\n", way_manager.GetErrorString().c_str());
+        return false;
+    }
+    return true;
+}
+
+// a random star-shaped ring of n vertexes around (lat, lng), its closing edge from the last
+// vertex to the first one is horizontal
+static geo::SimplePolygon make_flat_closed_ring(unsigned int &seed, int n, double lat, double lng,
+    double radius)
+{
+    geo::SimplePolygon ring;
+    for (int i = 0; i < n; ++i) {
+        const double angle = 2 * M_PI * i / n;
+        const double r = radius * (0.5 + 0.5 * rand01(seed));
+        ring.PushBack(geo::GeoPoint(lat + r * std::sin(angle), lng + r * std::cos(angle)));
+    }
+    ring.Vertex(n - 1).lat = ring.Vertex(0).lat;
+    return ring;
+}
+
+// GPS points at the middle of every step-th segment of the route, interval seconds apart
+static std::vector<geo::RouteMatchingViaPoint> make_trace(const std::vector<geo::SegmentPtr> &route,
+    size_t step, int interval, time_t tm)
+{
+    std::vector<geo::RouteMatchingViaPoint> via_points;
+    for (size_t i = 0; i < route.size(); i += step) {
+        const geo::GeoPoint mid_point = route[i]->GetMidPoint();
+        via_points.push_back(geo::RouteMatchingViaPoint(mid_point.lat, mid_point.lng,
+            route[i]->heading_, 30, tm));
+        via_points.back().index = (int)via_points.size() - 1;
+        tm += interval;
+    }
+    return via_points;
+}
 
 
 
@@ -46,8 +195,2459 @@ int test2()
     return 0;
 }
 
-int main()
+// route matching benchmark: heap allocations per trace
+// segs_csv: segments CSV; seg_id1/seg_id2: a route to simulate a GPS trace of about 200 points
+int test_route_matching_allocs(const char *segs_csv, geo::SEG_ID_T seg_id1, geo::SEG_ID_T seg_id2)
+{
+    geo::WayManager way_manager;
+    if (!way_manager.LoadSegments(segs_csv) || !way_manager.InitForRouting() ||
+        !way_manager.InitSegServices(way_manager.GetBoundries())) {
+        printf("failed to init way manager: %s\n", way_manager.GetErrorString().c_str());
+        return -1;
+    }
+
+    std::vector<geo::SegmentPtr> route;
+    if (!way_manager.ShortestPath(seg_id1, seg_id2, route) || route.empty()) {
+        printf("failed to find route from %lld to %lld\n", seg_id1, seg_id2);
+        return -1;
+    }
+
+    geo::RouteMatchingParams params;
+    const size_t step = (route.size() + 199) / 200;
+    time_t tm = util::StrToTimeT("2017-01-01 08:00:00");
+    for (size_t i = 0; i < route.size(); i += step) {
+        const auto &p_seg = route[i];
+        params.via_points.push_back(geo::RouteMatchingViaPoint(
+            (p_seg->from_point_.lat + p_seg->to_point_.lat) / 2,
+            (p_seg->from_point_.lng + p_seg->to_point_.lng) / 2,
+            p_seg->heading_, 30, tm));
+        tm += 5;
+    }
+
+    const int N_ROUNDS = 100;
+    for (int round = 0; round < N_ROUNDS; ++round) {
+        for (auto &via_point : params.via_points) { // clear the outputs
+            via_point.p_seg = nullptr;
+            via_point.i_seg = -1;
+            via_point.is_broken = false;
+        }
+
+        long long new_count0 = g_new_count;
+        auto t0 = util::GetTimeInMs64();
+        bool ok = way_manager.RouteMatching(params);
+        auto t1 = util::GetTimeInMs64();
+        long long new_count = g_new_count - new_count0;
+
+        geo::RouteMatchingAllocStats stats;
+        geo::RouteMatchingInternalAllocStats(params, stats);
+        if (round < 3 || round == N_ROUNDS - 1) {
+            printf("round %d: %s, points %d, %lld ms, heap allocs %lld, "
+                "arena allocs %d, arena mallocs %d, arena capacity %d\n",
+                round, ok ? "ok" : "failed", (int)params.via_points.size(),
+                (long long)(t1 - t0), new_count, (int)stats.arena_allocs,
+                (int)stats.arena_block_allocs, (int)stats.arena_capacity);
+        }
+    }
+    return 0;
+}
+
+// AssignSegment() throughput with n_threads threads, the callers read the error string of their
+// thread after each failed assignment. every 10th point is out of the map and must fail with an
+// error string
+static int run_assign_segment_threads(const geo::WayManager &way_manager, int n_threads)
+{
+    const geo::Bound bound = way_manager.GetBoundries();
+    const int N_POINTS = 1000000;
+    std::vector<std::thread> threads;
+    std::atomic<long long> assigned_count(0), err_count(0), wrong_count(0);
+
+    auto t0 = util::GetTimeInMs64();
+    for (int i_thread = 0; i_thread < n_threads; ++i_thread) {
+        threads.push_back(std::thread([&, i_thread]() {
+            unsigned int seed = 12345u + i_thread;
+            long long assigned = 0, errs = 0, wrongs = 0;
+            for (int i = 0; i < N_POINTS / n_threads; ++i) {
+                double lat = bound.minlat + (bound.maxlat - bound.minlat) * rand01(seed);
+                double lng = bound.minlng + (bound.maxlng - bound.minlng) * rand01(seed);
+                const int heading = (int)(rand01(seed) * 360);
+                const bool out_of_map = (i % 10 == 9);
+                if (out_of_map) {
+                    lat -= 1;
+                }
+                if (way_manager.AssignSegment(lat, lng, heading, 50.0, 30)) {
+                    ++assigned;
+                    if (out_of_map) {
+                        ++wrongs;
+                    }
+                } else if (!way_manager.GetErrorString().empty()) {
+                    ++errs;
+                } else if (out_of_map) {
+                    ++wrongs;
+                }
+            }
+            assigned_count += assigned;
+            err_count += errs;
+            wrong_count += wrongs;
+        }));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    auto t1 = util::GetTimeInMs64();
+
+    printf("threads %d: %d points in %lld ms, %.0f points/s, assigned %lld, errors %lld, "
+        "out of the map assigned or without error %lld\n", n_threads, N_POINTS, (long long)(t1 - t0),
+        N_POINTS * 1000.0 / (t1 - t0 + 1), (long long)assigned_count, (long long)err_count,
+        (long long)wrong_count);
+    return (wrong_count == 0 && assigned_count > 0) ? 0 : 1;
+}
+
+int test_assign_segment_threads(const char *segs_csv, int n_threads)
+{
+    geo::WayManager way_manager;
+    if (!way_manager.LoadSegments(segs_csv) ||
+        !way_manager.InitSegServices(way_manager.GetBoundries())) {
+        printf("failed to init way manager: %s\n", way_manager.GetErrorString().c_str());
+        return -1;
+    }
+    return run_assign_segment_threads(way_manager, n_threads);
+}
+
+// the same on a grid of about 100 m, with 1 to max_threads threads
+int test_assign_segment_threads_grid(int max_threads)
+{
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, make_grid_segs(100, 100))) {
+        return -1;
+    }
+    int ret = 0;
+    for (int n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+        ret |= run_assign_segment_threads(way_manager, n_threads);
+    }
+    return ret;
+}
+
+// batch distance kernels against distance_in_meter(): accuracy and throughput, fails beyond the
+// documented errors. half of the pairs are random on earth, half are 0.1 m to 100 km apart
+int test_distance_batch()
+{
+    const size_t N = 1000000;
+    std::vector<geo::GeoPoint> a(N), b(N);
+    unsigned int seed = 12345u;
+    for (size_t i = 0; i < N; ++i) {
+        a[i] = geo::GeoPoint(rand01(seed) * 140 - 70, rand01(seed) * 360 - 180);
+        if (i % 2) {
+            b[i] = geo::GeoPoint(rand01(seed) * 140 - 70, rand01(seed) * 360 - 180);
+        } else {
+            const double span = std::pow(10.0, rand01(seed) * 6 - 1) / 111000;
+            b[i] = geo::GeoPoint(a[i].lat + (rand01(seed) * 2 - 1) * span,
+                a[i].lng + (rand01(seed) * 2 - 1) * span);
+        }
+    }
+
+    std::vector<double> d(N), d_batch(N), d_equirect(N), d_from(N);
+    auto t0 = util::GetTimeInMs64();
+    for (size_t i = 0; i < N; ++i) {
+        d[i] = geo::distance_in_meter(a[i], b[i]);
+    }
+    auto t1 = util::GetTimeInMs64();
+    geo::distance_in_meter_batch(a.data(), b.data(), d_batch.data(), N);
+    auto t2 = util::GetTimeInMs64();
+    geo::distance_in_meter_equirect_batch(a.data(), b.data(), d_equirect.data(), N);
+    auto t3 = util::GetTimeInMs64();
+    geo::distance_in_meter_batch(a[0], b.data(), d_from.data(), N);
+
+    double max_err = 0, max_rel_err_10km = 0, max_rel_err_100km = 0;
+    for (size_t i = 0; i < N; ++i) {
+        max_err = std::max(max_err, std::fabs(d_batch[i] - d[i]));
+        max_err = std::max(max_err, std::fabs(d_from[i] - geo::distance_in_meter(a[0], b[i])));
+        if (d[i] > 0.01 && d[i] <= 100000) {
+            const double rel_err = std::fabs(d_equirect[i] - d[i]) / d[i];
+            max_rel_err_100km = std::max(max_rel_err_100km, rel_err);
+            if (d[i] <= 10000) {
+                max_rel_err_10km = std::max(max_rel_err_10km, rel_err);
+            }
+        }
+    }
+
+    printf("%d distances: scalar %lld ms, batch %lld ms, equirect batch %lld ms\n", (int)N,
+        (long long)(t1 - t0), (long long)(t2 - t1), (long long)(t3 - t2));
+    printf("batch max error %g m, equirect max relative error %g (10 km), %g (100 km)\n",
+        max_err, max_rel_err_10km, max_rel_err_100km);
+    // the bounds of the comments in geo_utils.cpp
+    return (max_err < 1e-5 && max_rel_err_10km < 1e-6 && max_rel_err_100km < 1e-4) ? 0 : 1;
+}
+
+// batch coordinate transforms against the scalar functions: accuracy and throughput, fails
+// beyond the 1e-12 degree of geo_utils.h or if china_only changes a point outside china.
+// random points in the bounding box of china, the 1/8 outside are left by china_only
+int test_coord_transform_batch()
+{
+    int ret = 0;
+    const size_t N = 1000000;
+    std::vector<double> lats(N), lngs(N), out_lats(N), out_lngs(N);
+    unsigned int seed = 12345u;
+    for (size_t i = 0; i < N; ++i) {
+        lats[i] = 18 + rand01(seed) * 36;
+        lngs[i] = 73 + rand01(seed) * 62;
+    }
+
+    typedef void (*ScalarFunc)(double, double, double&, double&);
+    typedef void (*BatchFunc)(const double *, const double *, double *, double *, size_t, bool);
+    struct {
+        const char *name;
+        ScalarFunc scalar_func;
+        BatchFunc batch_func;
+    } transforms[] = {
+        { "wgs84_to_mars", geo::wgs84_to_mars, geo::wgs84_to_mars_batch },
+        { "mars_to_wgs84", [](double lat, double lng, double& out_lat, double& out_lng) {
+            geo::mars_to_wgs84(lat, lng, out_lat, out_lng);
+        }, [](const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+            size_t n, bool china_only) {
+            geo::mars_to_wgs84_batch(lats, lngs, out_lats, out_lngs, n, 2, china_only);
+        } },
+        { "bd09_to_wgs84", geo::bd09_to_wgs84, geo::bd09_to_wgs84_batch },
+        { "wgs84_to_bd09", geo::wgs84_to_bd09, geo::wgs84_to_bd09_batch },
+    };
+
+    for (const auto& transform : transforms) {
+        auto t0 = util::GetTimeInMs64();
+        double max_err = 0;
+        for (size_t i = 0; i < N; ++i) {
+            transform.scalar_func(lats[i], lngs[i], out_lats[i], out_lngs[i]);
+        }
+        auto t1 = util::GetTimeInMs64();
+        std::vector<double> batch_lats(N), batch_lngs(N);
+        transform.batch_func(lats.data(), lngs.data(), batch_lats.data(), batch_lngs.data(), N,
+            false);
+        auto t2 = util::GetTimeInMs64();
+        for (size_t i = 0; i < N; ++i) {
+            max_err = std::max(max_err, std::max(std::fabs(batch_lats[i] - out_lats[i]),
+                std::fabs(batch_lngs[i] - out_lngs[i])));
+        }
+
+        transform.batch_func(lats.data(), lngs.data(), batch_lats.data(), batch_lngs.data(), N,
+            true);
+        auto t3 = util::GetTimeInMs64();
+        size_t wrong_outside = 0;
+        for (size_t i = 0; i < N; ++i) {
+            const bool inside = geo::is_inside_china(lats[i], lngs[i]);
+            if (inside != (batch_lats[i] != lats[i] || batch_lngs[i] != lngs[i])) {
+                ++wrong_outside;
+            }
+        }
+
+        printf("%s: scalar %lld ms, batch %lld ms, china only %lld ms, max error %g degree, "
+            "china only mismatches %d\n", transform.name, (long long)(t1 - t0),
+            (long long)(t2 - t1), (long long)(t3 - t2), max_err, (int)wrong_outside);
+        if (!(max_err < 1e-12) || wrong_outside != 0) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+// is_inside_china() and is_inside_china_batch() by the raster against the rectangles of
+// geo_utils_in_china.cpp tested directly: random points over the bounding box, the points on,
+// near and across the edges of the rectangles and the raster cells, and some cities
+int test_inside_china()
+{
+    struct RECT
+    {
+        double lat1, lng1, lat2, lng2;
+        bool Contains(double lat, double lng) const
+        {
+            return std::min(lat1, lat2) <= lat && std::max(lat1, lat2) >= lat &&
+                std::min(lng1, lng2) <= lng && std::max(lng1, lng2) >= lng;
+        }
+    };
+    static const RECT regions[] = {
+        { 49.220400, 79.446200, 42.889900, 96.330000 },
+        { 54.141500, 109.687200, 39.374200, 135.000200 },
+        { 42.889900, 73.124600, 29.529700, 124.143255 },
+        { 29.529700, 82.968400, 26.718600, 97.035200 },
+        { 29.529700, 97.025300, 20.414096, 124.367395 },
+        { 20.414096, 107.975793, 17.871542, 111.744104 },
+    };
+    static const RECT excludes[] = {
+        { 25.398623, 119.921265, 21.785006, 122.497559 },
+        { 22.284000, 101.865200, 20.098800, 106.665000 },
+        { 21.542200, 106.452500, 20.487800, 108.051000 },
+        { 55.817500, 109.032300, 50.325700, 119.127000 },
+        { 55.817500, 127.456800, 49.557400, 137.022700 },
+        { 44.892200, 131.266200, 42.569200, 137.022700 },
+    };
+    auto expected = [](double lat, double lng) {
+        bool in_region = false;
+        for (const auto &rect : regions) {
+            in_region = in_region || rect.Contains(lat, lng);
+        }
+        if (!in_region) {
+            return false;
+        }
+        for (const auto &rect : excludes) {
+            if (rect.Contains(lat, lng)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<double> lats, lngs;
+    unsigned int seed = 12345u;
+    for (int i = 0; i < 1000000; ++i) {
+        lats.push_back(17.0 + rand01(seed) * 39.0);
+        lngs.push_back(72.0 + rand01(seed) * 66.0);
+    }
+    // the edges of the rectangles, and the cell borders every 0.1 degree from their corner
+    const double offsets[] = { 0, 1e-12, -1e-12, 1e-9, -1e-9, 1e-7, -1e-7 };
+    for (const RECT *p_rects : { regions, excludes }) {
+        for (int i_rect = 0; i_rect < 6; ++i_rect) {
+            const RECT &rect = p_rects[i_rect];
+            for (double edge_lat : { rect.lat1, rect.lat2 }) {
+                for (double offset : offsets) {
+                    for (int k = 0; k <= 100; ++k) {
+                        lats.push_back(edge_lat + offset);
+                        lngs.push_back(std::min(rect.lng1, rect.lng2) - 0.5 +
+                            k * (std::fabs(rect.lng2 - rect.lng1) + 1) / 100);
+                    }
+                }
+            }
+            for (double edge_lng : { rect.lng1, rect.lng2 }) {
+                for (double offset : offsets) {
+                    for (int k = 0; k <= 100; ++k) {
+                        lngs.push_back(edge_lng + offset);
+                        lats.push_back(std::min(rect.lat1, rect.lat2) - 0.5 +
+                            k * (std::fabs(rect.lat2 - rect.lat1) + 1) / 100);
+                    }
+                }
+            }
+        }
+    }
+    for (int k = 0; k < 400; ++k) {
+        for (double offset : offsets) {
+            lats.push_back(17.871542 + k * 0.1 + offset);
+            lngs.push_back(73.1246 + rand01(seed) * 64.0);
+            lngs.push_back(73.1246 + k * 0.1 + offset);
+            lats.push_back(17.871542 + rand01(seed) * 38.0);
+        }
+    }
+
+    int wrong = 0;
+    size_t n_inside = 0;
+    for (size_t i = 0; i < lats.size(); ++i) {
+        const bool inside = expected(lats[i], lngs[i]);
+        n_inside += inside ? 1 : 0;
+        if (geo::is_inside_china(lats[i], lngs[i]) != inside) {
+            ++wrong;
+        }
+    }
+    std::vector<bool> inside;
+    const size_t n_batch = geo::is_inside_china_batch(lats.data(), lngs.data(), lats.size(),
+        inside);
+    for (size_t i = 0; i < lats.size(); ++i) {
+        if (inside[i] != geo::is_inside_china(lats[i], lngs[i])) {
+            ++wrong;
+        }
+    }
+
+    // Beijing, Shanghai, Urumqi, Sanya in; Taipei, Hanoi, Ulaanbaatar, Tokyo out
+    const double cities[][2] = { { 39.9042, 116.4074 }, { 31.2304, 121.4737 },
+        { 43.8256, 87.6168 }, { 18.2528, 109.5119 }, { 25.0330, 121.5654 },
+        { 21.0278, 105.8342 }, { 47.8864, 106.9057 }, { 35.6762, 139.6503 } };
+    for (int i = 0; i < 8; ++i) {
+        if (geo::is_inside_china(cities[i][0], cities[i][1]) != (i < 4)) {
+            ++wrong;
+        }
+    }
+
+    printf("inside china: %zu points, %zu inside, batch %zu inside, %d wrong\n", lats.size(),
+        n_inside, n_batch, wrong);
+    return (wrong == 0 && n_batch == n_inside) ? 0 : 1;
+}
+
+int test_fixed_point()
+{
+    const size_t N = 1000000;
+    unsigned int seed = 12345u;
+
+    // round trips of FixedGeoPoint, both ToGeoPoint() versions
+    size_t wrong_round_trips = 0;
+    for (size_t i = 0; i < N; ++i) {
+        const geo::GeoPoint point(-80 + rand01(seed) * 160, -180 + rand01(seed) * 360);
+        const geo::FixedGeoPoint fixed(point);
+        geo::GeoPoint point1;
+        fixed.ToGeoPoint(point1);
+        const geo::GeoPoint point2 = fixed.ToGeoPoint();
+        if (std::fabs(point1.lat - point.lat) > 0.50001e-6 ||
+            std::fabs(point1.lng - point.lng) > 0.50001e-6 || point1 != point2 ||
+            fixed != point1) {
+            ++wrong_round_trips;
+        }
+    }
+
+    // segments up to about 500 meters, points within about 1 km
+    std::vector<int> from_lats(N), from_lngs(N), to_lats(N), to_lngs(N);
+    std::vector<geo::GeoPoint> froms(N), tos(N);
+    const geo::GeoPoint point(31.2, 121.4);
+    for (size_t i = 0; i < N; ++i) {
+        froms[i] = geo::GeoPoint(point.lat + (rand01(seed) - 0.5) * 0.02,
+            point.lng + (rand01(seed) - 0.5) * 0.02);
+        tos[i] = geo::GeoPoint(froms[i].lat + (rand01(seed) - 0.5) * 0.005,
+            froms[i].lng + (rand01(seed) - 0.5) * 0.005);
+        from_lats[i] = geo::FixedGeoPoint::Lat2FixedLat(froms[i].lat);
+        from_lngs[i] = geo::FixedGeoPoint::Lng2FixedLng(froms[i].lng);
+        to_lats[i] = geo::FixedGeoPoint::Lat2FixedLat(tos[i].lat);
+        to_lngs[i] = geo::FixedGeoPoint::Lng2FixedLng(tos[i].lng);
+    }
+
+    auto t0 = util::GetTimeInMs64();
+    std::vector<double> distances(N);
+    for (size_t i = 0; i < N; ++i) {
+        distances[i] = std::sqrt(geo::distance_point_to_segment_square(point, froms[i], tos[i]));
+    }
+    auto t1 = util::GetTimeInMs64();
+    std::vector<float> fixed_distances(N);
+    geo::distance_point_to_segments_square(geo::FixedGeoPoint(point), from_lats.data(),
+        from_lngs.data(), to_lats.data(), to_lngs.data(), fixed_distances.data(), N);
+    auto t2 = util::GetTimeInMs64();
+
+    // the fixed point distance is never more than the double one plus the rounding, except for
+    // the segments the double version does not project on
+    double max_above = 0, max_below = 0, max_scalar_diff = 0;
+    for (size_t i = 0; i < N; ++i) {
+        const double d = std::sqrt((double)fixed_distances[i]);
+        const double abx = tos[i].lng - froms[i].lng;
+        const double aby = tos[i].lat - froms[i].lat;
+        if (abx * abx + aby * aby > 10e-12) {
+            max_above = std::max(max_above, d - distances[i]);
+            max_below = std::max(max_below, distances[i] - d);
+        }
+        const double d_scalar = std::sqrt(geo::distance_point_to_segment_square(
+            geo::FixedGeoPoint(point), geo::FixedGeoPoint(from_lats[i], from_lngs[i]),
+            geo::FixedGeoPoint(to_lats[i], to_lngs[i])));
+        max_scalar_diff = std::max(max_scalar_diff, std::fabs(d - d_scalar));
+    }
+
+    printf("wrong round trips %d\n", (int)wrong_round_trips);
+    printf("point to segment: double %lld ms, fixed batch %lld ms, fixed above double %g m, "
+        "below double %g m, batch to scalar %g m\n", (long long)(t1 - t0), (long long)(t2 - t1),
+        max_above, max_below, max_scalar_diff);
+
+    // the memory of the fixed point copies in the segment tiles (0 with SEG_FIXED_POINT_FILTER
+    // off), and the assignment throughput it buys, on a grid of about 100 m
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, make_grid_segs(60, 60))) {
+        return -1;
+    }
+    const geo::WayManagerInitStats &stats = way_manager.GetInitStats();
+    const size_t n_points = 200000;
+    size_t unassigned = 0;
+    auto t3 = util::GetTimeInMs64();
+    for (size_t i = 0; i < n_points; ++i) {
+        const geo::GeoPoint pos(31.2 + rand01(seed) * 0.059, 121.4 + rand01(seed) * 0.059);
+        if (!way_manager.AssignSegment(pos, -1, 100, 180)) {
+            ++unassigned;
+        }
+    }
+    auto t4 = util::GetTimeInMs64();
+    const bool mem_ok = stats.tile_fixed_coords_bytes == 0 ||
+        (stats.tile_fixed_coords_bytes >= stats.tile_seg_refs * 16 &&
+        stats.tile_fixed_coords_bytes <= stats.tile_seg_refs * 20);
+    printf("grid: %d segs, %d tile seg refs, fixed coords %d bytes (%.1f per seg), "
+        "%d assignments %lld ms, unassigned %d\n", (int)stats.seg_count,
+        (int)stats.tile_seg_refs, (int)stats.tile_fixed_coords_bytes,
+        (double)stats.tile_fixed_coords_bytes / std::max<size_t>(1, stats.seg_count),
+        (int)n_points, (long long)(t4 - t3), (int)unassigned);
+    return (wrong_round_trips == 0 && max_above < 0.2 && mem_ok && unassigned == 0) ? 0 : 1;
+}
+
+int test_tile_pyramid(const char *segs_csv, const char *out_dir)
+{
+    std::vector<geo::SEGMENT> segs;
+    std::string err;
+    if (!geo::WayManager::LoadSegmentsFromCsv(segs_csv, segs, err) || segs.empty()) {
+        printf("failed to load segments: %s\n", err.c_str());
+        return -1;
+    }
+    const geo::Bound bound = get_segs_bound(segs);
+    geo::WayManager way_manager(bound);
+    if (!way_manager.LoadSegments(segs)) {
+        printf("failed to load segments: %s\n", way_manager.GetErrorString().c_str());
+        return -1;
+    }
+
+    const int MIN_ZOOM = 10, MAX_ZOOM = 16;
+    geo::TilePyramid pyramid(MIN_ZOOM, MAX_ZOOM);
+    pyramid.SetSegments(way_manager);
+    unsigned int seed = 12345u;
+    for (int i = 0; i < 1000000; ++i) {
+        const double lat = bound.minlat + (bound.maxlat - bound.minlat) * rand01(seed);
+        const double lng = bound.minlng + (bound.maxlng - bound.minlng) * rand01(seed);
+        pyramid.AddPoint(geo::GeoPoint(lat, lng));
+    }
+
+    auto t0 = util::GetTimeInMs64();
+    if (!pyramid.Build()) {
+        printf("failed to build: %s\n", pyramid.GetErrorString().c_str());
+        return -1;
+    }
+    auto t1 = util::GetTimeInMs64();
+    size_t tile_count = 0;
+    for (int z = MIN_ZOOM; z <= MAX_ZOOM; ++z) {
+        tile_count += pyramid.GetTileCount(z);
+    }
+    const std::string dir(out_dir);
+    if (!util::DirExists(dir) && !util::MakeDir(dir)) {
+        printf("failed to create %s\n", out_dir);
+        return -1;
+    }
+    if (!pyramid.WriteTiles(dir + "/geojson", geo::TilePyramid::TILE_GEOJSON, false) ||
+        !pyramid.WriteTiles(dir + "/bin", geo::TilePyramid::TILE_BINARY, false)) {
+        printf("failed to write tiles: %s\n", pyramid.GetErrorString().c_str());
+        return -1;
+    }
+    auto t2 = util::GetTimeInMs64();
+
+    // the binary tile of the first segment decoded, within a quantization step
+    const geo::Segment &seg = way_manager.GetAllSegs()[0];
+    const int x = geo::long2tilex(seg.from_point_.lng, MAX_ZOOM);
+    const int y = geo::lat2tiley(seg.from_point_.lat, MAX_ZOOM);
+    std::string data;
+    geo::TilePyramid::TileContent content, decoded;
+    if (!pyramid.GetTile(MAX_ZOOM, x, y, content) ||
+        !pyramid.EncodeTile(MAX_ZOOM, x, y, geo::TilePyramid::TILE_BINARY, data) ||
+        !geo::TilePyramid::DecodeBinaryTile(data.data(), data.size(), decoded, err)) {
+        printf("failed to decode tile: %s%s\n", pyramid.GetErrorString().c_str(), err.c_str());
+        return -1;
+    }
+    double max_err = 0;
+    bool same = content.segs.size() == decoded.segs.size() &&
+        content.cells.size() == decoded.cells.size();
+    for (size_t i = 0; same && i < content.segs.size(); ++i) {
+        same = content.segs[i].seg_id == decoded.segs[i].seg_id &&
+            content.segs[i].way_id == decoded.segs[i].way_id;
+        max_err = std::max(max_err, geo::distance_in_meter(content.segs[i].from_point,
+            decoded.segs[i].from_point));
+        max_err = std::max(max_err, geo::distance_in_meter(content.segs[i].to_point,
+            decoded.segs[i].to_point));
+    }
+    for (size_t i = 0; same && i < content.cells.size(); ++i) {
+        same = content.cells[i].col == decoded.cells[i].col &&
+            content.cells[i].row == decoded.cells[i].row &&
+            content.cells[i].count == decoded.cells[i].count;
+    }
+
+    // a moved segment, only the tiles on its old and new geometry rewritten
+    geo::Segment moved = seg;
+    moved.to_point_.lat += 0.01;
+    pyramid.SetSegment(moved);
+    const size_t dirty_count = pyramid.GetDirtyTileCount();
+    auto t3 = util::GetTimeInMs64();
+    if (!pyramid.WriteTiles(dir + "/bin", geo::TilePyramid::TILE_BINARY, true)) {
+        printf("failed to write dirty tiles: %s\n", pyramid.GetErrorString().c_str());
+        return -1;
+    }
+    auto t4 = util::GetTimeInMs64();
+
+    printf("%d segments, %d tiles in %lld ms, written in %lld ms, %d bytes tile decoded %s "
+        "max error %g m, %d dirty tiles rewritten in %lld ms\n",
+        (int)way_manager.GetAllSegs().size(), (int)tile_count, (long long)(t1 - t0),
+        (long long)(t2 - t1), (int)data.size(), same ? "same" : "DIFFERENT", max_err,
+        (int)dirty_count, (long long)(t4 - t3));
+    return (same && max_err < 1.0 && dirty_count < tile_count / 10) ? 0 : 1;
+}
+
+// the textbook simplifications for checking, in meters of the local projection as geo_utils
+static double local_x(const geo::GeoPoint &point, const geo::GeoPoint &origin)
+{
+    return (point.lng - origin.lng) * std::cos(origin.lat * M_PI / 180) * 111194.99646;
+}
+
+static double local_y(const geo::GeoPoint &point, const geo::GeoPoint &origin)
+{
+    return (point.lat - origin.lat) * 111194.99646;
+}
+
+static void simple_dp(const std::vector<geo::GeoPoint> &points, size_t first, size_t last,
+    double tolerance, std::vector<geo::GeoPoint> &result)
+{
+    const auto &a = points[first];
+    const double abx = local_x(points[last], a), aby = local_y(points[last], a);
+    const double ab2 = abx * abx + aby * aby;
+    double max_d2 = -1;
+    size_t max_i = first;
+    for (size_t i = first + 1; i < last; ++i) {
+        double apx = local_x(points[i], a), apy = local_y(points[i], a);
+        const double t = (ab2 > 0) ?
+            std::min(std::max((apx * abx + apy * aby) / ab2, 0.0), 1.0) : 0.0;
+        apx -= abx * t;
+        apy -= aby * t;
+        if (apx * apx + apy * apy > max_d2) {
+            max_d2 = apx * apx + apy * apy;
+            max_i = i;
+        }
+    }
+    if (last > first + 1 && max_d2 > tolerance * tolerance) {
+        simple_dp(points, first, max_i, tolerance, result);
+        simple_dp(points, max_i, last, tolerance, result);
+    }
+    else {
+        result.push_back(points[last]);
+    }
+}
+
+static std::vector<geo::GeoPoint> simple_douglas_peucker(const std::vector<geo::GeoPoint> &points,
+    double tolerance)
+{
+    std::vector<geo::GeoPoint> result(1, points[0]);
+    simple_dp(points, 0, points.size() - 1, tolerance, result);
+    return result;
+}
+
+static std::vector<geo::GeoPoint> simple_visvalingam(std::vector<geo::GeoPoint> points,
+    double tolerance)
+{
+    auto area2 = [](const geo::GeoPoint &a, const geo::GeoPoint &b, const geo::GeoPoint &c) {
+        const double abx = local_x(b, b) - local_x(a, b), aby = local_y(b, b) - local_y(a, b);
+        const double acx = local_x(c, b) - local_x(a, b), acy = local_y(c, b) - local_y(a, b);
+        return std::fabs(abx * acy - aby * acx);
+    };
+    while (points.size() > 2) {
+        size_t min_i = 0;
+        double min_area = HUGE_VAL;
+        for (size_t i = 1; i + 1 < points.size(); ++i) {
+            const double area = area2(points[i - 1], points[i], points[i + 1]);
+            if (area < min_area) {
+                min_area = area;
+                min_i = i;
+            }
+        }
+        if (min_area >= 2 * tolerance * tolerance) {
+            break;
+        }
+        points.erase(points.begin() + min_i);
+    }
+    return points;
+}
+
+int test_offset_simplify()
+{
+    const size_t N = 1000000;
+    unsigned int seed = 12345u;
+
+    // segments up to about 500 meters, some of them of the same points
+    std::vector<geo::GeoPoint> froms(N), tos(N), offset_froms(N), offset_tos(N);
+    for (size_t i = 0; i < N; ++i) {
+        froms[i] = geo::GeoPoint(-60 + rand01(seed) * 120, -180 + rand01(seed) * 360);
+        tos[i] = (i % 1000 == 0) ? froms[i] : geo::GeoPoint(
+            froms[i].lat + (rand01(seed) - 0.5) * 0.005,
+            froms[i].lng + (rand01(seed) - 0.5) * 0.005);
+    }
+    auto t0 = util::GetTimeInMs64();
+    double max_err = 0;
+    for (size_t i = 0; i < N; ++i) {
+        geo::get_offset_segment(froms[i], tos[i], 6.0, offset_froms[i], offset_tos[i]);
+    }
+    auto t1 = util::GetTimeInMs64();
+    std::vector<geo::GeoPoint> batch_froms(N), batch_tos(N);
+    geo::get_offset_segment_batch(froms.data(), tos.data(), 6.0, batch_froms.data(),
+        batch_tos.data(), N);
+    auto t2 = util::GetTimeInMs64();
+    for (size_t i = 0; i < N; ++i) {
+        max_err = std::max(max_err, std::fabs(batch_froms[i].lat - offset_froms[i].lat));
+        max_err = std::max(max_err, std::fabs(batch_froms[i].lng - offset_froms[i].lng));
+        max_err = std::max(max_err, std::fabs(batch_tos[i].lat - offset_tos[i].lat));
+        max_err = std::max(max_err, std::fabs(batch_tos[i].lng - offset_tos[i].lng));
+    }
+
+    // a noisy road of about 2 m steps, simplified for zoom 14
+    std::vector<geo::GeoPoint> road(N);
+    road[0] = geo::GeoPoint(31.2, 121.4);
+    double heading = 0;
+    for (size_t i = 1; i < N; ++i) {
+        heading += (rand01(seed) - 0.5) * 10;
+        road[i] = geo::get_point_degree(road[i - 1], 2.0, heading);
+    }
+    const double tolerance = geo::zoom_to_tolerance(14, road[0].lat);
+    std::vector<geo::GeoPoint> dp(road), vw(road);
+    auto t3 = util::GetTimeInMs64();
+    dp.resize(geo::simplify_douglas_peucker(dp.data(), dp.size(), tolerance));
+    auto t4 = util::GetTimeInMs64();
+    vw.resize(geo::simplify_visvalingam(vw.data(), vw.size(), tolerance));
+    auto t5 = util::GetTimeInMs64();
+
+    // every removed point is within the tolerance of its part of the simplified line, measured
+    // in meters by the fixed point version
+    double max_dp_dist = 0;
+    for (size_t i = 0, j = 0; i < road.size(); ++i) {
+        if (j + 1 < dp.size() && road[i] == dp[j + 1]) {
+            ++j;
+        }
+        if (j + 1 < dp.size()) {
+            max_dp_dist = std::max(max_dp_dist, std::sqrt(geo::distance_point_to_segment_square(
+                geo::FixedGeoPoint(road[i]), geo::FixedGeoPoint(dp[j]),
+                geo::FixedGeoPoint(dp[j + 1]))));
+        }
+    }
+
+    // the same points as the textbook versions on a part of the road: Douglas-Peucker recursing
+    // in order, Visvalingam-Whyatt removing the smallest area one by one
+    const std::vector<geo::GeoPoint> part(road.begin(), road.begin() + 3000);
+    std::vector<geo::GeoPoint> part_dp(part), part_vw(part);
+    part_dp.resize(geo::simplify_douglas_peucker(part_dp.data(), part_dp.size(), tolerance));
+    geo::SimplifyScratch scratch;
+    part_vw.resize(geo::simplify_visvalingam(part_vw.data(), part_vw.size(), tolerance,
+        scratch));
+    const bool same_dp = part_dp == simple_douglas_peucker(part, tolerance);
+    const bool same_vw = part_vw == simple_visvalingam(part, tolerance);
+
+    printf("offset segments: scalar %lld ms, batch %lld ms, max error %g degree\n",
+        (long long)(t1 - t0), (long long)(t2 - t1), max_err);
+    printf("simplify %d points, tolerance %g m: douglas-peucker %d points in %lld ms, max "
+        "distance %g m, visvalingam %d points in %lld ms\n", (int)road.size(), tolerance,
+        (int)dp.size(), (long long)(t4 - t3), max_dp_dist, (int)vw.size(), (long long)(t5 - t4));
+    printf("same as the textbook versions: douglas-peucker %s, visvalingam %s\n",
+        same_dp ? "yes" : "no", same_vw ? "yes" : "no");
+    return (max_err < 1e-12 && max_dp_dist < tolerance + 0.2 && vw.size() < road.size() / 4 &&
+        same_dp && same_vw) ? 0 : 1;
+}
+
+int test_k_nearest_nodes()
+{
+    const int N_NODES = 1000000, N_QUERIES = 20000, K = 5;
+    unsigned int seed = 12345u;
+
+    // 1 node of 10 a gas station
+    const geo::Bound bound(30.5, 120.5, 31.5, 121.5);
+    std::vector<geo::NODE> nodes(N_NODES);
+    for (int i = 0; i < N_NODES; ++i) {
+        nodes[i] = geo::NODE(i + 1, (i % 10 == 0) ? geo::NDTYPE_GAS_STATION : geo::NDTYPE_DEFAULT,
+            geo::GeoPoint(bound.minlat + rand01(seed), bound.minlng + rand01(seed)), "");
+    }
+    for (int i = 1; i <= 3; ++i) { // 3 nodes of a rare type
+        nodes[i].nd_type = 200;
+    }
+    geo::WayManager dense, packed;
+    if (!dense.InitForNodeLocating(bound, nodes) ||
+        !packed.InitForNodeLocating(bound, nodes, true)) {
+        printf("failed to init node locating\n");
+        return -1;
+    }
+    std::vector<geo::GeoPoint> queries(N_QUERIES);
+    for (auto& query : queries) {
+        query = geo::GeoPoint(bound.minlat + rand01(seed), bound.minlng + rand01(seed));
+    }
+
+    // the same adjacent nodes in both indexes
+    int wrong_adjacent = 0;
+    std::vector<geo::WayManager::NODE_SEARCH_RESULT> results1, results2;
+    auto t0 = util::GetTimeInMs64();
+    for (const auto& query : queries) {
+        dense.FindAdjacentNodes(query, 150, false, results1);
+    }
+    auto t1 = util::GetTimeInMs64();
+    for (const auto& query : queries) {
+        packed.FindAdjacentNodes(query, 150, false, results2);
+        dense.FindAdjacentNodes(query, 150, false, results1);
+        if (results1.size() != results2.size()) {
+            ++wrong_adjacent;
+            continue;
+        }
+        for (size_t i = 0; i < results1.size(); ++i) {
+            if (std::get<1>(results1[i]) != std::get<1>(results2[i])) {
+                ++wrong_adjacent;
+                break;
+            }
+        }
+    }
+
+    // the k nearest gas stations, against all the nodes for a part of the queries
+    const geo::NODE_TYPE gas_station = geo::NDTYPE_GAS_STATION;
+    geo::NodeSearchFilter filter;
+    filter.types = &gas_station;
+    filter.type_count = 1;
+    int wrong_nearest = 0;
+    auto t2 = util::GetTimeInMs64();
+    for (const auto& query : queries) {
+        packed.FindKNearestNodes(query, K, filter, results1);
+    }
+    auto t3 = util::GetTimeInMs64();
+    std::vector<double> distances;
+    for (int i_query = 0; i_query < N_QUERIES; i_query += 100) {
+        const auto& query = queries[i_query];
+        distances.clear();
+        for (const auto& nd : nodes) {
+            if (nd.nd_type == gas_station) {
+                distances.push_back(geo::distance_in_meter(query, nd.geo_point));
+            }
+        }
+        std::partial_sort(distances.begin(), distances.begin() + K, distances.end());
+        dense.FindKNearestNodes(query, K, filter, results1);
+        packed.FindKNearestNodes(query, K, filter, results2);
+        if (results1.size() != K || results2.size() != K) {
+            ++wrong_nearest;
+            continue;
+        }
+        for (int i = 0; i < K; ++i) {
+            if (std::get<1>(results1[i]) != distances[i] ||
+                std::get<1>(results2[i]) != distances[i] ||
+                std::get<0>(results2[i])->nd_type_ != gas_station) {
+                ++wrong_nearest;
+                break;
+            }
+        }
+    }
+
+    // fewer matching nodes than k, or none: none returns at once, the 3 rare ones are scanned
+    // by their type instead of the tiles
+    const geo::NODE_TYPE rare_type = 200;
+    filter.types = &rare_type;
+    auto t4 = util::GetTimeInMs64();
+    for (int i_query = 0; i_query < N_QUERIES; i_query += 1000) {
+        const auto& query = queries[i_query];
+        dense.FindKNearestNodes(query, K, filter, results1);
+        packed.FindKNearestNodes(query, K, filter, results2);
+        if (results1.size() != 3 || results2.size() != 3) {
+            ++wrong_nearest;
+            continue;
+        }
+        for (int i = 0; i < 3; ++i) {
+            if (std::get<0>(results1[i])->nd_type_ != rare_type ||
+                std::get<1>(results1[i]) != std::get<1>(results2[i]) ||
+                (i > 0 && std::get<1>(results1[i]) < std::get<1>(results1[i - 1]))) {
+                ++wrong_nearest;
+                break;
+            }
+        }
+    }
+    auto t5 = util::GetTimeInMs64();
+    filter.types = &gas_station;
+    filter.has_name = true; // no gas station has a name
+    for (const auto& query : queries) {
+        dense.FindKNearestNodes(query, K, filter, results1);
+        packed.FindKNearestNodes(query, K, filter, results2);
+        if (!results1.empty() || !results2.empty()) {
+            ++wrong_nearest;
+        }
+    }
+    auto t6 = util::GetTimeInMs64();
+
+    printf("%d nodes: adjacent nodes %lld ms, wrong %d, %d nearest gas stations %lld ms, "
+        "wrong %d, 3 matching nodes %lld ms, no matching nodes %lld ms\n", N_NODES,
+        (long long)(t1 - t0), wrong_adjacent, K, (long long)(t3 - t2), wrong_nearest,
+        (long long)(t5 - t4), (long long)(t6 - t5));
+    return (wrong_adjacent == 0 && wrong_nearest == 0) ? 0 : 1;
+}
+
+int test_geojson_stream_reader(const char *json_pathname)
+{
+    const int N_FEATURES = 200000;
+    unsigned int seed = 12345u;
+
+    // 1 point of 10, the others linestrings of 2 to 9 points
+    std::vector<std::vector<geo::GeoPoint>> lines(N_FEATURES);
+    {
+        std::ofstream out(json_pathname);
+        geo::GeoJsonStreamWriter writer(out);
+        for (int i = 0; i < N_FEATURES; ++i) {
+            auto& line = lines[i];
+            line.resize((i % 10 == 0) ? 1 : 2 + i % 8);
+            for (auto& point : line) {
+                point = geo::GeoPoint(30.0 + rand01(seed), 120.0 + rand01(seed));
+            }
+            if (line.size() == 1) {
+                writer.BeginPoint(line[0]);
+            }
+            else {
+                writer.BeginLineString(line);
+            }
+            writer.AddProp("id", (long long)i);
+            writer.AddProp("name", "road \"" + std::to_string(i) + "\"");
+            writer.AddProp("speed", i * 0.5);
+            writer.AddProp("oneway", i % 2 == 0);
+            writer.EndFeature();
+        }
+        if (!writer.Close()) {
+            printf("failed to write %s\n", json_pathname);
+            return -1;
+        }
+    }
+
+    int wrong = 0;
+    auto check = [&](const geo::GeoObjPtr& p_obj) {
+        const int i = atoi(p_obj->GetPropAsStr("id").c_str());
+        const auto& line = lines[i];
+        const std::vector<geo::GeoPoint>* p_points = nullptr;
+        std::vector<geo::GeoPoint> point(1);
+        if (p_obj->GetObjType() == geo::GEOTYPE_POINT) {
+            point[0] = static_cast<const geo::GeoObj_Point&>(*p_obj).GetPoint();
+            p_points = &point;
+        }
+        else if (p_obj->GetObjType() == geo::GEOTYPE_LINESTRING) {
+            p_points = &static_cast<const geo::GeoObj_LineString&>(*p_obj).GetPoints();
+        }
+        if (p_points == nullptr || p_points->size() != line.size() ||
+            p_obj->GetPropAsStr("name") != "road \"" + std::to_string(i) + "\"" ||
+            atof(p_obj->GetPropAsStr("speed").c_str()) != i * 0.5 ||
+            p_obj->GetPropAsStr("oneway") != (i % 2 == 0 ? "1" : "0")) {
+            ++wrong;
+            return true;
+        }
+        for (size_t k = 0; k < line.size(); ++k) {
+            if (std::fabs((*p_points)[k].lat - line[k].lat) > 1e-6 ||
+                std::fabs((*p_points)[k].lng - line[k].lng) > 1e-6) {
+                ++wrong;
+                break;
+            }
+        }
+        return true;
+    };
+
+    geo::GeoJsonStreamReader reader;
+    auto t0 = util::GetTimeInMs64();
+    bool ok = reader.ReadFile(json_pathname, check);
+    auto t1 = util::GetTimeInMs64();
+    printf("ReadFile: %s, %d features, %d wrong, %d ms\n",
+        ok ? "ok" : reader.GetErrorString().c_str(), (int)reader.FeatureCount(), wrong,
+        (int)(t1 - t0));
+    if (!ok || reader.FeatureCount() != N_FEATURES || wrong != 0) {
+        return -1;
+    }
+
+    ok = reader.ReadFilePipelined(json_pathname, 256, check);
+    auto t2 = util::GetTimeInMs64();
+    printf("ReadFilePipelined: %s, %d features, %d wrong, %d ms\n",
+        ok ? "ok" : reader.GetErrorString().c_str(), (int)reader.FeatureCount(), wrong,
+        (int)(t2 - t1));
+    if (!ok || reader.FeatureCount() != N_FEATURES || wrong != 0) {
+        return -1;
+    }
+
+    // stopped by the callback
+    int count = 0;
+    ok = reader.ReadFilePipelined(json_pathname, 16, [&count](const geo::GeoObjPtr&) {
+        return ++count < 1000;
+    });
+    if (!ok || count != 1000) {
+        printf("failed to stop reading, %d features\n", count);
+        return -1;
+    }
+
+    // stopped by an exception of the callback, the parsing thread must still be joined
+    count = 0;
+    bool thrown = false;
+    try {
+        reader.ReadFilePipelined(json_pathname, 16, [&count](const geo::GeoObjPtr&) -> bool {
+            if (++count == 1000) {
+                throw std::runtime_error("stop");
+            }
+            return true;
+        });
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    if (!thrown || count != 1000) {
+        printf("failed to stop reading by an exception, %d features\n", count);
+        return -1;
+    }
+
+    // polygons and multi geometries written by GeoJSON, null geometry skipped
+    geo::MultiPolygon mpoly;
+    mpoly.polygons.resize(2);
+    for (int k = 0; k < 4; ++k) {
+        mpoly.polygons[0].outer_polygon.PushBack(geo::GeoPoint(30.0 + (k / 2), 120.0 + (k % 2)));
+        mpoly.polygons[1].outer_polygon.PushBack(geo::GeoPoint(32.0 + (k / 2), 120.0 + (k % 2)));
+    }
+    mpoly.polygons[1].inner_polygons.resize(1);
+    mpoly.polygons[1].inner_polygons[0].PushBack(geo::GeoPoint(32.5, 120.5));
+    mpoly.polygons[1].inner_polygons[0].PushBack(geo::GeoPoint(32.6, 120.6));
+    mpoly.polygons[1].inner_polygons[0].PushBack(geo::GeoPoint(32.5, 120.6));
+    geo::GeoJSON geo_json;
+    geo_json.AddObj(std::make_shared<geo::GeoObj_MultiPolygon>(mpoly));
+    geo_json.AddObj(std::make_shared<geo::GeoObj_Polygon>(mpoly.polygons[1]));
+    auto p_mline = std::make_shared<geo::GeoObj_MultiLineString>();
+    p_mline->AddLineString(geo::GeoObj_LineString(lines[1]));
+    p_mline->AddLineString(geo::GeoObj_LineString(lines[2]));
+    p_mline->AddProp("tags", "x");
+    geo_json.AddObj(p_mline);
+    std::string json = geo_json.ToJsonString();
+    json.insert(json.size() - 2, ",{\"type\":\"Feature\",\"geometry\":null,"
+        "\"properties\":{\"a\":[1,{\"b\":null}]}}");
+
+    std::vector<geo::GeoObjPtr> objs;
+    ok = reader.ReadString(json, [&objs](const geo::GeoObjPtr& p_obj) {
+        objs.push_back(p_obj);
+        return true;
+    });
+    if (!ok || objs.size() != 3 || reader.SkippedCount() != 1 ||
+        objs[0]->ToWKT() != geo::GeoObj_MultiPolygon(mpoly).ToWKT() ||
+        objs[1]->ToWKT() != geo::GeoObj_Polygon(mpoly.polygons[1]).ToWKT() ||
+        objs[2]->ToWKT() != p_mline->ToWKT() || objs[2]->GetPropAsStr("tags") != "x") {
+        printf("failed to read the geometries: %s\n", reader.GetErrorString().c_str());
+        return -1;
+    }
+
+    // truncated input
+    ok = reader.ReadString(json.substr(0, json.size() / 2), [](const geo::GeoObjPtr&) {
+        return true;
+    });
+    printf("truncated: %s\n", ok ? "no error" : reader.GetErrorString().c_str());
+    return ok ? -1 : 0;
+}
+
+// a 10x20 grid split into a west and an east shard between columns 9 and 10, at most 1 shard
+// loaded: the routes within and across the shards are connected, from seg1 to seg2, and as long
+// as the Dijkstra routes on the whole grid, also from or to the segments crossing the border.
+// the points are assigned in the shard covering them
+int test_sharded_way_manager()
+{
+    const int ROWS = 10, COLS = 20;
+    const std::vector<geo::SEGMENT> segs = make_grid_segs(ROWS, COLS);
+    const std::string pathname = "test_sharded.bin";
+    std::string err;
+    if (!geo::WayManager::SaveSegmentsBinary(segs, pathname, err)) {
+        printf("failed to save: %s\n", err.c_str());
+        return -1;
+    }
+    geo::WayManager whole;
+    if (!init_way_manager(whole, segs)) {
+        remove(pathname.c_str());
+        return -1;
+    }
+
+    // padded, as the max lat and lng are out of the regions
+    geo::Bound bound = get_segs_bound(segs);
+    bound.maxlat += 0.0005;
+    bound.maxlng += 0.0005;
+    const double border_lng = 121.4 + 9.5 * 0.001;
+    geo::ShardedWayManager sharded(1);
+    sharded.AddShard(geo::Bound(bound.minlat, bound.minlng, bound.maxlat, border_lng), pathname);
+    sharded.AddShard(geo::Bound(bound.minlat, border_lng, bound.maxlat, bound.maxlng), pathname);
+    if (!sharded.BuildOverlay()) {
+        printf("failed to build the overlay: %s\n", sharded.GetErrorString().c_str());
+        remove(pathname.c_str());
+        return -1;
+    }
+
+    unsigned int seed = 12345u;
+    int wrong = 0, routes = 0, cross_routes = 0;
+    std::vector<geo::SEG_ID_T> route;
+    std::vector<geo::SegmentPtr> whole_route;
+    for (int k = 0; k < 200; ++k) {
+        const geo::SegmentPtr p_seg1 =
+            whole.GetSegById(segs[(size_t)(rand01(seed) * segs.size())].seg_id);
+        const geo::SegmentPtr p_seg2 =
+            whole.GetSegById(segs[(size_t)(rand01(seed) * segs.size())].seg_id);
+        const int i_shard1 = sharded.FindShard(p_seg1->from_point_.lat, p_seg1->from_point_.lng);
+        const int i_shard2 = sharded.FindShard(p_seg2->to_point_.lat, p_seg2->to_point_.lng);
+        if (p_seg1 == p_seg2 || !whole.DijkstraShortestPath(p_seg1, p_seg2, whole_route)) {
+            continue;
+        }
+        if (!sharded.ShortestPath(i_shard1, p_seg1->seg_id_, i_shard2, p_seg2->seg_id_, route) ||
+            route.empty() || route.front() != p_seg1->seg_id_ ||
+            route.back() != p_seg2->seg_id_) {
+            ++wrong;
+            continue;
+        }
+        ++routes;
+        cross_routes += (i_shard1 != i_shard2);
+        double length = 0, whole_length = 0;
+        for (size_t i = 0; i < route.size(); ++i) {
+            const geo::SegmentPtr p_seg = whole.GetSegById(route[i]);
+            const geo::SegmentPtr p_pre = i ? whole.GetSegById(route[i - 1]) : nullptr;
+            if (!p_seg || (p_pre && p_pre->to_nd_ != p_seg->from_nd_)) {
+                length = -1;
+                break;
+            }
+            length += p_seg->length_;
+        }
+        for (const auto &p_seg : whole_route) {
+            whole_length += p_seg->length_;
+        }
+        if (length < 0 || std::fabs(length - whole_length) > 1) {
+            ++wrong;
+        }
+    }
+
+    // from a segment to itself, within a shard and across the border
+    const geo::SEG_ID_T border_seg_id = geo::Segment::GenerateSegID(1003, 10, 0);
+    for (int i_shard2 = 0; i_shard2 < 2; ++i_shard2) {
+        if (!sharded.ShortestPath(0, border_seg_id, i_shard2, border_seg_id, route) ||
+            route != std::vector<geo::SEG_ID_T>{ border_seg_id }) {
+            ++wrong;
+        }
+    }
+
+    int assigned = 0;
+    for (int k = 0; k < 100; ++k) {
+        const double lat = bound.minlat + rand01(seed) * (bound.maxlat - bound.minlat);
+        const double lng = bound.minlng + rand01(seed) * (bound.maxlng - bound.minlng);
+        int i_shard = -1;
+        const geo::SEG_ID_T seg_id = sharded.AssignSegment(lat, lng, 0, 50, 45, &i_shard);
+        const geo::SegmentPtr p_seg = whole.AssignSegment(lat, lng, 0, 50, 45);
+        if (i_shard != (lng < border_lng ? 0 : 1) ||
+            (seg_id != 0 && (!p_seg || p_seg->seg_id_ != seg_id))) {
+            ++wrong;
+        }
+        assigned += (seg_id != 0);
+    }
+    if (sharded.FindShard(bound.maxlat + 0.01, bound.minlng) != -1 ||
+        sharded.GetLoadedShardCount() > 1) {
+        ++wrong;
+    }
+    remove(pathname.c_str());
+
+    printf("sharded: %zu transfers, %d routes, %d across the shards, %d assigned, %d wrong\n",
+        sharded.GetTransferCount(), routes, cross_routes, assigned, wrong);
+    return (wrong == 0 && cross_routes > 0 && routes > cross_routes && assigned > 0) ? 0 : 1;
+}
+
+// the graph built by LoadSegments(segs, true) for a 40x40 grid, a 3x3 grid apart from it and a
+// one-way segment apart from both: the node flags, the ways with their segments in order, the
+// weak components and the init stats. the blocks run in parallel with more than 1 CPU
+int test_graph_construction()
+{
+    const int N = 40, M = 3;
+    std::vector<geo::SEGMENT> segs = make_grid_segs(N, N);
+    for (geo::SEGMENT seg : make_grid_segs(M, M, 0.001, 31.3, 121.5)) {
+        seg.way_id += 5000;
+        seg.seg_id = geo::Segment::GenerateSegID(seg.way_id, seg.way_sub_seq, 0);
+        seg.from_nd += 10000;
+        seg.to_nd += 10000;
+        segs.push_back(seg);
+    }
+    geo::SEGMENT one_way = segs.front();
+    one_way.way_id = 9000;
+    one_way.way_sub_seq = 1;
+    one_way.seg_id = geo::Segment::GenerateSegID(one_way.way_id, 1, 0);
+    one_way.from_nd = 20001;
+    one_way.to_nd = 20002;
+    one_way.from_lat = 31.25;
+    one_way.to_lat = 31.251;
+    one_way.from_lng = one_way.to_lng = 121.45;
+    one_way.one_way = true;
+    segs.push_back(one_way);
+
+    geo::WayManager way_manager;
+    way_manager.SetBoundries(get_segs_bound(segs));
+    if (!way_manager.LoadSegments(segs, true)) {
+        printf("failed to load: %s\n", way_manager.GetErrorString().c_str());
+        return -1;
+    }
+
+    int wrong = 0;
+    // every grid node is on a row and a column, the nodes of the main grid are connected
+    for (int i = 0; i < N * N + M * M; ++i) {
+        const geo::NODE_ID_T nd_id = (i < N * N) ? i + 1 : 10000 + (i - N * N) + 1;
+        const geo::NodePtr p_node = way_manager.GetNodeById(nd_id);
+        if (!p_node || !p_node->IsRoutingNode() || p_node->IsWeakConnected() != (i < N * N)) {
+            ++wrong;
+        }
+    }
+    for (geo::NODE_ID_T nd_id : { 20001, 20002 }) {
+        const geo::NodePtr p_node = way_manager.GetNodeById(nd_id);
+        if (!p_node || p_node->IsWeakConnected() || !p_node->IsDeadEndNode()) {
+            ++wrong;
+        }
+    }
+
+    // both directions of each way, its segments in order from end to end
+    size_t n_ways = 0;
+    for (int i = 0; i < 2 * (N + M); ++i) {
+        const int n = (i < 2 * N) ? N : M;
+        const geo::WAY_ID_T way_id = (i < 2 * N) ? ((i < N) ? 1000 + i : 2000 + i - N) :
+            ((i - 2 * N < M) ? 6000 + i - 2 * N : 7000 + i - 2 * N - M);
+        for (int dir : { 1, -1 }) {
+            const geo::OrientedWayPtr p_way = way_manager.GetWayById(dir * way_id);
+            if (!p_way || p_way->Segments().size() != (size_t)(n - 1) ||
+                p_way->Nodes().size() != (size_t)n || p_way->GetOppositeWay() == nullptr ||
+                p_way->GetOppositeWay()->WayId() != -dir * way_id) {
+                ++wrong;
+                continue;
+            }
+            ++n_ways;
+            const auto &way_segs = p_way->Segments();
+            for (size_t k = 0; k < way_segs.size(); ++k) {
+                if (way_segs[k]->way_id_ != way_id ||
+                    (k > 0 && way_segs[k - 1]->to_nd_ != way_segs[k]->from_nd_) ||
+                    p_way->Nodes()[k]->nd_id_ != way_segs[k]->from_nd_) {
+                    ++wrong;
+                    break;
+                }
+            }
+        }
+    }
+
+    const geo::WayManagerInitStats &stats = way_manager.GetInitStats();
+    const size_t expected_nodes = N * N + M * M + 2;
+    printf("graph: %zu nodes, %zu ways, %zu weak components, %zu checked ways, %d wrong\n",
+        stats.node_count, stats.way_count, stats.weak_component_count, n_ways, wrong);
+    // the one-way segment and its fake reversed one on both counts
+    return (wrong == 0 && stats.node_count == expected_nodes &&
+        stats.seg_count == segs.size() + 1 && stats.way_count == n_ways + 2 &&
+        stats.weak_component_count == 3) ? 0 : 1;
+}
+
+// the streaming CSV loader against the SEGMENTs parsed by LoadSegmentsFromCsv() and the ones
+// written: comment and empty lines, "\r\n" line ends, quoted names and tags with commas, and rows
+// without the optional columns. a row with an invalid segment ID fails the load
+int test_csv_streaming()
+{
+    std::vector<geo::SEGMENT> segs = make_grid_segs(60, 60);
+    const std::string pathname = "test_csv_streaming.csv";
+    FILE *fp = fopen(pathname.c_str(), "wb");
+    if (fp == nullptr) {
+        return -1;
+    }
+    fprintf(fp, "#SEG_ID,FROM_LAT,FROM_LNG,TO_LAT,TO_LNG,ONE_WAY,LENGTH,WAY_ID,WAY_SUB_SEQ,"
+        "SPLIT_SEQ,FROM_ND,TO_ND,WAY_TYPE,WAY_NAME,STRUCT_TYPE,LAYER,OPT_TAGS\n\n");
+    for (size_t i = 0; i < segs.size(); ++i) {
+        geo::SEGMENT &seg = segs[i];
+        seg.one_way = (i % 3 == 0);
+        fprintf(fp, "%lld,%.7f,%.7f,%.7f,%.7f,%d,%.3f,%lld,%d,%d,%lld,%lld,%d",
+            (long long)seg.seg_id, seg.from_lat, seg.from_lng, seg.to_lat, seg.to_lng,
+            seg.one_way ? 1 : 0, seg.length, (long long)seg.way_id, seg.way_sub_seq,
+            seg.split_seq, (long long)seg.from_nd, (long long)seg.to_nd, (int)seg.way_type);
+        if (i % 4 == 1) { // without the optional columns
+            seg.way_name.clear();
+            fprintf(fp, "\n");
+            continue;
+        }
+        if (i % 4 == 2) {
+            seg.way_name = "road, " + std::to_string(i);
+            seg.opt_tags = "lanes=2, maxspeed=" + std::to_string(i % 100);
+            seg.layer = 1;
+        }
+        fprintf(fp, ",\"%s\",%d,%d,\"%s\"%s", seg.way_name.c_str(), (int)seg.struct_type,
+            (int)seg.layer, seg.opt_tags.c_str(), (i % 5 == 0) ? "\r\n" : "\n");
+    }
+    fclose(fp);
+
+    int wrong = 0;
+    std::string err;
+    std::vector<geo::SEGMENT> parsed;
+    geo::WayManager way_manager;
+    way_manager.SetBoundries(get_segs_bound(segs));
+    if (!way_manager.LoadSegments(pathname) ||
+        !geo::WayManager::LoadSegmentsFromCsv(pathname, parsed, err)) {
+        printf("failed to load: %s%s\n", way_manager.GetErrorString().c_str(), err.c_str());
+        remove(pathname.c_str());
+        return -1;
+    }
+    if (parsed.size() != segs.size()) {
+        ++wrong;
+    }
+    std::map<geo::SEG_ID_T, const geo::SEGMENT*> parsed_map;
+    for (const auto &seg : parsed) {
+        parsed_map[seg.seg_id] = &seg;
+    }
+    for (size_t i = 0; i < segs.size(); ++i) {
+        const geo::SEGMENT &seg = segs[i];
+        const geo::SegmentPtr p_seg = way_manager.GetSegById(seg.seg_id);
+        const auto it = parsed_map.find(seg.seg_id);
+        if (!p_seg || it == parsed_map.end()) {
+            ++wrong;
+            continue;
+        }
+        // LoadSegmentsFromCsv() keeps the optional columns of the previous row for the rows
+        // without them, the streaming loader leaves them empty
+        const geo::SEGMENT loaded = p_seg->ToSEGMENT();
+        const bool all_columns = (i % 4 != 1);
+        for (const geo::SEGMENT *p : { &loaded, it->second }) {
+            if (p == it->second && !all_columns) {
+                continue;
+            }
+            if (p->way_id != seg.way_id || p->from_nd != seg.from_nd || p->to_nd != seg.to_nd ||
+                p->way_sub_seq != seg.way_sub_seq || p->split_seq != seg.split_seq ||
+                std::fabs(p->from_lat - seg.from_lat) > 1e-7 ||
+                std::fabs(p->to_lng - seg.to_lng) > 1e-7 || p->one_way != seg.one_way ||
+                p->way_type != seg.way_type || p->way_name != seg.way_name ||
+                p->struct_type != seg.struct_type || p->layer != seg.layer ||
+                p->opt_tags != seg.opt_tags) {
+                ++wrong;
+            }
+        }
+    }
+
+    // an invalid segment ID in the middle
+    fp = fopen(pathname.c_str(), "wb");
+    if (fp) {
+        fprintf(fp, "1,31.2,121.4,31.201,121.4,0,111,1,1,1,1,2,5\n"
+            "x,31.201,121.4,31.202,121.4,0,111,1,2,1,2,3,5\n");
+        fclose(fp);
+    }
+    geo::WayManager invalid;
+    const bool invalid_failed = !invalid.LoadSegments(pathname) &&
+        invalid.GetErrorString().find("segment ID") != std::string::npos;
+    remove(pathname.c_str());
+
+    printf("streaming CSV: %d segments, %d wrong, invalid segment ID %s\n",
+        (int)segs.size(), wrong, invalid_failed ? "failed" : "loaded");
+    return (wrong == 0 && invalid_failed) ? 0 : 1;
+}
+
+// a snapshot of a grid with routing and segment services, loaded into a new WayManager: the same
+// segments, routes, assigned and adjacent segments as the original. a truncated snapshot fails,
+// so do snapshots with bad indices, without changing the WayManager loaded before
+int test_snapshot()
+{
+    const int N = 20;
+    std::vector<geo::SEGMENT> segs = make_grid_segs(N, N);
+    for (size_t i = 0; i < segs.size(); i += 5) {
+        segs[i].opt_tags = "lanes=2";
+    }
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, segs)) {
+        return -1;
+    }
+    const std::string pathname = "test_snapshot.bin";
+    geo::WayManager loaded;
+    if (!way_manager.SaveSnapshot(pathname) || !loaded.LoadSnapshot(pathname)) {
+        printf("failed to save or load the snapshot: %s%s\n",
+            way_manager.GetErrorString().c_str(), loaded.GetErrorString().c_str());
+        remove(pathname.c_str());
+        return -1;
+    }
+
+    int wrong = 0;
+    for (const auto &seg : segs) {
+        const geo::SegmentPtr p_seg1 = way_manager.GetSegById(seg.seg_id);
+        const geo::SegmentPtr p_seg2 = loaded.GetSegById(seg.seg_id);
+        if (!p_seg1 || !p_seg2) {
+            ++wrong;
+            continue;
+        }
+        const geo::SEGMENT seg1 = p_seg1->ToSEGMENT(), seg2 = p_seg2->ToSEGMENT();
+        if (seg1.from_nd != seg2.from_nd || seg1.to_nd != seg2.to_nd ||
+            seg1.from_lat != seg2.from_lat || seg1.from_lng != seg2.from_lng ||
+            seg1.to_lat != seg2.to_lat || seg1.to_lng != seg2.to_lng ||
+            seg1.length != seg2.length || seg1.way_id != seg2.way_id ||
+            seg1.one_way != seg2.one_way || seg1.way_name != seg2.way_name ||
+            seg1.opt_tags != seg2.opt_tags || p_seg2->GetFromNode() == nullptr ||
+            p_seg2->GetToNode() == nullptr ||
+            p_seg2->GetFromNode()->IsRoutingNode() != p_seg1->GetFromNode()->IsRoutingNode() ||
+            p_seg2->GetToNode()->IsDeadEndNode() != p_seg1->GetToNode()->IsDeadEndNode()) {
+            ++wrong;
+        }
+    }
+
+    unsigned int seed = 12345u;
+    int routes = 0, assigned = 0;
+    std::vector<geo::SegmentPtr> route1, route2;
+    std::vector<std::tuple<geo::SegmentPtr, double>> adjacent1, adjacent2;
+    const geo::Bound bound = get_segs_bound(segs);
+    for (int k = 0; k < 500; ++k) {
+        const geo::SEG_ID_T seg_id1 = segs[(size_t)(rand01(seed) * segs.size())].seg_id;
+        const geo::SEG_ID_T seg_id2 = segs[(size_t)(rand01(seed) * segs.size())].seg_id;
+        const bool ok1 = way_manager.ShortestPath(seg_id1, seg_id2, route1);
+        const bool ok2 = loaded.ShortestPath(seg_id1, seg_id2, route2);
+        if (ok1 != ok2 || route1.size() != route2.size()) {
+            ++wrong;
+        }
+        else if (ok1) {
+            ++routes;
+            for (size_t i = 0; i < route1.size(); ++i) {
+                if (route1[i]->seg_id_ != route2[i]->seg_id_) {
+                    ++wrong;
+                    break;
+                }
+            }
+        }
+
+        const geo::GeoPoint point(bound.minlat + rand01(seed) * (bound.maxlat - bound.minlat),
+            bound.minlng + rand01(seed) * (bound.maxlng - bound.minlng));
+        const int heading = (int)(rand01(seed) * 360);
+        const geo::SegmentPtr p_seg1 = way_manager.AssignSegment(point, heading, 50, 45);
+        const geo::SegmentPtr p_seg2 = loaded.AssignSegment(point, heading, 50, 45);
+        if ((p_seg1 == nullptr) != (p_seg2 == nullptr) ||
+            (p_seg1 && p_seg1->seg_id_ != p_seg2->seg_id_)) {
+            ++wrong;
+        }
+        else if (p_seg1) {
+            ++assigned;
+        }
+        way_manager.FindAdjacentSegments(point, 100, false, adjacent1);
+        loaded.FindAdjacentSegments(point, 100, false, adjacent2);
+        if (adjacent1.size() != adjacent2.size()) {
+            ++wrong;
+        }
+    }
+
+    std::vector<char> data;
+    FILE *fp = fopen(pathname.c_str(), "rb");
+    if (fp) {
+        char buf[4096];
+        for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        fclose(fp);
+    }
+
+    // an out of range index in the segments of the nodes (section 5), of the tiles (10) and of
+    // the routing connections (16): the load fails and the loaded map is unchanged. the sections
+    // follow the 16 bytes file header, each one with a 16 bytes header (id, element size, count)
+    // and padded to 8 bytes
+    int bad_loaded = 0;
+    const uint32_t bad_sections[] = { 5, 10, 16 };
+    for (const uint32_t bad_section : bad_sections) {
+        std::vector<char> bad_data(data);
+        for (size_t pos = 16; pos + 16 <= bad_data.size();) {
+            uint32_t id, elem_size;
+            uint64_t count;
+            memcpy(&id, &bad_data[pos], 4);
+            memcpy(&elem_size, &bad_data[pos + 4], 4);
+            memcpy(&count, &bad_data[pos + 8], 8);
+            if (id == 0) {
+                break;
+            }
+            if (id == bad_section && count > 0) {
+                const int32_t bad_index = 0x7fffffff;
+                memcpy(&bad_data[pos + 16], &bad_index, 4);
+            }
+            const size_t bytes = (size_t)(elem_size * count);
+            pos += 16 + bytes + (8 - bytes % 8) % 8;
+        }
+        fp = fopen(pathname.c_str(), "wb");
+        if (fp) {
+            fwrite(bad_data.data(), 1, bad_data.size(), fp);
+            fclose(fp);
+        }
+        if (loaded.LoadSnapshot(pathname) || loaded.GetErrorString().empty()) {
+            ++bad_loaded;
+        }
+    }
+    for (const auto &seg : segs) {
+        if (!loaded.GetSegById(seg.seg_id) ||
+            loaded.ShortestPath(segs.front().seg_id, seg.seg_id, route2) !=
+            way_manager.ShortestPath(segs.front().seg_id, seg.seg_id, route1) ||
+            route1.size() != route2.size()) {
+            ++wrong;
+        }
+    }
+
+    // cut in the middle, the load fails instead of reading past the end
+    bool truncated_failed = false;
+    if (!data.empty()) {
+        fp = fopen(pathname.c_str(), "wb");
+        if (fp) {
+            fwrite(data.data(), 1, data.size() / 2, fp);
+            fclose(fp);
+            geo::WayManager truncated;
+            truncated_failed = !truncated.LoadSnapshot(pathname);
+        }
+    }
+    remove(pathname.c_str());
+
+    printf("snapshot: %d routes, %d assigned segments, %d wrong, bad indices loaded %d, "
+        "truncated snapshot %s\n", routes, assigned, wrong, bad_loaded,
+        truncated_failed ? "failed" : "loaded");
+    return (wrong == 0 && routes > 0 && assigned > 0 && bad_loaded == 0 && truncated_failed) ?
+        0 : 1;
+}
+
+// binary segments file round trips: the grid (coordinates on the 1e-7 degree grid) and the grid
+// with random coordinates, saved by SaveSegmentsBinary() and loaded by LoadSegments(). the fields
+// come back the same, the coordinates within half of 1e-7 degree
+int test_segbin_round_trip()
+{
+    std::vector<geo::SEGMENT> grid_segs = make_grid_segs(30, 30);
+    for (size_t i = 0; i < grid_segs.size(); i += 7) {
+        grid_segs[i].opt_tags = "maxspeed=" + std::to_string(i % 120) + ", lanes=2";
+        grid_segs[i].struct_type = geo::STRUCT_BRIDGE;
+        grid_segs[i].layer = 1;
+        grid_segs[i].one_way = true;
+        grid_segs[i].highway_type_str = "secondary";
+    }
+    // the same with the nodes moved randomly, one point per node
+    std::vector<geo::SEGMENT> random_segs = grid_segs;
+    unsigned int seed = 12345u;
+    std::map<geo::NODE_ID_T, geo::GeoPoint> node_points;
+    for (auto &seg : random_segs) {
+        for (int k = 0; k < 2; ++k) {
+            const geo::NODE_ID_T nd_id = k ? seg.to_nd : seg.from_nd;
+            double &lat = k ? seg.to_lat : seg.from_lat;
+            double &lng = k ? seg.to_lng : seg.from_lng;
+            auto it = node_points.find(nd_id);
+            if (it == node_points.end()) {
+                it = node_points.emplace(nd_id, geo::GeoPoint(lat + rand01(seed) * 0.0002,
+                    lng + rand01(seed) * 0.0002)).first;
+            }
+            lat = it->second.lat;
+            lng = it->second.lng;
+        }
+    }
+
+    const std::string pathname = "test_segbin_round_trip.bin";
+    double max_errs[2] = {};
+    int wrong = 0;
+    for (int i_case = 0; i_case < 2; ++i_case) {
+        const std::vector<geo::SEGMENT> &segs = i_case ? random_segs : grid_segs;
+        std::string err;
+        geo::WayManager way_manager;
+        way_manager.SetBoundries(get_segs_bound(segs));
+        if (!geo::WayManager::SaveSegmentsBinary(segs, pathname, err) ||
+            !way_manager.LoadSegments(pathname)) {
+            printf("failed to save or load: %s%s\n", err.c_str(),
+                way_manager.GetErrorString().c_str());
+            remove(pathname.c_str());
+            return -1;
+        }
+        for (const auto &seg : segs) {
+            const geo::SegmentPtr p_seg = way_manager.GetSegById(seg.seg_id);
+            if (!p_seg) {
+                ++wrong;
+                continue;
+            }
+            const geo::SEGMENT loaded = p_seg->ToSEGMENT();
+            if (loaded.way_id != seg.way_id || loaded.from_nd != seg.from_nd ||
+                loaded.to_nd != seg.to_nd || loaded.way_sub_seq != seg.way_sub_seq ||
+                loaded.split_seq != seg.split_seq || loaded.way_type != seg.way_type ||
+                loaded.struct_type != seg.struct_type || loaded.layer != seg.layer ||
+                loaded.one_way != seg.one_way || loaded.way_name != seg.way_name ||
+                loaded.opt_tags != seg.opt_tags ||
+                loaded.highway_type_str != seg.highway_type_str) {
+                ++wrong;
+            }
+            const double coord_errs[] = { loaded.from_lat - seg.from_lat,
+                loaded.from_lng - seg.from_lng, loaded.to_lat - seg.to_lat,
+                loaded.to_lng - seg.to_lng };
+            for (double coord_err : coord_errs) {
+                max_errs[i_case] = std::max(max_errs[i_case], std::fabs(coord_err));
+            }
+        }
+    }
+
+    // bad headers of the last file, of 1 block: a string table size wrapping the sum of the
+    // sizes, a segment count not the sum of the blocks', and a block of too many segments.
+    // the offsets are those of segbin::FileHeader and of the 1st segbin::BlockRecord after it
+    std::string data;
+    {
+        std::ifstream in(pathname, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    const size_t SEG_COUNT_AT = 24, STRS_SIZE_AT = 40, BLOCK_SEG_COUNT_AT = 64;
+    auto set_u64 = [](std::string &bytes, size_t at, uint64_t value) {
+        memcpy(&bytes[at], &value, sizeof(value));
+    };
+    int bad_loaded = 0;
+    for (int i_bad = 0; i_bad < 3; ++i_bad) {
+        std::string bad = data;
+        uint64_t seg_count = 0;
+        memcpy(&seg_count, &data[SEG_COUNT_AT], sizeof(seg_count));
+        if (i_bad == 0) {
+            set_u64(bad, STRS_SIZE_AT, ~0ULL - 16);
+        }
+        else if (i_bad == 1) {
+            set_u64(bad, SEG_COUNT_AT, seg_count + 1);
+        }
+        else {
+            set_u64(bad, SEG_COUNT_AT, 4097);
+            set_u64(bad, BLOCK_SEG_COUNT_AT, 4097);
+        }
+        {
+            std::ofstream out(pathname, std::ios::binary);
+            out.write(bad.data(), bad.size());
+        }
+        geo::WayManager way_manager;
+        way_manager.SetBoundries(get_segs_bound(random_segs));
+        if (way_manager.LoadSegments(pathname) || way_manager.GetErrorString().empty()) {
+            ++bad_loaded;
+        }
+    }
+    remove(pathname.c_str());
+
+    printf("binary segments: %d wrong, max coordinate error %g degree on the grid, %g degree "
+        "off the grid, bad headers loaded %d\n", wrong, max_errs[0], max_errs[1], bad_loaded);
+    return (wrong == 0 && max_errs[0] < 1e-13 && max_errs[1] <= 0.5e-7 + 1e-13 &&
+        bad_loaded == 0) ? 0 : 1;
+}
+
+// the raw opt tags of the segments: GetOptTags() is nullptr without tags, as before they were
+// kept raw, and otherwise the same as Segment::StrToTags(), also for tags without a name
+// or with quotes. GetTagByName() finds the same values. checked after loading the SEGMENTs and
+// after loading them from the binary segments file
+int test_opt_tags()
+{
+    const char *tags_strs[] = { "", "maxspeed=60, lanes=2", " lanes = 3 ,oneway", ",", "=x, ",
+        "name=\"a, b\", ref=S1" };
+    const size_t n_tags_strs = sizeof(tags_strs) / sizeof(tags_strs[0]);
+    std::vector<geo::SEGMENT> segs = make_grid_segs(10, 10);
+    for (size_t i = 0; i < segs.size(); ++i) {
+        segs[i].opt_tags = tags_strs[i % n_tags_strs];
+    }
+
+    const std::string pathname = "test_opt_tags.bin";
+    std::string err;
+    if (!geo::WayManager::SaveSegmentsBinary(segs, pathname, err)) {
+        printf("failed to save: %s\n", err.c_str());
+        return -1;
+    }
+    int wrong = 0, n_checked = 0;
+    for (int i_case = 0; i_case < 2; ++i_case) {
+        geo::WayManager way_manager;
+        way_manager.SetBoundries(get_segs_bound(segs));
+        if (!(i_case ? way_manager.LoadSegments(pathname) : way_manager.LoadSegments(segs))) {
+            printf("failed to load: %s\n", way_manager.GetErrorString().c_str());
+            remove(pathname.c_str());
+            return -1;
+        }
+        for (const auto &seg : segs) {
+            const geo::SegmentPtr p_seg = way_manager.GetSegById(seg.seg_id);
+            if (!p_seg) {
+                ++wrong;
+                continue;
+            }
+            ++n_checked;
+            const geo::Tags *p_tags = p_seg->GetOptTags();
+            const auto p_expected = geo::Segment::StrToTags(seg.opt_tags);
+            if ((p_tags == nullptr) != (p_expected == nullptr) ||
+                (p_tags == nullptr) != seg.opt_tags.empty() ||
+                p_seg->GetOptTagsStr() != seg.opt_tags) {
+                ++wrong;
+                continue;
+            }
+            if (p_tags == nullptr) {
+                continue;
+            }
+            if (p_tags->size() != p_expected->size()) {
+                ++wrong;
+                continue;
+            }
+            for (size_t i = 0; i < p_tags->size(); ++i) {
+                const geo::Tag &tag = (*p_tags)[i];
+                std::string value;
+                if (tag.name != (*p_expected)[i].name || tag.value != (*p_expected)[i].value ||
+                    !p_seg->GetTagByName(tag.name, &value) || value != tag.value) {
+                    ++wrong;
+                }
+            }
+            if (p_seg->GetTagByName("no_such_tag", nullptr)) {
+                ++wrong;
+            }
+        }
+    }
+    remove(pathname.c_str());
+
+    printf("opt tags: %d segments checked, %d wrong\n", n_checked, wrong);
+    return (wrong == 0 && n_checked == (int)segs.size() * 2) ? 0 : 1;
+}
+
+// nearby routing on a grid between random segments up to 3 blocks apart: the routes must be
+// connected from seg1 to seg2. prints how many are longer than the grid distance (the nearby
+// candidates do not always hold the shortest route) and a checksum of the routes, which must be
+// the same with and without NEARBY_CONN_INDEX of way_manager_routing.cpp
+int test_routing_nearby()
+{
+    const int N = 10;
+    const std::vector<geo::SEGMENT> segs = make_grid_segs(N, N);
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, segs)) {
+        return -1;
+    }
+    auto node_point = [N](geo::NODE_ID_T nd_id) {
+        const int r = (int)((nd_id - 1) / N), c = (int)((nd_id - 1) % N);
+        return geo::GeoPoint(31.2 + r * 0.001, 121.4 + c * 0.001);
+    };
+
+    unsigned int seed = 12345u;
+    int found = 0, wrong = 0, longer = 0;
+    unsigned long long checksum = 0;
+    std::vector<geo::SegmentPtr> route;
+    for (int k = 0; k < 20000; ++k) {
+        const geo::SEGMENT &seg1 = segs[(size_t)(rand01(seed) * segs.size())];
+        const geo::SEGMENT &seg2 = segs[(size_t)(rand01(seed) * segs.size())];
+        const geo::GeoPoint a = node_point(seg1.to_nd), b = node_point(seg2.from_nd);
+        if (seg1.seg_id == seg2.seg_id || std::fabs(a.lat - b.lat) > 0.0031 ||
+            std::fabs(a.lng - b.lng) > 0.0031) {
+            continue;
+        }
+        if (!way_manager.RoutingNearby(seg1.seg_id, seg2.seg_id, route)) {
+            continue;
+        }
+        ++found;
+        bool connected = route.front()->seg_id_ == seg1.seg_id &&
+            route.back()->seg_id_ == seg2.seg_id;
+        double length = 0;
+        for (size_t i = 0; i < route.size(); ++i) {
+            if (i > 0 && route[i - 1]->to_nd_ != route[i]->from_nd_) {
+                connected = false;
+            }
+            length += route[i]->length_;
+            checksum = checksum * 31 + (unsigned long long)route[i]->seg_id_;
+        }
+        // the manhattan distance between the nodes, without u-turns
+        const double shortest = seg1.length + seg2.length +
+            geo::distance_in_meter(a, geo::GeoPoint(b.lat, a.lng)) +
+            geo::distance_in_meter(geo::GeoPoint(b.lat, a.lng), b);
+        if (!connected) {
+            ++wrong;
+        }
+        else if (length > shortest + 1) {
+            ++longer;
+        }
+    }
+    printf("nearby routing: %d routes, %d not connected, %d longer than the grid distance, "
+        "checksum %llu\n", found, wrong, longer, checksum);
+    return (found > 0 && wrong == 0) ? 0 : 1;
+}
+
+// CompactRoute from ShortestPath() against the segment vector version on a grid, near pairs (by
+// the nearby routing) and far ones (by Dijkstra), and a straight route kept as one span
+int test_compact_route()
+{
+    const int N = 20;
+    const std::vector<geo::SEGMENT> segs = make_grid_segs(N, N);
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, segs)) {
+        return -1;
+    }
+
+    unsigned int seed = 12345u;
+    int found = 0, wrong = 0;
+    std::vector<geo::SegmentPtr> route, segs_of_compact;
+    std::vector<geo::SEG_ID_T> seg_ids;
+    std::vector<geo::GeoPoint> polyline;
+    geo::CompactRoute compact_route;
+    long long nearby_allocs = 0;
+    int nearby_count = 0;
+    for (int k = 0; k < 2000; ++k) {
+        const geo::SegmentPtr p_seg1 =
+            way_manager.GetSegById(segs[(size_t)(rand01(seed) * segs.size())].seg_id);
+        const geo::SegmentPtr p_seg2 =
+            way_manager.GetSegById(segs[(size_t)(rand01(seed) * segs.size())].seg_id);
+        const bool ok = way_manager.ShortestPath(p_seg1, p_seg2, route);
+        const long long allocs0 = g_new_count;
+        const bool nearby = way_manager.RoutingNearby(p_seg1, p_seg2, compact_route);
+        if (nearby && k > 0) {
+            nearby_allocs += g_new_count - allocs0;
+            ++nearby_count;
+        }
+        if (way_manager.ShortestPath(p_seg1, p_seg2, compact_route) != ok) {
+            ++wrong;
+            continue;
+        }
+        if (!ok) {
+            continue;
+        }
+        ++found;
+        compact_route.ToSegs(segs_of_compact);
+        compact_route.ToSegIds(seg_ids);
+        compact_route.ToPolyline(polyline);
+        double length = 0;
+        for (const auto& p_seg : route) {
+            length += p_seg->length_;
+        }
+        if (segs_of_compact != route || compact_route.SegCount() != route.size() ||
+            seg_ids.size() != route.size() || seg_ids.back() != route.back()->seg_id_ ||
+            polyline.size() != route.size() + 1 || polyline.back() != route.back()->to_point_ ||
+            std::fabs(compact_route.Length() - length) > 1e-6 ||
+            compact_route.Front() != route.front() || compact_route.Back() != route.back()) {
+            ++wrong;
+        }
+    }
+
+    // row 5 from column 2 to 17, one way, one span
+    geo::SegmentPtr p_seg1 = way_manager.GetSegById(geo::Segment::GenerateSegID(1005, 3, 0));
+    geo::SegmentPtr p_seg2 = way_manager.GetSegById(geo::Segment::GenerateSegID(1005, 17, 0));
+    const bool straight_ok = way_manager.DijkstraShortestPath(p_seg1, p_seg2, compact_route) &&
+        compact_route.Spans().size() == 1 && compact_route.SegCount() == 15;
+
+    printf("compact routes: %d found, %d wrong, straight route %s, %.1f allocations per "
+        "nearby route\n", found, wrong, straight_ok ? "ok" : "wrong",
+        (double)nearby_allocs / std::max(1, nearby_count));
+    return (found > 0 && wrong == 0 && straight_ok) ? 0 : 1;
+}
+
+// the encoded polylines against the example of the Google polyline format, the routes of segments
+// decoded back, and a feature without props written with "properties": null
+int test_stream_writers()
+{
+    geo::GeoObj_LineString line;
+    line.AddPoint(geo::GeoPoint(38.5, -120.2));
+    line.AddPoint(geo::GeoPoint(40.7, -120.95));
+    line.AddPoint(geo::GeoPoint(43.252, -126.453));
+    const std::string google_encoded = "_p~iF~ps|U_ulLnnqC_mqNvxq`@";
+    geo::GeoObj_LineString decoded;
+    if (line.ToCompressedGeometry(5) != google_encoded ||
+        !decoded.FromCompressedGeometry(google_encoded, 5) || decoded.GetPoints().size() != 3) {
+        printf("wrong encoded polyline: %s\n", line.ToCompressedGeometry(5).c_str());
+        return -1;
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        if (geo::distance_in_meter(decoded.GetPoints()[i], line.GetPoints()[i]) > 0.01) {
+            printf("wrong decoded polyline point %d\n", (int)i);
+            return -1;
+        }
+    }
+
+    // row 2 of the grid from column 0 to 4
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, make_grid_segs(5, 5))) {
+        return -1;
+    }
+    std::vector<geo::SegmentPtr> route;
+    for (int i = 0; i < 4; ++i) {
+        route.push_back(way_manager.GetSegById(geo::Segment::GenerateSegID(1002, i + 1, 0)));
+        if (!route.back()) {
+            printf("no segment %d of way 1002\n", i + 1);
+            return -1;
+        }
+    }
+    std::ostringstream route_out;
+    const std::string route_encoded = geo::CompactRoute(route).ToEncodedPolyline(6);
+    if (!geo::WayManager::SegsToEncodedPolyline(route, route_out, 6) ||
+        route_out.str() != route_encoded ||
+        !decoded.FromCompressedGeometry(route_encoded, 6) || decoded.GetPoints().size() != 5) {
+        printf("wrong encoded route: %s\n", route_encoded.c_str());
+        return -1;
+    }
+    for (int c = 0; c < 5; ++c) {
+        const geo::GeoPoint& point = decoded.GetPoints()[c];
+        if (std::fabs(point.lat - (31.2 + 2 * 0.001)) > 0.6e-6 ||
+            std::fabs(point.lng - (121.4 + c * 0.001)) > 0.6e-6) {
+            printf("wrong decoded route point %d\n", c);
+            return -1;
+        }
+    }
+
+    std::ostringstream json_out;
+    geo::GeoJsonStreamWriter writer(json_out);
+    writer.BeginPoint(geo::GeoPoint(31.2, 121.4));
+    writer.EndFeature();
+    writer.BeginLineString(geo::GeoPoint(31.2, 121.4), geo::GeoPoint(31.3, 121.5));
+    writer.AddProp("a", 1);
+    writer.EndFeature();
+    if (!writer.Close()) {
+        return -1;
+    }
+    const std::string json = json_out.str();
+    std::vector<geo::GeoObjPtr> objs;
+    geo::GeoJsonStreamReader reader;
+    const bool ok = reader.ReadString(json, [&objs](const geo::GeoObjPtr& p_obj) {
+        objs.push_back(p_obj);
+        return true;
+    });
+    if (json.find("\"properties\":null}") == std::string::npos || !ok || objs.size() != 2 ||
+        objs[1]->GetPropAsStr("a") != "1") {
+        printf("wrong GeoJSON: %s\n", json.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// match probabilities and alternative routes on a grid. the GPS points are on row 2, then
+// drifted toward row 3, so that the parallel road becomes an alternative
+int test_route_matching_probs()
+{
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, make_grid_segs(10, 10))) {
+        return -1;
+    }
+    std::vector<geo::SegmentPtr> route;
+    if (!way_manager.ShortestPath(geo::Segment::GenerateSegID(1002, 1, 0),
+        geo::Segment::GenerateSegID(1002, 9, 0), route)) {
+        printf("failed to find the route on row 2\n");
+        return -1;
+    }
+
+    int failures = 0;
+    for (double drift : { 0.0, 0.0004 }) {
+        geo::RouteMatchingParams params;
+        params.radius = 80;
+        params.alternative_count = 3;
+        params.via_points = make_trace(route, 1, 10, util::StrToTimeT("2017-01-01 08:00:00"));
+        for (auto &via_point : params.via_points) {
+            via_point.geo_point.lat += drift;
+        }
+        if (!way_manager.RouteMatching(params) || params.result_route.empty()) {
+            printf("drift %g: route matching failed: %s\n", drift, params.err.c_str());
+            ++failures;
+            continue;
+        }
+
+        // every point matched with a probability, the alternatives different from the result
+        // and each other, ordered by weight and their probabilities not more than 1 in total
+        float min_match_prob = 1.0f;
+        bool points_on_row2 = true;
+        for (const auto &via_point : params.via_points) {
+            if (via_point.p_seg == nullptr || via_point.match_prob <= 0.0f ||
+                via_point.match_prob > 1.0f) {
+                ++failures;
+                continue;
+            }
+            min_match_prob = std::min(min_match_prob, via_point.match_prob);
+            points_on_row2 = points_on_row2 && via_point.p_seg->way_id_ == 1002;
+        }
+        double total_prob = params.result_prob;
+        int last_weight = 0;
+        for (size_t i = 0; i < params.alternatives.size(); ++i) {
+            const auto &alternative = params.alternatives[i];
+            if (alternative.route.empty() || alternative.route == params.result_route ||
+                alternative.weight < last_weight || alternative.prob < 0.0f) {
+                ++failures;
+            }
+            for (size_t j = 0; j < i; ++j) {
+                if (params.alternatives[j].route == alternative.route) {
+                    ++failures;
+                }
+            }
+            last_weight = alternative.weight;
+            total_prob += alternative.prob;
+        }
+        if (params.result_prob <= 0.0f || total_prob > 1.0001 ||
+            params.alternatives.size() > 3) {
+            ++failures;
+        }
+
+        // on the road: the route and all the points on row 2
+        bool on_row2 = true;
+        for (const auto &p_seg : params.result_route) {
+            on_row2 = on_row2 && p_seg->way_id_ == 1002;
+        }
+        if (drift == 0.0 && (!on_row2 || !points_on_row2)) {
+            ++failures;
+        }
+        printf("drift %g: result %d segments on row 2 %s, prob %g, min point prob %g, "
+            "%d alternatives, total prob %g\n", drift, (int)params.result_route.size(),
+            on_row2 ? "yes" : "no", params.result_prob, min_match_prob,
+            (int)params.alternatives.size(), total_prob);
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// PreparedPolygon::Within() against point_in_polygon(), for rings whose closing edge is
+// horizontal, the first vertex is then only seen before any edge is added
+int test_prepared_polygon()
+{
+    std::vector<geo::SimplePolygon> rings;
+    geo::SimplePolygon trapezoid; // the first vertex alone holds the min lng
+    trapezoid.PushBack(geo::GeoPoint(0, -5));
+    trapezoid.PushBack(geo::GeoPoint(10, -2));
+    trapezoid.PushBack(geo::GeoPoint(10, 2));
+    trapezoid.PushBack(geo::GeoPoint(0, 5));
+    rings.push_back(trapezoid);
+    unsigned int seed = 42;
+    for (int n : { 3, 4, 7, 50, 1000 }) {
+        rings.push_back(make_flat_closed_ring(seed, n, 31.2, 121.4, 0.1));
+    }
+
+    int failures = 0;
+    for (const auto &ring : rings) {
+        const geo::PreparedPolygon prepared(ring);
+        double minlat = 1e9, minlng = 1e9, maxlat = -1e9, maxlng = -1e9;
+        for (const auto &pt : ring.Vertexes()) {
+            minlat = std::min(minlat, pt.lat);
+            minlng = std::min(minlng, pt.lng);
+            maxlat = std::max(maxlat, pt.lat);
+            maxlng = std::max(maxlng, pt.lng);
+        }
+        double b_minlat, b_minlng, b_maxlat, b_maxlng;
+        if (!prepared.GetBound(b_minlat, b_minlng, b_maxlat, b_maxlng) || b_minlat != minlat ||
+            b_minlng != minlng || b_maxlat != maxlat || b_maxlng != maxlng) {
+            printf("%d vertexes: wrong bound lng [%g, %g], expected [%g, %g]\n",
+                (int)ring.VertexNumber(), b_minlng, b_maxlng, minlng, maxlng);
+            ++failures;
+        }
+
+        // points around the ring, margin of 10% on each side
+        int mismatches = 0, inside = 0;
+        const double dlat = (maxlat - minlat) * 1.2, dlng = (maxlng - minlng) * 1.2;
+        for (int i = 0; i < 100000; ++i) {
+            const double lat = minlat - (maxlat - minlat) * 0.1 + dlat * rand01(seed);
+            const double lng = minlng - (maxlng - minlng) * 0.1 + dlng * rand01(seed);
+            const bool in = geo::point_in_polygon(lat, lng, ring);
+            inside += in ? 1 : 0;
+            mismatches += (prepared.Within(lat, lng) != in) ? 1 : 0;
+        }
+        printf("%d vertexes: %d points inside, %d mismatches\n", (int)ring.VertexNumber(),
+            inside, mismatches);
+        failures += mismatches;
+    }
+    if (!geo::PreparedPolygon(trapezoid).Within(1, -4.5)) {
+        printf("(1, -4.5) should be within the trapezoid\n");
+        ++failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// PolygonSetIndex against testing all the polygons one by one, overlapping rings with
+// horizontal closing edges, every third one with a hole
+int test_polygon_set_index()
+{
+    unsigned int seed = 7;
+    std::vector<geo::Polygon> polygons;
+    geo::PolygonSetIndex index;
+    for (int i = 0; i < 500; ++i) {
+        const double lat = 31.0 + rand01(seed), lng = 121.0 + rand01(seed);
+        const double radius = 0.01 + 0.05 * rand01(seed);
+        polygons.push_back(geo::Polygon());
+        auto &polygon = polygons.back();
+        // a hole well inside: the outer ring has enough vertexes not to cut into it
+        const bool has_hole = (i % 3 == 0);
+        const int n = (has_hole ? 12 : 3) + (int)(rand01(seed) * 50);
+        polygon.outer_polygon = make_flat_closed_ring(seed, n, lat, lng, radius);
+        if (has_hole) {
+            polygon.inner_polygons.push_back(make_flat_closed_ring(seed, 5, lat, lng,
+                radius * 0.2));
+        }
+        if (index.AddPolygon(polygon) != i) {
+            printf("wrong polygon ID for %d\n", i);
+            return 1;
+        }
+    }
+    index.Build();
+
+    int failures = 0, found_count = 0;
+    std::vector<geo::GeoPoint> points;
+    std::vector<int> ids, expected, batch_ids;
+    for (int i = 0; i < 50000; ++i) {
+        points.push_back(geo::GeoPoint(30.95 + 1.1 * rand01(seed), 120.95 + 1.1 * rand01(seed)));
+        const auto &pt = points.back();
+        expected.clear();
+        for (int id = 0; id < (int)polygons.size(); ++id) {
+            if (geo::point_in_polygon(pt.lat, pt.lng, polygons[id])) {
+                expected.push_back(id);
+            }
+        }
+        index.FindPolygons(pt.lat, pt.lng, ids);
+        const int id = index.FindPolygon(pt);
+        if (ids != expected || id != (expected.empty() ? -1 : expected[0])) {
+            ++failures;
+        }
+        found_count += expected.empty() ? 0 : 1;
+    }
+    index.FindPolygon(points, batch_ids);
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (batch_ids[i] != index.FindPolygon(points[i])) {
+            ++failures;
+        }
+    }
+    printf("%d points, %d in some polygon, %d mismatches\n", (int)points.size(), found_count,
+        failures);
+    return failures == 0 ? 0 : 1;
+}
+
+// ExtractSegTraversals() of a trace at the middle points of row 2, 10 seconds per segment,
+// with the route broken after a via point, then TravelTimeAggregator with the traversals
+int test_travel_time()
+{
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, make_grid_segs(10, 10))) {
+        return -1;
+    }
+    geo::RouteMatchingParams params;
+    if (!way_manager.ShortestPath(geo::Segment::GenerateSegID(1002, 1, 0),
+        geo::Segment::GenerateSegID(1002, 9, 0), params.result_route)) {
+        printf("failed to find the route on row 2\n");
+        return -1;
+    }
+    const time_t tm0 = util::StrToTimeT("2017-01-01 08:00:00");
+    params.via_points = make_trace(params.result_route, 1, 10, tm0);
+    for (size_t i = 0; i < params.via_points.size(); ++i) {
+        params.via_points[i].p_seg = params.result_route[i];
+        params.via_points[i].i_seg = (int)i;
+    }
+
+    // full: the segments entirely between the first and the last anchors of a run
+    auto get_full_segs = [&way_manager](const geo::RouteMatchingParams &params,
+        std::vector<int> &full_segs) {
+        std::vector<geo::SegTraversal> traversals;
+        full_segs.clear();
+        if (!way_manager.ExtractSegTraversals(params, traversals)) {
+            return false;
+        }
+        for (const auto &traversal : traversals) {
+            if (!traversal.partial) {
+                full_segs.push_back(traversal.i_seg);
+            }
+        }
+        return true;
+    };
+
+    int failures = 0;
+    std::vector<int> full_segs;
+    const std::vector<int> all_full{ 1, 2, 3, 4, 5, 6, 7 };
+    const std::vector<int> broken_at_4{ 1, 2, 3, 6, 7 };
+    if (!get_full_segs(params, full_segs) || full_segs != all_full) {
+        printf("no broken route: wrong full traversals\n");
+        ++failures;
+    }
+
+    // no route from point 4 to point 5: segments 4 and 5 are only partially known
+    params.via_points[4].is_broken = true;
+    if (!get_full_segs(params, full_segs) || full_segs != broken_at_4) {
+        printf("broken after point 4: wrong full traversals\n");
+        ++failures;
+    }
+
+    // point 4 dropped as out of order keeps the route broken from point 3 to point 5
+    params.via_points[4].record_time = params.via_points[3].record_time;
+    const std::vector<int> broken_at_3{ 1, 2, 6, 7 };
+    if (!get_full_segs(params, full_segs) || full_segs != broken_at_3) {
+        printf("broken after dropped point 4: wrong full traversals\n");
+        ++failures;
+    }
+
+    // the aggregator: the unbroken trace added by 4 threads 100 times each
+    params.via_points[4].is_broken = false;
+    params.via_points[4].record_time = params.via_points[3].record_time + 10;
+    std::vector<geo::SegTraversal> traversals;
+    way_manager.ExtractSegTraversals(params, traversals);
+    geo::TravelTimeAggregator aggregator;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&aggregator, &traversals]() {
+            for (int i = 0; i < 100; ++i) {
+                aggregator.Add(traversals);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    std::vector<geo::TravelTimeAggregator::SlotStats> all_stats;
+    aggregator.GetAll(all_stats);
+    const int slot = aggregator.TimeToSlot((double)tm0);
+    if (aggregator.Size() != all_full.size() || all_stats.size() != all_full.size()) {
+        printf("aggregator: %d stats, expected %d\n", (int)aggregator.Size(),
+            (int)all_full.size());
+        ++failures;
+    }
+    for (int i : all_full) {
+        const auto &p_seg = params.result_route[i];
+        geo::TravelTimeAggregator::SlotStats stats;
+        const double speed = p_seg->length_ / 10 * 3.6;
+        if (!aggregator.Get(p_seg->seg_id_, slot, stats) || stats.count != 400 ||
+            std::fabs(stats.AvgSpeed() - speed) > 1e-6 || stats.StdDevSpeed() > 1e-3 ||
+            std::fabs(stats.AvgTravelTime() - 10) > 1e-6) {
+            printf("aggregator: wrong stats of segment %d\n", i);
+            ++failures;
+        }
+    }
+    aggregator.Clear();
+    if (aggregator.Size() != 0) {
+        ++failures;
+    }
+
+    // large segment IDs: 2^61 and 2^62 times the 96 slots are both 0 modulo 2^64, they must
+    // still be kept apart
+    geo::SEGMENT seg = make_grid_segs(1, 2)[0];
+    seg.seg_id = 1LL << 61;
+    geo::Segment seg1(seg);
+    seg.seg_id = 1LL << 62;
+    geo::Segment seg2(seg);
+    traversals.assign(2, traversals[1]);
+    traversals[0].p_seg = &seg1;
+    traversals[1].p_seg = &seg2;
+    traversals[1].speed *= 2;
+    aggregator.Add(traversals);
+    geo::TravelTimeAggregator::SlotStats stats1, stats2;
+    if (aggregator.Size() != 2 || !aggregator.Get(seg1.seg_id_, slot, stats1) ||
+        !aggregator.Get(seg2.seg_id_, slot, stats2) || stats1.count != 1 || stats2.count != 1 ||
+        stats1.seg_id != seg1.seg_id_ || stats2.AvgSpeed() != traversals[1].speed) {
+        printf("aggregator: large segment IDs mixed up\n");
+        ++failures;
+    }
+    printf("travel time: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+// exclusions of row 5 set and removed over and over while other threads match a trace on row 2.
+// the matching is not affected and the fields next to the exclusion flags never change
+int test_exclusion_updates()
+{
+    geo::WayManager way_manager;
+    if (!init_way_manager(way_manager, make_grid_segs(10, 10))) {
+        return -1;
+    }
+    std::vector<geo::SegmentPtr> route, row5;
+    if (!way_manager.ShortestPath(geo::Segment::GenerateSegID(1002, 1, 0),
+        geo::Segment::GenerateSegID(1002, 9, 0), route)) {
+        printf("failed to find the route on row 2\n");
+        return -1;
+    }
+    std::vector<std::tuple<int, int>> fields; // (heading_, layer_) of row5
+    for (int i = 1; i <= 9; ++i) {
+        for (int dir = 1; dir >= -1; dir -= 2) {
+            row5.push_back(way_manager.GetSegById(geo::Segment::GenerateSegID(1005, dir * i, 0)));
+            fields.push_back(std::make_tuple((int)row5.back()->heading_,
+                (int)row5.back()->layer_));
+        }
+    }
+    const time_t tm0 = util::StrToTimeT("2017-01-01 08:00:00");
+    geo::EXCLUSION_SETTING always;
+    always.ex_type = geo::EXTYPE_ALWAYS;
+
+    std::atomic<bool> done(false);
+    std::atomic<int> failures(0), rounds(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t) {
+        threads.emplace_back([&]() {
+            while (!done) {
+                geo::RouteMatchingParams params;
+                params.radius = 80;
+                params.via_points = make_trace(route, 1, 10, tm0);
+                bool ok = way_manager.RouteMatching(params) && !params.result_route.empty();
+                for (const auto &p_seg : params.result_route) {
+                    ok = ok && p_seg->way_id_ == 1002;
+                }
+                for (size_t i = 0; i < row5.size(); ++i) {
+                    ok = ok && fields[i] == std::make_tuple((int)row5[i]->heading_,
+                        (int)row5[i]->layer_);
+                }
+                failures += ok ? 0 : 1;
+                ++rounds;
+            }
+        });
+    }
+    for (int i = 0; i < 2000; ++i) {
+        way_manager.SetExclusionSegs(row5, always, true);
+        way_manager.RemoveExclusionSegs(row5, true);
+    }
+    done = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // the flags follow the settings
+    geo::EXCLUSION_SETTING no_gps;
+    no_gps.ex_type = geo::EXTYPE_NO_GPS;
+    const auto &p_seg = row5.front();
+    way_manager.SetExclusionSegs(row5, always, true);
+    if (!p_seg->ExcludedFlag() || !p_seg->ExcludedAlways() || p_seg->ExcludedNoGps() ||
+        !way_manager.IsSegmentExcluded(p_seg, tm0, false)) {
+        ++failures;
+    }
+    way_manager.SetExclusionSegs(row5, no_gps, true);
+    if (!p_seg->ExcludedFlag() || p_seg->ExcludedAlways() || !p_seg->ExcludedNoGps() ||
+        way_manager.IsSegmentExcluded(p_seg, tm0, false)) {
+        ++failures;
+    }
+    way_manager.RemoveExclusionSegs(row5, true);
+    if (p_seg->ExcludedFlag() || p_seg->ExcludedAlways() || p_seg->ExcludedNoGps()) {
+        ++failures;
+    }
+
+    // after the incremental sync, the route along row 2 and down column 9 goes around the excluded
+    // middle segment of the row, and along the row again once the exclusion is removed
+    const geo::SegmentPtr p_seg1 = route.front();
+    const geo::SegmentPtr p_seg2 = way_manager.GetSegById(geo::Segment::GenerateSegID(2009, -2, 0));
+    std::vector<geo::SegmentPtr> excluded = { way_manager.GetSegById(
+        geo::Segment::GenerateSegID(1002, 5, 0)) };
+    auto route_has_excluded = [&]() {
+        std::vector<geo::SegmentPtr> route_at_tm0;
+        if (!way_manager.DijkstraShortestPath(p_seg1, p_seg2, route_at_tm0, nullptr, tm0) ||
+            route_at_tm0.back() != p_seg2) {
+            return -1;
+        }
+        return (int)(std::find(route_at_tm0.begin(), route_at_tm0.end(), excluded.front()) !=
+            route_at_tm0.end());
+    };
+    const int before = route_has_excluded();
+    way_manager.SetExclusionSegs(excluded, always, true);
+    const int during = route_has_excluded();
+    way_manager.RemoveExclusionSegs(excluded, true);
+    const int after = route_has_excluded();
+    if (before != 1 || during != 0 || after != 1) {
+        printf("excluded segment on the route: %d before, %d during, %d after the exclusion\n",
+            before, during, after);
+        ++failures;
+    }
+    printf("exclusion updates: %d matching rounds, %d failures\n", (int)rounds,
+        (int)failures);
+    return failures == 0 ? 0 : 1;
+}
+
+// ReloadWithSegmentDiff() by SharedWayManager: an added diagonal road, a removed row and a
+// modified segment show up in the new version only, the exclusions are carried over
+int test_segment_diff()
+{
+    const auto segs = make_grid_segs(5, 5);
+    auto p_base = std::make_shared<geo::WayManager>();
+    if (!init_way_manager(*p_base, segs)) {
+        return -1;
+    }
+    std::vector<geo::SegmentPtr> row3;
+    for (int i = 1; i <= 4; ++i) {
+        row3.push_back(p_base->GetSegById(geo::Segment::GenerateSegID(1003, i, 0)));
+    }
+    geo::EXCLUSION_SETTING always;
+    always.ex_type = geo::EXTYPE_ALWAYS;
+    p_base->SetExclusionSegs(row3, always, true);
+    geo::SharedWayManager shared(p_base);
+
+    auto seg_id = [](geo::WAY_ID_T way_id, int sub_seq) {
+        return geo::Segment::GenerateSegID(way_id, sub_seq, 0);
+    };
+    auto has_way = [](const std::vector<geo::SegmentPtr> &route, geo::WAY_ID_T way_id) {
+        for (const auto &p_seg : route) {
+            if (p_seg->way_id_ == way_id) {
+                return true;
+            }
+        }
+        return false;
+    };
+    int failures = 0;
+    std::vector<geo::SegmentPtr> route;
+
+    // add: a one-way diagonal from node 1 (row 0, col 0) to node 7 (row 1, col 1)
+    geo::SEGMENT diagonal = segs[0];
+    diagonal.way_id = 3000;
+    diagonal.way_sub_seq = 1;
+    diagonal.seg_id = seg_id(3000, 1);
+    diagonal.to_nd = 7;
+    diagonal.to_lat = segs[0].from_lat + 0.001;
+    diagonal.to_lng = segs[0].from_lng + 0.001;
+    diagonal.one_way = true;
+    if (!shared.ReloadWithSegmentDiff({ diagonal }, {}, {})) {
+        printf("add: %s\n", shared.GetErrorString().c_str());
+        return 1;
+    }
+    auto p_v1 = shared.Get();
+    if (p_v1 == p_base || p_v1->MapVersion() != p_base->MapVersion() + 1 ||
+        !p_v1->GetSegById(seg_id(3000, 1)) || p_base->GetSegById(seg_id(3000, 1)) ||
+        !p_v1->ShortestPath(seg_id(3000, 1), seg_id(1001, 4), route) || route.empty()) {
+        printf("add: the diagonal is not in the new version\n");
+        ++failures;
+    }
+
+    // remove: row 2, and an ID never loaded which is ignored
+    std::vector<geo::SEG_ID_T> removed{ 12345 };
+    for (int i = 1; i <= 4; ++i) {
+        removed.push_back(seg_id(1002, i));
+        removed.push_back(seg_id(1002, -i));
+    }
+    if (!shared.ReloadWithSegmentDiff({}, removed, {})) {
+        printf("remove: %s\n", shared.GetErrorString().c_str());
+        return 1;
+    }
+    auto p_v2 = shared.Get();
+    if (p_v2->GetSegById(seg_id(1002, 1)) || !p_v1->GetSegById(seg_id(1002, 1)) ||
+        !p_v2->GetSegById(seg_id(3000, 1)) ||
+        !p_v2->ShortestPath(seg_id(2000, 1), seg_id(2004, -1), route) ||
+        has_way(route, 1002) || route.empty()) {
+        printf("remove: row 2 is still in the new version\n");
+        ++failures;
+    }
+
+    // modify: the type and the name of a segment on row 1
+    geo::SEGMENT modified;
+    for (const auto &seg : segs) {
+        if (seg.seg_id == seg_id(1001, 2)) {
+            modified = seg;
+        }
+    }
+    modified.way_type = geo::HIGHWAY_PRIMARY;
+    modified.way_name = "renamed";
+    if (!shared.ReloadWithSegmentDiff({}, {}, { modified })) {
+        printf("modify: %s\n", shared.GetErrorString().c_str());
+        return 1;
+    }
+    auto p_v3 = shared.Get();
+    const auto p_seg = p_v3->GetSegById(seg_id(1001, 2));
+    if (!p_seg || p_seg->way_type_ != geo::HIGHWAY_PRIMARY || p_seg->way_name_ != "renamed" ||
+        p_v2->GetSegById(seg_id(1001, 2))->way_name_ != "row1" ||
+        !p_v3->ShortestPath(seg_id(1001, 1), seg_id(1001, 3), route) || route.size() != 3) {
+        printf("modify: the segment is not modified in the new version\n");
+        ++failures;
+    }
+
+    // the exclusions of row 3 in all the versions
+    for (const auto &p_version : { p_v1, p_v2, p_v3 }) {
+        const auto p_excluded = p_version->GetSegById(seg_id(1003, 2));
+        if (!p_excluded || !p_excluded->ExcludedAlways() ||
+            !p_version->IsSegmentExcluded(p_excluded, 0, false)) {
+            printf("exclusions not carried over to version %llu\n", p_version->MapVersion());
+            ++failures;
+        }
+    }
+    printf("segment diff: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
 {
+    if (argc == 2 && strcmp(argv[1], "segment_diff") == 0) {
+        return test_segment_diff();
+    }
+    if (argc == 2 && strcmp(argv[1], "exclusions") == 0) {
+        return test_exclusion_updates();
+    }
+    if (argc == 2 && strcmp(argv[1], "travel_time") == 0) {
+        return test_travel_time();
+    }
+    if (argc == 2 && strcmp(argv[1], "polygon_set") == 0) {
+        return test_polygon_set_index();
+    }
+    if (argc == 2 && strcmp(argv[1], "prepared_polygon") == 0) {
+        return test_prepared_polygon();
+    }
+    if (argc == 2 && strcmp(argv[1], "match_probs") == 0) {
+        return test_route_matching_probs();
+    }
+    if (argc == 3 && strcmp(argv[1], "geojson_read") == 0) {
+        return test_geojson_stream_reader(argv[2]);
+    }
+    if (argc == 2 && strcmp(argv[1], "knn") == 0) {
+        return test_k_nearest_nodes();
+    }
+    if (argc == 2 && strcmp(argv[1], "simplify") == 0) {
+        return test_offset_simplify();
+    }
+    if (argc == 4 && strcmp(argv[1], "tiles") == 0) {
+        return test_tile_pyramid(argv[2], argv[3]);
+    }
+    if (argc == 2 && strcmp(argv[1], "opt_tags") == 0) {
+        return test_opt_tags();
+    }
+    if (argc == 2 && strcmp(argv[1], "inside_china") == 0) {
+        return test_inside_china();
+    }
+    if (argc == 2 && strcmp(argv[1], "sharded") == 0) {
+        return test_sharded_way_manager();
+    }
+    if (argc == 2 && strcmp(argv[1], "graph") == 0) {
+        return test_graph_construction();
+    }
+    if (argc == 2 && strcmp(argv[1], "csv_streaming") == 0) {
+        return test_csv_streaming();
+    }
+    if (argc == 2 && strcmp(argv[1], "snapshot") == 0) {
+        return test_snapshot();
+    }
+    if (argc == 2 && strcmp(argv[1], "segbin") == 0) {
+        return test_segbin_round_trip();
+    }
+    if (argc == 2 && strcmp(argv[1], "compact_route") == 0) {
+        return test_compact_route();
+    }
+    if (argc == 2 && strcmp(argv[1], "nearby") == 0) {
+        return test_routing_nearby();
+    }
+    if (argc == 2 && strcmp(argv[1], "stream_write") == 0) {
+        return test_stream_writers();
+    }
+    if (argc == 3 && strcmp(argv[1], "assign_threads") == 0) {
+        return test_assign_segment_threads_grid(atoi(argv[2]));
+    }
+    if (argc == 2 && strcmp(argv[1], "fixed") == 0) {
+        return test_fixed_point();
+    }
+    if (argc == 2 && strcmp(argv[1], "transform") == 0) {
+        return test_coord_transform_batch();
+    }
+    if (argc == 2 && strcmp(argv[1], "distance") == 0) {
+        return test_distance_batch();
+    }
+    if (argc == 3) {
+        return test_assign_segment_threads(argv[1], atoi(argv[2]));
+    }
+    if (argc == 4) {
+        return test_route_matching_allocs(argv[1], atoll(argv[2]), atoll(argv[3]));
+    }
     test2();
     return 0;
 }
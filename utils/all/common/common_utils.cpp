@@ -300,7 +300,7 @@ bool MakeDir(const string& pathname)
 #ifdef _WIN32
     return 0 == _mkdir(pathname.c_str());
 #else
-    return mkdir(pathname.c_str(), 0);
+    return 0 == mkdir(pathname.c_str(), 0777);
 #endif
 }
 
@@ -0,0 +1,154 @@
+/*----------------------------------------------------------------------*
+ * Copyright(c) 2015 SAP SE. All rights reserved
+ * Author      : SAP Custom Development
+ * Description : Read-only memory mapped file
+ *----------------------------------------------------------------------*
+ * Change - History : Change history
+ * Developer  Date      Description
+ * I078212    20261019  Initial creation
+ *----------------------------------------------------------------------*/
+
+#ifndef _MAPPED_FILE_HPP_
+#define _MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+// Maps the whole file read-only. The pages are shared by all the processes mapping the
+// same file, and only loaded from disk when touched.
+class MappedFile
+{
+public:
+    MappedFile()
+    {}
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& pathname)
+    {
+        Close();
+#ifdef _WIN32
+        h_file_ = ::CreateFileA(pathname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (h_file_ == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!::GetFileSizeEx(h_file_, &file_size) || file_size.QuadPart == 0) {
+            Close();
+            return false;
+        }
+        h_mapping_ = ::CreateFileMappingA(h_file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (h_mapping_ == NULL) {
+            Close();
+            return false;
+        }
+        p_data_ = (const char *)::MapViewOfFile(h_mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (p_data_ == nullptr) {
+            Close();
+            return false;
+        }
+        size_ = (size_t)file_size.QuadPart;
+#else
+        fd_ = ::open(pathname.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd_, &st) != 0 || st.st_size == 0) {
+            Close();
+            return false;
+        }
+        void *p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            Close();
+            return false;
+        }
+        p_data_ = (const char *)p;
+        size_ = (size_t)st.st_size;
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (p_data_) {
+            ::UnmapViewOfFile(p_data_);
+        }
+        if (h_mapping_ != NULL) {
+            ::CloseHandle(h_mapping_);
+            h_mapping_ = NULL;
+        }
+        if (h_file_ != INVALID_HANDLE_VALUE) {
+            ::CloseHandle(h_file_);
+            h_file_ = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (p_data_) {
+            ::munmap((void *)p_data_, size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif
+        p_data_ = nullptr;
+        size_ = 0;
+    }
+
+    // hint the OS to read ahead, e.g., before a sequential scan
+    void WillNeed() const
+    {
+#ifndef _WIN32
+        if (p_data_) {
+            ::madvise((void *)p_data_, size_, MADV_WILLNEED);
+        }
+#endif
+    }
+
+    bool IsOpen() const
+    {
+        return p_data_ != nullptr;
+    }
+    const char* Data() const
+    {
+        return p_data_;
+    }
+    size_t Size() const
+    {
+        return size_;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE h_file_{ INVALID_HANDLE_VALUE };
+    HANDLE h_mapping_{ NULL };
+#else
+    int fd_{ -1 };
+#endif
+    const char *p_data_{};
+    size_t size_{};
+};
+
+}
+
+#endif // _MAPPED_FILE_HPP_
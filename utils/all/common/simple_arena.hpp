@@ -0,0 +1,186 @@
+/*----------------------------------------------------------------------*
+ * Copyright(c) 2015 SAP SE. All rights reserved
+ * Author      : SAP Custom Development
+ * Description : Simple monotonic (bump pointer) arena
+ *----------------------------------------------------------------------*
+ * Change - History : Change history
+ * Developer  Date      Description
+ * I078212    20261019  Initial creation
+ *----------------------------------------------------------------------*/
+
+#ifndef _SIMPLE_ARENA_HPP_
+#define _SIMPLE_ARENA_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <new>
+#include <utility>
+
+namespace util {
+
+// Monotonic arena: allocations bump a pointer inside big blocks, nothing is freed
+// until Reset(). Objects created by New() are NOT destructed, so only put objects
+// whose destructors are trivial or whose memory also comes from the same arena.
+// After Reset(), the used blocks are merged into one block, so a steady workload
+// (e.g., one trace after another) does not call malloc any more after warm-up.
+class SimpleArena
+{
+public:
+    explicit SimpleArena(size_t block_size = 64 * 1024)
+        : block_size_(block_size)
+    {}
+
+    SimpleArena(const SimpleArena&) = delete;
+    SimpleArena& operator=(const SimpleArena&) = delete;
+
+    void* Allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        ++alloc_count_;
+
+        size_t offset = (cur_offset_ + align - 1) & ~(align - 1);
+        if (blocks_.empty() || offset + size > blocks_[cur_block_].size) {
+            NextBlock(size + align);
+            offset = (cur_offset_ + align - 1) & ~(align - 1);
+        }
+
+        cur_offset_ = offset + size;
+        bytes_used_ += size;
+        return blocks_[cur_block_].p_data.get() + offset;
+    }
+
+    template<typename T, typename... Args>
+    T* New(Args&&... args)
+    {
+        void *p = Allocate(sizeof(T), alignof(T));
+        return new (p) T(std::forward<Args>(args)...);
+    }
+
+    // make all the memory reusable, objects allocated before are invalid afterwards
+    void Reset()
+    {
+        if (blocks_.size() > 1) {
+            // merge into one block big enough for the last workload
+            size_t total = 0;
+            for (const auto& block : blocks_) {
+                total += block.size;
+            }
+            blocks_.clear();
+            AddBlock(total);
+        }
+        cur_block_ = 0;
+        cur_offset_ = 0;
+        bytes_used_ = 0;
+    }
+
+    // release all the blocks
+    void Destory()
+    {
+        blocks_.clear();
+        cur_block_ = 0;
+        cur_offset_ = 0;
+        bytes_used_ = 0;
+    }
+
+    // statistics
+    size_t AllocCount() const { return alloc_count_; } // times Allocate() called
+    size_t BlockAllocCount() const { return block_alloc_count_; } // times malloc called
+    size_t BytesUsed() const { return bytes_used_; } // since last Reset()
+    size_t Capacity() const
+    {
+        size_t total = 0;
+        for (const auto& block : blocks_) {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> p_data;
+        size_t size;
+    };
+
+    void NextBlock(size_t min_size)
+    {
+        // reuse the following block kept from the previous round if big enough
+        while (!blocks_.empty() && cur_block_ + 1 < blocks_.size()) {
+            ++cur_block_;
+            cur_offset_ = 0;
+            if (blocks_[cur_block_].size >= min_size) {
+                return;
+            }
+        }
+        AddBlock(min_size > block_size_ ? min_size : block_size_);
+    }
+
+    void AddBlock(size_t size)
+    {
+        Block block;
+        block.p_data.reset(new char[size]);
+        block.size = size;
+        blocks_.push_back(std::move(block));
+        ++block_alloc_count_;
+
+        cur_block_ = blocks_.size() - 1;
+        cur_offset_ = 0;
+    }
+
+private:
+    const size_t block_size_;
+    std::vector<Block> blocks_;
+    size_t cur_block_{};
+    size_t cur_offset_{};
+    size_t bytes_used_{};
+    size_t alloc_count_{};
+    size_t block_alloc_count_{};
+};
+
+// STL compatible allocator on top of SimpleArena, deallocate() does nothing
+template<typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(SimpleArena *p_arena) noexcept
+        : p_arena_(p_arena)
+    {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : p_arena_(other.p_arena_)
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(p_arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) noexcept
+    {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept
+    {
+        return p_arena_ == other.p_arena_;
+    }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept
+    {
+        return p_arena_ != other.p_arena_;
+    }
+
+private:
+    SimpleArena *p_arena_;
+
+    template<typename U> friend class ArenaAllocator;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}
+
+#endif // _SIMPLE_ARENA_HPP_
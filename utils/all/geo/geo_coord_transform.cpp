@@ -2,6 +2,8 @@
 #include <cmath>
 #include <cstdlib>
 #include "geo_utils.h"
+#include "geo_utils_batch.h"
+#include "geo_utils_kernels.h"
 
 
 using namespace std;
@@ -148,4 +150,78 @@ void mars_to_wgs84(double mgLat, double mgLon, double &wgLat, double &wgLon, int
 #endif
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch transforms
+//
+// the kernels of geo_utils_kernels.h, 4 points at a time by geo_utils_avx2.cpp if the CPU has
+// AVX2. the remainders, and all of them on the other CPUs, by the scalar functions above
+
+static const size_t TRANSFORM_MIN_BLOCK_SIZE = 4096;
+
+// converts the columns in blocks of threads, by lanes(lats, lngs, out_lats, out_lngs, n) of
+// batch::avx2 first, then by transform(lat, lng, out_lat, out_lng). with china_only, the points
+// outside china are copied
+template <typename Lanes, typename Transform>
+static void transform_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only, const Lanes& lanes, const Transform& transform)
+{
+    const bool has_avx2 = batch::CpuHasAvx2();
+    batch::ParForBlocks(n, [&](size_t begin, size_t end) {
+        size_t i = begin;
+        if (has_avx2) {
+            i += lanes(lats + begin, lngs + begin, out_lats + begin, out_lngs + begin,
+                end - begin, china_only);
+        }
+        for (; i < end; ++i) {
+            const double lat = lats[i], lng = lngs[i];
+            if (china_only && !is_inside_china(lat, lng)) {
+                out_lats[i] = lat;
+                out_lngs[i] = lng;
+                continue;
+            }
+            transform(lat, lng, out_lats[i], out_lngs[i]);
+        }
+    }, TRANSFORM_MIN_BLOCK_SIZE);
+}
+
+void wgs84_to_mars_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only)
+{
+    transform_batch(lats, lngs, out_lats, out_lngs, n, china_only, batch::avx2::Wgs84ToMars,
+        [](double lat, double lng, double& mars_lat, double& mars_lng) {
+        wgs84_to_mars(lat, lng, mars_lat, mars_lng);
+    });
+}
+
+void mars_to_wgs84_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, int loop_time, bool china_only)
+{
+    transform_batch(lats, lngs, out_lats, out_lngs, n, china_only,
+        [loop_time](const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+            size_t n, bool china_only) {
+        return batch::avx2::MarsToWgs84(lats, lngs, out_lats, out_lngs, n, loop_time,
+            china_only);
+    }, [loop_time](double mars_lat, double mars_lng, double& lat, double& lng) {
+        mars_to_wgs84(mars_lat, mars_lng, lat, lng, loop_time);
+    });
+}
+
+void bd09_to_wgs84_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only)
+{
+    transform_batch(lats, lngs, out_lats, out_lngs, n, china_only, batch::avx2::Bd09ToWgs84,
+        [](double bd_lat, double bd_lng, double& lat, double& lng) {
+        bd09_to_wgs84(bd_lat, bd_lng, lat, lng);
+    });
+}
+
+void wgs84_to_bd09_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only)
+{
+    transform_batch(lats, lngs, out_lats, out_lngs, n, china_only, batch::avx2::Wgs84ToBd09,
+        [](double lat, double lng, double& bd_lat, double& bd_lng) {
+        wgs84_to_bd09(lat, lng, bd_lat, bd_lng);
+    });
+}
+
 GEO_END_NAMESPACE
@@ -2,35 +2,30 @@
 #include <cmath>
 #include <cstdlib>
 #include <algorithm>
+#include <limits>
 #include <stdexcept>
 #include "geo_utils.h"
+#include "geo_utils_batch.h"
+#include "geo_utils_kernels.h"
 #include "common/common_utils.h"
-
-
-#ifndef M_PI
-#define M_PI       3.14159265358979323846
+#if defined(_MSC_VER)
+#include <intrin.h>
 #endif
 
-#define R_EARTH         6371004 // in meters
-#define R_EARTH_KM      6371.004 // in km
-#define EARTH_RADIUS    6378137
-#define POLAR_RADIUS    6356725
 
-#define LAT_METERS_PER_DEGREE   (111194.99646)  // R_EARTH * 2 * PI / 360
-
-#define COORDINATE_PRECISION    1000000.0
+#define R_EARTH_KM      6371.004 // in km
 
 
 GEO_BEGIN_NAMESPACE
 
 int FixedGeoPoint::Lat2FixedLat(double lat)
 {
-    return (int)(lat * COORDINATE_PRECISION);
+    return (int)std::lround(lat * COORDINATE_PRECISION);
 }
 
 int FixedGeoPoint::Lng2FixedLng(double lng)
 {
-    return (int)(lng * COORDINATE_PRECISION);
+    return (int)std::lround(lng * COORDINATE_PRECISION);
 }
 
 double FixedGeoPoint::FixedLat2Lat(int lat)
@@ -44,6 +39,33 @@ double FixedGeoPoint::FixedLng2Lng(int lng)
 }
 
 
+PolylineEncoder::PolylineEncoder(std::string& out, int precision)
+    : out_(out), factor_(::pow(10, precision))
+{}
+
+void PolylineEncoder::AddPoint(double lat, double lng)
+{
+    const long long fixed_lat = llround(lat * factor_);
+    const long long fixed_lng = llround(lng * factor_);
+    AppendValue(fixed_lat - last_lat_);
+    AppendValue(fixed_lng - last_lng_);
+    last_lat_ = fixed_lat;
+    last_lng_ = fixed_lng;
+}
+
+// 5 bits chunks from the lowest, with 0x20 as the continuation bit, offset by 63
+void PolylineEncoder::AppendValue(long long value)
+{
+    unsigned long long u = value < 0 ? ~((unsigned long long)value << 1) :
+        (unsigned long long)value << 1;
+    while (u >= 0x20) {
+        out_ += (char)((0x20 | (u & 0x1f)) + 63);
+        u >>= 5;
+    }
+    out_ += (char)(u + 63);
+}
+
+
 Bound::Bound(const std::string & bbox_str)
 {
     std::vector<std::string> bounds;
@@ -148,6 +170,81 @@ double distance_in_km(double lat1, double lng1, double lat2, double lng2)
     return s * R_EARTH_KM;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch distances
+//
+// the kernels of geo_utils_kernels.h, 4 pairs at a time by geo_utils_avx2.cpp if the CPU has
+// AVX2. the remainders, and all of them on the other CPUs, by the scalar functions
+
+static bool check_cpu_avx2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+    // FMA, OSXSAVE and AVX, then the AVX states enabled by the OS
+    const int ECX_FMA_OSXSAVE_AVX = (1 << 12) | (1 << 27) | (1 << 28);
+    __cpuid(regs, 1);
+    if ((regs[2] & ECX_FMA_OSXSAVE_AVX) != ECX_FMA_OSXSAVE_AVX || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // checks the OS support of the AVX states too
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+bool batch::CpuHasAvx2()
+{
+    static const bool has_avx2 = check_cpu_avx2();
+    return has_avx2;
+}
+
+void distance_in_meter_batch(const GeoPoint *a, const GeoPoint *b, double *out, size_t n)
+{
+    size_t i = batch::CpuHasAvx2() ? batch::avx2::DistanceInMeter(a, b, out, n) : 0;
+    for (; i < n; ++i) {
+        out[i] = distance_in_meter(a[i], b[i]);
+    }
+}
+
+void distance_in_meter_batch(const GeoPoint &from, const GeoPoint *to, double *out, size_t n)
+{
+    size_t i = batch::CpuHasAvx2() ? batch::avx2::DistanceInMeter(from, to, out, n) : 0;
+    for (; i < n; ++i) {
+        out[i] = distance_in_meter(from, to[i]);
+    }
+}
+
+double distance_in_meter_equirect(double lat1, double lng1, double lat2, double lng2)
+{
+    return EquirectKernel::Distance(lat1, lng1, lat2, lng2);
+}
+
+void distance_in_meter_equirect_batch(const GeoPoint *a, const GeoPoint *b, double *out,
+    size_t n)
+{
+    size_t i = batch::CpuHasAvx2() ? batch::avx2::DistanceInMeterEquirect(a, b, out, n) : 0;
+    for (; i < n; ++i) {
+        out[i] = distance_in_meter_equirect(a[i], b[i]);
+    }
+}
+
+void distance_in_meter_equirect_batch(const GeoPoint &from, const GeoPoint *to, double *out,
+    size_t n)
+{
+    size_t i = batch::CpuHasAvx2() ? batch::avx2::DistanceInMeterEquirect(from, to, out, n) : 0;
+    for (; i < n; ++i) {
+        out[i] = distance_in_meter_equirect(from, to[i]);
+    }
+}
+
 double distance_point_to_segment_square(double lat, double lng,
     double seg_from_lat, double seg_from_lng,
     double seg_to_lat, double seg_to_lng)
@@ -186,6 +283,28 @@ double distance_point_to_segment_square(double lat, double lng,
     return r1*r1 + r2*r2;
 }
 
+double distance_point_to_segment_square(const FixedGeoPoint& point,
+    const FixedGeoPoint& seg_from, const FixedGeoPoint& seg_to)
+{
+    // the differences are exact in int, at most 360 degrees
+    const double kx = fixed_lng_scale(point.lat);
+    const double ky = LAT_METERS_PER_DEGREE / COORDINATE_PRECISION;
+    return point_to_segment_square((seg_from.lng - point.lng) * kx,
+        (seg_from.lat - point.lat) * ky, (seg_to.lng - point.lng) * kx,
+        (seg_to.lat - point.lat) * ky);
+}
+
+void distance_point_to_segments_square(const FixedGeoPoint& point, const int *from_lats,
+    const int *from_lngs, const int *to_lats, const int *to_lngs, float *out, size_t n)
+{
+    size_t i = batch::CpuHasAvx2() ? batch::avx2::PointToSegmentsSquare(point, from_lats,
+        from_lngs, to_lats, to_lngs, out, n) : 0;
+    for (; i < n; ++i) {
+        out[i] = (float)distance_point_to_segment_square(point,
+            FixedGeoPoint(from_lats[i], from_lngs[i]), FixedGeoPoint(to_lats[i], to_lngs[i]));
+    }
+}
+
 double distance_point_to_segment(double lat, double lng,
     double seg_from_lat, double seg_from_lng,
     double seg_to_lat, double seg_to_lng)
@@ -277,44 +396,60 @@ void get_offset_segment(const GeoPoint &from, const GeoPoint &to, double offset,
     offset_to.lng = to.lng + offset_from.lng - from.lng;
 }
 
-void get_offset_linestr_simple(const std::vector<GeoPoint>& points, double offset,
-    std::vector<GeoPoint>& offset_points)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch offsets
+//
+// offset_shift() of geo_utils_kernels.h, 4 segments at a time by geo_utils_avx2.cpp if the CPU
+// has AVX2, the others by get_offset_segment()
+
+// offsets[i] if offsets is not null, offset_from can be null
+static void offset_segment_batch(const GeoPoint *from, const GeoPoint *to, const double *offsets,
+    double offset, GeoPoint *offset_from, GeoPoint *offset_to, size_t n)
 {
-    if (points.size() < 2) {
-        offset_points = points;
-        return;
-    }
-    if (offset < 0.001 && offset > -0.001) {
-        offset_points = points;
-        return;
+    size_t i = batch::CpuHasAvx2() ?
+        batch::avx2::OffsetSegments(from, to, offsets, offset, offset_from, offset_to, n) : 0;
+    for (; i < n; ++i) {
+        GeoPoint unused_from;
+        get_offset_segment(from[i], to[i], (offsets == nullptr) ? offset : offsets[i],
+            (offset_from != nullptr) ? offset_from[i] : unused_from, offset_to[i]);
     }
+}
 
-    offset_points.clear();
-    offset_points.reserve(points.size());
+void get_offset_segment_batch(const GeoPoint *from, const GeoPoint *to, double offset,
+    GeoPoint *offset_from, GeoPoint *offset_to, size_t n)
+{
+    offset_segment_batch(from, to, nullptr, offset, offset_from, offset_to, n);
+}
 
-    const auto size = points.size();
-    GeoPoint offset_from, offset_to;
-    get_offset_segment(points[0], points[1], offset, offset_from, offset_to);
-    offset_points.push_back(offset_from);
+void get_offset_segment_batch(const GeoPoint *from, const GeoPoint *to, const double *offsets,
+    GeoPoint *offset_from, GeoPoint *offset_to, size_t n)
+{
+    offset_segment_batch(from, to, offsets, 0, offset_from, offset_to, n);
+}
 
-    for (size_t i = 1; i < size; ++i) {
-        get_offset_segment(points[i - 1], points[i], offset, offset_from, offset_to);
-        offset_points.push_back(offset_to);
+size_t get_offset_linestr_simple(const GeoPoint *points, size_t n, double offset,
+    GeoPoint *offset_points)
+{
+    if (n < 2 || (offset < 0.001 && offset > -0.001)) {
+        std::copy(points, points + n, offset_points);
+        return n;
     }
-}
 
+    // the 1st point by the 1st segment, the others as the "to" points of their segments
+    offset_segment_batch(points, points + 1, nullptr, offset, offset_points, offset_points + 1, 1);
+    offset_segment_batch(points + 1, points + 2, nullptr, offset, nullptr, offset_points + 2,
+        n - 2);
+    return n;
+}
 
-static void AppendResultPoints(std::vector<GeoPoint>& result_points,
-    const geo::GeoPoint& point)
+void get_offset_linestr_simple(const std::vector<GeoPoint>& points, double offset,
+    std::vector<GeoPoint>& offset_points)
 {
-    if (result_points.empty()) {
-        result_points.emplace_back(point);
-    }
-    else if (geo::distance_in_meter(result_points.back(), point) > 2) {
-        result_points.emplace_back(point);
-    }
+    offset_points.resize(points.size());
+    get_offset_linestr_simple(points.data(), points.size(), offset, offset_points.data());
 }
 
+
 static geo::GeoPoint OffsetPoint(const geo::GeoPoint& point, double offset,
     double segment_heading)
 {
@@ -330,76 +465,73 @@ static geo::GeoPoint OffsetPoint(const geo::GeoPoint& point, double offset,
 }
 
 static const int SAME_HEADING_RANGE = 10;
-static void SimpleCompressRoutePoints(std::vector<GeoPoint>& points,
-    std::vector<bool>& one_ways, double min_len)
+
+// removes the short segments in the same direction as a neighbour, in place. the removals are
+// decided on the original points, the write index never passes the points still to be read.
+// OneWays is bool * or std::vector<bool>
+template <typename OneWays>
+static size_t CompressRoutePoints(GeoPoint *points, OneWays& one_ways, size_t n, double min_len)
 {
-    if (points.size() <= 1) {
-        return;
+    if (n <= 1) {
+        return n;
     }
-    const int size = (int)points.size();
-    std::vector<int> removals;
-    removals.reserve(size);
 
-    for (int i = 0; i < size - 1; ++i) {
+    size_t count = 0;
+    bool remove_cur = false; // by the previous segment
+    for (size_t i = 0; i + 1 < n; ++i) {
+        bool remove_next = false;
         const auto& pt0 = points[i];
         const auto& pt1 = points[i + 1];
-        double seg_len = geo::distance_in_meter(pt0, pt1);
-        if (seg_len >= min_len) {
-            continue;
-        }
-        int heading = (int)geo::get_heading_in_degree(pt0, pt1);
-        int heading_prev = (i == 0) ?
-            0 : (int)geo::get_heading_in_degree(points[i - 1], pt0);
-        int heading_next = (i < size - 2) ?
-            (int)geo::get_heading_in_degree(pt1, points[i + 2]) : 0;
-        if (i != 0) {
-            if (geo::in_same_direction(heading, heading_prev, SAME_HEADING_RANGE)) {
-                removals.push_back(i);
-                continue;
+        if (geo::distance_in_meter(pt0, pt1) < min_len) {
+            int heading = (int)geo::get_heading_in_degree(pt0, pt1);
+            if (i != 0 && geo::in_same_direction(heading,
+                (int)geo::get_heading_in_degree(points[i - 1], pt0), SAME_HEADING_RANGE)) {
+                remove_cur = true;
             }
-        }
-        if (i != size - 2) {
-            if (geo::in_same_direction(heading, heading_next, SAME_HEADING_RANGE)) {
-                removals.push_back(i + 1);
-                continue;
+            else if (i + 2 != n && geo::in_same_direction(heading,
+                (int)geo::get_heading_in_degree(pt1, points[i + 2]), SAME_HEADING_RANGE)) {
+                remove_next = true;
             }
         }
-    }
-
-    if (!removals.empty()) {
-        std::reverse(removals.begin(), removals.end());
-        for (auto i : removals) {
-            points.erase(points.begin() + i);
-            one_ways.erase(one_ways.begin() + i);
+        if (!remove_cur) {
+            points[count] = points[i];
+            one_ways[count] = (bool)one_ways[i];
+            ++count;
         }
+        remove_cur = remove_next;
     }
+    points[count] = points[n - 1];
+    one_ways[count] = (bool)one_ways[n - 1];
+    return count + 1;
 }
 
-void get_offset_linestr(std::vector<GeoPoint>& points, std::vector<bool>& one_ways,
-    double offset, std::vector<GeoPoint>& offset_points)
+// offset_points has room for 2 * n points
+template <typename OneWays>
+static size_t OffsetRoutePoints(const GeoPoint *points, const OneWays& one_ways, size_t n,
+    double offset, GeoPoint *offset_points)
 {
-    SimpleCompressRoutePoints(points, one_ways, 5);
-    if (points.size() <= 1 || (offset < 0.001 && offset > -0.001)) {
-        offset_points = points;
-        return;
-    }
-    if (one_ways.size() != points.size()) {
-        throw std::runtime_error("points number does not match one_way flags number");
+    if (n <= 1 || (offset < 0.001 && offset > -0.001)) {
+        std::copy(points, points + n, offset_points);
+        return n;
     }
 
+    size_t count = 0;
+    auto append_point = [offset_points, &count](const geo::GeoPoint& point) {
+        if (count == 0 || geo::distance_in_meter(offset_points[count - 1], point) > 2) {
+            offset_points[count++] = point;
+        }
+    };
+
     geo::GeoPoint point1, point2;
-    offset_points.clear();
-    const int size = (int)points.size();
-    offset_points.reserve(size);
+    const int size = (int)n;
 
     // offset for the 1st point
-    if (one_ways.front()) {
-        AppendResultPoints(offset_points, points.front());
+    if (one_ways[0]) {
+        append_point(points[0]);
     }
     else {
-        auto heading = geo::get_heading_in_degree(points.front(), points[1]);
-        auto point = OffsetPoint(points.front(), offset, heading);
-        AppendResultPoints(offset_points, point);
+        auto heading = geo::get_heading_in_degree(points[0], points[1]);
+        append_point(OffsetPoint(points[0], offset, heading));
     }
 
     for (int i = 1; i < size - 1; ++i) {
@@ -408,20 +540,20 @@ void get_offset_linestr(std::vector<GeoPoint>& points, std::vector<bool>& one_wa
         auto heading2 = geo::get_heading_in_degree(pt, next_pt);
 
         if (one_ways[i - 1] && one_ways[i]) {
-            AppendResultPoints(offset_points, pt);
+            append_point(pt);
         }
         else if (geo::in_same_direction((int)heading1, (int)heading2, SAME_HEADING_RANGE)) {
             // same direction case
             geo::get_offset_segment(pt, next_pt, one_ways[i] ? 0 : offset, point1, point2);
-            AppendResultPoints(offset_points, point1);
+            append_point(point1);
         }
         else if (std::abs((((int)heading1 - (int)heading2 + 360) % 360) - 180) < SAME_HEADING_RANGE) {
             // u-turn case
             point1 = OffsetPoint(pt, (one_ways[i - 1] ? 0 : offset), heading1);
-            AppendResultPoints(offset_points, point1);
+            append_point(point1);
 
             point2 = OffsetPoint(pt, (one_ways[i] ? 0 : offset), heading2);
-            AppendResultPoints(offset_points, point2);
+            append_point(point2);
         }
         else {
             geo::GeoPoint s1_from, s1_to, s2_from, s2_to;
@@ -430,26 +562,279 @@ void get_offset_linestr(std::vector<GeoPoint>& points, std::vector<bool>& one_wa
 
             if (true == geo::lines_intersection(s1_from, s1_to, s2_from, s2_to, point1)) {
                 // if have the intersection point
-                AppendResultPoints(offset_points, point1);
+                append_point(point1);
             }
             else {
-                AppendResultPoints(offset_points, s1_to);
-                AppendResultPoints(offset_points, s2_from);
+                append_point(s1_to);
+                append_point(s2_from);
             }
         }
     }
 
     // offset for the last point
-    if (one_ways.back()) {
-        AppendResultPoints(offset_points, points.back());
+    if (one_ways[size - 1]) {
+        append_point(points[size - 1]);
     }
     else {
-        auto heading = geo::get_heading_in_degree(points[size - 2], points.back());
-        auto point = OffsetPoint(points.back(), offset, heading);
-        AppendResultPoints(offset_points, point);
+        auto heading = geo::get_heading_in_degree(points[size - 2], points[size - 1]);
+        append_point(OffsetPoint(points[size - 1], offset, heading));
+    }
+    return count;
+}
+
+void get_offset_linestr(std::vector<GeoPoint>& points, std::vector<bool>& one_ways,
+    double offset, std::vector<GeoPoint>& offset_points)
+{
+    if (points.size() > 1 && one_ways.size() != points.size()) {
+        throw std::runtime_error("points number does not match one_way flags number");
+    }
+    const size_t n = CompressRoutePoints(points.data(), one_ways, points.size(), 5);
+    points.resize(n);
+    one_ways.resize(n);
+    offset_points.resize(2 * n);
+    offset_points.resize(OffsetRoutePoints(points.data(), one_ways, n, offset,
+        offset_points.data()));
+}
+
+size_t get_offset_linestr(GeoPoint *points, bool *one_ways, size_t n, double offset,
+    GeoPoint *offset_points)
+{
+    n = CompressRoutePoints(points, one_ways, n, 5);
+    return OffsetRoutePoints(points, one_ways, n, offset, offset_points);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Polyline simplification
+//
+// in meters of the local equirectangular projection at each chord or triangle
+
+double zoom_to_tolerance(double zoom, double lat, double pixels)
+{
+    return 2 * M_PI * R_EARTH * std::cos(rad(lat)) / (256 * std::pow(2.0, zoom)) * pixels;
+}
+
+struct LocalMeters
+{
+    explicit LocalMeters(const GeoPoint& origin)
+        : origin(origin), lng_scale(std::cos(rad(origin.lat)) * LAT_METERS_PER_DEGREE)
+    {}
+
+    double X(const GeoPoint& point) const
+    {
+        return (point.lng - origin.lng) * lng_scale;
+    }
+
+    double Y(const GeoPoint& point) const
+    {
+        return (point.lat - origin.lat) * LAT_METERS_PER_DEGREE;
+    }
+
+    const GeoPoint origin;
+    const double lng_scale;
+};
+
+// the removed points of (first, last) are marked with a NaN lat, compacted afterwards so that
+// the order of the parts does not matter: the smaller part is recursed into and the larger one
+// looped, the recursion depth is at most log2(n)
+static void DouglasPeucker(GeoPoint *points, size_t first, size_t last, double tolerance2)
+{
+    while (last > first + 1) {
+        const LocalMeters local(points[first]);
+        const double ax = local.X(points[first]), ay = local.Y(points[first]);
+        const double abx = local.X(points[last]) - ax, aby = local.Y(points[last]) - ay;
+        const double ab2 = abx * abx + aby * aby;
+        double max_d2 = -1;
+        size_t max_i = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            double apx = local.X(points[i]) - ax, apy = local.Y(points[i]) - ay;
+            const double t = (ab2 > 0) ?
+                std::min(std::max((apx * abx + apy * aby) / ab2, 0.0), 1.0) : 0.0;
+            apx -= abx * t;
+            apy -= aby * t;
+            const double d2 = apx * apx + apy * apy;
+            if (d2 > max_d2) {
+                max_d2 = d2;
+                max_i = i;
+            }
+        }
+        if (max_d2 <= tolerance2) {
+            for (size_t i = first + 1; i < last; ++i) {
+                points[i].lat = std::numeric_limits<double>::quiet_NaN();
+            }
+            return;
+        }
+        if (max_i - first < last - max_i) {
+            DouglasPeucker(points, first, max_i, tolerance2);
+            first = max_i;
+        }
+        else {
+            DouglasPeucker(points, max_i, last, tolerance2);
+            last = max_i;
+        }
     }
 }
 
+size_t simplify_douglas_peucker(GeoPoint *points, size_t n, double tolerance)
+{
+    if (n <= 2) {
+        return n;
+    }
+    DouglasPeucker(points, 0, n - 1, tolerance * tolerance);
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!std::isnan(points[i].lat)) {
+            points[count++] = points[i];
+        }
+    }
+    return count;
+}
+
+// a binary min-heap of the inner points by area, heap_pos[i] is the heap index of point i
+namespace {
+class AreaHeap
+{
+public:
+    explicit AreaHeap(SimplifyScratch& scratch)
+        : areas_(scratch.areas), heap_(scratch.heap), heap_pos_(scratch.heap_pos)
+    {}
+
+    void Build()
+    {
+        for (size_t i = heap_.size() / 2; i-- > 0;) {
+            SiftDown(i);
+        }
+    }
+    bool Empty() const
+    {
+        return heap_.empty();
+    }
+    unsigned int Top() const
+    {
+        return heap_[0];
+    }
+    void Pop()
+    {
+        Place(0, heap_.back());
+        heap_.pop_back();
+        if (!heap_.empty()) {
+            SiftDown(0);
+        }
+    }
+    void Update(unsigned int i, double area)
+    {
+        const bool smaller = area < areas_[i];
+        areas_[i] = area;
+        if (smaller) {
+            SiftUp(heap_pos_[i]);
+        }
+        else {
+            SiftDown(heap_pos_[i]);
+        }
+    }
+
+private:
+    void Place(size_t pos, unsigned int i)
+    {
+        heap_[pos] = i;
+        heap_pos_[i] = (unsigned int)pos;
+    }
+    void SiftUp(size_t pos)
+    {
+        const unsigned int i = heap_[pos];
+        while (pos > 0 && areas_[i] < areas_[heap_[(pos - 1) / 2]]) {
+            Place(pos, heap_[(pos - 1) / 2]);
+            pos = (pos - 1) / 2;
+        }
+        Place(pos, i);
+    }
+    void SiftDown(size_t pos)
+    {
+        const unsigned int i = heap_[pos];
+        const size_t size = heap_.size();
+        for (size_t child = 2 * pos + 1; child < size; child = 2 * pos + 1) {
+            if (child + 1 < size && areas_[heap_[child + 1]] < areas_[heap_[child]]) {
+                ++child;
+            }
+            if (!(areas_[heap_[child]] < areas_[i])) {
+                break;
+            }
+            Place(pos, heap_[child]);
+            pos = child;
+        }
+        Place(pos, i);
+    }
+
+    std::vector<double>& areas_;
+    std::vector<unsigned int>& heap_;
+    std::vector<unsigned int>& heap_pos_;
+};
+}
+
+size_t simplify_visvalingam(GeoPoint *points, size_t n, double tolerance,
+    SimplifyScratch& scratch)
+{
+    if (n <= 2) {
+        return n;
+    }
+    // twice the triangle area
+    auto area2 = [points](unsigned int a, unsigned int b, unsigned int c) {
+        const LocalMeters local(points[b]);
+        const double abx = local.X(points[b]) - local.X(points[a]);
+        const double aby = local.Y(points[b]) - local.Y(points[a]);
+        const double acx = local.X(points[c]) - local.X(points[a]);
+        const double acy = local.Y(points[c]) - local.Y(points[a]);
+        return std::fabs(abx * acy - aby * acx);
+    };
+    const double limit = 2 * tolerance * tolerance;
+
+    // the inner points linked by prev/next, all in the heap at first
+    auto &prev = scratch.prev, &next = scratch.next;
+    prev.resize(n);
+    next.resize(n);
+    scratch.areas.resize(n);
+    scratch.heap_pos.resize(n);
+    scratch.heap.clear();
+    for (unsigned int i = 1; i + 1 < n; ++i) {
+        prev[i] = i - 1;
+        next[i] = i + 1;
+        scratch.areas[i] = area2(i - 1, i, i + 1);
+        scratch.heap_pos[i] = (unsigned int)scratch.heap.size();
+        scratch.heap.push_back(i);
+    }
+    next[0] = 1;
+    prev[n - 1] = (unsigned int)n - 2;
+
+    AreaHeap heap(scratch);
+    heap.Build();
+    while (!heap.Empty() && scratch.areas[heap.Top()] < limit) {
+        const unsigned int i = heap.Top();
+        heap.Pop();
+        const unsigned int p = prev[i], nx = next[i];
+        next[p] = nx;
+        prev[nx] = p;
+        if (p > 0) {
+            heap.Update(p, area2(prev[p], p, nx));
+        }
+        if (nx + 1 < n) {
+            heap.Update(nx, area2(p, nx, next[nx]));
+        }
+    }
+
+    // the kept points in order, the write index never passes the read one
+    size_t count = 0;
+    for (size_t i = 0; i + 1 < n; i = next[i]) {
+        points[count++] = points[i];
+    }
+    points[count++] = points[n - 1];
+    return count;
+}
+
+size_t simplify_visvalingam(GeoPoint *points, size_t n, double tolerance)
+{
+    static thread_local SimplifyScratch scratch;
+    return simplify_visvalingam(points, n, tolerance, scratch);
+}
+
 // Get the projection point on the segment
 void get_projection_point(const GeoPoint& point,
     const GeoPoint& seg_from, const GeoPoint& seg_to,
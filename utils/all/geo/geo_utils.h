@@ -5,6 +5,8 @@
 #include <string>
 #include <memory>
 #include <tuple>
+#include <functional>
+#include <iosfwd>
 
 #define GEO_BEGIN_NAMESPACE namespace geo {
 #define GEO_END_NAMESPACE }
@@ -106,7 +108,11 @@ struct FixedGeoPoint
     explicit FixedGeoPoint(const GeoPoint& src)
         : lat(Lat2FixedLat(src.lat)), lng(Lng2FixedLng(src.lng))
     {}
+    explicit FixedGeoPoint(int lat, int lng)
+        : lat(lat), lng(lng)
+    {}
 
+    // microdegrees, rounded to the nearest
     static int Lat2FixedLat(double lat);
     static int Lng2FixedLng(double lng);
     static double FixedLat2Lat(int lat);
@@ -114,12 +120,12 @@ struct FixedGeoPoint
 
     bool operator==(const GeoPoint& src) const
     {
-        return src.lat == lat && src.lng == lng;
+        return Lat2FixedLat(src.lat) == lat && Lng2FixedLng(src.lng) == lng;
     }
 
     bool operator!=(const GeoPoint& src) const
     {
-        return src.lat != lat || src.lng != lng;
+        return !(*this == src);
     }
 
     GeoPoint ToGeoPoint() const
@@ -130,7 +136,7 @@ struct FixedGeoPoint
     void ToGeoPoint(GeoPoint& point) const
     {
         point.lat = FixedLat2Lat(lat);
-        point.lng = FixedLat2Lat(lng);
+        point.lng = FixedLng2Lng(lng);
     }
 
     int lat{};
@@ -231,6 +237,48 @@ struct Bound
 };
 
 
+// Google encoded polyline, the reverse of GeoObj_LineString::FromCompressedGeometry(). points
+// are appended to out one by one, no point array is needed
+class PolylineEncoder
+{
+public:
+    explicit PolylineEncoder(std::string& out, int precision = 5);
+
+    void AddPoint(double lat, double lng);
+    void AddPoint(const GeoPoint& point)
+    {
+        AddPoint(point.lat, point.lng);
+    }
+
+private:
+    void AppendValue(long long value);
+
+private:
+    std::string& out_;
+    double factor_;
+    long long last_lat_{};
+    long long last_lng_{};
+};
+
+// encoded polyline of *p_head (if not null), then of get_point(elem) for each elem of
+// [first, last). count is the number of the elements, only for reserving
+template <typename Iter, typename GetPoint>
+std::string encode_polyline(const GeoPoint *p_head, Iter first, Iter last, size_t count,
+    GetPoint get_point, int precision = 5)
+{
+    std::string encoded;
+    encoded.reserve((count + 1) * 8);
+    PolylineEncoder encoder(encoded, precision);
+    if (p_head) {
+        encoder.AddPoint(*p_head);
+    }
+    for (; first != last; ++first) {
+        encoder.AddPoint(get_point(*first));
+    }
+    return encoded;
+}
+
+
 static inline double DMS_TO_DEGREE(int d, int m, int s, int ms)
 {
     return (d + m / 60.0 + (s + ms / 1000.0) / 3600.0);
@@ -246,6 +294,20 @@ static inline double distance_in_meter(const GeoPoint &p1, const GeoPoint &p2)
 }
 double distance_in_meter_same_lat(double lat, double lng1, double lng2);
 double distance_in_meter_same_lng(double lat1, double lat2);
+// out[i] = distance_in_meter(a[i], b[i]), vectorized with AVX2 if the CPU has it
+void distance_in_meter_batch(const GeoPoint *a, const GeoPoint *b, double *out, size_t n);
+// out[i] = distance_in_meter(from, to[i])
+void distance_in_meter_batch(const GeoPoint &from, const GeoPoint *to, double *out, size_t n);
+// local equirectangular approximation, only for short distances, see geo_utils.cpp for the error
+double distance_in_meter_equirect(double lat1, double lng1, double lat2, double lng2);
+static inline double distance_in_meter_equirect(const GeoPoint &p1, const GeoPoint &p2)
+{
+    return distance_in_meter_equirect(p1.lat, p1.lng, p2.lat, p2.lng);
+}
+void distance_in_meter_equirect_batch(const GeoPoint *a, const GeoPoint *b, double *out,
+    size_t n);
+void distance_in_meter_equirect_batch(const GeoPoint &from, const GeoPoint *to, double *out,
+    size_t n);
 double distance_in_km(double lat1, double lng1, double lat2, double lng2);
 static inline double distance_in_km(const GeoPoint &p1, const GeoPoint &p2)
 {
@@ -269,6 +331,17 @@ static inline double distance_point_to_segment_square(const GeoPoint& point,
     return distance_point_to_segment_square(point.lat, point.lng, seg_from.lat, seg_from.lng,
         seg_to.lat, seg_to.lng);
 }
+// fixed point versions. the nearest point of the segment is searched in meters, not in degrees,
+// so the distance is never more than the one of the double version above plus the rounding of
+// the coordinates to microdegrees (below 0.2 meter), except for the segments shorter than about
+// 0.35 meter, which the double version does not project on. for the filtering of nearby segments
+double distance_point_to_segment_square(const FixedGeoPoint& point,
+    const FixedGeoPoint& seg_from, const FixedGeoPoint& seg_to);
+// out[i] = the distance above from point to segment i in float, the segments in struct of arrays.
+// 8 segments at a time with AVX2 if the CPU has it. pass the same arrays as from and to for
+// point distances
+void distance_point_to_segments_square(const FixedGeoPoint& point, const int *from_lats,
+    const int *from_lngs, const int *to_lats, const int *to_lngs, float *out, size_t n);
 
 void get_lat_lng_degree(double lat0, double lng0, double distance, double angle, double &lat, double &lng);
 void get_lat_lng_rad(double lat0, double lng0, double distance, double angle_rad, double &lat, double &lng);
@@ -294,6 +367,40 @@ void get_offset_linestr_simple(const std::vector<GeoPoint>& points, double offse
 // note: offset_points may have different point count from points
 void get_offset_linestr(std::vector<GeoPoint>& points, std::vector<bool>& one_ways,
     double offset, std::vector<GeoPoint>& offset_points);
+// offset_from[i] and offset_to[i] as get_offset_segment(from[i], to[i]), vectorized with AVX2
+// if the CPU has it. the outputs do not overlap the inputs
+void get_offset_segment_batch(const GeoPoint *from, const GeoPoint *to, double offset,
+    GeoPoint *offset_from, GeoPoint *offset_to, size_t n);
+// offsets[i] for segment i, e.g. by Segment::AdjustOffset()
+void get_offset_segment_batch(const GeoPoint *from, const GeoPoint *to, const double *offsets,
+    GeoPoint *offset_from, GeoPoint *offset_to, size_t n);
+// the versions on caller buffers without allocations, return the offset_points count.
+// offset_points has room for n points, and does not overlap points
+size_t get_offset_linestr_simple(const GeoPoint *points, size_t n, double offset,
+    GeoPoint *offset_points);
+// points and one_ways are compressed in place first. offset_points has room for 2 * n points
+size_t get_offset_linestr(GeoPoint *points, bool *one_ways, size_t n, double offset,
+    GeoPoint *offset_points);
+
+// the simplification tolerance in meters: the size of pixels at the zoom level, 256 pixel tiles
+double zoom_to_tolerance(double zoom, double lat, double pixels = 1.0);
+// in place, return the kept point count. the first and last points are kept.
+// Douglas-Peucker: the points within tolerance meters of the simplified line are removed.
+// no allocations, the recursion depth is O(log n)
+size_t simplify_douglas_peucker(GeoPoint *points, size_t n, double tolerance);
+// the working memory of simplify_visvalingam(), about 24 bytes per point. kept by the caller
+// between calls, which do not allocate once it has grown to the largest n
+struct SimplifyScratch
+{
+    std::vector<double> areas;
+    std::vector<unsigned int> prev, next, heap, heap_pos;
+};
+// Visvalingam-Whyatt: the point of the smallest triangle area is removed and the areas of its
+// neighbours updated, until all the areas are at least tolerance^2 square meters. O(n log n).
+// the version without scratch uses one per thread
+size_t simplify_visvalingam(GeoPoint *points, size_t n, double tolerance,
+    SimplifyScratch& scratch);
+size_t simplify_visvalingam(GeoPoint *points, size_t n, double tolerance);
 
 void get_projection_point(const GeoPoint& point, const GeoPoint& seg_from, const GeoPoint& seg_to,
     GeoPoint& projection_point);
@@ -364,7 +471,23 @@ void bd09_to_wgs84(double bd_lat, double bd_lng, double &lat, double &lng);
 // WGS84 to BD-09
 void wgs84_to_bd09(double lat, double lng, double &bd_lat, double &bd_lng);
 
+// column (SoA) versions of the above for n points, out_lats and out_lngs may be lats and lngs.
+// vectorized with AVX2 if the CPU has it, large arrays are split to threads. the results are
+// within 1e-12 degree of the scalar functions. with china_only, the points outside china
+// (is_inside_china()) are copied unchanged
+void wgs84_to_mars_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only = false);
+void mars_to_wgs84_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, int loop_time = 2, bool china_only = false);
+void bd09_to_wgs84_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only = false);
+void wgs84_to_bd09_batch(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only = false);
+
 bool is_inside_china(double lat, double lng);
+// inside[i] = is_inside_china(lats[i], lngs[i]), returns the number of points inside
+size_t is_inside_china_batch(const double *lats, const double *lngs, size_t n,
+    std::vector<bool>& inside);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Polygon
@@ -596,6 +719,140 @@ private:
     friend class MultiPolygonHelper;
 };
 
+// a polygon prepared for many point in polygon tests, e.g. geofencing GPS points. the edges of
+// all the rings are bucketed into latitude bands, a test only checks the edges crossing the band
+// of the point, with the even-odd rule of point_in_polygon(). built directly from the vertexes,
+// and immutable after the construction, so it can be shared by threads
+class PreparedPolygon
+{
+public:
+    PreparedPolygon()
+    {}
+    explicit PreparedPolygon(const SimplePolygon& polygon);
+    explicit PreparedPolygon(const Polygon& polygon);
+    explicit PreparedPolygon(const MultiPolygon& mpoly);
+
+    bool Empty() const
+    {
+        return edges_.empty();
+    }
+
+    // the bounding box, false if empty
+    bool GetBound(double& minlat, double& minlng, double& maxlat, double& maxlng) const
+    {
+        minlat = minlat_;
+        minlng = minlng_;
+        maxlat = maxlat_;
+        maxlng = maxlng_;
+        return !edges_.empty();
+    }
+
+    bool Within(double lat, double lng) const;
+    bool Within(const GeoPoint& point) const
+    {
+        return Within(point.lat, point.lng);
+    }
+
+    // within[i] = Within(points[i]), returns the number of points within
+    size_t Within(const GeoPoint *points, size_t n, std::vector<bool>& within) const;
+    size_t Within(const std::vector<GeoPoint>& points, std::vector<bool>& within) const
+    {
+        return Within(points.data(), points.size(), within);
+    }
+
+private:
+    // lng on the edge at lat is lng1 + (lat - lat1) * slope
+    struct Edge
+    {
+        double lat1, lng1, lat2, slope;
+    };
+
+    void AddRing(const SimplePolygon& ring);
+    void BuildBands();
+
+    int BandOf(double lat) const
+    {
+        int band = (int)((lat - minlat_) * bands_per_degree_);
+        return band < 0 ? 0 : (band >= band_count_ ? band_count_ - 1 : band);
+    }
+
+private:
+    double minlat_{}, minlng_{}, maxlat_{}, maxlng_{};
+    bool has_bound_{}; // the bounding box is set from the first vertex
+    double bands_per_degree_{};
+    int band_count_{};
+    std::vector<Edge> edges_; // by band, an edge is copied into all the bands it crosses
+    std::vector<unsigned int> band_begins_; // [band] => the first edge, band_count_ + 1 items
+};
+
+// the polygons containing a point, e.g. the districts of GPS points. a packed R-tree over the
+// bounding boxes of the polygons finds the candidates, which are tested with PreparedPolygon.
+// the polygons are added, then Build() is called once, after which the index is immutable and
+// can be shared by threads
+class PolygonSetIndex
+{
+public:
+    // returns the polygon ID, the index in the order added
+    int AddPolygon(const SimplePolygon& polygon);
+    int AddPolygon(const Polygon& polygon);
+    int AddPolygon(const MultiPolygon& mpoly);
+    void Build();
+
+    size_t Size() const
+    {
+        return polygons_.size();
+    }
+
+    // the smallest ID of the polygons containing the point, -1 if none
+    int FindPolygon(double lat, double lng) const;
+    int FindPolygon(const GeoPoint& point) const
+    {
+        return FindPolygon(point.lat, point.lng);
+    }
+    // the IDs of all the polygons containing the point, ascending. returns the count
+    size_t FindPolygons(double lat, double lng, std::vector<int>& ids) const;
+
+    // ids[i] = FindPolygon(points[i]), large batches are split to threads
+    void FindPolygon(const GeoPoint *points, size_t n, std::vector<int>& ids) const;
+    void FindPolygon(const std::vector<GeoPoint>& points, std::vector<int>& ids) const
+    {
+        FindPolygon(points.data(), points.size(), ids);
+    }
+
+private:
+    struct Box
+    {
+        double minlat, minlng, maxlat, maxlng;
+
+        bool Contains(double lat, double lng) const
+        {
+            return lat >= minlat && lat <= maxlat && lng >= minlng && lng <= maxlng;
+        }
+    };
+    // a tree node, its children are [begin, end) of the level below, or of items_ at level 0
+    struct Node
+    {
+        Box box;
+        unsigned int begin, end;
+    };
+    struct Item
+    {
+        Box box;
+        int id;
+    };
+
+    int AddPrepared(PreparedPolygon&& polygon);
+
+    // calls found(id) for each polygon containing the point, until it returns false
+    template <typename Found>
+    void Search(double lat, double lng, const Found& found) const;
+
+private:
+    std::vector<PreparedPolygon> polygons_; // by ID
+    std::vector<Item> items_;
+    std::vector<std::vector<Node>> levels_; // levels_.back() is the root level
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // GeoJSON utils
 
@@ -741,6 +998,11 @@ public:
         points_.push_back(GeoPoint(lat, lng));
     }
 
+    const std::vector<GeoPoint>& GetPoints() const
+    {
+        return points_;
+    }
+
     virtual std::string ToWKT() const;
     virtual bool IntersectWithBound(const Bound& bound) const
     {
@@ -768,6 +1030,7 @@ public:
     {}
 
     bool FromCompressedGeometry(const std::string& compressed_geometry, int precision);
+    std::string ToCompressedGeometry(int precision) const;
 
     void AddPoint(const GeoPoint& point)
     {
@@ -835,6 +1098,17 @@ public:
         : GeoObj(GEOTYPE_MULTILINESTRING), linestrings_(linestrings)
     {}
 
+    void AddLineString(const GeoObj_LineString& linestring)
+    {
+        linestrings_.push_back(linestring);
+    }
+
+    const std::vector<GeoObj_LineString>& GetLineStrings() const
+    {
+        return linestrings_;
+    }
+
+    virtual std::string ToWKT() const;
     virtual bool IntersectWithBound(const Bound& bound) const
     {
         for (auto& line : linestrings_) {
@@ -987,6 +1261,111 @@ protected:
     friend class GeoJsonHelper;
 };
 
+// writes a GeoJSON FeatureCollection to the stream feature by feature, without building the
+// objects first. the memory used is constant whatever the count of the features. usage:
+//  writer.BeginLineString(); writer.AddPoint(...) ...; writer.AddProp(...) ...; writer.EndFeature();
+// props can be added only after the geometry of the feature
+class GeoJsonStreamWriter
+{
+public:
+    explicit GeoJsonStreamWriter(std::ostream& out);
+    ~GeoJsonStreamWriter();
+
+    void BeginPoint(const GeoPoint& point);
+    void BeginLineString();
+    void AddPoint(const GeoPoint& point);
+    void EndFeature();
+
+    // LineString feature, EndFeature() still needed after its props
+    void BeginLineString(const GeoPoint& from, const GeoPoint& to);
+    void BeginLineString(const std::vector<GeoPoint>& points);
+
+    void AddProp(const char* name, const std::string& value);
+    void AddProp(const char* name, const char* value);
+    void AddProp(const char* name, int value);
+    void AddProp(const char* name, long long value);
+    void AddProp(const char* name, unsigned long long value);
+    void AddProp(const char* name, double value);
+    void AddProp(const char* name, bool value);
+
+    // ends the FeatureCollection and flushes, false if writing to the stream failed
+    bool Close();
+    size_t FeatureCount() const
+    {
+        return feature_count_;
+    }
+
+private:
+    enum STATE
+    {
+        STATE_NONE,     // between features
+        STATE_GEOMETRY, // adding points to the geometry
+        STATE_PROPS,    // adding props
+    };
+
+    void BeginFeature(const char* geo_type);
+    void EndGeometry();
+    void AppendCoord(const GeoPoint& point);
+    void AppendKey(const char* name);
+    void AppendString(const char* str, size_t len);
+    void FlushIfFull();
+
+private:
+    std::ostream& out_;
+    std::string buff_;
+    size_t feature_count_{};
+    STATE state_{ STATE_NONE };
+    bool has_point_{};
+    bool has_prop_{};
+    bool closed_{};
+};
+
+// reads a GeoJSON FeatureCollection feature by feature with the rapidjson SAX reader. each
+// feature is built and passed to the callback before the next one is parsed, so the memory used
+// depends on the biggest feature, not on the size of the input. a single Feature or a bare
+// geometry is read as one feature. prop values which are objects or arrays are kept as their
+// json text. features with null or unsupported geometry (GeometryCollection) are skipped
+class GeoJsonStreamReader
+{
+public:
+    // returns false to stop reading, the Read* functions then return true
+    typedef std::function<bool(const GeoObjPtr& p_obj)> FeatureCallback;
+
+    bool ReadFile(const std::string& json_pathname, const FeatureCallback& callback);
+    bool ReadStream(std::istream& in, const FeatureCallback& callback);
+    bool ReadString(const std::string& json, const FeatureCallback& callback);
+
+    // parses in a worker thread while the callback runs in the calling thread, at most
+    // queue_size parsed features are waiting for the callback
+    bool ReadFilePipelined(const std::string& json_pathname, size_t queue_size,
+        const FeatureCallback& callback);
+
+    // features passed to the callback
+    size_t FeatureCount() const
+    {
+        return feature_count_;
+    }
+
+    size_t SkippedCount() const
+    {
+        return skipped_count_;
+    }
+
+    const std::string& GetErrorString() const
+    {
+        return err_str_;
+    }
+
+private:
+    template <typename Stream>
+    bool Read(Stream& stream, const FeatureCallback& callback);
+
+private:
+    size_t feature_count_{};
+    size_t skipped_count_{};
+    std::string err_str_;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 GEO_END_NAMESPACE
@@ -0,0 +1,247 @@
+// the AVX2 loops of the batch functions. this is the only file compiled with AVX2 (/arch:AVX2,
+// -mavx2 -mfma), the callers check batch::CpuHasAvx2() first. only the lane types of the kernels
+// are instantiated here: a scalar instantiation compiled with AVX2 could be the one picked by the
+// linker for the other files
+
+#include "geo_utils_kernels.h"
+
+
+GEO_BEGIN_NAMESPACE
+namespace batch {
+namespace avx2 {
+
+#if defined(__AVX2__)
+static_assert(sizeof(GeoPoint) == 2 * sizeof(double), "GeoPoint is loaded as 2 doubles");
+
+// 4 points at p as lats and lngs, in the lane order 0, 2, 1, 3
+static inline void load_points(const GeoPoint *p, Double4 &lats, Double4 &lngs)
+{
+    const __m256d v0 = _mm256_loadu_pd(&p[0].lat);
+    const __m256d v1 = _mm256_loadu_pd(&p[2].lat);
+    lats = Double4(_mm256_unpacklo_pd(v0, v1));
+    lngs = Double4(_mm256_unpackhi_pd(v0, v1));
+}
+
+// stores the lanes in the order 0, 2, 1, 3 of load_points()
+static inline void store_distances(double *out, const Double4 &d)
+{
+    _mm256_storeu_pd(out, _mm256_permute4x64_pd(d.v, 0xD8));
+}
+
+// the reverse of load_points()
+static inline void store_points(GeoPoint *p, const Double4 &lats, const Double4 &lngs)
+{
+    _mm256_storeu_pd(&p[0].lat, _mm256_unpacklo_pd(lats.v, lngs.v));
+    _mm256_storeu_pd(&p[2].lat, _mm256_unpackhi_pd(lats.v, lngs.v));
+}
+
+template <typename Kernel>
+static size_t distance_lanes(const GeoPoint *a, const GeoPoint *b, double *out, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        Double4 lats1, lngs1, lats2, lngs2;
+        load_points(a + i, lats1, lngs1);
+        load_points(b + i, lats2, lngs2);
+        store_distances(out + i, Kernel::Distance(lats1, lngs1, lats2, lngs2));
+    }
+    return i;
+}
+
+template <typename Kernel>
+static size_t distance_lanes(const GeoPoint &from, const GeoPoint *to, double *out, size_t n)
+{
+    size_t i = 0;
+    const Double4 lat1(from.lat), lng1(from.lng);
+    for (; i + 4 <= n; i += 4) {
+        Double4 lats2, lngs2;
+        load_points(to + i, lats2, lngs2);
+        store_distances(out + i, Kernel::Distance(lat1, lng1, lats2, lngs2));
+    }
+    return i;
+}
+
+size_t DistanceInMeter(const GeoPoint *a, const GeoPoint *b, double *out, size_t n)
+{
+    return distance_lanes<HaversineKernel>(a, b, out, n);
+}
+
+size_t DistanceInMeter(const GeoPoint &from, const GeoPoint *to, double *out, size_t n)
+{
+    return distance_lanes<HaversineKernel>(from, to, out, n);
+}
+
+size_t DistanceInMeterEquirect(const GeoPoint *a, const GeoPoint *b, double *out, size_t n)
+{
+    return distance_lanes<EquirectKernel>(a, b, out, n);
+}
+
+size_t DistanceInMeterEquirect(const GeoPoint &from, const GeoPoint *to, double *out, size_t n)
+{
+    return distance_lanes<EquirectKernel>(from, to, out, n);
+}
+
+size_t PointToSegmentsSquare(const FixedGeoPoint& point, const int *from_lats,
+    const int *from_lngs, const int *to_lats, const int *to_lngs, float *out, size_t n)
+{
+    const Float8 kx((float)fixed_lng_scale(point.lat));
+    const Float8 ky((float)(LAT_METERS_PER_DEGREE / COORDINATE_PRECISION));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        point_to_segment_square(Float8::LoadRelative(from_lngs + i, point.lng) * kx,
+            Float8::LoadRelative(from_lats + i, point.lat) * ky,
+            Float8::LoadRelative(to_lngs + i, point.lng) * kx,
+            Float8::LoadRelative(to_lats + i, point.lat) * ky).Store(out + i);
+    }
+    return i;
+}
+
+size_t OffsetSegments(const GeoPoint *from, const GeoPoint *to, const double *offsets,
+    double offset, GeoPoint *offset_from, GeoPoint *offset_to, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        Double4 lats1, lngs1, lats2, lngs2, d_lat, d_lng;
+        load_points(from + i, lats1, lngs1);
+        load_points(to + i, lats2, lngs2);
+        const Double4 offsets4 = (offsets == nullptr) ? Double4(offset) :
+            Double4(_mm256_permute4x64_pd(_mm256_loadu_pd(offsets + i), 0xD8));
+        offset_shift(lats1, lngs1, lats2, lngs2, offsets4, d_lat, d_lng);
+        if (offset_from != nullptr) {
+            store_points(offset_from + i, lats1 + d_lat, lngs1 + d_lng);
+        }
+        store_points(offset_to + i, lats2 + d_lat, lngs2 + d_lng);
+    }
+    return i;
+}
+
+// converts 4 points at a time by transform(lat, lng, out_lat, out_lng), the points outside china
+// are copied with china_only
+template <typename Transform>
+static size_t transform_lanes(const double *lats, const double *lngs, double *out_lats,
+    double *out_lngs, size_t n, bool china_only, const Transform& transform)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const Double4 lat = Double4::Load(lats + i);
+        const Double4 lng = Double4::Load(lngs + i);
+        long long inside[4] = { -1, -1, -1, -1 };
+        if (china_only) {
+            for (int k = 0; k < 4; ++k) {
+                inside[k] = is_inside_china(lats[i + k], lngs[i + k]) ? -1 : 0;
+            }
+        }
+        const Mask4 mask(_mm256_castsi256_pd(_mm256_set_epi64x(inside[3], inside[2],
+            inside[1], inside[0])));
+        if (mask.None()) {
+            lat.Store(out_lats + i);
+            lng.Store(out_lngs + i);
+            continue;
+        }
+
+        Double4 out_lat, out_lng;
+        transform(lat, lng, out_lat, out_lng);
+        Select(mask, out_lat, lat).Store(out_lats + i);
+        Select(mask, out_lng, lng).Store(out_lngs + i);
+    }
+    return i;
+}
+
+size_t Wgs84ToMars(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, bool china_only)
+{
+    return transform_lanes(lats, lngs, out_lats, out_lngs, n, china_only,
+        [](const Double4& lat, const Double4& lng, Double4& mars_lat, Double4& mars_lng) {
+        wgs84_to_mars_kernel(lat, lng, mars_lat, mars_lng);
+    });
+}
+
+size_t MarsToWgs84(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, int loop_time, bool china_only)
+{
+    return transform_lanes(lats, lngs, out_lats, out_lngs, n, china_only,
+        [loop_time](const Double4& mars_lat, const Double4& mars_lng, Double4& lat,
+            Double4& lng) {
+        mars_to_wgs84_kernel(mars_lat, mars_lng, lat, lng, loop_time);
+    });
+}
+
+size_t Bd09ToWgs84(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, bool china_only)
+{
+    return transform_lanes(lats, lngs, out_lats, out_lngs, n, china_only,
+        [](const Double4& bd_lat, const Double4& bd_lng, Double4& lat, Double4& lng) {
+        Double4 mars_lat, mars_lng;
+        bd09_to_gcj02(bd_lat, bd_lng, mars_lat, mars_lng);
+        mars_to_wgs84_kernel(mars_lat, mars_lng, lat, lng, 2);
+    });
+}
+
+size_t Wgs84ToBd09(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, bool china_only)
+{
+    return transform_lanes(lats, lngs, out_lats, out_lngs, n, china_only,
+        [](const Double4& lat, const Double4& lng, Double4& bd_lat, Double4& bd_lng) {
+        Double4 mars_lat, mars_lng;
+        wgs84_to_mars_kernel(lat, lng, mars_lat, mars_lng);
+        gcj02_to_bd09(mars_lat, mars_lng, bd_lat, bd_lng);
+    });
+}
+
+#else
+size_t DistanceInMeter(const GeoPoint *, const GeoPoint *, double *, size_t)
+{
+    return 0;
+}
+
+size_t DistanceInMeter(const GeoPoint &, const GeoPoint *, double *, size_t)
+{
+    return 0;
+}
+
+size_t DistanceInMeterEquirect(const GeoPoint *, const GeoPoint *, double *, size_t)
+{
+    return 0;
+}
+
+size_t DistanceInMeterEquirect(const GeoPoint &, const GeoPoint *, double *, size_t)
+{
+    return 0;
+}
+
+size_t PointToSegmentsSquare(const FixedGeoPoint&, const int *, const int *, const int *,
+    const int *, float *, size_t)
+{
+    return 0;
+}
+
+size_t OffsetSegments(const GeoPoint *, const GeoPoint *, const double *, double, GeoPoint *,
+    GeoPoint *, size_t)
+{
+    return 0;
+}
+
+size_t Wgs84ToMars(const double *, const double *, double *, double *, size_t, bool)
+{
+    return 0;
+}
+
+size_t MarsToWgs84(const double *, const double *, double *, double *, size_t, int, bool)
+{
+    return 0;
+}
+
+size_t Bd09ToWgs84(const double *, const double *, double *, double *, size_t, bool)
+{
+    return 0;
+}
+
+size_t Wgs84ToBd09(const double *, const double *, double *, double *, size_t, bool)
+{
+    return 0;
+}
+#endif
+
+} // namespace avx2
+} // namespace batch
+GEO_END_NAMESPACE
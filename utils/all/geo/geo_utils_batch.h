@@ -0,0 +1,398 @@
+#ifndef _GEO_UTILS_BATCH_H_
+#define _GEO_UTILS_BATCH_H_
+
+// internal header, only for the geo*.cpp files with batch functions, and for ParForBlocks()
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "geo_utils.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace geo {
+namespace batch {
+
+// the kernels of the batch functions are templates written once for T = double, one value at a
+// time, and for T = Double4, 4 lanes with AVX2 when compiled for it (/arch:AVX2, -mavx2), the
+// float kernels likewise for T = float and T = Float8, 8 lanes. sin and cos are polynomials
+// (cephes coefficients) without branches, the same in the lanes and in the scalar kernels.
+// only geo_utils_avx2.cpp is compiled with AVX2, the batch functions call it if CpuHasAvx2()
+
+// true if the CPU and the OS support AVX2 and FMA, checked once
+bool CpuHasAvx2();
+
+// the loops of geo_utils_avx2.cpp, call them only if CpuHasAvx2(). they do the leading whole
+// groups of lanes and return the count done, the caller does the rest. they do nothing and
+// return 0 if geo_utils_avx2.cpp is compiled without AVX2
+namespace avx2 {
+size_t DistanceInMeter(const GeoPoint *a, const GeoPoint *b, double *out, size_t n);
+size_t DistanceInMeter(const GeoPoint &from, const GeoPoint *to, double *out, size_t n);
+size_t DistanceInMeterEquirect(const GeoPoint *a, const GeoPoint *b, double *out, size_t n);
+size_t DistanceInMeterEquirect(const GeoPoint &from, const GeoPoint *to, double *out, size_t n);
+size_t PointToSegmentsSquare(const FixedGeoPoint& point, const int *from_lats,
+    const int *from_lngs, const int *to_lats, const int *to_lngs, float *out, size_t n);
+size_t OffsetSegments(const GeoPoint *from, const GeoPoint *to, const double *offsets,
+    double offset, GeoPoint *offset_from, GeoPoint *offset_to, size_t n);
+// the points outside china are copied with china_only
+size_t Wgs84ToMars(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, bool china_only);
+size_t MarsToWgs84(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, int loop_time, bool china_only);
+size_t Bd09ToWgs84(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, bool china_only);
+size_t Wgs84ToBd09(const double *lats, const double *lngs, double *out_lats, double *out_lngs,
+    size_t n, bool china_only);
+} // namespace avx2
+
+static const double PI = 3.14159265358979323846;
+// pi/2 in three parts, for the range reduction
+static const double PIO2_1 = 1.57079632673412561417e+00;
+static const double PIO2_2 = 6.07710050630396597660e-11;
+static const double PIO2_3 = 2.02226624879595063154e-21;
+static const double TWO_OVER_PI = 6.36619772367581382433e-01;
+
+// sin(r) = r + r * z * P(z), cos(r) = 1 - z / 2 + z * z * Q(z), z = r * r, |r| <= pi/4
+static const double SIN_P[] = { 1.58962301576546568060e-10, -2.50507477628578072866e-8,
+    2.75573136213857245213e-6, -1.98412698295895385996e-4, 8.33333333332211858878e-3,
+    -1.66666666666666307295e-1 };
+static const double COS_Q[] = { -1.13585365213876817300e-11, 2.08757008419747316778e-9,
+    -2.75573141792967388112e-7, 2.48015872888517045348e-5, -1.38888888888730564116e-3,
+    4.16666666666665929218e-2 };
+
+// the lane operations of T = double
+inline double Sqrt(double x)
+{
+    return std::sqrt(x);
+}
+
+inline double Floor(double x)
+{
+    return std::floor(x);
+}
+
+inline double Abs(double x)
+{
+    return std::fabs(x);
+}
+
+inline double Min(double a, double b)
+{
+    return a < b ? a : b;
+}
+
+inline double Max(double a, double b)
+{
+    return a > b ? a : b;
+}
+
+inline float Min(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+inline float Max(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+inline bool LessEqual(double a, double b)
+{
+    return a <= b;
+}
+
+inline double Select(bool cond, double a, double b)
+{
+    return cond ? a : b;
+}
+
+inline double NegateIf(bool cond, double v)
+{
+    return cond ? -v : v;
+}
+
+// bit of the integral q
+inline bool QuadrantBit(double q, int bit)
+{
+    return (((long long)q >> bit) & 1) != 0;
+}
+
+#if defined(__AVX2__)
+struct Double4
+{
+    Double4()
+    {}
+    Double4(double x) : v(_mm256_set1_pd(x))
+    {}
+    explicit Double4(__m256d v) : v(v)
+    {}
+
+    static Double4 Load(const double *p)
+    {
+        return Double4(_mm256_loadu_pd(p));
+    }
+
+    void Store(double *p) const
+    {
+        _mm256_storeu_pd(p, v);
+    }
+
+    __m256d v;
+};
+
+// all bits set in the lanes where it is true
+struct Mask4
+{
+    explicit Mask4(__m256d m) : m(m)
+    {}
+
+    bool None() const
+    {
+        return _mm256_movemask_pd(m) == 0;
+    }
+
+    __m256d m;
+};
+
+inline Double4 operator+(const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_add_pd(a.v, b.v));
+}
+
+inline Double4 operator-(const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_sub_pd(a.v, b.v));
+}
+
+inline Double4 operator*(const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_mul_pd(a.v, b.v));
+}
+
+inline Double4 operator/(const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_div_pd(a.v, b.v));
+}
+
+inline Double4 operator-(const Double4& a)
+{
+    return Double4(_mm256_xor_pd(a.v, _mm256_set1_pd(-0.0)));
+}
+
+inline Double4 Sqrt(const Double4& x)
+{
+    return Double4(_mm256_sqrt_pd(x.v));
+}
+
+inline Double4 Floor(const Double4& x)
+{
+    return Double4(_mm256_floor_pd(x.v));
+}
+
+inline Double4 Abs(const Double4& x)
+{
+    return Double4(_mm256_andnot_pd(_mm256_set1_pd(-0.0), x.v));
+}
+
+inline Double4 Min(const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_min_pd(a.v, b.v));
+}
+
+inline Double4 Max(const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_max_pd(a.v, b.v));
+}
+
+inline Mask4 LessEqual(const Double4& a, const Double4& b)
+{
+    return Mask4(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ));
+}
+
+inline Double4 Select(const Mask4& cond, const Double4& a, const Double4& b)
+{
+    return Double4(_mm256_blendv_pd(b.v, a.v, cond.m));
+}
+
+inline Double4 NegateIf(const Mask4& cond, const Double4& v)
+{
+    return Double4(_mm256_xor_pd(v.v, _mm256_and_pd(cond.m, _mm256_set1_pd(-0.0))));
+}
+
+inline Mask4 QuadrantBit(const Double4& q, int bit)
+{
+    const __m256i q_int = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(q.v));
+    const __m256i bit_mask = _mm256_set1_epi64x(1LL << bit);
+    return Mask4(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(q_int, bit_mask),
+        bit_mask)));
+}
+
+// 8 float lanes, for the kernels where float is precise enough
+struct Float8
+{
+    Float8()
+    {}
+    Float8(float x) : v(_mm256_set1_ps(x))
+    {}
+    explicit Float8(__m256 v) : v(v)
+    {}
+
+    // p[0..7] - origin, converted to float
+    static Float8 LoadRelative(const int *p, int origin)
+    {
+        const __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        return Float8(_mm256_cvtepi32_ps(_mm256_sub_epi32(i, _mm256_set1_epi32(origin))));
+    }
+
+    void Store(float *p) const
+    {
+        _mm256_storeu_ps(p, v);
+    }
+
+    __m256 v;
+};
+
+inline Float8 operator+(const Float8& a, const Float8& b)
+{
+    return Float8(_mm256_add_ps(a.v, b.v));
+}
+
+inline Float8 operator-(const Float8& a, const Float8& b)
+{
+    return Float8(_mm256_sub_ps(a.v, b.v));
+}
+
+inline Float8 operator*(const Float8& a, const Float8& b)
+{
+    return Float8(_mm256_mul_ps(a.v, b.v));
+}
+
+inline Float8 operator/(const Float8& a, const Float8& b)
+{
+    return Float8(_mm256_div_ps(a.v, b.v));
+}
+
+inline Float8 operator-(const Float8& a)
+{
+    return Float8(_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)));
+}
+
+inline Float8 Min(const Float8& a, const Float8& b)
+{
+    return Float8(_mm256_min_ps(a.v, b.v));
+}
+
+inline Float8 Max(const Float8& a, const Float8& b)
+{
+    return Float8(_mm256_max_ps(a.v, b.v));
+}
+#endif
+
+template <typename T>
+inline T Poly(const T& z, const double *c, int n)
+{
+    T v = c[0];
+    for (int i = 1; i < n; ++i) {
+        v = v * z + c[i];
+    }
+    return v;
+}
+
+// sin(r + q * pi/2) and cos(r + q * pi/2), |r| <= pi/4, q integral
+template <typename T>
+inline void SinCosQuadrant(const T& r, const T& q, T *p_sin, T *p_cos)
+{
+    const T z = r * r;
+    const T s = r + r * z * Poly(z, SIN_P, 6);
+    const T c = T(1.0) - z * 0.5 + z * z * Poly(z, COS_Q, 6);
+    const auto q_odd = QuadrantBit(q, 0);
+    if (p_sin != nullptr) {
+        *p_sin = NegateIf(QuadrantBit(q, 1), Select(q_odd, c, s));
+    }
+    if (p_cos != nullptr) {
+        *p_cos = NegateIf(QuadrantBit(q + 1.0, 1), Select(q_odd, s, c));
+    }
+}
+
+// x = r + q * pi/2, |r| <= pi/4, for |x| up to about 1e9
+template <typename T>
+inline T ReduceHalfPi(const T& x, T& q)
+{
+    q = Floor(x * TWO_OVER_PI + 0.5);
+    return ((x - q * PIO2_1) - q * PIO2_2) - q * PIO2_3;
+}
+
+template <typename T>
+inline T Sin(const T& x)
+{
+    T q, s;
+    SinCosQuadrant(ReduceHalfPi(x, q), q, &s, (T *)nullptr);
+    return s;
+}
+
+template <typename T>
+inline T Cos(const T& x)
+{
+    T q, c;
+    SinCosQuadrant(ReduceHalfPi(x, q), q, (T *)nullptr, &c);
+    return c;
+}
+
+// sin(pi * t) and cos(pi * t), the reduction t - q / 2 is exact
+template <typename T>
+inline void SinCosPi(const T& t, T *p_sin, T *p_cos)
+{
+    const T q = Floor(t * 2.0 + 0.5);
+    SinCosQuadrant((t - q * 0.5) * PI, q, p_sin, p_cos);
+}
+
+template <typename T>
+inline T SinPi(const T& t)
+{
+    T s;
+    SinCosPi(t, &s, (T *)nullptr);
+    return s;
+}
+
+template <typename T>
+inline T CosPi(const T& t)
+{
+    T c;
+    SinCosPi(t, (T *)nullptr, &c);
+    return c;
+}
+
+// splits [0, count) into blocks and calls work(begin, end) for each block in its own thread.
+// small counts are done in the calling thread
+inline void ParForBlocks(size_t count, const std::function<void(size_t, size_t)>& work,
+    size_t min_block_size = 1024)
+{
+    size_t task_count = std::min((size_t)std::thread::hardware_concurrency(), (size_t)8);
+    task_count = std::min(task_count, count / min_block_size);
+    if (task_count < 2) {
+        if (count > 0) {
+            work(0, count);
+        }
+        return;
+    }
+
+    const size_t block_size = count / task_count;
+    std::vector<std::shared_ptr<std::thread>> threads(task_count - 1);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i] = std::make_shared<std::thread>(work, block_size * i, block_size * (i + 1));
+    }
+    work(block_size * threads.size(), count);
+    for (auto& p_thread : threads) {
+        p_thread->join();
+    }
+}
+
+} // namespace batch
+} // namespace geo
+
+#endif // _GEO_UTILS_BATCH_H_
@@ -6,12 +6,25 @@
 #include "geo_utils.h"
 #include <string>
 #include <fstream>
+#include <ostream>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <istream>
 #include "common/common_utils.h"
 #include "common/rapidjson_helper.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/prettywriter.h"
 #include "rapidjson/stringbuffer.h"
+#include "rapidjson/reader.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/istreamwrapper.h"
+#include "rapidjson/error/en.h"
 
 
 GEO_BEGIN_NAMESPACE
@@ -68,6 +81,9 @@ public:
             auto& v = std::get<1>(prop);
 
             switch (std::get<2>(prop)) {
+            case JSON_NULL_TYPE:
+                ok = util::WritePairNull(writer, k);
+                break;
             case JSON_BOOL_TYPE:
                 ok = util::WritePairBool(writer, k, (v == "1"));
                 break;
@@ -339,6 +355,112 @@ public:
         if (ok) ok = writer.EndObject();
         return ok;
     }
+    static void SetProps(GeoObj& obj, std::vector<JsonProp>& props)
+    {
+        obj.props_.swap(props);
+        props.clear();
+    }
+
+    // builds the geometry read by GeoJsonStreamReader. points are all the positions in order,
+    // pos_level is the nesting level of the positions in the coordinates, ends2 and ends3 the
+    // ends in points of the arrays at level 2 and 3, ring_ends2 the ends in ends3 of the arrays
+    // at level 2. nullptr if the coordinates do not fit the type
+    static GeoObjPtr MakeGeoObj(const std::string& type, int pos_level,
+        std::vector<GeoPoint>& points, const std::vector<size_t>& ends2,
+        const std::vector<size_t>& ring_ends2, const std::vector<size_t>& ends3)
+    {
+        GEO_TYPE geo_type = GEOTYPE_INVALID;
+        int expected_level = 0;
+        if (type == "Point") {
+            geo_type = GEOTYPE_POINT;
+            expected_level = 1;
+        }
+        else if (type == "MultiPoint" || type == "LineString") {
+            geo_type = (type[0] == 'M') ? GEOTYPE_MULTIPOINT : GEOTYPE_LINESTRING;
+            expected_level = 2;
+        }
+        else if (type == "MultiLineString" || type == "Polygon") {
+            geo_type = (type[0] == 'M') ? GEOTYPE_MULTILINESTRING : GEOTYPE_POLYGON;
+            expected_level = 3;
+        }
+        else if (type == "MultiPolygon") {
+            geo_type = GEOTYPE_MULTIPOLYGON;
+            expected_level = 4;
+        }
+        if (geo_type == GEOTYPE_INVALID || (!points.empty() && pos_level != expected_level)) {
+            return nullptr;
+        }
+
+        switch (geo_type) {
+        case GEOTYPE_POINT:
+            if (points.size() != 1) {
+                return nullptr;
+            }
+            return std::make_shared<GeoObj_Point>(points[0]);
+        case GEOTYPE_MULTIPOINT: {
+            auto p_obj = std::make_shared<GeoObj_MultiPoint>();
+            p_obj->points_.swap(points);
+            return p_obj;
+        }
+        case GEOTYPE_LINESTRING: {
+            auto p_obj = std::make_shared<GeoObj_LineString>();
+            p_obj->points_.swap(points);
+            return p_obj;
+        }
+        case GEOTYPE_MULTILINESTRING: {
+            auto p_obj = std::make_shared<GeoObj_MultiLineString>();
+            p_obj->linestrings_.reserve(ends2.size());
+            size_t begin = 0;
+            for (size_t end : ends2) {
+                p_obj->linestrings_.emplace_back(
+                    std::vector<GeoPoint>(points.begin() + begin, points.begin() + end));
+                begin = end;
+            }
+            return p_obj;
+        }
+        case GEOTYPE_POLYGON: {
+            if (ends2.empty()) {
+                return nullptr;
+            }
+            auto p_obj = std::make_shared<GeoObj_Polygon>();
+            AssignRings(points, ends2, 0, ends2.size(), p_obj->polygon_);
+            return p_obj;
+        }
+        case GEOTYPE_MULTIPOLYGON: {
+            auto p_obj = std::make_shared<GeoObj_MultiPolygon>();
+            auto& polygons = p_obj->multi_polygon_.polygons;
+            polygons.reserve(ring_ends2.size());
+            size_t ring_begin = 0;
+            for (size_t ring_end : ring_ends2) {
+                if (ring_end == ring_begin) {
+                    return nullptr;
+                }
+                polygons.emplace_back();
+                AssignRings(points, ends3, ring_begin, ring_end, polygons.back());
+                ring_begin = ring_end;
+            }
+            return p_obj;
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    // rings [ring_begin, ring_end) of ring_ends, the first one is the outer ring
+    static void AssignRings(const std::vector<GeoPoint>& points,
+        const std::vector<size_t>& ring_ends, size_t ring_begin, size_t ring_end, Polygon& polygon)
+    {
+        size_t begin = (ring_begin == 0) ? 0 : ring_ends[ring_begin - 1];
+        for (size_t i = ring_begin; i < ring_end; ++i) {
+            if (i != ring_begin) {
+                polygon.inner_polygons.emplace_back();
+            }
+            SimplePolygon& ring = (i == ring_begin) ? polygon.outer_polygon :
+                polygon.inner_polygons.back();
+            ring.vertexes.assign(points.begin() + begin, points.begin() + ring_ends[i]);
+            begin = ring_ends[i];
+        }
+    }
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -507,6 +629,13 @@ bool GeoObj_LineString::FromCompressedGeometry(const std::string& encoded, int i
     return true;
 }
 
+// encode route geometry, the reverse of FromCompressedGeometry()
+std::string GeoObj_LineString::ToCompressedGeometry(int precision) const
+{
+    return encode_polyline(nullptr, this->points_.begin(), this->points_.end(),
+        this->points_.size(), [](const GeoPoint& point) { return point; }, precision);
+}
+
 bool GeoObj_LineString::FromWKT(const std::string& wkt)
 {
     const std::string prefix("LINESTRING");
@@ -559,6 +688,24 @@ std::string GeoObj_LineString::ToWKT() const
     return wkt;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// class GeoObj_MultiLineString
+
+std::string GeoObj_MultiLineString::ToWKT() const
+{
+    std::string wkt("MULTILINESTRING(");
+    for (size_t i = 0; i < linestrings_.size(); ++i) {
+        // "LINESTRING(...)" without the type name
+        wkt += linestrings_[i].ToWKT().substr(10);
+        if (i < linestrings_.size() - 1) {
+            wkt += ',';
+        }
+    }
+
+    wkt += ')';
+    return wkt;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // class GeoJSON
 
@@ -600,4 +747,775 @@ bool GeoJSON::ToJsonFile(const std::string& json_pathname, bool pretty/* = false
     return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// class GeoJsonStreamWriter
+
+#define GEOJSON_STREAM_BUFF_SIZE   (64 * 1024)
+
+GeoJsonStreamWriter::GeoJsonStreamWriter(std::ostream& out)
+    : out_(out)
+{
+    buff_.reserve(GEOJSON_STREAM_BUFF_SIZE + 1024);
+    buff_ = "{\"type\":\"FeatureCollection\",\"features\":[";
+}
+
+GeoJsonStreamWriter::~GeoJsonStreamWriter()
+{
+    Close();
+}
+
+void GeoJsonStreamWriter::BeginFeature(const char* geo_type)
+{
+    if (state_ != STATE_NONE) {
+        EndFeature();
+    }
+    if (feature_count_++ > 0) {
+        buff_ += ',';
+    }
+    buff_ += "{\"type\":\"Feature\",\"geometry\":{\"type\":\"";
+    buff_ += geo_type;
+    buff_ += "\",\"coordinates\":";
+    has_point_ = false;
+    has_prop_ = false;
+}
+
+void GeoJsonStreamWriter::BeginPoint(const GeoPoint& point)
+{
+    BeginFeature("Point");
+    AppendCoord(point);
+    buff_ += '}';
+    state_ = STATE_PROPS;
+}
+
+void GeoJsonStreamWriter::BeginLineString()
+{
+    BeginFeature("LineString");
+    buff_ += '[';
+    state_ = STATE_GEOMETRY;
+}
+
+void GeoJsonStreamWriter::BeginLineString(const GeoPoint& from, const GeoPoint& to)
+{
+    BeginLineString();
+    AddPoint(from);
+    AddPoint(to);
+}
+
+void GeoJsonStreamWriter::BeginLineString(const std::vector<GeoPoint>& points)
+{
+    BeginLineString();
+    for (const auto& point : points) {
+        AddPoint(point);
+    }
+}
+
+void GeoJsonStreamWriter::AddPoint(const GeoPoint& point)
+{
+    if (state_ != STATE_GEOMETRY) {
+        return;
+    }
+    if (has_point_) {
+        buff_ += ',';
+    }
+    AppendCoord(point);
+    has_point_ = true;
+}
+
+void GeoJsonStreamWriter::EndGeometry()
+{
+    if (state_ == STATE_GEOMETRY) {
+        buff_ += "]}";
+        state_ = STATE_PROPS;
+    }
+}
+
+void GeoJsonStreamWriter::EndFeature()
+{
+    if (state_ == STATE_NONE) {
+        return;
+    }
+    EndGeometry();
+    // a feature without props still has the member (RFC 7946, 3.2)
+    buff_ += has_prop_ ? "}" : ",\"properties\":null";
+    buff_ += '}';
+    state_ = STATE_NONE;
+    FlushIfFull();
+}
+
+// the same precision as GeoJsonHelper::ToPrecision6, without the trailing zeros
+static void AppendDegree(std::string& buff, double degree)
+{
+    char str[32];
+    int len = snprintf(str, sizeof(str), "%.6f", degree);
+    if (len <= 0 || len >= (int)sizeof(str)) {
+        buff += '0';
+        return;
+    }
+    while (str[len - 1] == '0') {
+        --len;
+    }
+    if (str[len - 1] == '.') {
+        --len;
+    }
+    buff.append(str, len);
+}
+
+void GeoJsonStreamWriter::AppendCoord(const GeoPoint& point)
+{
+    buff_ += '[';
+    AppendDegree(buff_, point.lng);
+    buff_ += ',';
+    AppendDegree(buff_, point.lat);
+    buff_ += ']';
+}
+
+void GeoJsonStreamWriter::AppendKey(const char* name)
+{
+    EndGeometry();
+    if (state_ != STATE_PROPS) {
+        return;
+    }
+    buff_ += has_prop_ ? "," : ",\"properties\":{";
+    has_prop_ = true;
+    AppendString(name, strlen(name));
+    buff_ += ':';
+}
+
+void GeoJsonStreamWriter::AppendString(const char* str, size_t len)
+{
+    static const char HEX[] = "0123456789abcdef";
+    buff_ += '"';
+    for (size_t i = 0; i < len; ++i) {
+        const unsigned char c = (unsigned char)str[i];
+        switch (c) {
+        case '"':
+            buff_ += "\\\"";
+            break;
+        case '\\':
+            buff_ += "\\\\";
+            break;
+        case '\n':
+            buff_ += "\\n";
+            break;
+        case '\r':
+            buff_ += "\\r";
+            break;
+        case '\t':
+            buff_ += "\\t";
+            break;
+        default:
+            if (c < 0x20) {
+                buff_ += "\\u00";
+                buff_ += HEX[c >> 4];
+                buff_ += HEX[c & 0xF];
+            }
+            else {
+                buff_ += (char)c;
+            }
+            break;
+        }
+    }
+    buff_ += '"';
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, const std::string& value)
+{
+    AppendKey(name);
+    AppendString(value.c_str(), value.length());
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, const char* value)
+{
+    AppendKey(name);
+    AppendString(value, strlen(value));
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, int value)
+{
+    AppendKey(name);
+    buff_ += std::to_string(value);
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, long long value)
+{
+    AppendKey(name);
+    buff_ += std::to_string(value);
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, unsigned long long value)
+{
+    AppendKey(name);
+    buff_ += std::to_string(value);
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, double value)
+{
+    AppendKey(name);
+    if (!std::isfinite(value)) {
+        buff_ += "null";
+        return;
+    }
+    char buff[32];
+    snprintf(buff, sizeof(buff), "%.15g", value);
+    buff_ += buff;
+}
+
+void GeoJsonStreamWriter::AddProp(const char* name, bool value)
+{
+    AppendKey(name);
+    buff_ += value ? "true" : "false";
+}
+
+void GeoJsonStreamWriter::FlushIfFull()
+{
+    if (buff_.size() >= GEOJSON_STREAM_BUFF_SIZE) {
+        out_.write(buff_.data(), buff_.size());
+        buff_.clear();
+    }
+}
+
+bool GeoJsonStreamWriter::Close()
+{
+    if (!closed_) {
+        closed_ = true;
+        EndFeature();
+        buff_ += "]}";
+        out_.write(buff_.data(), buff_.size());
+        out_.flush();
+        buff_.clear();
+        buff_.shrink_to_fit();
+    }
+    return out_.good();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// class GeoJsonStreamReader
+
+// the SAX handler of GeoJsonStreamReader. depth_ is the count of the open objects and arrays,
+// the other *_depth_ are the depths of the objects and arrays being read, -1 if not open
+class GeoJsonReadHandler
+    : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, GeoJsonReadHandler>
+{
+public:
+    explicit GeoJsonReadHandler(const GeoJsonStreamReader::FeatureCallback& callback)
+        : callback_(callback), nested_writer_(nested_buff_)
+    {
+        points_.reserve(1024);
+    }
+
+    bool Null()
+    {
+        if (skip_depth_ >= 0) return true;
+        if (nested_depth_ >= 0) return nested_writer_.Null();
+        if (coords_depth_ >= 0) {
+            invalid_ = true;
+        }
+        else if (depth_ == props_depth_) {
+            props_.push_back(std::make_tuple(key_, std::string(), JSON_NULL_TYPE));
+        }
+        return true;
+    }
+
+    bool Bool(bool b)
+    {
+        if (skip_depth_ >= 0) return true;
+        if (nested_depth_ >= 0) return nested_writer_.Bool(b);
+        if (coords_depth_ >= 0) {
+            invalid_ = true;
+        }
+        else if (depth_ == props_depth_) {
+            props_.push_back(std::make_tuple(key_, std::string(b ? "1" : "0"), JSON_BOOL_TYPE));
+        }
+        return true;
+    }
+
+    bool Int(int i)
+    {
+        return Number(i, JSON_INT_TYPE);
+    }
+
+    bool Uint(unsigned u)
+    {
+        return Number(u, JSON_INT_TYPE);
+    }
+
+    bool Int64(int64_t i)
+    {
+        return Number(i, JSON_INT_TYPE);
+    }
+
+    bool Uint64(uint64_t u)
+    {
+        return Number(u, JSON_INT_TYPE);
+    }
+
+    bool Double(double d)
+    {
+        return Number(d, JSON_REAL_TYPE);
+    }
+
+    bool String(const char* str, rapidjson::SizeType len, bool)
+    {
+        if (skip_depth_ >= 0) return true;
+        if (nested_depth_ >= 0) return nested_writer_.String(str, len);
+        if (coords_depth_ >= 0) {
+            invalid_ = true;
+        }
+        else if (depth_ == props_depth_) {
+            props_.push_back(std::make_tuple(key_, std::string(str, len), JSON_STR_TYPE));
+        }
+        else if (key_ == "type") {
+            if (depth_ == geometry_depth_) {
+                geometry_type_.assign(str, len);
+            }
+            else if (depth_ == feature_depth_) {
+                feature_type_.assign(str, len);
+            }
+        }
+        return true;
+    }
+
+    bool Key(const char* str, rapidjson::SizeType len, bool)
+    {
+        if (skip_depth_ >= 0) return true;
+        if (nested_depth_ >= 0) return nested_writer_.Key(str, len);
+        key_.assign(str, len);
+        return true;
+    }
+
+    bool StartObject()
+    {
+        return Start(true);
+    }
+
+    bool EndObject(rapidjson::SizeType)
+    {
+        return End(true);
+    }
+
+    bool StartArray()
+    {
+        return Start(false);
+    }
+
+    bool EndArray(rapidjson::SizeType)
+    {
+        return End(false);
+    }
+
+    size_t FeatureCount() const
+    {
+        return feature_count_;
+    }
+
+    size_t SkippedCount() const
+    {
+        return skipped_count_;
+    }
+
+    // the parsing was terminated by the callback
+    bool Stopped() const
+    {
+        return stopped_;
+    }
+
+    const std::string& GetErrorString() const
+    {
+        return err_str_;
+    }
+
+private:
+    template <typename T>
+    bool Number(T v, int json_type)
+    {
+        if (skip_depth_ >= 0) return true;
+        if (nested_depth_ >= 0) return WriteNested(v);
+        if (coords_depth_ >= 0) {
+            AddCoord(static_cast<double>(v));
+        }
+        else if (depth_ == props_depth_) {
+            props_.push_back(std::make_tuple(key_, NumberToString(v), json_type));
+        }
+        return true;
+    }
+
+    bool WriteNested(int v)
+    {
+        return nested_writer_.Int(v);
+    }
+
+    bool WriteNested(unsigned v)
+    {
+        return nested_writer_.Uint(v);
+    }
+
+    bool WriteNested(int64_t v)
+    {
+        return nested_writer_.Int64(v);
+    }
+
+    bool WriteNested(uint64_t v)
+    {
+        return nested_writer_.Uint64(v);
+    }
+
+    bool WriteNested(double v)
+    {
+        return nested_writer_.Double(v);
+    }
+
+    template <typename T>
+    std::string NumberToString(T v)
+    {
+        return std::to_string(v);
+    }
+
+    // the shortest text which reads back as the same double
+    std::string NumberToString(double v)
+    {
+        nested_buff_.Clear();
+        nested_writer_.Reset(nested_buff_);
+        nested_writer_.Double(v);
+        return std::string(nested_buff_.GetString(), nested_buff_.GetSize());
+    }
+
+    void AddCoord(double v)
+    {
+        const int level = depth_ - coords_depth_ + 1;
+        if (pos_level_ < 0) {
+            pos_level_ = level;
+        }
+        else if (level != pos_level_) {
+            invalid_ = true;
+        }
+        if (pos_count_ < 2) {
+            pos_[pos_count_] = v;
+        }
+        ++pos_count_;
+    }
+
+    // coordinates are [lng, lat] or [lng, lat, alt]
+    void EndCoordsArray()
+    {
+        const int level = depth_ - coords_depth_ + 1;
+        if (pos_count_ > 0) {
+            if (pos_count_ < 2) {
+                invalid_ = true;
+            }
+            else {
+                points_.push_back(GeoPoint(pos_[1], pos_[0]));
+            }
+            pos_count_ = 0;
+        }
+        else if (level == 2) {
+            ends2_.push_back(points_.size());
+            ring_ends2_.push_back(ends3_.size());
+        }
+        else if (level == 3) {
+            ends3_.push_back(points_.size());
+        }
+    }
+
+    bool Start(bool is_object)
+    {
+        ++depth_;
+        if (skip_depth_ >= 0) return true;
+        if (nested_depth_ >= 0) {
+            return is_object ? nested_writer_.StartObject() : nested_writer_.StartArray();
+        }
+        if (coords_depth_ >= 0) {
+            // objects, or arrays in positions or deeper than MultiPolygon
+            if (is_object || pos_count_ > 0 || depth_ - coords_depth_ + 1 > 4) {
+                invalid_ = true;
+                skip_depth_ = depth_;
+            }
+            return true;
+        }
+
+        const int parent_depth = depth_ - 1;
+        if (parent_depth == props_depth_) {
+            // kept as the json text
+            nested_key_ = key_;
+            nested_depth_ = depth_;
+            nested_buff_.Clear();
+            nested_writer_.Reset(nested_buff_);
+            return is_object ? nested_writer_.StartObject() : nested_writer_.StartArray();
+        }
+        if (!is_object && key_ == "coordinates" &&
+            (parent_depth == geometry_depth_ || parent_depth == feature_depth_)) {
+            coords_depth_ = depth_;
+        }
+        else if (is_object && parent_depth == feature_depth_ && key_ == "geometry") {
+            geometry_depth_ = depth_;
+        }
+        else if (is_object && parent_depth == feature_depth_ && key_ == "properties") {
+            props_depth_ = depth_;
+        }
+        else if (!is_object && parent_depth == feature_depth_ && feature_depth_ == 1 &&
+            key_ == "features") {
+            features_depth_ = depth_;
+            in_collection_ = true;
+        }
+        else if (is_object && (parent_depth == 0 || parent_depth == features_depth_)) {
+            BeginFeature();
+        }
+        else if (parent_depth == 0) {
+            err_str_ = "the GeoJSON root is not an object";
+            return false;
+        }
+        else {
+            skip_depth_ = depth_;
+        }
+        return true;
+    }
+
+    bool End(bool is_object)
+    {
+        bool ok = true;
+        if (skip_depth_ >= 0) {
+            if (depth_ == skip_depth_) {
+                skip_depth_ = -1;
+            }
+        }
+        else if (nested_depth_ >= 0) {
+            ok = is_object ? nested_writer_.EndObject() : nested_writer_.EndArray();
+            if (depth_ == nested_depth_) {
+                props_.push_back(std::make_tuple(nested_key_,
+                    std::string(nested_buff_.GetString(), nested_buff_.GetSize()), JSON_STR_TYPE));
+                nested_depth_ = -1;
+            }
+        }
+        else if (coords_depth_ >= 0) {
+            EndCoordsArray();
+            if (depth_ == coords_depth_) {
+                coords_depth_ = -1;
+            }
+        }
+        else if (depth_ == props_depth_) {
+            props_depth_ = -1;
+        }
+        else if (depth_ == geometry_depth_) {
+            geometry_depth_ = -1;
+        }
+        else if (depth_ == features_depth_) {
+            features_depth_ = -1;
+        }
+        else if (depth_ == feature_depth_) {
+            ok = EndFeature();
+        }
+        --depth_;
+        return ok;
+    }
+
+    void BeginFeature()
+    {
+        feature_depth_ = depth_;
+        geometry_depth_ = -1;
+        coords_depth_ = -1;
+        props_depth_ = -1;
+        feature_type_.clear();
+        geometry_type_.clear();
+        points_.clear();
+        ends2_.clear();
+        ring_ends2_.clear();
+        ends3_.clear();
+        props_.clear();
+        pos_level_ = -1;
+        pos_count_ = 0;
+        invalid_ = false;
+    }
+
+    bool EndFeature()
+    {
+        // back to the FeatureCollection
+        const bool is_root = (feature_depth_ == 1);
+        feature_depth_ = is_root ? -1 : 1;
+        if (is_root && in_collection_) {
+            return true;
+        }
+
+        // a Feature, or a bare geometry
+        const std::string& type = (feature_type_ == "Feature") ? geometry_type_ : feature_type_;
+        GeoObjPtr p_obj;
+        if (!invalid_) {
+            p_obj = GeoJsonHelper::MakeGeoObj(type, pos_level_, points_, ends2_, ring_ends2_,
+                ends3_);
+        }
+        if (p_obj == nullptr) {
+            ++skipped_count_;
+            return true;
+        }
+
+        GeoJsonHelper::SetProps(*p_obj, props_);
+        ++feature_count_;
+        if (!callback_(p_obj)) {
+            stopped_ = true;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const GeoJsonStreamReader::FeatureCallback& callback_;
+    int depth_{};
+    int feature_depth_{ -1 };
+    int features_depth_{ -1 };
+    int geometry_depth_{ -1 };
+    int coords_depth_{ -1 };
+    int props_depth_{ -1 };
+    int nested_depth_{ -1 };
+    int skip_depth_{ -1 };
+    bool in_collection_{};
+    std::string key_;
+
+    // the feature being read
+    std::string feature_type_;
+    std::string geometry_type_;
+    std::vector<GeoPoint> points_;
+    std::vector<size_t> ends2_;
+    std::vector<size_t> ring_ends2_;
+    std::vector<size_t> ends3_;
+    std::vector<JsonProp> props_;
+    double pos_[2]{};
+    int pos_count_{};
+    int pos_level_{ -1 };
+    bool invalid_{};
+
+    std::string nested_key_;
+    rapidjson::StringBuffer nested_buff_;
+    rapidjson::Writer<rapidjson::StringBuffer> nested_writer_;
+
+    size_t feature_count_{};
+    size_t skipped_count_{};
+    bool stopped_{};
+    std::string err_str_;
+};
+
+template <typename Stream>
+bool GeoJsonStreamReader::Read(Stream& stream, const FeatureCallback& callback)
+{
+    feature_count_ = 0;
+    skipped_count_ = 0;
+    err_str_.clear();
+
+    GeoJsonReadHandler handler(callback);
+    rapidjson::Reader reader;
+    const rapidjson::ParseResult result = reader.Parse(stream, handler);
+    feature_count_ = handler.FeatureCount();
+    skipped_count_ = handler.SkippedCount();
+    if (result.IsError() && !handler.Stopped()) {
+        err_str_ = "GeoJSON parse error at offset " + std::to_string(result.Offset()) + ": " +
+            (handler.GetErrorString().empty() ? rapidjson::GetParseError_En(result.Code()) :
+            handler.GetErrorString());
+        return false;
+    }
+    return true;
+}
+
+bool GeoJsonStreamReader::ReadFile(const std::string& json_pathname,
+    const FeatureCallback& callback)
+{
+    FILE *fp = fopen(json_pathname.c_str(), "rb");
+    if (fp == nullptr) {
+        feature_count_ = 0;
+        skipped_count_ = 0;
+        err_str_ = "cannot open GeoJSON file: " + json_pathname;
+        return false;
+    }
+
+    std::vector<char> buff(GEOJSON_STREAM_BUFF_SIZE);
+    rapidjson::FileReadStream stream(fp, buff.data(), buff.size());
+    const bool ok = Read(stream, callback);
+    fclose(fp);
+    return ok;
+}
+
+bool GeoJsonStreamReader::ReadStream(std::istream& in, const FeatureCallback& callback)
+{
+    rapidjson::IStreamWrapper stream(in);
+    return Read(stream, callback);
+}
+
+bool GeoJsonStreamReader::ReadString(const std::string& json, const FeatureCallback& callback)
+{
+    rapidjson::StringStream stream(json.c_str());
+    return Read(stream, callback);
+}
+
+bool GeoJsonStreamReader::ReadFilePipelined(const std::string& json_pathname,
+    size_t queue_size, const FeatureCallback& callback)
+{
+    queue_size = std::max(queue_size, (size_t)1);
+    std::mutex queue_mutex;
+    std::condition_variable not_empty, not_full;
+    std::deque<GeoObjPtr> queue;
+    bool parse_done = false, stop = false;
+
+    GeoJsonStreamReader parser;
+    bool parse_ok = false;
+    std::thread parse_thread([&]() {
+        parse_ok = parser.ReadFile(json_pathname, [&](const GeoObjPtr& p_obj) {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            not_full.wait(lock, [&]() { return queue.size() < queue_size || stop; });
+            if (stop) {
+                return false;
+            }
+            queue.push_back(p_obj);
+            not_empty.notify_one();
+            return true;
+        });
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        parse_done = true;
+        not_empty.notify_one();
+    });
+
+    // stops and joins the parsing thread on every way out of the loop below, also when the
+    // callback throws, as a joinable std::thread must not be destroyed
+    struct ParseThreadGuard
+    {
+        std::thread& thread;
+        std::mutex& mutex;
+        std::condition_variable& not_full;
+        bool& stop;
+
+        ~ParseThreadGuard()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            not_full.notify_one();
+            thread.join();
+        }
+    };
+
+    feature_count_ = 0;
+    {
+        ParseThreadGuard guard{ parse_thread, queue_mutex, not_full, stop };
+        for (;;) {
+            GeoObjPtr p_obj;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                not_empty.wait(lock, [&]() { return !queue.empty() || parse_done; });
+                if (queue.empty()) {
+                    break;
+                }
+                p_obj = std::move(queue.front());
+                queue.pop_front();
+                not_full.notify_one();
+            }
+
+            ++feature_count_;
+            if (!callback(p_obj)) {
+                break;
+            }
+        }
+    }
+
+    skipped_count_ = parser.SkippedCount();
+    err_str_ = parser.GetErrorString();
+    return parse_ok;
+}
+
 GEO_END_NAMESPACE
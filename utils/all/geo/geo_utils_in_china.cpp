@@ -54,7 +54,8 @@ static bool InRectangle(const Rectangle &rect, double lat, double lng)
     return rect.West <= lng && rect.East >= lng && rect.North >= lat && rect.South <= lat;
 }
 
-bool is_inside_china(double lat, double lng)
+// the exact test with the rectangles
+static bool is_inside_china_exact(double lat, double lng)
 {
     for (size_t i = 0; i < COUNT_OF(regions); i++) {
         if (InRectangle(regions[i], lat, lng)) {
@@ -69,4 +70,139 @@ bool is_inside_china(double lat, double lng)
     return false;
 }
 
+// the rectangles rasterized into cells of CELL_SIZE degree, 2 bits a cell, built at the first use.
+// a cell is inside or outside if each rectangle either covers it or misses it, the other cells
+// are boundary cells, tested with the rectangles
+class ChinaRaster
+{
+public:
+    enum CELL_TYPE
+    {
+        CELL_OUTSIDE = 0,
+        CELL_INSIDE = 1,
+        CELL_BOUNDARY = 2,
+    };
+
+    ChinaRaster()
+    {
+        min_lat_ = max_lat_ = regions[0].South;
+        min_lng_ = max_lng_ = regions[0].West;
+        for (size_t i = 0; i < COUNT_OF(regions); i++) {
+            min_lat_ = MIN(min_lat_, regions[i].South);
+            max_lat_ = MAX(max_lat_, regions[i].North);
+            min_lng_ = MIN(min_lng_, regions[i].West);
+            max_lng_ = MAX(max_lng_, regions[i].East);
+        }
+        rows_ = (int)((max_lat_ - min_lat_) / CELL_SIZE) + 1;
+        cols_ = (int)((max_lng_ - min_lng_) / CELL_SIZE) + 1;
+        cells_.assign(((size_t)rows_ * cols_ + 3) / 4, 0);
+
+        for (int row = 0; row < rows_; ++row) {
+            for (int col = 0; col < cols_; ++col) {
+                const double south = min_lat_ + row * CELL_SIZE;
+                const double west = min_lng_ + col * CELL_SIZE;
+                const size_t i_cell = (size_t)row * cols_ + col;
+                cells_[i_cell / 4] |= (unsigned char)(CellType(south, west) << (i_cell % 4 * 2));
+            }
+        }
+    }
+
+    CELL_TYPE Lookup(double lat, double lng) const
+    {
+        if (!(lat >= min_lat_ && lat <= max_lat_ && lng >= min_lng_ && lng <= max_lng_)) {
+            return CELL_OUTSIDE;
+        }
+        const int row = (int)((lat - min_lat_) * (1 / CELL_SIZE));
+        const int col = (int)((lng - min_lng_) * (1 / CELL_SIZE));
+        if (row >= rows_ || col >= cols_) {
+            return CELL_BOUNDARY;
+        }
+        const size_t i_cell = (size_t)row * cols_ + col;
+        return (CELL_TYPE)((cells_[i_cell / 4] >> (i_cell % 4 * 2)) & 3);
+    }
+
+private:
+    // the cell, with a margin for the rounding of Lookup()
+    CELL_TYPE CellType(double south, double west) const
+    {
+        const double north = south + CELL_SIZE, east = west + CELL_SIZE;
+        bool in_region = false, in_exclude = false;
+        for (size_t i = 0; i < COUNT_OF(regions); i++) {
+            const int cover = Cover(regions[i], south, west, north, east);
+            if (cover < 0) {
+                return CELL_BOUNDARY;
+            }
+            in_region = in_region || cover > 0;
+        }
+        for (size_t i = 0; i < COUNT_OF(excludes); i++) {
+            const int cover = Cover(excludes[i], south, west, north, east);
+            if (cover < 0) {
+                return CELL_BOUNDARY;
+            }
+            in_exclude = in_exclude || cover > 0;
+        }
+        return (in_region && !in_exclude) ? CELL_INSIDE : CELL_OUTSIDE;
+    }
+
+    // 1 if the rectangle covers the cell, 0 if it misses it, -1 if they overlap
+    static int Cover(const Rectangle &rect, double south, double west, double north,
+        double east)
+    {
+        if (rect.South <= south - MARGIN && rect.North >= north + MARGIN &&
+            rect.West <= west - MARGIN && rect.East >= east + MARGIN) {
+            return 1;
+        }
+        if (rect.South > north + MARGIN || rect.North < south - MARGIN ||
+            rect.West > east + MARGIN || rect.East < west - MARGIN) {
+            return 0;
+        }
+        return -1;
+    }
+
+private:
+    static const double CELL_SIZE;
+    static const double MARGIN;
+
+    double min_lat_, min_lng_, max_lat_, max_lng_;
+    int rows_, cols_;
+    std::vector<unsigned char> cells_;
+};
+
+const double ChinaRaster::CELL_SIZE = 0.1;
+const double ChinaRaster::MARGIN = 1e-9;
+
+static const ChinaRaster& GetChinaRaster()
+{
+    static const ChinaRaster raster; // thread safe initialization
+    return raster;
+}
+
+bool is_inside_china(double lat, double lng)
+{
+    switch (GetChinaRaster().Lookup(lat, lng)) {
+    case ChinaRaster::CELL_INSIDE:
+        return true;
+    case ChinaRaster::CELL_OUTSIDE:
+        return false;
+    default:
+        return is_inside_china_exact(lat, lng);
+    }
+}
+
+size_t is_inside_china_batch(const double *lats, const double *lngs, size_t n,
+    std::vector<bool>& inside)
+{
+    const ChinaRaster& raster = GetChinaRaster();
+    size_t count = 0;
+    inside.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const auto cell_type = raster.Lookup(lats[i], lngs[i]);
+        const bool in = (cell_type == ChinaRaster::CELL_INSIDE) ||
+            (cell_type == ChinaRaster::CELL_BOUNDARY && is_inside_china_exact(lats[i], lngs[i]));
+        inside[i] = in;
+        count += in ? 1 : 0;
+    }
+    return count;
+}
+
 GEO_END_NAMESPACE
@@ -0,0 +1,243 @@
+#ifndef _GEO_UTILS_KERNELS_H_
+#define _GEO_UTILS_KERNELS_H_
+
+// internal header, the kernels of the batch functions. the scalar types are instantiated in
+// geo_utils.cpp, the lane types only in geo_utils_avx2.cpp
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include "geo_utils.h"
+#include "geo_utils_batch.h"
+
+
+#ifndef M_PI
+#define M_PI       3.14159265358979323846
+#endif
+
+#define R_EARTH         6371004 // in meters
+#define EARTH_RADIUS    6378137
+#define POLAR_RADIUS    6356725
+
+#define LAT_METERS_PER_DEGREE   (111194.99646)  // R_EARTH * 2 * PI / 360
+
+#define COORDINATE_PRECISION    1000000.0
+
+
+GEO_BEGIN_NAMESPACE
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// distances
+//
+// the results are within 1e-5 meter of distance_in_meter() (1.8e-6 measured on 1M pairs up to
+// 20000 km apart)
+
+static const double DEG_TO_RAD = M_PI / 180;
+
+// asin(x) = x + x * P(z) / Q(z), z = x * x, |x| <= 0.5 (fdlibm)
+static const double ASIN_P[] = { 3.47933107596021167570e-05, 7.91534994289814532176e-04,
+    -4.00555345006794114027e-02, 2.01212532134862925881e-01, -3.25565818622400915405e-01,
+    1.66666666666666657415e-01 };
+static const double ASIN_Q[] = { 7.70381505559019352791e-02, -6.88283971605453293030e-01,
+    2.02094576023350569471e+00, -2.40339491173441421878e+00 };
+
+// 2 * asin(sqrt(h)), 0 <= h <= 1
+template <typename T>
+static inline T fast_central_angle(const T& h)
+{
+    using namespace batch;
+    const auto small = LessEqual(h, T(0.25));
+    // asin(x) = pi/2 - 2 * asin(sqrt((1 - x) / 2)) for x > 0.5
+    const T z = Select(small, h, (T(1.0) - Sqrt(h)) * 0.5);
+    const T x = Sqrt(z);
+    const T v = x + x * (z * Poly(z, ASIN_P, 6) / (Poly(z, ASIN_Q, 4) * z + 1.0));
+    return Select(small, v * 2.0, T(M_PI) - v * 4.0);
+}
+
+struct HaversineKernel
+{
+    template <typename T>
+    static T Distance(const T& lat1, const T& lng1, const T& lat2, const T& lng2)
+    {
+        using namespace batch;
+        const T rad_lat1 = lat1 * DEG_TO_RAD;
+        const T rad_lat2 = lat2 * DEG_TO_RAD;
+        const T sin_a_2 = Sin((rad_lat1 - rad_lat2) * 0.5);
+        const T sin_b_2 = Sin((lng1 - lng2) * DEG_TO_RAD * 0.5);
+        const T h = sin_a_2 * sin_a_2 + Cos(rad_lat1) * Cos(rad_lat2) * (sin_b_2 * sin_b_2);
+        return fast_central_angle(Min(Max(h, T(0.0)), T(1.0))) * R_EARTH;
+    }
+};
+
+// the relative error to distance_in_meter() is below 1e-6 up to 10 km and 1e-4 up to 100 km,
+// between the latitudes -70 and 70. it reaches 1% at 1000 km
+struct EquirectKernel
+{
+    template <typename T>
+    static T Distance(const T& lat1, const T& lng1, const T& lat2, const T& lng2)
+    {
+        using namespace batch;
+        T d_lng = lng2 - lng1;
+        d_lng = d_lng - Floor(d_lng * (1.0 / 360) + 0.5) * 360.0; // the shorter way round
+        const T x = d_lng * DEG_TO_RAD * CosPi((lat1 + lat2) * (0.5 / 180));
+        const T y = (lat2 - lat1) * DEG_TO_RAD;
+        return Sqrt(x * x + y * y) * R_EARTH;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// point to segment distances
+
+// the point is the origin, the segment in meters
+template <typename T>
+static inline T point_to_segment_square(const T& from_x, const T& from_y, const T& to_x,
+    const T& to_y)
+{
+    using namespace batch;
+    const T abx = to_x - from_x;
+    const T aby = to_y - from_y;
+    // t is 0 for a zero length segment
+    const T ab2 = Max(abx * abx + aby * aby, T(1e-12f));
+    const T t = Min(Max(-(from_x * abx + from_y * aby) / ab2, T(0.0f)), T(1.0f));
+    const T x = from_x + abx * t;
+    const T y = from_y + aby * t;
+    return x * x + y * y;
+}
+
+// meters per microdegree of longitude at the latitude
+static inline double fixed_lng_scale(int lat)
+{
+    return LAT_METERS_PER_DEGREE / COORDINATE_PRECISION *
+        std::cos(lat / COORDINATE_PRECISION * DEG_TO_RAD);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// offsets
+//
+// the shift of get_offset_segment() without atan2: the sin and cos of the initial bearing are
+// y / r and x / r, rotated by 90 degrees for get_lat_lng_rad(). the results are within 1e-12
+// degree of get_offset_segment()
+
+template <typename T>
+static inline void offset_shift(const T& from_lat, const T& from_lng, const T& to_lat,
+    const T& to_lng, const T& offset, T& d_lat, T& d_lng)
+{
+    using namespace batch;
+    const T rad_lat1 = from_lat * DEG_TO_RAD;
+    const T rad_lat2 = to_lat * DEG_TO_RAD;
+    const T d_rad_lng = (to_lng - from_lng) * DEG_TO_RAD;
+    const T cos_lat1 = Cos(rad_lat1);
+    const T cos_lat2 = Cos(rad_lat2);
+    const T y = Sin(d_rad_lng) * cos_lat2;
+    const T x = cos_lat1 * Sin(rad_lat2) - Sin(rad_lat1) * cos_lat2 * Cos(d_rad_lng);
+    const T r = Sqrt(x * x + y * y);
+    // the same points, get_heading_in_degree() returns about 0
+    const auto same = LessEqual(Abs(to_lat - from_lat) + Abs(to_lng - from_lng), T(0.0));
+    const T sin_heading = Select(same, T(0.0), y / r);
+    const T cos_heading = Select(same, T(1.0), x / r);
+
+    const T ec = T((double)POLAR_RADIUS) +
+        (T(90.0) - from_lat) * ((double)(EARTH_RADIUS - POLAR_RADIUS) / 90.0);
+    d_lng = offset * cos_heading / (ec * cos_lat1) * (180 / M_PI);
+    d_lat = -(offset * sin_heading) / ec * (180 / M_PI);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// coordinate transforms
+//
+// the formulas of geo_coord_transform.cpp. sin and cos of multiples of pi are evaluated by
+// SinPi(), sin(3a) = 3 sin(a) - 4 sin(a)^3 saves three of them. atan2() is not needed, see
+// gcj02_to_bd09(). the results are within 1e-12 degree of the scalar functions
+
+template <typename T>
+static inline T sin_triple(const T& sin_a)
+{
+    return sin_a * (T(3.0) - sin_a * sin_a * 4.0);
+}
+
+template <typename T>
+static inline void wgs84_to_mars_kernel(const T& lat, const T& lng, T& mars_lat, T& mars_lng)
+{
+    using namespace batch;
+    const double a = 6378245.0;
+    const double ee = 0.00669342162296594323;
+
+    // transformLat() and transformLon()
+    const T x = lng - 105.0, y = lat - 35.0;
+    const T sin_x_3 = SinPi(x * (1.0 / 3.0)), sin_y_3 = SinPi(y * (1.0 / 3.0));
+    const T sin_2x = SinPi(x * 2.0);
+    const T common = (sin_triple(sin_2x) * 20.0 + sin_2x * 20.0) * 2.0 / 3.0;
+    T d_lat = T(-100.0) + x * 2.0 + y * 3.0 + y * y * 0.2 + x * y * 0.1 + Sqrt(Abs(x)) * 0.2 +
+        common + (sin_triple(sin_y_3) * 20.0 + sin_y_3 * 40.0) * 2.0 / 3.0 +
+        (SinPi(y * (1.0 / 12.0)) * 160.0 + SinPi(y * (1.0 / 30.0)) * 320.0) * 2.0 / 3.0;
+    T d_lng = T(300.0) + x + y * 2.0 + x * x * 0.1 + x * y * 0.1 + Sqrt(Abs(x)) * 0.1 +
+        common + (sin_triple(sin_x_3) * 20.0 + sin_x_3 * 40.0) * 2.0 / 3.0 +
+        (SinPi(x * (1.0 / 12.0)) * 150.0 + SinPi(x * (1.0 / 30.0)) * 300.0) * 2.0 / 3.0;
+
+    T sin_lat, cos_lat;
+    SinCosPi(lat * (1.0 / 180.0), &sin_lat, &cos_lat);
+    const T magic = T(1.0) - sin_lat * sin_lat * ee;
+    const T sqrt_magic = Sqrt(magic);
+    d_lat = (d_lat * 180.0) / (T(a * (1 - ee)) / (magic * sqrt_magic) * PI);
+    d_lng = (d_lng * 180.0) / (T(a) / sqrt_magic * cos_lat * PI);
+    mars_lat = lat + d_lat;
+    mars_lng = lng + d_lng;
+}
+
+template <typename T>
+static inline void mars_to_wgs84_kernel(const T& mars_lat, const T& mars_lng, T& lat, T& lng,
+    int loop_time)
+{
+    lat = mars_lat;
+    lng = mars_lng;
+    for (int i = 0; i < loop_time; ++i) {
+        T lat_new, lng_new;
+        wgs84_to_mars_kernel(lat, lng, lat_new, lng_new);
+        lat = mars_lat - (lat_new - lat);
+        lng = mars_lng - (lng_new - lng);
+    }
+}
+
+// (x, y) rotated by theta = atan2(y, x) + delta and scaled to z, i.e. z * cos(theta) and
+// z * sin(theta), by the angle sum formulas with cos(atan2(y, x)) = x / r and
+// sin(atan2(y, x)) = y / r
+template <typename T>
+static inline void rotate_to(const T& x, const T& y, const T& r, const T& z, const T& delta,
+    T& z_cos, T& z_sin)
+{
+    using namespace batch;
+    const auto r_zero = LessEqual(r, T(0.0));
+    const T cos_t0 = Select(r_zero, T(1.0), x / r);
+    const T sin_t0 = Select(r_zero, T(0.0), y / r);
+    const T sin_d = Sin(delta), cos_d = Cos(delta);
+    z_cos = z * (cos_t0 * cos_d - sin_t0 * sin_d);
+    z_sin = z * (sin_t0 * cos_d + cos_t0 * sin_d);
+}
+
+// bd_encrypt(), y * X_PI = pi * y * 50 / 3
+template <typename T>
+static inline void gcj02_to_bd09(const T& lat, const T& lng, T& bd_lat, T& bd_lng)
+{
+    using namespace batch;
+    const T x = lng, y = lat;
+    const T r = Sqrt(x * x + y * y);
+    const T z = r + SinPi(y * (50.0 / 3.0)) * 0.00002;
+    rotate_to(x, y, r, z, CosPi(x * (50.0 / 3.0)) * 0.000003, bd_lng, bd_lat);
+    bd_lng = bd_lng + 0.0065;
+    bd_lat = bd_lat + 0.006;
+}
+
+// bd_decrypt()
+template <typename T>
+static inline void bd09_to_gcj02(const T& bd_lat, const T& bd_lng, T& lat, T& lng)
+{
+    using namespace batch;
+    const T x = bd_lng - 0.0065, y = bd_lat - 0.006;
+    const T r = Sqrt(x * x + y * y);
+    const T z = r - SinPi(y * (50.0 / 3.0)) * 0.00002;
+    rotate_to(x, y, r, z, -(CosPi(x * (50.0 / 3.0)) * 0.000003), lng, lat);
+}
+
+
+GEO_END_NAMESPACE
+
+#endif // _GEO_UTILS_KERNELS_H_
@@ -4,7 +4,10 @@
 #endif
 
 #include "geo_utils.h"
+#include "geo_utils_batch.h"
 #include "common/common_utils.h"
+#include <algorithm>
+#include <cmath>
 #include <boost/geometry/geometry.hpp>
 #include <boost/geometry/geometries/point_xy.hpp>
 #include <boost/geometry/geometries/polygon.hpp>
@@ -606,4 +609,318 @@ bool multi_polygon_covered_by(const MultiPolygon& mpoly, double lat, double lng)
     return bg::covered_by(pt, p_helper->multi_polygon_2d_);
 }
 
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// class PreparedPolygon
+
+// about this many edges per band, bands are not narrower than MIN_BAND_HEIGHT degree
+static const int PREPARED_POLYGON_EDGES_PER_BAND = 2;
+static const int PREPARED_POLYGON_MAX_BANDS = 1 << 16;
+static const double PREPARED_POLYGON_MIN_BAND_HEIGHT = 1e-6;
+
+PreparedPolygon::PreparedPolygon(const SimplePolygon& polygon)
+{
+    AddRing(polygon);
+    BuildBands();
+}
+
+PreparedPolygon::PreparedPolygon(const Polygon& polygon)
+{
+    // the even-odd rule gives the same as testing the outer and the inner polygons
+    AddRing(polygon.outer_polygon);
+    for (const auto& inner_poly : polygon.inner_polygons) {
+        AddRing(inner_poly);
+    }
+    BuildBands();
+}
+
+PreparedPolygon::PreparedPolygon(const MultiPolygon& mpoly)
+{
+    for (const auto& poly : mpoly.polygons) {
+        AddRing(poly.outer_polygon);
+        for (const auto& inner_poly : poly.inner_polygons) {
+            AddRing(inner_poly);
+        }
+    }
+    BuildBands();
+}
+
+void PreparedPolygon::AddRing(const SimplePolygon& ring)
+{
+    const size_t nvert = ring.VertexNumber();
+    for (size_t i = 0, j = nvert - 1; i < nvert; j = i++) {
+        const GeoPoint& pt_i = ring.Vertex(i);
+        const GeoPoint& pt_j = ring.Vertex(j);
+        if (!has_bound_) { // not edges_.empty(), the first edges may be horizontal
+            minlat_ = maxlat_ = pt_i.lat;
+            minlng_ = maxlng_ = pt_i.lng;
+            has_bound_ = true;
+        }
+        minlat_ = std::min(minlat_, pt_i.lat);
+        maxlat_ = std::max(maxlat_, pt_i.lat);
+        minlng_ = std::min(minlng_, pt_i.lng);
+        maxlng_ = std::max(maxlng_, pt_i.lng);
+
+        // horizontal edges never cross the ray of a point
+        if (pt_i.lat != pt_j.lat) {
+            edges_.push_back(Edge{ pt_i.lat, pt_i.lng, pt_j.lat,
+                (pt_j.lng - pt_i.lng) / (pt_j.lat - pt_i.lat) });
+        }
+    }
+}
+
+void PreparedPolygon::BuildBands()
+{
+    if (edges_.empty()) {
+        band_count_ = 0;
+        return;
+    }
+
+    const double height = maxlat_ - minlat_;
+    band_count_ = (int)std::min<size_t>(edges_.size() / PREPARED_POLYGON_EDGES_PER_BAND + 1,
+        PREPARED_POLYGON_MAX_BANDS);
+    band_count_ = std::max(1, std::min(band_count_,
+        (int)(height / PREPARED_POLYGON_MIN_BAND_HEIGHT) + 1));
+    bands_per_degree_ = band_count_ / height;
+
+    // counting sort of the edges by the bands they cross
+    std::vector<Edge> edges;
+    edges.swap(edges_);
+    band_begins_.assign(band_count_ + 1, 0);
+    for (const auto& edge : edges) {
+        const int band_end = BandOf(std::max(edge.lat1, edge.lat2)) + 1;
+        for (int band = BandOf(std::min(edge.lat1, edge.lat2)); band < band_end; ++band) {
+            ++band_begins_[band + 1];
+        }
+    }
+    for (int band = 0; band < band_count_; ++band) {
+        band_begins_[band + 1] += band_begins_[band];
+    }
+    edges_.resize(band_begins_[band_count_]);
+    std::vector<unsigned int> band_ends(band_begins_.begin(), band_begins_.end() - 1);
+    for (const auto& edge : edges) {
+        const int band_end = BandOf(std::max(edge.lat1, edge.lat2)) + 1;
+        for (int band = BandOf(std::min(edge.lat1, edge.lat2)); band < band_end; ++band) {
+            edges_[band_ends[band]++] = edge;
+        }
+    }
+}
+
+bool PreparedPolygon::Within(double lat, double lng) const
+{
+    if (lat < minlat_ || lat > maxlat_ || lng < minlng_ || lng > maxlng_ || edges_.empty()) {
+        return false;
+    }
+
+    bool in = false;
+    const int band = BandOf(lat);
+    const Edge *p_end = edges_.data() + band_begins_[band + 1];
+    for (const Edge *p_edge = edges_.data() + band_begins_[band]; p_edge < p_end; ++p_edge) {
+        if (((p_edge->lat1 > lat) != (p_edge->lat2 > lat)) &&
+            (lng < p_edge->lng1 + (lat - p_edge->lat1) * p_edge->slope)) {
+            in = !in;
+        }
+    }
+    return in;
+}
+
+size_t PreparedPolygon::Within(const GeoPoint *points, size_t n, std::vector<bool>& within) const
+{
+    size_t count = 0;
+    within.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const bool in = Within(points[i].lat, points[i].lng);
+        within[i] = in;
+        count += in ? 1 : 0;
+    }
+    return count;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// class PolygonSetIndex
+
+static const size_t POLYGON_SET_NODE_CAPACITY = 16;
+
+int PolygonSetIndex::AddPolygon(const SimplePolygon& polygon)
+{
+    return AddPrepared(PreparedPolygon(polygon));
+}
+
+int PolygonSetIndex::AddPolygon(const Polygon& polygon)
+{
+    return AddPrepared(PreparedPolygon(polygon));
+}
+
+int PolygonSetIndex::AddPolygon(const MultiPolygon& mpoly)
+{
+    return AddPrepared(PreparedPolygon(mpoly));
+}
+
+int PolygonSetIndex::AddPrepared(PreparedPolygon&& polygon)
+{
+    polygons_.push_back(std::move(polygon));
+    return (int)polygons_.size() - 1;
+}
+
+// sort-tile-recursive packing: the boxes are sorted by lng into vertical slices, each slice by
+// lat, then packed into nodes of POLYGON_SET_NODE_CAPACITY children, level by level up to the
+// root
+void PolygonSetIndex::Build()
+{
+    const size_t M = POLYGON_SET_NODE_CAPACITY;
+    items_.clear();
+    levels_.clear();
+    for (size_t id = 0; id < polygons_.size(); ++id) {
+        Item item;
+        if (polygons_[id].GetBound(item.box.minlat, item.box.minlng, item.box.maxlat,
+            item.box.maxlng)) {
+            item.id = (int)id;
+            items_.push_back(item);
+        }
+    }
+    if (items_.empty()) {
+        return;
+    }
+
+    auto str_sort = [M](std::vector<Box>& boxes, std::vector<unsigned int>& order) {
+        const size_t node_count = (boxes.size() + M - 1) / M;
+        const size_t slice_size = M * (size_t)std::ceil(std::sqrt((double)node_count));
+        order.resize(boxes.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = (unsigned int)i;
+        }
+        std::sort(order.begin(), order.end(), [&boxes](unsigned int a, unsigned int b) {
+            return boxes[a].minlng + boxes[a].maxlng < boxes[b].minlng + boxes[b].maxlng;
+        });
+        for (size_t i = 0; i < order.size(); i += slice_size) {
+            std::sort(order.begin() + i, order.begin() + std::min(i + slice_size, order.size()),
+                [&boxes](unsigned int a, unsigned int b) {
+                return boxes[a].minlat + boxes[a].maxlat < boxes[b].minlat + boxes[b].maxlat;
+            });
+        }
+    };
+    auto pack = [M](const std::vector<Box>& boxes, std::vector<Node>& nodes) {
+        for (size_t i = 0; i < boxes.size(); i += M) {
+            Node node;
+            node.begin = (unsigned int)i;
+            node.end = (unsigned int)std::min(i + M, boxes.size());
+            node.box = boxes[i];
+            for (size_t k = i + 1; k < node.end; ++k) {
+                node.box.minlat = std::min(node.box.minlat, boxes[k].minlat);
+                node.box.minlng = std::min(node.box.minlng, boxes[k].minlng);
+                node.box.maxlat = std::max(node.box.maxlat, boxes[k].maxlat);
+                node.box.maxlng = std::max(node.box.maxlng, boxes[k].maxlng);
+            }
+            nodes.push_back(node);
+        }
+    };
+
+    // leaves
+    std::vector<Box> boxes(items_.size());
+    std::vector<unsigned int> order;
+    for (size_t i = 0; i < items_.size(); ++i) {
+        boxes[i] = items_[i].box;
+    }
+    str_sort(boxes, order);
+    std::vector<Item> items(items_.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        items[i] = items_[order[i]];
+        boxes[i] = items[i].box;
+    }
+    items_.swap(items);
+    levels_.emplace_back();
+    pack(boxes, levels_.back());
+
+    // the upper levels, the nodes of a level are sorted before the level above is packed
+    while (levels_.back().size() > 1) {
+        std::vector<Node>& level = levels_.back();
+        boxes.resize(level.size());
+        for (size_t i = 0; i < level.size(); ++i) {
+            boxes[i] = level[i].box;
+        }
+        str_sort(boxes, order);
+        std::vector<Node> nodes(level.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            nodes[i] = level[order[i]];
+            boxes[i] = nodes[i].box;
+        }
+        level.swap(nodes);
+        std::vector<Node> upper;
+        pack(boxes, upper);
+        levels_.push_back(std::move(upper));
+    }
+}
+
+template <typename Found>
+void PolygonSetIndex::Search(double lat, double lng, const Found& found) const
+{
+    if (levels_.empty()) {
+        return;
+    }
+
+    // (level, node) pairs to visit
+    std::pair<size_t, unsigned int> stack[64 * POLYGON_SET_NODE_CAPACITY];
+    size_t stack_size = 0;
+    const size_t root_level = levels_.size() - 1;
+    for (unsigned int i = 0; i < levels_[root_level].size(); ++i) {
+        stack[stack_size++] = std::make_pair(root_level, i);
+    }
+    while (stack_size > 0) {
+        const auto top = stack[--stack_size];
+        const Node& node = levels_[top.first][top.second];
+        if (!node.box.Contains(lat, lng)) {
+            continue;
+        }
+        if (top.first == 0) {
+            for (unsigned int i = node.begin; i < node.end; ++i) {
+                const Item& item = items_[i];
+                if (item.box.Contains(lat, lng) && polygons_[item.id].Within(lat, lng)) {
+                    if (!found(item.id)) {
+                        return;
+                    }
+                }
+            }
+        }
+        else {
+            for (unsigned int i = node.begin; i < node.end; ++i) {
+                stack[stack_size++] = std::make_pair(top.first - 1, i);
+            }
+        }
+    }
+}
+
+int PolygonSetIndex::FindPolygon(double lat, double lng) const
+{
+    int min_id = -1;
+    Search(lat, lng, [&min_id](int id) {
+        if (min_id < 0 || id < min_id) {
+            min_id = id;
+        }
+        return true;
+    });
+    return min_id;
+}
+
+size_t PolygonSetIndex::FindPolygons(double lat, double lng, std::vector<int>& ids) const
+{
+    ids.clear();
+    Search(lat, lng, [&ids](int id) {
+        ids.push_back(id);
+        return true;
+    });
+    std::sort(ids.begin(), ids.end());
+    return ids.size();
+}
+
+void PolygonSetIndex::FindPolygon(const GeoPoint *points, size_t n, std::vector<int>& ids) const
+{
+    ids.resize(n);
+    batch::ParForBlocks(n, [this, points, &ids](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ids[i] = FindPolygon(points[i].lat, points[i].lng);
+        }
+    }, 4096);
+}
+
 GEO_END_NAMESPACE
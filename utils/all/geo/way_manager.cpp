@@ -11,13 +11,25 @@
 #include <future>
 #include <cmath>
 #include <tuple>
+#include <deque>
+#include <atomic>
+#include <functional>
+#if defined(__has_include)
+#if __has_include(<charconv>) && __cplusplus >= 201703L
+#include <charconv>
+#endif
+#endif
 #include "geo_utils.h"
+#include "geo_utils_batch.h"
 #include "common/csv_to_tuples.hpp"
 #include "common/simple_matrix.hpp"
 #include "common/common_utils.h"
 #include "common/simple_thread_pool.hpp"
 #include "common/simple_par_algorithm.hpp"
 #include "common/at_scope_exit.h"
+#include "common/mapped_file.hpp"
+#include "way_manager_snapshot.h"
+#include "way_manager_segbin.h"
 #if WAY_MANAGER_HANA_LOG == 1
 #include <hana/logging.h>
 #include <chrono>
@@ -43,6 +55,16 @@
 #define _countof(a) (sizeof(a)/sizeof(*(a)))
 #endif
 
+// compiling switch for filtering the segments near a point by a fixed point (microdegree) copy of
+// their coordinates in the segment tiles, before the segments themselves are touched.
+// NOTE: this is a speed filter only, not a fixed point memory mode. Segment::from_point_ and
+// to_point_ stay doubles, as the exact distances, the routing and the callers use them, so the
+// copy costs memory instead of saving it: 16 bytes per segment reference of the tiles, and each
+// segment is referenced by about 10 tiles (its tiles and their neighbours), i.e. about 160 bytes
+// per segment, see tile_fixed_coords_bytes of WayManagerInitStats. with the switch off, nothing
+// is added and every candidate segment is touched by the double distance
+#define SEG_FIXED_POINT_FILTER  1
+
 using namespace std;
 
 namespace geo {
@@ -298,6 +320,21 @@ void Segment::GetOffsetLinestr(const std::vector<SegmentPtr>& segs, double offse
     }
 }
 
+size_t Segment::GetOffsetLinestr(const SegmentPtr *segs, size_t n, double offset,
+    GeoPoint *points, bool *one_ways, GeoPoint *offset_points)
+{
+    if (n == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        points[i] = segs[i]->from_point_;
+        one_ways[i] = segs[i]->one_way_;
+    }
+    points[n] = segs[n - 1]->to_point_;
+    one_ways[n] = segs[n - 1]->one_way_;
+    return geo::get_offset_linestr(points, one_ways, n + 1, offset, offset_points);
+}
+
 double Segment::AdjustOffset(double offset, HIGHWAY_TYPE type)
 {
     // some of below entries may need future adjustments
@@ -363,16 +400,91 @@ double Segment::AdjustOffset(double offset, HIGHWAY_TYPE type)
 
 bool Segment::GetTagByName(const std::string& tag_name, std::string* p_tag_value) const
 {
-    if (p_opt_tags_ == nullptr || p_opt_tags_->empty()) {
+    return p_opt_tags_ && p_opt_tags_->Find(tag_name, p_tag_value);
+}
+
+RawTags::RawTags(const std::string& tags_str)
+    : str_(tags_str),
+    has_quotes_(tags_str.find_first_of("\"\r\n") != std::string::npos)
+{}
+
+const Tags& RawTags::GetTags() const
+{
+    std::call_once(parse_flag_, [this]() {
+        auto p_tags = Segment::StrToTags(str_);
+        if (p_tags) {
+            tags_.swap(*p_tags);
+        }
+    });
+    return tags_;
+}
+
+static inline bool IsTagSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// without quotes, the tags are split the same way as by Segment::StrToTags():
+//  "name1=value1, name2 = value2,name3"
+bool RawTags::Find(const std::string& tag_name, std::string* p_tag_value) const
+{
+    if (has_quotes_) {
+        for (const auto &tag : GetTags()) {
+            if (tag.name == tag_name) {
+                if (p_tag_value) {
+                    *p_tag_value = tag.value;
+                }
+                return true;
+            }
+        }
         return false;
     }
-    for (const auto &tag : *p_opt_tags_) {
-        if (tag.name == tag_name) {
+    if (tag_name.empty()) {
+        return false;
+    }
+
+    // std::find() instead of memchr(), whose lengths from the pointer differences are taken by
+    // gcc as possibly negative (-Wstringop-overread). p <= p_tag_end <= p_end all along
+    const char *p = str_.data();
+    const char *const p_end = p + str_.size();
+    while (true) {
+        const char *p_tag_end = std::find(p, p_end, ',');
+        while (p < p_tag_end && IsTagSpace(*p)) {
+            ++p;
+        }
+        const char *p_eq = std::find(p, p_tag_end, '=');
+        if (p_eq == p_tag_end) {
+            p_eq = nullptr;
+        }
+        const char *p_name_end = p_eq ? p_eq : p_tag_end;
+        while (p_name_end > p && IsTagSpace(p_name_end[-1])) {
+            --p_name_end;
+        }
+
+        if ((size_t)(p_name_end - p) == tag_name.size() &&
+            0 == memcmp(p, tag_name.data(), tag_name.size())) {
             if (p_tag_value) {
-                *p_tag_value = tag.value;
+                p_tag_value->clear();
+                if (p_eq) {
+                    const char *p_value = p_eq + 1;
+                    while (p_value < p_tag_end && IsTagSpace(*p_value)) {
+                        ++p_value;
+                    }
+                    // "a=b=c" has value "b"
+                    const char *p_value_end = std::find(p_value, p_tag_end, '=');
+                    while (p_value_end > p_value && IsTagSpace(p_value_end[-1])) {
+                        --p_value_end;
+                    }
+                    p_tag_value->assign(p_value, p_value_end);
+                }
             }
             return true;
         }
+
+        if (p_tag_end == p_end) {
+            break;
+        }
+        p = p_tag_end + 1;
     }
     return false;
 }
@@ -522,6 +634,108 @@ void OrientedWay::DoneAddSegment(const WayManager& way_manager)
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// class CompactRoute
+
+bool CompactRoute::Append(const SegmentPtr& p_seg)
+{
+    const OrientedWayPtr p_way = p_seg->GetWayOriented();
+    if (p_way == nullptr) {
+        return false;
+    }
+    const auto& segs = p_way->Segments();
+
+    // most likely the next segment of the last span
+    if (!spans_.empty()) {
+        const auto& last = spans_.back();
+        if (last.p_way == p_way && last.i_end < segs.size() && segs[last.i_end] == p_seg) {
+            AppendSpan(p_way, last.i_end, last.i_end + 1);
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < segs.size(); ++i) {
+        if (segs[i] == p_seg) {
+            AppendSpan(p_way, i, i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CompactRoute::Append(const std::vector<SegmentPtr>& segs)
+{
+    for (const auto& p_seg : segs) {
+        if (!Append(p_seg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CompactRoute::AppendSpan(const OrientedWayPtr& p_way, size_t i_begin, size_t i_end)
+{
+    if (i_begin >= i_end) {
+        return;
+    }
+    seg_count_ += i_end - i_begin;
+    if (!spans_.empty() && spans_.back().p_way == p_way && spans_.back().i_end == i_begin) {
+        spans_.back().i_end = (unsigned int)i_end;
+        return;
+    }
+    spans_.push_back(Span{ p_way, (unsigned int)i_begin, (unsigned int)i_end });
+}
+
+void CompactRoute::ToSegs(std::vector<SegmentPtr>& segs) const
+{
+    segs.clear();
+    segs.reserve(seg_count_);
+    for (const auto& span : spans_) {
+        const auto& way_segs = span.p_way->Segments();
+        segs.insert(segs.end(), way_segs.begin() + span.i_begin, way_segs.begin() + span.i_end);
+    }
+}
+
+void CompactRoute::ToSegIds(std::vector<SEG_ID_T>& seg_ids) const
+{
+    seg_ids.clear();
+    seg_ids.reserve(seg_count_);
+    for (const auto& p_seg : *this) {
+        seg_ids.push_back(p_seg->seg_id_);
+    }
+}
+
+void CompactRoute::ToPolyline(std::vector<GeoPoint>& points) const
+{
+    points.clear();
+    if (Empty()) {
+        return;
+    }
+    points.reserve(seg_count_ + 1);
+    points.push_back(Front()->from_point_);
+    for (const auto& p_seg : *this) {
+        points.push_back(p_seg->to_point_);
+    }
+}
+
+std::string CompactRoute::ToEncodedPolyline(int precision) const
+{
+    if (Empty()) {
+        return std::string();
+    }
+    return encode_polyline(&Front()->from_point_, begin(), end(), seg_count_,
+        [](const SegmentPtr& p_seg) { return p_seg->to_point_; }, precision);
+}
+
+double CompactRoute::Length() const
+{
+    double length = 0;
+    for (const auto& p_seg : *this) {
+        length += p_seg->length_;
+    }
+    return length;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // class WayManager
 
@@ -534,19 +748,28 @@ bool WayManager::InitWayMap()
 
     way_map_.clear();
 
-    // get oriented way number
-    UNORD_SET<WAY_ID_T> ori_way_set;
-    WAY_ID_T last_way_id = 0;
+    // (oriented way ID, segment) sorted by way ID, the segments of a way are grouped together
+    typedef std::pair<WAY_ID_T, SegmentPtr> WAY_SEG;
+    std::vector<WAY_SEG> way_segs;
+    way_segs.reserve(seg_map_.size());
     for (auto& it : seg_map_) {
-        const SegmentPtr& p_seg = it.second;
-        auto signed_way_id = p_seg->GetWayIdOriented();
-        if (signed_way_id != last_way_id) {
-            ori_way_set.insert(signed_way_id);
-            last_way_id = signed_way_id;
+        way_segs.emplace_back(it.second->GetWayIdOriented(), it.second);
+    }
+    util::ParSort(way_segs.begin(), way_segs.end(), [](const WAY_SEG& i, const WAY_SEG& j) {
+        if (i.first != j.first) {
+            return i.first < j.first;
+        }
+        return i.second->seg_id_ < j.second->seg_id_;
+    });
+
+    std::vector<size_t> way_begins;
+    for (size_t i = 0; i < way_segs.size(); ++i) {
+        if (i == 0 || way_segs[i].first != way_segs[i - 1].first) {
+            way_begins.push_back(i);
         }
     }
-    ori_way_pool_.Reserve(ori_way_set.size());
-    ori_way_set = std::move(decltype(ori_way_set)()); // destory
+    const size_t way_count = way_begins.size();
+    way_begins.push_back(way_segs.size());
 
 #if WAY_MANAGER_HANA_LOG == 1
     std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start0;
@@ -554,20 +777,13 @@ bool WayManager::InitWayMap()
     auto start = std::chrono::system_clock::now();
 #endif
 
-    OrientedWayPtr p_way = nullptr;
-    for (auto& it : seg_map_) {
-        const SegmentPtr& p_seg = it.second;
-
-        // NOTE: for opposite oriented way, way ID is negative
-        WAY_ID_T way_id = p_seg->GetWayIdOriented();
-        if (p_way == nullptr || p_way->WayId() != way_id) {
-            OrientedWayPtr& way = way_map_[way_id];
-            if (nullptr == way) {
-                way = ori_way_pool_.AllocNew(OrientedWay(way_id, p_seg->one_way_ != 0));
-            }
-            p_way = way;
-        }
-        p_way->AddSegment(p_seg);
+    ori_way_pool_.Clear();
+    ori_way_pool_.Reserve(way_count);
+    way_map_.reserve(way_count);
+    for (size_t i = 0; i < way_count; ++i) {
+        const WAY_SEG& way_seg = way_segs[way_begins[i]];
+        way_map_[way_seg.first] = ori_way_pool_.AllocNew(
+            OrientedWay(way_seg.first, way_seg.second->one_way_ != 0));
     }
 
 #if WAY_MANAGER_HANA_LOG == 1
@@ -577,9 +793,17 @@ bool WayManager::InitWayMap()
     start = std::chrono::system_clock::now();
 #endif
 
-    for (auto& it : way_map_) {
-        it.second->DoneAddSegment(*this);
-    }
+    // each way only changes its own segments, way_map_ is read only from here on
+    batch::ParForBlocks(way_count, [this, &way_segs, &way_begins](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            OrientedWay& way = ori_way_pool_[(int)i];
+            way.segments_.reserve(way_begins[i + 1] - way_begins[i]);
+            for (size_t k = way_begins[i]; k < way_begins[i + 1]; ++k) {
+                way.segments_.push_back(way_segs[k].second); // no duplicates, seg_map_ keys
+            }
+            way.DoneAddSegment(*this);
+        }
+    }, 256);
 
 #if WAY_MANAGER_HANA_LOG == 1
     elapsed = std::chrono::system_clock::now() - start0;
@@ -613,85 +837,110 @@ SegmentPtr WayManager::GetReversedSeg(const SegmentPtr& p_seg) const
     return nullptr;
 }
 
+// one segment as a LineString, followed by its nodes not written yet as Points
+static void SegToJson(const WayManager& way_manager, const Segment& seg, double offset,
+    const std::string& seg_color, const std::string& node_color,
+    UNORD_SET<NODE_ID_T>& written_nodes, GeoJsonStreamWriter& writer)
+{
+    if (seg.one_way_) {
+        writer.BeginLineString(seg.from_point_, seg.to_point_);
+    }
+    else {
+        GeoPoint off_from, off_to;
+        geo::get_offset_segment(seg.from_point_, seg.to_point_, offset, off_from, off_to);
+        writer.BeginLineString(off_from, off_to);
+    }
+    writer.AddProp("seg_id", seg.seg_id_);
+    writer.AddProp("way_id", seg.way_id_);
+    writer.AddProp("one_way", seg.one_way_);
+    writer.AddProp("length", seg.length_);
+    writer.AddProp("heading", (int)seg.heading_);
+    writer.AddProp("way_name/type", (seg.way_name_.empty() ? "<null>" : seg.way_name_)
+        + '/' + std::to_string(seg.way_type_));
+    writer.AddProp("from/to nodes", std::to_string(seg.from_nd_) + '/' +
+        std::to_string(seg.to_nd_));
+    writer.AddProp("structure/layer", std::to_string(seg.struct_type_) + '/' +
+        std::to_string(seg.layer_));
+    writer.AddProp("color", seg_color);
+    writer.EndFeature();
+
+    NODE_ID_T nodes[2] {seg.from_nd_, seg.to_nd_};
+    for (int i = 0; i < 2; ++i) {
+        if (!written_nodes.insert(nodes[i]).second) {
+            continue;
+        }
+        auto&& p_node = way_manager.GetNodeById(nodes[i]);
+        if (p_node == nullptr) {
+            continue;
+        }
+        writer.BeginPoint(p_node->geo_point_);
+        writer.AddProp("node", p_node->nd_id_);
+        writer.AddProp("name", p_node->nd_name_);
+        writer.AddProp("coord", std::to_string(p_node->geo_point_.lat) + ',' +
+            std::to_string(p_node->geo_point_.lng));
+        writer.AddProp("way_connector", p_node->IsWayConnector());
+        writer.AddProp("connected_segs", (int)p_node->ConnectedSegments().size());
+        writer.AddProp("crossroad", p_node->IsCorssroad());
+        writer.AddProp("color", p_node->IsRoutingNode() ? std::string("gold") : node_color);
+        writer.EndFeature();
+    }
+}
+
 bool WayManager::SegsToJson(const Bound& bound, double offset, const std::string& seg_color,
     const std::string& node_color, const std::string& pathname) const
 {
-    std::vector<SegmentPtr> segs;
-    segs.reserve(1024 * 2);
+    std::ofstream out(pathname.c_str(), std::ios::binary);
+    if (!out.good()) {
+        return false;
+    }
 
+    GeoJsonStreamWriter writer(out);
+    UNORD_SET<NODE_ID_T> written_nodes;
     for (const auto& seg_elem : this->seg_map_) {
         const auto& p_seg = seg_elem.second;
         if (!bound.Empty() &&
             bound.OutOfBound(p_seg->from_point_) && bound.OutOfBound(p_seg->to_point_)) {
             continue;
         }
-        segs.push_back(p_seg);
+        SegToJson(*this, *p_seg, offset, seg_color, node_color, written_nodes, writer);
     }
-
-    return SegsToJson(segs, offset, seg_color, node_color, pathname);
+    return writer.Close();
 }
 
 bool WayManager::SegsToJson(const std::vector<SegmentPtr>& segs,
     double offset, const std::string& seg_color, const std::string& node_color,
     const std::string& pathname) const
 {
-    std::set<NODE_ID_T> nodes_set;
-    geo::GeoJSON geo_json;
+    std::ofstream out(pathname.c_str(), std::ios::binary);
+    if (!out.good()) {
+        return false;
+    }
+    return SegsToJson(segs, offset, seg_color, node_color, out);
+}
 
+bool WayManager::SegsToJson(const std::vector<SegmentPtr>& segs,
+    double offset, const std::string& seg_color, const std::string& node_color,
+    std::ostream& out) const
+{
+    GeoJsonStreamWriter writer(out);
+    UNORD_SET<NODE_ID_T> written_nodes;
     for (const auto& p_seg : segs) {
-        std::shared_ptr<GeoObj_LineString> p_line = std::make_shared<GeoObj_LineString>();
-        if (p_seg->one_way_) {
-            p_line->AddPoint(p_seg->from_point_);
-            p_line->AddPoint(p_seg->to_point_);
-        }
-        else {
-            GeoPoint off_from, off_to;
-            geo::get_offset_segment(p_seg->from_point_, p_seg->to_point_, offset,
-                off_from, off_to);
-            p_line->AddPoint(off_from);
-            p_line->AddPoint(off_to);
-        }
-        p_line->AddProp("seg_id", p_seg->seg_id_);
-        p_line->AddProp("way_id", p_seg->way_id_);
-        p_line->AddProp("one_way", p_seg->one_way_);
-        p_line->AddProp("length", p_seg->length_);
-        p_line->AddProp("heading", p_seg->heading_);
-        p_line->AddProp("way_name/type", (p_seg->way_name_.empty() ? "<null>" : p_seg->way_name_)
-            + '/' + std::to_string(p_seg->way_type_));
-        p_line->AddProp("from/to nodes", std::to_string(p_seg->from_nd_) + '/' +
-            std::to_string(p_seg->to_nd_));
-        p_line->AddProp("structure/layer", std::to_string(p_seg->struct_type_) + '/' +
-            std::to_string(p_seg->layer_));
-
-        p_line->AddProp("color", seg_color);
-        geo_json.AddObj(p_line);
-
-        NODE_ID_T nodes[2] {p_seg->from_nd_, p_seg->to_nd_};
-        for (int i = 0; i < 2; ++i) {
-            if (nodes_set.find(nodes[i]) == nodes_set.end()) {
-                nodes_set.insert(nodes[i]);
-
-                auto&& p_node = this->GetNodeById(nodes[i]);
-                auto&& p_point = std::make_shared<geo::GeoObj_Point>(p_node->geo_point_);
-                p_point->AddProp("node", p_node->nd_id_);
-                p_point->AddProp("name", p_node->nd_name_);
-                p_point->AddProp("coord", std::to_string(p_node->geo_point_.lat) + ',' +
-                    std::to_string(p_node->geo_point_.lng));
-                p_point->AddProp("way_connector", p_node->IsWayConnector());
-                p_point->AddProp("connected_segs", (int)p_node->ConnectedSegments().size());
-                p_point->AddProp("crossroad", p_node->IsCorssroad());
-                if (p_node->IsRoutingNode()) {
-                    p_point->AddProp("color", "gold");
-                }
-                else {
-                    p_point->AddProp("color", node_color);
-                }
-                geo_json.AddObj(p_point);
-            }
-        }
+        SegToJson(*this, *p_seg, offset, seg_color, node_color, written_nodes, writer);
     }
+    return writer.Close();
+}
 
-    return geo_json.ToJsonFile(pathname);
+bool WayManager::SegsToEncodedPolyline(const std::vector<SegmentPtr>& route, std::ostream& out,
+    int precision/* = 5*/)
+{
+    if (route.empty()) {
+        return out.good();
+    }
+    const std::string encoded = encode_polyline(&route.front()->from_point_, route.begin(),
+        route.end(), route.size(), [](const SegmentPtr& p_seg) { return p_seg->to_point_; },
+        precision);
+    out.write(encoded.data(), encoded.size());
+    return out.good();
 }
 
 double WayManager::ProjectionLengthOnSegRoute(const GeoPoint& p1, const GeoPoint& p2,
@@ -982,123 +1231,128 @@ ORIENTATION WayManager::HeadingToORIENTATION(int heading)
     return orientation;
 }
 
-void WayManager::FlagWeakConnectivity(util::SimpleObjPool<Node>& node_pool)
+// lock free union-find, the root of a set is always its smallest index
+static int FindNodeRoot(std::vector<std::atomic<int>>& parents, int i)
 {
-    const int n = (int)node_pool.Size();
-    if (n == 0) return;
-
-    // map each component's node ID to (component ID, node pool index)
-    UNORD_MAP<NODE_ID_T, std::tuple<int, int>> node_to_component_id;
-    node_to_component_id.reserve(n);
-    std::vector<size_t> component_sizes; // sizes of all components
-    std::vector<NodePtr> component(n); // component for weak connection
-
-    int component_id = 0;
-    for (int i = 0; i < n; ++i) {
-        Node& seed_node = node_pool[i];
-        if (node_to_component_id.find(seed_node.nd_id_) != node_to_component_id.end()) {
-            continue;
+    while (true) {
+        int parent = parents[i].load(std::memory_order_relaxed);
+        if (parent == i) {
+            return i;
         }
-
-        // reset Node::is_visited
-        for (int i = 0; i < n; ++i) {
-            node_pool[i].is_visited = 0;
+        const int grand_parent = parents[parent].load(std::memory_order_relaxed);
+        if (grand_parent != parent) {
+            // path halving, any ancestor is a valid parent
+            parents[i].compare_exchange_weak(parent, grand_parent, std::memory_order_relaxed);
         }
-        seed_node.is_visited = 1;
-        size_t component_size = 0;
-        component[component_size++] = &seed_node;
-
-        for (size_t i = 0; i < component_size; ++i) {
-            auto& p_node = component[i];
+        i = grand_parent;
+    }
+}
 
-            for (auto& p_seg : p_node->connected_segments_) {
-                if (!p_seg->p_from_nd_->is_visited) {
-                    p_seg->p_from_nd_->is_visited = 1;
-                    component[component_size++] = p_seg->p_from_nd_;
-                }
-                else if (!p_seg->p_to_nd_->is_visited) {
-                    p_seg->p_to_nd_->is_visited = 1;
-                    component[component_size++] = p_seg->p_to_nd_;
-                }
-            }
+static void UnionNodes(std::vector<std::atomic<int>>& parents, int a, int b)
+{
+    while (true) {
+        a = FindNodeRoot(parents, a);
+        b = FindNodeRoot(parents, b);
+        if (a == b) {
+            return;
         }
-
-        if ((int)component_size >= n / 2) {
-            // this must be the main component. set flag for each node
-            for (size_t i = 0; i < component_size; ++i) {
-                component[i]->is_weak_connected = 1;
-            }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        // link the larger root to the smaller one, retry if a got linked meanwhile
+        int expected = a;
+        if (parents[a].compare_exchange_strong(expected, b)) {
             return;
         }
-        else if (component_size > 0) {
-            for (size_t k = 0; k < component_size; ++k) {
-                node_to_component_id[component[k]->nd_id_] = std::make_tuple(component_id, i);
-            }
-            component_sizes.push_back(component_size);
+    }
+}
+
+size_t WayManager::FlagWeakConnectivity(util::SimpleObjPool<Node>& node_pool)
+{
+    const int n = (int)node_pool.Size();
+    if (n == 0) return 0;
 
-            component_id++;
+    Node *p_nodes = &node_pool[0];
+    std::vector<std::atomic<int>> parents(n);
+    batch::ParForBlocks(n, [&parents](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            parents[i].store((int)i, std::memory_order_relaxed);
         }
-    }
+    });
+    batch::ParForBlocks(n, [&parents, p_nodes](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            for (const auto& p_seg : p_nodes[i].connected_segments_) {
+                UnionNodes(parents, (int)(p_seg->p_from_nd_ - p_nodes),
+                    (int)(p_seg->p_to_nd_ - p_nodes));
+            }
+        }
+    });
 
-    if (component_sizes.empty()) {
-        // should never happen
-        throw std::runtime_error("graph weak connectivity main component not found");
+    // the main component is the biggest one, the first one in pool order if there are several
+    std::vector<int> roots(n);
+    std::vector<int> component_sizes(n);
+    for (int i = 0; i < n; ++i) {
+        roots[i] = FindNodeRoot(parents, i);
+        ++component_sizes[roots[i]];
     }
-
-    // get the main component ID
-    component_id = 0;
-    size_t size = component_sizes[0];
-    for (size_t i = 1; i < component_sizes.size(); ++i) {
-        if (size < component_sizes[i]) {
-            component_id = (int)i;
-            size = component_sizes[i];
+    size_t component_count = 0;
+    int main_root = 0;
+    for (int i = 0; i < n; ++i) {
+        if (roots[i] == i) {
+            ++component_count;
+            if (component_sizes[i] > component_sizes[main_root]) {
+                main_root = i;
+            }
         }
     }
 
     // set flag for each node
-    for (const auto& it : node_to_component_id) {
-        int comp_id, i_pool;
-        std::tie(comp_id, i_pool) = it.second;
-        if (comp_id == component_id) {
-            node_pool[i_pool].is_weak_connected = 1;
+    for (int i = 0; i < n; ++i) {
+        if (roots[i] == main_root) {
+            p_nodes[i].is_weak_connected = 1;
         }
     }
+    return component_count;
 }
 
 void WayManager::FlagNodeInternals(util::SimpleObjPool<Node>& node_pool)
 {
-    // for all Nodes' internal members
-    const int size = (int)node_pool.Size();
-    for (int i = 0; i < size; ++i) {
-        auto& node = node_pool[i];
-        const std::vector<SegmentPtr>& conn_segs = node.connected_segments_;
-
-        // init is_way_connector_
-        if (node.nd_id_ > 0 && conn_segs.size() >= 2) {
-            auto& p_conn_seg0 = conn_segs.front();
-
-            // to init all Node::is_way_connector_
-            for (auto& p_conn_seg : conn_segs) {
-                if (p_conn_seg->way_id_ != p_conn_seg0->way_id_) {
-                    node.is_way_connector_ = 1;
-                    break;
+    // for all Nodes' internal members, each node only changes itself
+    const size_t size = node_pool.Size();
+    batch::ParForBlocks(size, [&node_pool](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& node = node_pool[(int)i];
+            const std::vector<SegmentPtr>& conn_segs = node.connected_segments_;
+
+            // init is_way_connector_
+            if (node.nd_id_ > 0 && conn_segs.size() >= 2) {
+                auto& p_conn_seg0 = conn_segs.front();
+
+                // to init all Node::is_way_connector_
+                for (auto& p_conn_seg : conn_segs) {
+                    if (p_conn_seg->way_id_ != p_conn_seg0->way_id_) {
+                        node.is_way_connector_ = 1;
+                        break;
+                    }
                 }
             }
-        }
 
-        // init is_dead_end_
-        if (conn_segs.size() == 1) {
-            node.is_dead_end_ = 1;
-        }
-        else if (conn_segs.size() == 2) {
-            if (WayManager::GetAngle(conn_segs.front()->heading_, conn_segs.back()->heading_) == 180) {
+            // init is_dead_end_
+            if (conn_segs.size() == 1) {
                 node.is_dead_end_ = 1;
             }
+            else if (conn_segs.size() == 2) {
+                if (WayManager::GetAngle(conn_segs.front()->heading_,
+                    conn_segs.back()->heading_) == 180) {
+                    node.is_dead_end_ = 1;
+                }
+            }
         }
-    }
+    });
 }
 
-void WayManager::DoneAddNodeMap(util::SimpleObjPool<Node>& node_pool)
+// return the number of weakly connected components
+size_t WayManager::DoneAddNodeMap(util::SimpleObjPool<Node>& node_pool)
 {
 #if WAY_MANAGER_HANA_LOG == 1
     hana::Logger logger("WayManager");
@@ -1150,46 +1404,87 @@ void WayManager::DoneAddNodeMap(util::SimpleObjPool<Node>& node_pool)
         throw std::runtime_error("WayManager::DoneAddNodeMap: empty sub blocks");
     }
 
-    if (n_nodes > 1024) {
-        auto f_node_internals = std::async(std::launch::async, [&node_pool]() {
-            FlagNodeInternals(node_pool);
-        });
-
-        FlagWeakConnectivity(node_pool);
-        f_node_internals.get();
-    }
-    else {
-        FlagNodeInternals(node_pool);
-        FlagWeakConnectivity(node_pool);
-    }
+    // both are parallel inside
+    FlagNodeInternals(node_pool);
+    return FlagWeakConnectivity(node_pool);
 }
 
 
-// static
-const std::string& WayManager::GetCurThreadErrStr(std::mutex& threads_err_mutex,
-    UNORD_MAP<std::string, std::string>& threads_err_strs)
+struct ThreadErrSlot
 {
-    std::string thread_id;
-    std::stringstream ss;
-    ss << std::this_thread::get_id();
-    ss >> thread_id;
+    unsigned long long owner_id; // 0 if free
+    unsigned long long set_seq;  // for reusing the least recently set slot
+    std::string err_str;
+};
+
+// a thread usually works for very few objects, so linear search is fast enough.
+// deque keeps the references returned by ThreadErrStrs::Get() valid on push_back()
+static thread_local std::deque<ThreadErrSlot> tls_err_slots;
+static thread_local unsigned long long tls_err_set_seq;
+static const size_t MAX_THREAD_ERR_SLOTS = 64;
+static std::atomic<unsigned long long> g_next_err_strs_id{ 1 };
+
+ThreadErrStrs::ThreadErrStrs()
+    : id_(g_next_err_strs_id++)
+{}
 
-    std::lock_guard<std::mutex> guard(threads_err_mutex);
-    return threads_err_strs[thread_id];
+ThreadErrStrs::~ThreadErrStrs()
+{
+    // only the slot of the current thread can be freed here. slots in other threads are
+    // left over, they are reused when MAX_THREAD_ERR_SLOTS is reached there
+    for (auto& slot : tls_err_slots) {
+        if (slot.owner_id == id_) {
+            slot.owner_id = 0;
+            slot.err_str.clear();
+            break;
+        }
+    }
 }
 
-// static
-void WayManager::SetCurThreadErrStr(std::mutex& threads_err_mutex,
-    UNORD_MAP<std::string, std::string>& threads_err_strs,
-    const std::string& str)
+const std::string& ThreadErrStrs::Get() const
+{
+    static const std::string EMPTY_STR;
+    for (const auto& slot : tls_err_slots) {
+        if (slot.owner_id == id_) {
+            return slot.err_str;
+        }
+    }
+    return EMPTY_STR;
+}
+
+void ThreadErrStrs::Set(const std::string& str) const
 {
-    std::string thread_id;
-    std::stringstream ss;
-    ss << std::this_thread::get_id();
-    ss >> thread_id;
+    ++tls_err_set_seq;
+    ThreadErrSlot *p_free_slot = nullptr, *p_oldest_slot = nullptr;
+    for (auto& slot : tls_err_slots) {
+        if (slot.owner_id == id_) {
+            slot.set_seq = tls_err_set_seq;
+            slot.err_str = str;
+            return;
+        }
+        if (slot.owner_id == 0) {
+            if (!p_free_slot) {
+                p_free_slot = &slot;
+            }
+        } else if (!p_oldest_slot || slot.set_seq < p_oldest_slot->set_seq) {
+            p_oldest_slot = &slot;
+        }
+    }
+    if (str.empty()) {
+        return;
+    }
 
-    std::lock_guard<std::mutex> guard(threads_err_mutex);
-    threads_err_strs[thread_id] = str;
+    if (!p_free_slot) {
+        if (tls_err_slots.size() < MAX_THREAD_ERR_SLOTS) {
+            tls_err_slots.push_back(ThreadErrSlot());
+            p_free_slot = &tls_err_slots.back();
+        } else {
+            p_free_slot = p_oldest_slot;
+        }
+    }
+    p_free_slot->owner_id = id_;
+    p_free_slot->set_seq = tls_err_set_seq;
+    p_free_slot->err_str = str;
 }
 
 //Parser lines to segments
@@ -1252,6 +1547,28 @@ static string ParserLinesToSegs(const std::vector<char *>& lines, vector<SEGMENT
     return string();
 }
 
+// in_segments_csvs contains '*', pathnames are with the base dir
+static bool FindSegmentsCsvFiles(const string& in_segments_csvs, vector<string>& pathnames,
+    string& err)
+{
+    vector<string> files;
+    std::string in_csvs = in_segments_csvs;
+    util::StringReplace(in_csvs, "/", "\\");
+    size_t n_pos = in_csvs.rfind("\\");
+    size_t end_index = (n_pos == std::string::npos) ? 0 : n_pos + 1;
+    std::string base_dir = in_csvs.substr(0, end_index);
+    if (false == util::FindFiles(in_csvs, files)){
+        err = "Error: cannot find file: " + in_segments_csvs;
+        return false;
+    }
+
+    pathnames.clear();
+    for (const auto& file : files) {
+        pathnames.push_back(base_dir + file);
+    }
+    return true;
+}
+
 // multi-threaded version of LoadSegmentsCsvs()
 // have checked in_segments_csvs and the string contains '*'
 static bool LoadSegmentsCsvs_Multi(const string& in_segments_csvs, vector<SEGMENT> &segs,
@@ -1265,13 +1582,7 @@ static bool LoadSegmentsCsvs_Multi(const string& in_segments_csvs, vector<SEGMEN
         << elapsed.count() << " seconds" << hana::endl;);
 #endif
     vector<string> files;
-    std::string in_csvs = in_segments_csvs;
-    util::StringReplace(in_csvs, "/", "\\");
-    size_t n_pos = in_csvs.rfind("\\");
-    size_t end_index = (n_pos == std::string::npos) ? 0 : n_pos + 1;
-    std::string base_dir = in_csvs.substr(0, end_index);
-    if (false == util::FindFiles(in_csvs, files)){
-        err = "Error: cannot find file: " + in_segments_csvs;
+    if (false == FindSegmentsCsvFiles(in_segments_csvs, files, err)) {
         return false;
     }
     size_t concurrency = (files.size() > std::thread::hardware_concurrency()) ?
@@ -1286,19 +1597,19 @@ static bool LoadSegmentsCsvs_Multi(const string& in_segments_csvs, vector<SEGMEN
     std::vector<std::shared_ptr<std::thread> > threads(concurrency);
     for (size_t i = 0; i < concurrency; ++i) {
         threads[i] = std::make_shared<std::thread>(
-            [&files, i, &seg_blocks, base_dir, concurrency]() {
+            [&files, i, &seg_blocks, concurrency]() {
             size_t j = i;
             block_data& bd = seg_blocks[i];
             std::string part_file;
             do { 
-                if (!util::ReadAllFromFile(base_dir + files[j], part_file)) {
-                    bd.block_err = "Error in opening " + base_dir + files[j];
+                if (!util::ReadAllFromFile(files[j], part_file)) {
+                    bd.block_err = "Error in opening " + files[j];
                     return ;
                 }
                 bd.block_segs.reserve(part_file.size() / 110 * ((files.size() - 1) / concurrency + 1));
                 std::vector<char *> lines;
                 util::ParseCsvLineInPlace(lines, &part_file[0], '\n', true); // true means leave quotes alone
-                bd.block_err = ParserLinesToSegs(lines, bd.block_segs, base_dir + files[j]);
+                bd.block_err = ParserLinesToSegs(lines, bd.block_segs, files[j]);
                 if (!bd.block_err.empty()) {
                     return;
                 }
@@ -1433,8 +1744,30 @@ bool WayManager::LoadSegments(const std::string &segs_csv, bool reverse_seg/*= f
         << elapsed.count() << " seconds" << hana::endl;);
 #endif
 
-    vector<SEGMENT> segs;
+    std::vector<std::string> pathnames;
     std::string err;
+    if (segs_csv.find('*') != std::string::npos) {
+        if (false == FindSegmentsCsvFiles(segs_csv, pathnames, err)) {
+            this->SetErrorString(err);
+            return false;
+        }
+    }
+    else {
+        pathnames.push_back(segs_csv);
+    }
+
+    // gzipped files cannot be mapped, they are loaded via SEGMENTs
+    bool has_gz = false;
+    for (const auto& pathname : pathnames) {
+        if (pathname.size() > 3 && pathname.substr(pathname.size() - 3) == ".gz") {
+            has_gz = true;
+        }
+    }
+    if (!has_gz) {
+        return LoadSegmentsStreaming(pathnames, reverse_seg);
+    }
+
+    vector<SEGMENT> segs;
     if (segs_csv.find('*') != std::string::npos) {
         if (false == LoadSegmentsCsvs_Multi(segs_csv, segs, err)) {
             this->SetErrorString(err);
@@ -1462,58 +1795,643 @@ bool WayManager::LoadSegments(const std::string &segs_csv, bool reverse_seg/*= f
     return LoadSegments(segs, reverse_seg);
 }
 
-// init all Node::connected_segments_ and all Segment::p_from_nd_, p_to_nd_
-bool WayManager::InitNodeConnectedSegs()
+// streaming loader, no vector<SEGMENT> in between
+
+// a field in the mapped data which is not '\0' terminated
+struct CSV_FIELD
 {
-#if WAY_MANAGER_HANA_LOG == 1
-    hana::Logger logger("WayManager");
-    auto start = std::chrono::system_clock::now();
-    AT_SCOPE_EXIT(std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
-    HANA_SDK_DEBUG(logger) << "WayManager::InitNodeConnectedSegs(): run time "
-        << elapsed.count() << " seconds" << hana::endl;);
-#endif
+    const char *begin;
+    const char *end;
+};
 
-    for (const auto& entry : seg_map_) {
-        const SegmentPtr& p_seg = entry.second;
-        if (0 == p_seg->from_nd_|| 0 == p_seg->to_nd_) {
-            SetErrorString("Error: WayManager: invalid from/to node: "
-                + std::to_string(p_seg->from_nd_) + "/" + std::to_string(p_seg->to_nd_));
-            return false;
-        }
+static inline bool IsCsvSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
 
-        if (nullptr == p_seg->p_from_nd_) {
-            p_seg->p_from_nd_ = node_map_[p_seg->from_nd_];
-            if (nullptr == p_seg->p_from_nd_) {
-                SetErrorString("Error: WayManager: cannot get node info for "
-                    + std::to_string(p_seg->from_nd_));
-                return false;
+// splits the line [p, p_end) the same way as util::ParseCsvLineInPlace() does, but without
+// modifying the data. return the number of fields, the ones after max_fields are dropped
+static size_t SplitCsvFields(const char *p, const char *p_end, CSV_FIELD *fields,
+    size_t max_fields)
+{
+    size_t n_fields = 0;
+    while (true) {
+        while (p < p_end && IsCsvSpace(*p)) {
+            ++p;
+        }
+
+        CSV_FIELD field;
+        const char *p_quote_end = nullptr;
+        bool in_quotes = false;
+        if (p < p_end && *p == '"') {
+            in_quotes = true;
+            ++p;
+        }
+        field.begin = p;
+        for (; p < p_end; ++p) {
+            const char c = *p;
+            if (in_quotes) {
+                if (c == '"') {
+                    if (p + 1 < p_end && p[1] == '"') {
+                        ++p; // 2 double quotes in a row, kept as they are
+                    }
+                    else {
+                        in_quotes = false;
+                        p_quote_end = p;
+                    }
+                }
+            }
+            else if (c == ',' || c == '\r') {
+                break;
             }
         }
-        if (nullptr == p_seg->p_to_nd_) {
-            p_seg->p_to_nd_ = node_map_[p_seg->to_nd_];
-            if (nullptr == p_seg->p_to_nd_) {
-                SetErrorString("Error: WayManager: cannot get node info for "
-                    + std::to_string(p_seg->to_nd_));
+        field.end = p_quote_end ? p_quote_end : p;
+        if (!p_quote_end) {
+            while (field.end > field.begin && IsCsvSpace(field.end[-1])) {
+                --field.end;
+            }
+        }
+        if (n_fields < max_fields) {
+            fields[n_fields] = field;
+        }
+        ++n_fields;
+
+        if (p >= p_end || *p == '\r') {
+            break;
+        }
+        ++p; // skip the delimiter
+    }
+    return n_fields < max_fields ? n_fields : max_fields;
+}
+
+// same as atoll(), stops at the first non-digit
+static inline long long CsvFieldToInt64(const CSV_FIELD& field)
+{
+    const char *p = field.begin;
+    bool negative = false;
+    if (p < field.end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+    long long value = 0;
+    for (; p < field.end && *p >= '0' && *p <= '9'; ++p) {
+        value = value * 10 + (*p - '0');
+    }
+    return negative ? -value : value;
+}
+
+static inline int CsvFieldToInt(const CSV_FIELD& field)
+{
+    return (int)CsvFieldToInt64(field);
+}
+
+static inline double CsvFieldToDouble(const CSV_FIELD& field)
+{
+#ifdef __cpp_lib_to_chars
+    double value = 0;
+    const char *p = field.begin;
+    if (p < field.end && *p == '+') {
+        ++p;
+    }
+    std::from_chars(p, field.end, value);
+    return value;
+#else
+    // strtod() needs a '\0' terminated string, the mapped data is not
+    char buff[64];
+    size_t len = (size_t)(field.end - field.begin);
+    if (len >= sizeof(buff)) {
+        len = sizeof(buff) - 1;
+    }
+    memcpy(buff, field.begin, len);
+    buff[len] = '\0';
+    return strtod(buff, nullptr);
+#endif
+}
+
+static inline std::string CsvFieldToStr(const CSV_FIELD& field)
+{
+    return std::string(field.begin, field.end);
+}
+
+struct CSV_BLOCK
+{
+    const char *begin;
+    const char *end;
+    const std::string *p_pathname;
+    size_t first_line;  // index of the first line among all the blocks
+    size_t line_count;
+    std::string err;
+    // for the blocks of binary segments files, line_count is the segment count then
+    const char *p_strs;
+    size_t strs_size;
+    double coord_precision;
+};
+
+static size_t CountCsvLines(const char *begin, const char *end)
+{
+    size_t count = 0;
+    const char *p = begin;
+    while (p < end) {
+        const char *p_eol = (const char *)memchr(p, '\n', end - p);
+        ++count;
+        if (!p_eol) {
+            break;
+        }
+        p = p_eol + 1;
+    }
+    return count;
+}
+
+// one slot per line in segs[], the slots of comments and invalid lines are left with seg_id_ 0
+static void ParseCsvBlockToSegs(CSV_BLOCK& block, std::vector<Segment>& segs)
+{
+    //#SEG_ID, FROM_LAT, FROM_LNG, TO_LAT, TO_LNG, ONE_WAY, LENGTH, WAY_ID, WAY_SUB_SEQ, SPLIT_SEQ,
+    // FROM_ND, TO_ND, WAY_TYPE, WAY_NAME, STRUCT_TYPE, LAYER, OPT_TAGS
+    CSV_FIELD fields[17];
+    std::string last_opt_tags_str;
+    SharedRawTagsPtr p_opt_tags;
+
+    size_t i_seg = block.first_line;
+    const char *p = block.begin;
+    for (; p < block.end; ++i_seg) {
+        const char *p_eol = (const char *)memchr(p, '\n', block.end - p);
+        const char *p_line_end = p_eol ? p_eol : block.end;
+        const char *p_line = p;
+        p = p_line_end + 1;
+
+        while (p_line < p_line_end && IsCsvSpace(*p_line)) {
+            ++p_line;
+        }
+        if (p_line >= p_line_end || *p_line == '#') { // ignore empty and comment lines
+            continue;
+        }
+
+        const size_t n_fields = SplitCsvFields(p_line, p_line_end, fields, _countof(fields));
+        if (n_fields < 13) {
+#ifdef _WIN32
+            printf("WARNING: ignore invalid line: \"%s\" in file %s\n",
+                std::string(p_line, p_line_end).c_str(), block.p_pathname->c_str());
+#endif
+            continue;
+        }
+        const SEG_ID_T seg_id = CsvFieldToInt64(fields[0]);
+        if (0 == seg_id) {
+            block.err = "Error in parsing segment ID: \"" + CsvFieldToStr(fields[0]) + '\"';
+            return;
+        }
+
+        if (n_fields >= 17) {
+            const CSV_FIELD& tags = fields[16];
+            const size_t tags_len = (size_t)(tags.end - tags.begin);
+            if (last_opt_tags_str.size() != tags_len ||
+                0 != memcmp(last_opt_tags_str.data(), tags.begin, tags_len)) {
+                last_opt_tags_str.assign(tags.begin, tags.end);
+                p_opt_tags = RawTags::Create(last_opt_tags_str);
+            }
+        }
+        else if (!last_opt_tags_str.empty() || p_opt_tags) {
+            last_opt_tags_str.clear();
+            p_opt_tags = nullptr;
+        }
+
+        static const std::string EMPTY_STR;
+        const bool one_way = (fields[5].end - fields[5].begin == 1 && fields[5].begin[0] == '1');
+        segs[i_seg] = Segment(seg_id, CsvFieldToInt64(fields[7]),
+            CsvFieldToInt(fields[8]), CsvFieldToInt(fields[9]),
+            CsvFieldToInt64(fields[10]), CsvFieldToInt64(fields[11]),
+            CsvFieldToDouble(fields[1]), CsvFieldToDouble(fields[2]),
+            CsvFieldToDouble(fields[3]), CsvFieldToDouble(fields[4]),
+            one_way, static_cast<geo::HIGHWAY_TYPE>(CsvFieldToInt(fields[12])), EMPTY_STR,
+            n_fields >= 14 ? CsvFieldToStr(fields[13]) : EMPTY_STR,
+            n_fields >= 15 ? static_cast<STRUCT_TYPE>(CsvFieldToInt(fields[14])) : STRUCT_DEFAULT,
+            n_fields >= 16 ? static_cast<short>(CsvFieldToInt(fields[15])) : (short)0,
+            p_opt_tags);
+    }
+}
+
+// one slot per segment of the binary block in segs[], see way_manager_segbin.h
+static void DecodeSegBinBlock(CSV_BLOCK& block, std::vector<Segment>& segs)
+{
+    using namespace segbin;
+    DeltaState state;
+    uint64_t last_tags_str = 0;
+    SharedRawTagsPtr p_opt_tags;
+    auto get_str = [&block](uint64_t offset) {
+        return offset < block.strs_size ? block.p_strs + offset : "";
+    };
+
+    const char *p = block.begin;
+    for (size_t i = 0; i < block.line_count; ++i) {
+        int64_t seg_id, way_id, from_nd, to_nd, from_lat, from_lng, to_lat, to_lng;
+        int64_t way_sub_seq, split_seq, layer;
+        uint64_t flags, way_type, struct_type, name_str, highway_str, tags_str;
+        bool ok = GetSVarint(p, block.end, seg_id) && GetSVarint(p, block.end, way_id) &&
+            GetVarint(p, block.end, flags);
+        from_nd = 0;
+        if (ok && (flags & SEGF_FROM_ND_IS_PREV_TO_ND) == 0) {
+            ok = GetSVarint(p, block.end, from_nd);
+        }
+        ok = ok && GetSVarint(p, block.end, to_nd);
+        from_lat = from_lng = 0;
+        if (ok && (flags & SEGF_FROM_PT_IS_PREV_TO_PT) == 0) {
+            ok = GetSVarint(p, block.end, from_lat) && GetSVarint(p, block.end, from_lng);
+        }
+        ok = ok && GetSVarint(p, block.end, to_lat) && GetSVarint(p, block.end, to_lng) &&
+            GetSVarint(p, block.end, way_sub_seq) && GetSVarint(p, block.end, split_seq) &&
+            GetVarint(p, block.end, way_type) && GetVarint(p, block.end, struct_type) &&
+            GetSVarint(p, block.end, layer) && GetVarint(p, block.end, name_str) &&
+            GetVarint(p, block.end, highway_str) && GetVarint(p, block.end, tags_str);
+        if (!ok) {
+            block.err = "Error in decoding binary segments file " + *block.p_pathname;
+            return;
+        }
+
+        // deltas to absolute values
+        seg_id += state.seg_id;
+        way_id += state.way_id;
+        from_nd += state.to_nd;
+        to_nd += from_nd;
+        from_lat += state.to_lat;
+        from_lng += state.to_lng;
+        to_lat += from_lat;
+        to_lng += from_lng;
+        state.seg_id = seg_id;
+        state.way_id = way_id;
+        state.to_nd = to_nd;
+        state.to_lat = to_lat;
+        state.to_lng = to_lng;
+        if (0 == seg_id) {
+            block.err = "Invalid segment ID 0 in binary segments file " + *block.p_pathname;
+            return;
+        }
+
+        if (tags_str != last_tags_str) {
+            last_tags_str = tags_str;
+            p_opt_tags = RawTags::Create(get_str(tags_str));
+        }
+        segs[block.first_line + i] = Segment(seg_id, way_id, (int)way_sub_seq, (int)split_seq,
+            from_nd, to_nd, from_lat / block.coord_precision, from_lng / block.coord_precision,
+            to_lat / block.coord_precision, to_lng / block.coord_precision,
+            (flags & SEGF_ONE_WAY) != 0, static_cast<HIGHWAY_TYPE>(way_type),
+            get_str(highway_str), get_str(name_str), static_cast<STRUCT_TYPE>(struct_type),
+            (short)layer, p_opt_tags);
+    }
+}
+
+//
+// map the files -> split into blocks at line ends -> count the lines of each block in parallel
+// -> one pool slot per line -> parse each block into its own slots in parallel
+//
+bool WayManager::LoadSegmentsStreaming(const std::vector<std::string> &pathnames,
+    bool reversed_seg)
+{
+    init_stats_ = WayManagerInitStats();
+    init_stats_.thread_count = (int)std::max(1u, std::thread::hardware_concurrency());
+    auto start = util::GetTimeInMs64();
+
+    std::vector<std::unique_ptr<util::MappedFile>> files;
+    for (const auto& pathname : pathnames) {
+        files.emplace_back(new util::MappedFile());
+        if (!files.back()->Open(pathname)) {
+            SetErrorString("Error in opening file: " + pathname);
+            return false;
+        }
+        files.back()->WillNeed();
+    }
+
+    size_t concurrency = std::thread::hardware_concurrency();
+    if (concurrency == 0) concurrency = 2;
+    const size_t blocks_per_file = std::max((size_t)1, concurrency / files.size());
+    const size_t MIN_BLOCK_SIZE = 64 * 1024;
+
+    std::vector<CSV_BLOCK> blocks;
+    for (size_t i_file = 0; i_file < files.size(); ++i_file) {
+        const char *p_data = files[i_file]->Data();
+        const char *p_end = p_data + files[i_file]->Size();
+        if (segbin::IsSegBin(p_data, files[i_file]->Size())) {
+            // binary segments file, the blocks are given by its index
+            segbin::FileHeader header;
+            const segbin::BlockRecord *p_block_records;
+            const char *p_strs;
+            std::string err;
+            if (!segbin::ReadHeader(p_data, files[i_file]->Size(), header, p_block_records,
+                p_strs, err)) {
+                SetErrorString(err + ": " + pathnames[i_file]);
                 return false;
             }
+            for (uint64_t i = 0; i < header.block_count; ++i) {
+                const auto& record = p_block_records[i];
+                CSV_BLOCK block{ p_data + record.offset, p_data + record.offset + record.size,
+                    &pathnames[i_file], 0, (size_t)record.seg_count, std::string(),
+                    p_strs, (size_t)header.strs_size, header.coord_precision };
+                blocks.push_back(block);
+            }
+            continue;
+        }
+
+        const size_t block_size = std::max(MIN_BLOCK_SIZE,
+            files[i_file]->Size() / blocks_per_file + 1);
+        for (const char *p = p_data; p < p_end;) {
+            const char *p_block_end = p_end;
+            if ((size_t)(p_end - p) > block_size) {
+                p_block_end = (const char *)memchr(p + block_size, '\n', p_end - p - block_size);
+                p_block_end = p_block_end ? p_block_end + 1 : p_end;
+            }
+            CSV_BLOCK block{ p, p_block_end, &pathnames[i_file], 0, 0, std::string(),
+                nullptr, 0, 0 };
+            blocks.push_back(block);
+            p = p_block_end;
+        }
+    }
+
+    // the threads pick the blocks one by one
+    auto par_for_blocks = [&blocks, concurrency](const std::function<void(CSV_BLOCK&)>& work) {
+        std::atomic<size_t> next_block{ 0 };
+        const size_t n_threads = std::min(concurrency, blocks.size());
+        std::vector<std::shared_ptr<std::thread>> threads(n_threads);
+        for (auto& p_thread : threads) {
+            p_thread = std::make_shared<std::thread>([&blocks, &next_block, &work]() {
+                for (size_t i = next_block++; i < blocks.size(); i = next_block++) {
+                    work(blocks[i]);
+                }
+            });
+        }
+        for (auto& p_thread : threads) {
+            p_thread->join();
         }
+    };
 
-        // populate Node::connected_segments_, make sure no duplicated segments
-        auto it = std::find_if(p_seg->p_from_nd_->connected_segments_.begin(),
-            p_seg->p_from_nd_->connected_segments_.end(),
-            [&p_seg](const SegmentPtr& s) {return p_seg->seg_id_ == s->seg_id_; });
-        if (it == p_seg->p_from_nd_->connected_segments_.end()) {
-            p_seg->p_from_nd_->connected_segments_.push_back(p_seg);
+    par_for_blocks([](CSV_BLOCK& block) {
+        if (!block.p_strs) {
+            block.line_count = CountCsvLines(block.begin, block.end);
         }
+    });
+    size_t line_count = 0;
+    for (auto& block : blocks) {
+        block.first_line = line_count;
+        line_count += block.line_count;
+    }
+    if (line_count == 0) {
+        SetErrorString("No rows found in segments file: " + pathnames.front());
+        return false;
+    }
+
+    // the segments are parsed in place, the pool is not reallocated from here on
+    node_map_.clear();
+    seg_map_.clear();
+    node_pool_.Clear();
+    seg_pool_.Clear();
+    seg_pool_.Reserve(line_count);
+    std::vector<Segment>& segs = seg_pool_.AllObjs();
+    segs.resize(line_count, Segment(SEGMENT()));
 
-        it = std::find_if(p_seg->p_to_nd_->connected_segments_.begin(),
-            p_seg->p_to_nd_->connected_segments_.end(),
-            [&p_seg](const SegmentPtr& s) {return p_seg->seg_id_ == s->seg_id_; });
-        if (it == p_seg->p_to_nd_->connected_segments_.end()) {
-            p_seg->p_to_nd_->connected_segments_.push_back(p_seg);
+    par_for_blocks([&segs](CSV_BLOCK& block) {
+        if (block.p_strs) {
+            DecodeSegBinBlock(block, segs);
         }
+        else {
+            ParseCsvBlockToSegs(block, segs);
+        }
+    });
+    for (const auto& block : blocks) {
+        if (!block.err.empty()) {
+            SetErrorString(block.err);
+            return false;
+        }
+    }
+    files.clear();
+    init_stats_.parse_ms = util::GetTimeInMs64() - start;
+
+    return LoadSegmentsFromPool(reversed_seg);
+}
+
+bool WayManager::SaveSegmentsBinary(const std::vector<SEGMENT> &segs,
+    const std::string &pathname, std::string &err)
+{
+    segbin::Writer writer;
+    for (const auto& seg : segs) {
+        writer.AddSegment(seg);
     }
 
+    FILE *fp = fopen(pathname.c_str(), "wb");
+    if (fp == nullptr) {
+        err = "SaveSegmentsBinary: cannot open file " + pathname;
+        return false;
+    }
+    AT_SCOPE_EXIT(if (fp) fclose(fp););
+    if (!writer.Save(fp) || fclose(fp) != 0) {
+        fp = nullptr;
+        err = "SaveSegmentsBinary: error in writing file " + pathname;
+        return false;
+    }
+    fp = nullptr;
+    return true;
+}
+
+bool WayManager::SaveSegmentsBinary(const std::string &pathname) const
+{
+    const auto &segs = seg_pool_.AllObjs();
+    if (segs.empty()) {
+        SetErrorString("SaveSegmentsBinary: no segments loaded");
+        return false;
+    }
+
+    std::vector<SEGMENT> out_segs;
+    out_segs.reserve(segs.size());
+    for (const auto &seg : segs) {
+        out_segs.push_back(seg.ToSEGMENT());
+        // one-way segments were turned into two-way by their fake reversed segments
+        if (reversed_seg_ && seg_map_.find(-seg.seg_id_) != seg_map_.end()) {
+            out_segs.back().one_way = true;
+        }
+    }
+
+    std::string err;
+    if (false == SaveSegmentsBinary(out_segs, pathname, err)) {
+        SetErrorString(err);
+        return false;
+    }
+    return true;
+}
+
+// seg_pool_ is filled with the loaded segments, the ones with seg_id_ 0 are skipped
+bool WayManager::LoadSegmentsFromPool(bool reversed_seg)
+{
+    const auto start = util::GetTimeInMs64();
+    std::vector<Segment>& segs = seg_pool_.AllObjs();
+    node_map_.clear();
+    seg_map_.clear();
+    node_pool_.Clear();
+
+    // drop the empty slots
+    segs.erase(std::remove_if(segs.begin(), segs.end(),
+        [](const Segment& seg) { return seg.seg_id_ == 0; }), segs.end());
+    if (segs.empty()) {
+        SetErrorString("Error: WayManager: too few segments to load");
+        return false;
+    }
+
+    // segs[] are preferred to be orderred by "WAY_ID", "WAY_SUB_SEQ", "SPLIT_SEQ", which is
+    // usually the case in the CSV files already
+    auto seg_less = [](const Segment& i, const Segment& j) {
+        if (i.way_id_ != j.way_id_) {
+            return i.way_id_ < j.way_id_;
+        }
+        if (i.way_sub_seq_ != j.way_sub_seq_) {
+            return i.way_sub_seq_ < j.way_sub_seq_;
+        }
+        return i.split_seq_ < j.split_seq_;
+    };
+    if (!std::is_sorted(segs.begin(), segs.end(), seg_less)) {
+        util::ParSort(segs.begin(), segs.end(), seg_less, 4);
+    }
+
+    // if part of the way is in bound, keep all the segments of the way
+    size_t n_kept = 0;
+    for (size_t i_begin = 0; i_begin < segs.size();) {
+        const WAY_ID_T way_id = segs[i_begin].way_id_;
+        geo::Bound way_bound(segs[i_begin].from_point_.lat, segs[i_begin].from_point_.lng,
+            segs[i_begin].from_point_.lat, segs[i_begin].from_point_.lng);
+        size_t i_end = i_begin;
+        for (; i_end < segs.size() && segs[i_end].way_id_ == way_id; ++i_end) {
+            way_bound.Expand(segs[i_end].from_point_.lat, segs[i_end].from_point_.lng);
+            way_bound.Expand(segs[i_end].to_point_.lat, segs[i_end].to_point_.lng);
+        }
+        if (way_bound.IntersectBound(bound_)) {
+            for (size_t i = i_begin; i < i_end; ++i, ++n_kept) {
+                if (n_kept != i) {
+                    segs[n_kept] = std::move(segs[i]);
+                }
+            }
+        }
+        i_begin = i_end;
+    }
+    segs.erase(segs.begin() + n_kept, segs.end());
+
+    seg_map_.reserve(segs.size());
+    for (auto& seg : segs) {
+        seg_map_.insert({ seg.seg_id_, &seg });
+        node_map_.emplace(seg.from_nd_, nullptr);
+        node_map_.emplace(seg.to_nd_, nullptr);
+    }
+    node_pool_.Reserve(node_map_.size());
+    for (const auto& seg : segs) {
+        NodePtr& p_from_nd = node_map_[seg.from_nd_];
+        if (nullptr == p_from_nd) {
+            p_from_nd = node_pool_.AllocNew(Node(seg.from_nd_, seg.from_point_.lat,
+                seg.from_point_.lng));
+        }
+        NodePtr& p_to_nd = node_map_[seg.to_nd_];
+        if (nullptr == p_to_nd) {
+            p_to_nd = node_pool_.AllocNew(Node(seg.to_nd_, seg.to_point_.lat,
+                seg.to_point_.lng));
+        }
+    }
+    init_stats_.seg_node_maps_ms = util::GetTimeInMs64() - start;
+
+    return DoneLoadSegments(reversed_seg);
+}
+
+// init all Node::connected_segments_ and all Segment::p_from_nd_, p_to_nd_
+bool WayManager::InitNodeConnectedSegs()
+{
+#if WAY_MANAGER_HANA_LOG == 1
+    hana::Logger logger("WayManager");
+    auto start = std::chrono::system_clock::now();
+    AT_SCOPE_EXIT(std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+    HANA_SDK_DEBUG(logger) << "WayManager::InitNodeConnectedSegs(): run time "
+        << elapsed.count() << " seconds" << hana::endl;);
+#endif
+
+    std::vector<SegmentPtr> segs;
+    segs.reserve(seg_map_.size());
+    for (const auto& entry : seg_map_) {
+        segs.push_back(entry.second);
+    }
+
+    // resolve the nodes and count the connected segments of each node
+    Node *p_nodes = node_pool_.Size() ? &node_pool_[0] : nullptr;
+    const size_t n_nodes = node_pool_.Size();
+    std::vector<std::atomic<unsigned int>> degrees(n_nodes);
+    std::mutex err_mutex;
+    std::string err;
+    batch::ParForBlocks(segs.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const SegmentPtr& p_seg = segs[i];
+            std::string seg_err;
+            if (0 == p_seg->from_nd_ || 0 == p_seg->to_nd_) {
+                seg_err = "Error: WayManager: invalid from/to node: "
+                    + std::to_string(p_seg->from_nd_) + "/" + std::to_string(p_seg->to_nd_);
+            }
+            for (int k = 0; k < 2 && seg_err.empty(); ++k) {
+                NodePtr& p_node = (k == 0) ? p_seg->p_from_nd_ : p_seg->p_to_nd_;
+                const NODE_ID_T nd_id = (k == 0) ? p_seg->from_nd_ : p_seg->to_nd_;
+                if (nullptr == p_node) {
+                    auto it = node_map_.find(nd_id);
+                    if (it != node_map_.end()) {
+                        p_node = it->second;
+                    }
+                }
+                if (nullptr == p_node || p_node < p_nodes || p_node >= p_nodes + n_nodes) {
+                    seg_err = "Error: WayManager: cannot get node info for "
+                        + std::to_string(nd_id);
+                }
+            }
+            if (!seg_err.empty()) {
+                std::lock_guard<std::mutex> guard(err_mutex);
+                err = seg_err;
+                return;
+            }
+
+            ++degrees[p_seg->p_from_nd_ - p_nodes];
+            if (p_seg->p_to_nd_ != p_seg->p_from_nd_) {
+                ++degrees[p_seg->p_to_nd_ - p_nodes];
+            }
+        }
+    });
+    if (!err.empty()) {
+        SetErrorString(err);
+        return false;
+    }
+
+    // the segment indices of node i are in seg_indices[offsets[i], offsets[i + 1])
+    std::vector<size_t> offsets(n_nodes + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < n_nodes; ++i) {
+        offsets[i + 1] = offsets[i] + degrees[i];
+        degrees[i] = (unsigned int)offsets[i]; // as the write position from here on
+    }
+    std::vector<unsigned int> seg_indices(offsets[n_nodes]);
+    batch::ParForBlocks(segs.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const SegmentPtr& p_seg = segs[i];
+            seg_indices[degrees[p_seg->p_from_nd_ - p_nodes]++] = (unsigned int)i;
+            if (p_seg->p_to_nd_ != p_seg->p_from_nd_) {
+                seg_indices[degrees[p_seg->p_to_nd_ - p_nodes]++] = (unsigned int)i;
+            }
+        }
+    });
+
+    // populate Node::connected_segments_ in the order of seg_map_, make sure no duplicated
+    // segments
+    batch::ParForBlocks(n_nodes, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& conn_segs = p_nodes[i].connected_segments_;
+            const bool check_dup = !conn_segs.empty();
+            std::sort(seg_indices.begin() + offsets[i], seg_indices.begin() + offsets[i + 1]);
+            conn_segs.reserve(conn_segs.size() + offsets[i + 1] - offsets[i]);
+            for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+                const SegmentPtr& p_seg = segs[seg_indices[k]];
+                if (check_dup && std::find_if(conn_segs.begin(), conn_segs.end(),
+                    [&p_seg](const SegmentPtr& s) {return p_seg->seg_id_ == s->seg_id_; }) !=
+                    conn_segs.end()) {
+                    continue;
+                }
+                conn_segs.push_back(p_seg);
+            }
+        }
+    });
+
     return true;
 }
 
@@ -1654,6 +2572,10 @@ bool WayManager_LoadSegmentsT(WayManager &way_manager,
     way_manager.node_pool_.Reserve(num_rows * 3 / 4);
     way_manager.seg_pool_.Reserve(num_rows);
 
+    way_manager.init_stats_ = WayManagerInitStats();
+    way_manager.init_stats_.thread_count = (int)std::max(1u, std::thread::hardware_concurrency());
+    const auto start = util::GetTimeInMs64();
+
 #if WAY_MANAGER_HANA_LOG == 1
     hana::Logger logger("WayManager");
     auto start0 = std::chrono::system_clock::now();
@@ -1666,7 +2588,7 @@ bool WayManager_LoadSegmentsT(WayManager &way_manager,
 
     NODE_ID_T last_from_id = 0, last_to_id = 0;
     std::string last_opt_tags_str;
-    SharedTagsPtr p_opt_tags;
+    SharedRawTagsPtr p_opt_tags;
 
     for (auto const& one_seg : segs) {
         SEGMENT_PTR seg(one_seg);
@@ -1695,7 +2617,7 @@ bool WayManager_LoadSegmentsT(WayManager &way_manager,
         }
 
         if (last_opt_tags_str != seg->opt_tags) {
-            p_opt_tags = Segment::StrToTags(seg->opt_tags);
+            p_opt_tags = RawTags::Create(seg->opt_tags);
             last_opt_tags_str = seg->opt_tags;
         }
 
@@ -1727,33 +2649,55 @@ bool WayManager_LoadSegmentsT(WayManager &way_manager,
         last_to_id = p_seg->to_nd_;
     }
 
+    way_manager.init_stats_.seg_node_maps_ms = util::GetTimeInMs64() - start;
+
 #if WAY_MANAGER_HANA_LOG == 1
     std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start0;
     HANA_SDK_DEBUG(logger) << "WayManager::LoadSegments(segs) part 1: run time "
         << elapsed.count() << " seconds" << hana::endl;
 #endif
 
-    way_manager.InitNodeConnectedSegs();
+    return way_manager.DoneLoadSegments(reversed_seg);
+}
+
+// segment and node maps are ready
+bool WayManager::DoneLoadSegments(bool reversed_seg)
+{
+    reversed_seg_ = reversed_seg;
+    auto start = util::GetTimeInMs64();
+    InitNodeConnectedSegs();
+    init_stats_.node_conn_segs_ms = util::GetTimeInMs64() - start;
 
     // for generation of fake reversed segments
     if (reversed_seg) {
-        way_manager.GenerateReversedSegsIntoSegMap();
+        start = util::GetTimeInMs64();
+        GenerateReversedSegsIntoSegMap();
+        init_stats_.reversed_segs_ms = util::GetTimeInMs64() - start;
 
         // clear and re-generate all nodes' connectd segments
-        for (auto& e : way_manager.node_map_) {
+        start = util::GetTimeInMs64();
+        for (auto& e : node_map_) {
             e.second->ConnectedSegments().clear();
         }
-        way_manager.InitNodeConnectedSegs();
+        InitNodeConnectedSegs();
+        init_stats_.node_conn_segs_ms += util::GetTimeInMs64() - start;
     }
 
-    way_manager.DoneAddNodeMap(way_manager.node_pool_);
+    start = util::GetTimeInMs64();
+    init_stats_.weak_component_count = DoneAddNodeMap(node_pool_);
+    init_stats_.node_flags_ms = util::GetTimeInMs64() - start;
 
-    if (false == way_manager.InitWayMap()) {
+    start = util::GetTimeInMs64();
+    if (false == InitWayMap()) {
         return false;
     }
+    init_stats_.way_map_ms = util::GetTimeInMs64() - start;
+    init_stats_.seg_count = seg_map_.size();
+    init_stats_.node_count = node_map_.size();
+    init_stats_.way_count = way_map_.size();
 
-    if (way_manager.seg_map_.empty()) {
-        way_manager.SetErrorString("Error: too few segments or invalid bound");
+    if (seg_map_.empty()) {
+        SetErrorString("Error: too few segments or invalid bound");
         return false;
     }
     return true;
@@ -1815,12 +2759,24 @@ static double CalcDistanceSquareMeters(const geo::GeoPoint &coord, const Segment
     return geo::distance_point_to_segment_square(coord, seg.from_point_, seg.to_point_);
 }
 
+#if SEG_FIXED_POINT_FILTER == 1
+// the fixed point distances are never more than the double ones plus FIXED_FILTER_MARGIN meters
+static const double FIXED_FILTER_MARGIN = 0.5;
+#endif
+
 struct Tile
 {
 public:
     TILE_XY tile_id;
     std::vector<SegmentPtr> segments;
     std::vector<SegmentPtr> segments_with_neighbours;
+#if SEG_FIXED_POINT_FILTER == 1
+    // the coordinates of segments_with_neighbours in microdegrees, 4 arrays one after another:
+    // from lats, from lngs, to lats, to lngs
+    std::vector<int> fixed_coords;
+    // indexes of the segments too short for the filtering, see FixedDistancesSquare()
+    std::vector<int> short_segs;
+#endif
 
 public:
     Tile() : tile_id(0)
@@ -1839,9 +2795,54 @@ public:
             segments.push_back(p_seg);
         }
     }
+
+#if SEG_FIXED_POINT_FILTER == 1
+    // to be called each time segments_with_neighbours is set
+    void InitFixedCoords()
+    {
+        const size_t n = segments_with_neighbours.size();
+        std::vector<int>(n * 4).swap(fixed_coords);
+        short_segs.clear();
+        for (size_t i = 0; i < n; ++i) {
+            const Segment &seg = *segments_with_neighbours[i];
+            fixed_coords[i] = FixedGeoPoint::Lat2FixedLat(seg.from_point_.lat);
+            fixed_coords[n + i] = FixedGeoPoint::Lng2FixedLng(seg.from_point_.lng);
+            fixed_coords[n * 2 + i] = FixedGeoPoint::Lat2FixedLat(seg.to_point_.lat);
+            fixed_coords[n * 3 + i] = FixedGeoPoint::Lng2FixedLng(seg.to_point_.lng);
+
+            // geo::distance_point_to_segment_square() does not project on them
+            const double abx = seg.to_point_.lng - seg.from_point_.lng;
+            const double aby = seg.to_point_.lat - seg.from_point_.lat;
+            if (abx * abx + aby * aby <= 10e-12) {
+                short_segs.push_back((int)i);
+            }
+        }
+    }
+
+    // distances[i]: squared meters from pos to segments_with_neighbours[i], in float. never more
+    // than the one of CalcDistanceSquareMeters() plus FIXED_FILTER_MARGIN meters, so the segments
+    // beyond radius + FIXED_FILTER_MARGIN can be skipped
+    void FixedDistancesSquare(const geo::GeoPoint& pos, float *distances) const
+    {
+        const size_t n = segments_with_neighbours.size();
+        const int *p = fixed_coords.data();
+        geo::distance_point_to_segments_square(FixedGeoPoint(pos), p, p + n, p + n * 2,
+            p + n * 3, distances, n);
+        for (int i : short_segs) {
+            distances[i] = 0;
+        }
+    }
+#endif
 };
 typedef Tile* TilePtr;
 
+// to add (p_setting not null) or to remove (p_setting is null) the exclusion of segments
+struct ExclusionChange
+{
+    const std::vector<SegmentPtr> *p_segs;
+    std::shared_ptr<EXCLUSION_SETTING> p_setting;
+};
+
 // NOTE: this segment manager implementation merge two-way segment as only one. It merges them into
 // one if two are found.
 class SegmentManager
@@ -1849,7 +2850,8 @@ class SegmentManager
 public:
     explicit SegmentManager(const SegmentMap& all_segs_map, const Bound& bound, int match_priority)
         : all_segs_map_(all_segs_map), bound_(bound), match_priority_(match_priority),
-        local_utc_diff_(8 * 3600) // timezone default China
+        local_utc_diff_(8 * 3600), // timezone default China
+        p_exclusion_overlay_(std::make_shared<ExclusionOverlay>())
     {
         GRID_CELL_ZOOM_LEVEL = geo::span_to_zoom_level(CELL_SIZE, (bound.minlat + bound.maxlat) / 2);
 
@@ -1892,9 +2894,27 @@ public:
         return true;
     }
 
+    // the count of the segment references of the tiles (segments_with_neighbours), and the bytes
+    // of their fixed point copies
+    void GetTileMemStats(size_t &seg_refs, size_t &fixed_coords_bytes) const
+    {
+        seg_refs = 0;
+        fixed_coords_bytes = 0;
+        for (int y = 0; y < tile_mat_.height(); ++y) {
+            for (int x = 0; x < tile_mat_.width(); ++x) {
+                const Tile &tile = tile_mat_(y, x);
+                seg_refs += tile.segments_with_neighbours.size();
+#if SEG_FIXED_POINT_FILTER == 1
+                fixed_coords_bytes += tile.fixed_coords.size() * sizeof(int) +
+                    tile.short_segs.size() * sizeof(int);
+#endif
+            }
+        }
+    }
+
     const std::string& GetErrorString() const
     {
-        return WayManager::GetCurThreadErrStr(threads_err_mutex_, threads_err_strs_);
+        return WayManager::GetCurThreadErrStr(threads_err_strs_);
     }
 
     SegmentPtr AssignSegment(const geo::GeoPoint& point, const SegAssignParams& params,
@@ -1905,7 +2925,7 @@ public:
         }
         TilePtr p_tile = GetTileByPos(point);
         if (!p_tile) {
-            WayManager::SetCurThreadErrStr(threads_err_mutex_, threads_err_strs_,
+            WayManager::SetCurThreadErrStr(threads_err_strs_,
                 "AssignSegment: coordinate's tile not in range");
             return nullptr;
         }
@@ -1913,7 +2933,7 @@ public:
         const std::vector<SegmentPtr>& arrSegs = p_tile->segments_with_neighbours;
         const size_t MAX = 512 * 6;
         if (arrSegs.size() > MAX) {
-            WayManager::SetCurThreadErrStr(threads_err_mutex_, threads_err_strs_,
+            WayManager::SetCurThreadErrStr(threads_err_strs_,
                 "AssignSegment: BUFFER SIZE TOO SMALL!!!, SEGMENTS NUMBER IS " +
                 std::to_string(arrSegs.size()));
             return nullptr;
@@ -1923,9 +2943,20 @@ public:
         int aCandidatesIndexes[MAX];
         int candidateCount = 0;
         const double radius2 = params.radius * params.radius;
+#if SEG_FIXED_POINT_FILTER == 1
+        float aFixedDistances[MAX];
+        p_tile->FixedDistancesSquare(point, aFixedDistances);
+        const float fixed_radius2 = (float)((params.radius + FIXED_FILTER_MARGIN) *
+            (params.radius + FIXED_FILTER_MARGIN));
+#endif
 
         const int segs_count = (int)arrSegs.size();
         for (int i = 0; i < segs_count; i++) {
+#if SEG_FIXED_POINT_FILTER == 1
+            if (aFixedDistances[i] >= fixed_radius2) {
+                continue;
+            }
+#endif
             const SegmentPtr& pSeg = arrSegs[i];
 
             if (params.ignore_reverse_segs && pSeg->seg_id_ < 0) {
@@ -1997,13 +3028,13 @@ public:
                 continue;
             }
 
-            if (params.check_no_gps_route && pSeg->excluded_no_gps_) {
+            if (params.check_no_gps_route && pSeg->ExcludedNoGps()) {
                 continue;
             }
 
             // seg is excluded. e.g., some tunnels may be closed in the middle night
-            if (params.dev_data_time && pSeg->excluded_flag_) {
-                if (pSeg->excluded_always_) {
+            if (params.dev_data_time && pSeg->ExcludedFlag()) {
+                if (pSeg->ExcludedAlways()) {
                     continue;
                 }
                 if (this->IsSegmentExcluded(pSeg, params.dev_data_time,
@@ -2020,6 +3051,8 @@ public:
         }
 
         if (candidateCount == 0) {
+            WayManager::SetCurThreadErrStr(threads_err_strs_,
+                "AssignSegment: no segment within the radius");
             return nullptr;
         }
         else if (candidateCount == 1) {
@@ -2314,7 +3347,7 @@ public:
         return 2 * d + theta;
     }
 
-    bool SetExclusionSegs(std::vector<SegmentPtr> &segs, const EXCLUSION_SETTING &setting)
+    static std::shared_ptr<EXCLUSION_SETTING> NewExclusionSetting(const EXCLUSION_SETTING &setting)
     {
         auto p_setting = std::make_shared<EXCLUSION_SETTING>(setting);
         if (p_setting->ex_type == EXTYPE_DAILY_TIME_RANGE) {
@@ -2330,29 +3363,110 @@ public:
             p_setting->time_range_from = shift_to_y2k(p_setting->time_range_from);
             p_setting->time_range_to = shift_to_y2k(p_setting->time_range_to);
         }
+        return p_setting;
+    }
+
+    // copy-on-write of the exclusion overlay, then publish it as a new version. copying costs
+    // O(excluded segments) pointer copies, the segment map and the tiles are not touched.
+    // NOTE: writers are not thread safe among themselves, WayManager serializes them
+    bool UpdateExclusions(const std::vector<ExclusionChange> &changes)
+    {
+        auto p_overlay = std::make_shared<ExclusionOverlay>(
+            *std::atomic_load(&p_exclusion_overlay_));
+        ++p_overlay->version;
+        for (const auto &change : changes) {
+            for (const auto &p_seg : *change.p_segs) {
+                if (change.p_setting) {
+                    p_overlay->settings[p_seg->seg_id_] = change.p_setting;
+                }
+                else {
+                    p_overlay->settings.erase(p_seg->seg_id_);
+                }
+            }
+        }
 
-        for (auto &p_seg : segs) {
-            p_seg->excluded_flag_ = 1;
-            p_seg->excluded_always_ = (setting.ex_type == EXTYPE_ALWAYS) ? 1 : 0;
-            p_seg->excluded_no_gps_ = (setting.ex_type == EXTYPE_NO_GPS) ? 1 : 0;
+        // flags of removed exclusions are cleared before publishing, flags of added ones are
+        // set after publishing, so that readers never see a flag without its setting
+        for (const auto &change : changes) {
+            for (const auto &p_seg : *change.p_segs) {
+                if (p_overlay->settings.find(p_seg->seg_id_) == p_overlay->settings.end()) {
+                    p_seg->excluded_flags_.Set(EXTYPE_NONE);
+                }
+            }
+        }
+        std::atomic_store(&p_exclusion_overlay_,
+            std::shared_ptr<const ExclusionOverlay>(std::move(p_overlay)));
 
-            excluded_seg_map_[p_seg->seg_id_] = p_setting;
+        auto p_published = std::atomic_load(&p_exclusion_overlay_);
+        for (const auto &change : changes) {
+            for (const auto &p_seg : *change.p_segs) {
+                auto it = p_published->settings.find(p_seg->seg_id_);
+                if (it != p_published->settings.end()) {
+                    p_seg->excluded_flags_.Set(it->second->ex_type);
+                }
+            }
         }
         return true;
     }
 
+    bool SetExclusionSegs(std::vector<SegmentPtr> &segs, const EXCLUSION_SETTING &setting)
+    {
+        return UpdateExclusions({ ExclusionChange{ &segs, NewExclusionSetting(setting) } });
+    }
+
+    unsigned long long ExclusionVersion() const
+    {
+        return std::atomic_load(&p_exclusion_overlay_)->version;
+    }
+
+    // carry the exclusions over to another version of the map, for the segments still there.
+    // the settings are shared. excluded_segs are the segments of the other map got excluded
+    bool CopyExclusionsTo(SegmentManager &other, std::vector<SegmentPtr> &excluded_segs) const
+    {
+        excluded_segs.clear();
+        const auto p_overlay = std::atomic_load(&p_exclusion_overlay_);
+        UNORD_MAP<const EXCLUSION_SETTING *, size_t> setting_indices;
+        std::vector<std::shared_ptr<EXCLUSION_SETTING>> settings;
+        std::vector<std::vector<SegmentPtr>> settings_segs;
+        for (const auto &elem : p_overlay->settings) {
+            auto it = other.all_segs_map_.find(elem.first);
+            if (it == other.all_segs_map_.end()) {
+                continue;
+            }
+            auto it_index = setting_indices.find(elem.second.get());
+            if (it_index == setting_indices.end()) {
+                it_index = setting_indices.insert({ elem.second.get(), settings.size() }).first;
+                settings.push_back(elem.second);
+                settings_segs.emplace_back();
+            }
+            settings_segs[it_index->second].push_back(it->second);
+            excluded_segs.push_back(it->second);
+        }
+        if (settings.empty()) {
+            return true;
+        }
+
+        std::vector<ExclusionChange> changes;
+        for (size_t i = 0; i < settings.size(); ++i) {
+            changes.push_back(ExclusionChange{ &settings_segs[i], settings[i] });
+        }
+        return other.UpdateExclusions(changes);
+    }
+
     // is_localtime: true if dev_data_time is local time
     bool IsSegmentExcluded(const SegmentPtr &p_seg, time_t dev_data_time, bool is_localtime) const
     {
-        if (!p_seg->excluded_flag_) {
+        if (!p_seg->ExcludedFlag()) {
             return false;
         }
-        if (p_seg->excluded_always_) {
+        if (p_seg->ExcludedAlways()) {
             return true;
         }
 
-        auto it = excluded_seg_map_.find(p_seg->seg_id_);
-        if (it == excluded_seg_map_.cend()) {
+        // the snapshot keeps the setting alive even if a writer publishes a new version
+        const auto p_overlay = std::atomic_load(&p_exclusion_overlay_);
+        auto it = p_overlay->settings.find(p_seg->seg_id_);
+        if (it == p_overlay->settings.cend()) {
             return false;
         }
         auto &ex_setting = *it->second;
@@ -2402,7 +3516,7 @@ public:
         case EXTYPE_NO_GPS:
         {
             // excluded from segment assignment, but can still be used as part of the routing
-            // result callers can check Segment::excluded_no_gps_ flag for fine control before
+            // result callers can check Segment::ExcludedNoGps() for fine control before
             // call this method IsSegmentExcluded
             return false;
         }
@@ -2423,7 +3537,19 @@ public:
             return true;
         }
 
-        for (const auto& p_seg : p_tile->segments_with_neighbours) {
+#if SEG_FIXED_POINT_FILTER == 1
+        std::vector<float> fixed_distances(p_tile->segments_with_neighbours.size());
+        p_tile->FixedDistancesSquare(pos, fixed_distances.data());
+        const float fixed_radius2 = (float)((radius + FIXED_FILTER_MARGIN) *
+            (radius + FIXED_FILTER_MARGIN));
+#endif
+        for (size_t i = 0; i < p_tile->segments_with_neighbours.size(); ++i) {
+#if SEG_FIXED_POINT_FILTER == 1
+            if (fixed_distances[i] >= fixed_radius2) {
+                continue;
+            }
+#endif
+            const auto& p_seg = p_tile->segments_with_neighbours[i];
             if (has_name) {
                 if (p_seg->way_name_.empty()) {
                     continue;
@@ -2670,6 +3796,9 @@ private:
                 }
             }
         }
+#if SEG_FIXED_POINT_FILTER == 1
+        p_tile->InitFixedCoords();
+#endif
     }
 
     void InitNeighbourSegs()
@@ -2719,11 +3848,18 @@ private:
     const int match_priority_;
     int min_tile_x_, min_tile_y_, mat_width_, mat_height_;
     SimpleMatrix<Tile> tile_mat_;
-    mutable std::mutex threads_err_mutex_;
-    mutable UNORD_MAP<std::string, std::string> threads_err_strs_;
+    ThreadErrStrs threads_err_strs_;
 
     time_t local_utc_diff_; // = local time - utc time
-    UNORD_MAP<SEG_ID_T, std::shared_ptr<EXCLUSION_SETTING>> excluded_seg_map_;
+
+    // exclusion settings are immutable once published (RCU like). readers (assignment, routing)
+    // take the current version by std::atomic_load without locking
+    struct ExclusionOverlay
+    {
+        unsigned long long version{};
+        UNORD_MAP<SEG_ID_T, std::shared_ptr<EXCLUSION_SETTING>> settings;
+    };
+    std::shared_ptr<const ExclusionOverlay> p_exclusion_overlay_;
 
     double GRID_CELL_ZOOM_LEVEL;
     friend class geo::WayManager;
@@ -2742,20 +3878,27 @@ bool WayManager::InitSegServices(const Bound& bound, MATCH_PRI match_priority/*
         return false;
     }
 
+    const auto start = util::GetTimeInMs64();
     p_seg_manager_ = std::make_shared<seg::SegmentManager>(seg_map_, bound, match_priority);
     if (false == p_seg_manager_->LoadToTileMatrix()) {
         SetErrorString(p_seg_manager_->GetErrorString());
         return false;
     }
+    init_stats_.seg_services_ms = util::GetTimeInMs64() - start;
+    p_seg_manager_->GetTileMemStats(init_stats_.tile_seg_refs, init_stats_.tile_fixed_coords_bytes);
 
-    p_seg_manager_->excluded_seg_map_.clear();
     return true;
 }
 
 SegmentPtr WayManager::AssignSegment(const geo::GeoPoint& point, const SegAssignParams& params,
     SegAssignResults *p_results /*= nullptr*/) const
 {
-    return p_seg_manager_->AssignSegment(point, params, p_results);
+    SegmentPtr p_seg = p_seg_manager_->AssignSegment(point, params, p_results);
+    if (!p_seg) {
+        // the segment manager keeps its own error strings, read by GetErrorString() from here
+        SetErrorString(p_seg_manager_->GetErrorString());
+    }
+    return p_seg;
 }
 
 SegmentPtr WayManager::AssignSegment(double lat, double lng, int heading, double radius,
@@ -2773,7 +3916,7 @@ SegmentPtr WayManager::AssignSegment(double lat, double lng, int heading, double
     params.excluded_seg_ids = const_cast<SEG_ID_T*>(excluded_seg_ids);
     params.excluded_seg_count = excluded_seg_count;
 
-    return p_seg_manager_->AssignSegment(geo::GeoPoint(lat, lng), params, nullptr);
+    return AssignSegment(geo::GeoPoint(lat, lng), params, nullptr);
 }
 
 SegmentPtr WayManager::AssignSegment(const geo::GeoPoint& point, int heading, double radius,
@@ -2791,7 +3934,7 @@ SegmentPtr WayManager::AssignSegment(const geo::GeoPoint& point, int heading, do
     params.excluded_seg_ids = const_cast<SEG_ID_T*>(excluded_seg_ids);
     params.excluded_seg_count = excluded_seg_count;
 
-    return p_seg_manager_->AssignSegment(point, params, nullptr);
+    return AssignSegment(point, params, nullptr);
 }
 
 bool WayManager::FindAdjacentSegments(const geo::GeoPoint& point, double radius, bool has_name,
@@ -2849,115 +3992,131 @@ bool WayManager::GenerateReversedSegsIntoSegMap()
         return false;
     }
 
-    UNORD_SET<WAY_ID_T> non_rev_ways;
+    std::vector<SegmentPtr> all_segs;
+    all_segs.reserve(seg_map_.size());
     for (const auto& elem : seg_map_) {
-        const SegmentPtr& p_seg = elem.second;
-        if (!SimpleCheckReverseAble(p_seg)) {
-            continue;
-        }
-        if (non_rev_ways.find(p_seg->way_id_) != non_rev_ways.end()) {
-            continue;
-        }
-
-        // do not generate fake reversed segmemnts for any segments connected with one-way tunnel
-        bool found = false;
-        for (int i = 0; i < 2 && !found; ++i) {
-            const auto& p_node = (i == 0) ? p_seg->p_from_nd_ : p_seg->p_to_nd_;
-            for (const auto& p_conn_seg : p_node->connected_segments_) {
-                if (p_conn_seg->way_id_ == p_seg->way_id_) {
-                    continue;
-                }
-                if (p_conn_seg->one_way_ && p_conn_seg->struct_type_ == STRUCT_TUNNEL) {
-                    found = true;
-                    break;
-                }
-            }
-        }
-        if (found) {
-            non_rev_ways.insert(p_seg->way_id_);
-            continue;
-        }
-
-        // for one-way, check if there is an opposite one-way nearby.
-        {
-            // <----------<----------<----------
-            // ---------->---------->---------->
-            //             this seg
+        all_segs.push_back(elem.second);
+    }
 
-            bool ok_to_generate = true;
-            const GeoPoint&& mid_pt = GeoPoint::GetMidPoint(p_seg->from_point_, p_seg->to_point_);
-            std::vector<std::tuple<SegmentPtr, double> > segs;
-            if (!p_seg->way_name_.empty()) {
-                seg_manager.FindAdjacentSegments(mid_pt, 60.0, true, segs);
+    // the checks only read the segments, each block collects its own non-reversible ways
+    UNORD_SET<WAY_ID_T> non_rev_ways;
+    std::mutex non_rev_ways_mutex;
+    batch::ParForBlocks(all_segs.size(), [&](size_t begin, size_t end) {
+        UNORD_SET<WAY_ID_T> block_non_rev_ways;
+        for (size_t i_seg = begin; i_seg < end; ++i_seg) {
+            const SegmentPtr& p_seg = all_segs[i_seg];
+            if (!SimpleCheckReverseAble(p_seg)) {
+                continue;
             }
-            else {
-                // segments with and without names are all returned
-                seg_manager.FindAdjacentSegments(mid_pt, 60.0, false, segs);
+            if (block_non_rev_ways.find(p_seg->way_id_) != block_non_rev_ways.end()) {
+                continue;
             }
 
-            if (!segs.empty()) {
-                SegmentPtr p_near_seg;
-                for (auto& t : segs) {
-                    std::tie(p_near_seg, std::ignore) = t;
-
-                    if (!p_near_seg->one_way_) {
+            // do not generate fake reversed segmemnts for any segments connected with one-way
+            // tunnel
+            bool found = false;
+            for (int i = 0; i < 2 && !found; ++i) {
+                const auto& p_node = (i == 0) ? p_seg->p_from_nd_ : p_seg->p_to_nd_;
+                for (const auto& p_conn_seg : p_node->connected_segments_) {
+                    if (p_conn_seg->way_id_ == p_seg->way_id_) {
                         continue;
                     }
-                    // basic checks of direction, way name ...
-                    if (WayManager::GetAngle(p_near_seg->heading_, p_seg->heading_) <= 170) {
-                        continue;
+                    if (p_conn_seg->one_way_ && p_conn_seg->struct_type_ == STRUCT_TUNNEL) {
+                        found = true;
+                        break;
                     }
-                    // if have way name, should have the same way name. if not, should have
-                    // the same way type
-                    if (!p_seg->way_name_.empty()) {
-                        if (p_near_seg->way_name_ != p_seg->way_name_) {
+                }
+            }
+            if (found) {
+                block_non_rev_ways.insert(p_seg->way_id_);
+                continue;
+            }
+
+            // for one-way, check if there is an opposite one-way nearby.
+            {
+                // <----------<----------<----------
+                // ---------->---------->---------->
+                //             this seg
+
+                bool ok_to_generate = true;
+                const GeoPoint&& mid_pt = GeoPoint::GetMidPoint(p_seg->from_point_,
+                    p_seg->to_point_);
+                std::vector<std::tuple<SegmentPtr, double> > segs;
+                if (!p_seg->way_name_.empty()) {
+                    seg_manager.FindAdjacentSegments(mid_pt, 60.0, true, segs);
+                }
+                else {
+                    // segments with and without names are all returned
+                    seg_manager.FindAdjacentSegments(mid_pt, 60.0, false, segs);
+                }
+
+                if (!segs.empty()) {
+                    SegmentPtr p_near_seg;
+                    for (auto& t : segs) {
+                        std::tie(p_near_seg, std::ignore) = t;
+
+                        if (!p_near_seg->one_way_) {
                             continue;
                         }
-                    }
-                    else {
-                        if (p_near_seg->way_type_ != p_seg->way_type_) {
+                        // basic checks of direction, way name ...
+                        if (WayManager::GetAngle(p_near_seg->heading_, p_seg->heading_) <= 170) {
+                            continue;
+                        }
+                        // if have way name, should have the same way name. if not, should have
+                        // the same way type
+                        if (!p_seg->way_name_.empty()) {
+                            if (p_near_seg->way_name_ != p_seg->way_name_) {
+                                continue;
+                            }
+                        }
+                        else {
+                            if (p_near_seg->way_type_ != p_seg->way_type_) {
+                                continue;
+                            }
+                        }
+                        if (p_near_seg->struct_type_ != p_seg->struct_type_ ||
+                            p_near_seg->layer_ != p_seg->layer_) {
                             continue;
                         }
-                    }
-                    if (p_near_seg->struct_type_ != p_seg->struct_type_ ||
-                        p_near_seg->layer_ != p_seg->layer_) {
-                        continue;
-                    }
 
-                    // verify if the opposiste segment is valid (for countries driving on right,
-                    // should be on the left)
-                    //
-                    //                <-------------------
-                    //                         A
-                    //                         |
-                    //   ------------->------------------>---------------->
-                    //                      this seg
-                    const GeoPoint&& mid_pt_near_seg =
-                        GeoPoint::GetMidPoint(p_near_seg->from_point_, p_near_seg->to_point_);
-                    int heading_mid_to_mid =
-                        (int)geo::get_heading_in_degree(mid_pt, mid_pt_near_seg);
-                    int angle = (heading_mid_to_mid - p_seg->heading_ + 720) % 360;
-                    bool valid = false;
-                    if (this->drive_on_right_) {
-                        valid = (angle >= 190 && angle <= 350);
-                    }
-                    else {
-                        valid = (angle >= 10 && angle <= 170);
-                    }
-                    if (valid) {
-                        // if found valid opposite segment, no need to generate the fake one
-                        ok_to_generate = false;
-                        break;
+                        // verify if the opposiste segment is valid (for countries driving on
+                        // right, should be on the left)
+                        //
+                        //                <-------------------
+                        //                         A
+                        //                         |
+                        //   ------------->------------------>---------------->
+                        //                      this seg
+                        const GeoPoint&& mid_pt_near_seg =
+                            GeoPoint::GetMidPoint(p_near_seg->from_point_, p_near_seg->to_point_);
+                        int heading_mid_to_mid =
+                            (int)geo::get_heading_in_degree(mid_pt, mid_pt_near_seg);
+                        int angle = (heading_mid_to_mid - p_seg->heading_ + 720) % 360;
+                        bool valid = false;
+                        if (this->drive_on_right_) {
+                            valid = (angle >= 190 && angle <= 350);
+                        }
+                        else {
+                            valid = (angle >= 10 && angle <= 170);
+                        }
+                        if (valid) {
+                            // if found valid opposite segment, no need to generate the fake one
+                            ok_to_generate = false;
+                            break;
+                        }
                     }
                 }
-            }
 
-            if (!ok_to_generate) {
-                non_rev_ways.insert(p_seg->way_id_);
-                continue;
+                if (!ok_to_generate) {
+                    block_non_rev_ways.insert(p_seg->way_id_);
+                    continue;
+                }
             }
         }
-    }
+
+        std::lock_guard<std::mutex> guard(non_rev_ways_mutex);
+        non_rev_ways.insert(block_non_rev_ways.begin(), block_non_rev_ways.end());
+    });
 
     std::vector<SegmentPtr> rev_seg_candidates;
     rev_seg_candidates.reserve(seg_map_.size() / 4);
@@ -3012,13 +4171,29 @@ bool WayManager::GenerateReversedSegsIntoSegMap()
 bool WayManager::SetExclusionSegs(std::vector<SegmentPtr> &segs, const EXCLUSION_SETTING &setting,
     bool sync_for_routing)
 {
+    std::lock_guard<std::mutex> guard(exclusion_update_mutex_);
     bool ok = p_seg_manager_->SetExclusionSegs(segs, setting);
     if (sync_for_routing) {
-        SyncExclusionSegsToRouting();
+        SyncExclusionSegsToRoutingNoLock(segs);
+    }
+    return ok;
+}
+
+bool WayManager::RemoveExclusionSegs(const std::vector<SegmentPtr> &segs, bool sync_for_routing)
+{
+    std::lock_guard<std::mutex> guard(exclusion_update_mutex_);
+    bool ok = p_seg_manager_->UpdateExclusions({ seg::ExclusionChange{ &segs, nullptr } });
+    if (sync_for_routing) {
+        SyncExclusionSegsToRoutingNoLock(segs);
     }
     return ok;
 }
 
+unsigned long long WayManager::ExclusionVersion() const
+{
+    return p_seg_manager_ ? p_seg_manager_->ExclusionVersion() : 0;
+}
+
 bool WayManager::IsSegmentExcluded(const SegmentPtr &p_seg, time_t dev_data_time,
     bool is_localtime) const
 {
@@ -3235,6 +4410,8 @@ bool WayManager::SetExclusionRoutes(const std::vector<EXCLUDED_ROUTE> &ex_routes
         return false;
     }
 
+    // all the routes except NO GPS ones are published as one exclusion version
+    std::vector<seg::ExclusionChange> changes;
     int index = 0;
     for (const auto &r : ex_routes) {
         EXCLUSION_SETTING ex_setting;
@@ -3253,19 +4430,26 @@ bool WayManager::SetExclusionRoutes(const std::vector<EXCLUDED_ROUTE> &ex_routes
             }
         }
         else if (ex_setting.ex_type != EXTYPE_NONE) {
+            auto p_setting = seg::SegmentManager::NewExclusionSetting(ex_setting);
             if (!seg_routes[index].empty()) {
-                this->SetExclusionSegs(seg_routes[index], ex_setting, false);
+                changes.push_back(seg::ExclusionChange{ &seg_routes[index], p_setting });
             }
             if (!seg_routes_rev[index].empty()) {
-                this->SetExclusionSegs(seg_routes_rev[index], ex_setting, false);
+                changes.push_back(seg::ExclusionChange{ &seg_routes_rev[index], p_setting });
             }
         }
 
         ++index;
     }
 
-    if (sync_for_routing) {
-        SyncExclusionSegsToRouting();
+    if (!changes.empty()) {
+        std::lock_guard<std::mutex> guard(exclusion_update_mutex_);
+        p_seg_manager_->UpdateExclusions(changes);
+        if (sync_for_routing) {
+            for (const auto &change : changes) {
+                SyncExclusionSegsToRoutingNoLock(*change.p_segs);
+            }
+        }
     }
     return true;
 }
@@ -3342,4 +4526,584 @@ bool WayManager::ExcludedRoutesToJsons(const std::vector<EXCLUDED_ROUTE> &ex_rou
     return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// snapshot
+
+bool WayManager::SaveSnapshot(const std::string &pathname) const
+{
+    using namespace snapshot;
+#if WAY_MANAGER_HANA_LOG == 1
+    hana::Logger logger("WayManager");
+    auto start = std::chrono::system_clock::now();
+    AT_SCOPE_EXIT(std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+    HANA_SDK_DEBUG(logger) << "WayManager::SaveSnapshot(): run time "
+        << elapsed.count() << " seconds" << hana::endl;);
+#endif
+
+    if (seg_map_.empty()) {
+        SetErrorString("SaveSnapshot: no segments loaded");
+        return false;
+    }
+
+    FILE *fp = fopen(pathname.c_str(), "wb");
+    if (fp == nullptr) {
+        SetErrorString("SaveSnapshot: cannot open file " + pathname);
+        return false;
+    }
+    AT_SCOPE_EXIT(if (fp) fclose(fp););
+
+    const auto &segs = seg_pool_.AllObjs();
+    const auto &rev_segs = seg_pool_rev_.AllObjs();
+    const auto &nodes = node_pool_.AllObjs();
+    const auto &ways = ori_way_pool_.AllObjs();
+    const SegIndexer seg_indexer(segs, rev_segs);
+    Writer writer(fp);
+
+    MetaRecord meta{};
+    meta.minlat = bound_.minlat;
+    meta.minlng = bound_.minlng;
+    meta.maxlat = bound_.maxlat;
+    meta.maxlng = bound_.maxlng;
+    meta.drive_on_right = drive_on_right_ ? 1 : 0;
+    meta.seg_count = (uint32_t)segs.size();
+    meta.rev_seg_count = (uint32_t)rev_segs.size();
+    if (p_seg_manager_) {
+        meta.has_seg_services = 1;
+        meta.seg_minlat = p_seg_manager_->bound_.minlat;
+        meta.seg_minlng = p_seg_manager_->bound_.minlng;
+        meta.seg_maxlat = p_seg_manager_->bound_.maxlat;
+        meta.seg_maxlng = p_seg_manager_->bound_.maxlng;
+        meta.match_priority = p_seg_manager_->match_priority_;
+    }
+    meta.has_routing = p_route_manager_ ? 1 : 0;
+    if (!writer.WriteHeader() || !writer.WriteSection(SEC_META, &meta, 1)) {
+        SetErrorString("SaveSnapshot: error in writing " + pathname);
+        return false;
+    }
+
+    // segments
+    {
+        std::vector<SegRecord> records;
+        records.reserve(segs.size() + rev_segs.size());
+        auto add_seg = [&](const Segment &seg) {
+            SegRecord r{};
+            r.seg_id = seg.seg_id_;
+            r.way_id = seg.way_id_;
+            r.from_nd = seg.from_nd_;
+            r.to_nd = seg.to_nd_;
+            r.from_lat = seg.from_point_.lat;
+            r.from_lng = seg.from_point_.lng;
+            r.to_lat = seg.to_point_.lat;
+            r.to_lng = seg.to_point_.lng;
+            r.length = seg.length_;
+            r.way_sub_seq = seg.way_sub_seq_;
+            r.split_seq = seg.split_seq_;
+            r.way_type = seg.way_type_;
+            r.struct_type = seg.struct_type_;
+            r.heading = seg.heading_;
+            r.layer = seg.layer_;
+            r.name_str = writer.AddString(seg.way_name_);
+            r.highway_str = writer.AddString(seg.highway_type_str_);
+            r.tags_str = writer.AddString(seg.GetOptTagsStr());
+            r.from_node = PoolIndex<Node>(seg.p_from_nd_, nodes);
+            r.to_node = PoolIndex<Node>(seg.p_to_nd_, nodes);
+            r.ori_way = PoolIndex<OrientedWay>(seg.p_ori_way_, ways);
+            r.one_way = seg.one_way_ ? 1 : 0;
+            records.push_back(r);
+        };
+        for (const auto &seg : segs) {
+            add_seg(seg);
+        }
+        for (const auto &seg : rev_segs) {
+            add_seg(seg);
+        }
+        if (!writer.WriteSection(SEC_SEGS, records)) {
+            SetErrorString("SaveSnapshot: error in writing " + pathname);
+            return false;
+        }
+    }
+
+    // nodes
+    {
+        std::vector<NodeRecord> records;
+        std::vector<int32_t> node_segs;
+        records.reserve(nodes.size());
+        node_segs.reserve(nodes.size() * 2);
+        for (const auto &node : nodes) {
+            NodeRecord r{};
+            r.nd_id = node.nd_id_;
+            r.lat = node.geo_point_.lat;
+            r.lng = node.geo_point_.lng;
+            r.name_str = writer.AddString(node.nd_name_);
+            r.nd_type = node.nd_type_;
+            r.is_way_connector = node.is_way_connector_ ? 1 : 0;
+            r.is_dead_end = node.is_dead_end_ ? 1 : 0;
+            r.is_weak_connected = node.is_weak_connected ? 1 : 0;
+            r.segs_begin = (uint32_t)node_segs.size();
+            r.segs_count = (uint32_t)node.connected_segments_.size();
+            for (const auto &p_seg : node.connected_segments_) {
+                node_segs.push_back(seg_indexer.ToIndex(p_seg));
+            }
+            records.push_back(r);
+        }
+        if (!writer.WriteSection(SEC_NODES, records) ||
+            !writer.WriteSection(SEC_NODE_SEGS, node_segs)) {
+            SetErrorString("SaveSnapshot: error in writing " + pathname);
+            return false;
+        }
+    }
+
+    // oriented ways
+    {
+        std::vector<WayRecord> records;
+        std::vector<int32_t> way_segs, way_nodes;
+        records.reserve(ways.size());
+        for (const auto &way : ways) {
+            WayRecord r{};
+            r.way_id = way.way_id_;
+            r.minlat = way.bbox_.minlat;
+            r.minlng = way.bbox_.minlng;
+            r.maxlat = way.bbox_.maxlat;
+            r.maxlng = way.bbox_.maxlng;
+            r.name_str = writer.AddString(way.name_);
+            r.opposite_way = PoolIndex<OrientedWay>(way.p_opposite_way_, ways);
+            r.segs_begin = (uint32_t)way_segs.size();
+            r.segs_count = (uint32_t)way.segments_.size();
+            for (const auto &p_seg : way.segments_) {
+                way_segs.push_back(seg_indexer.ToIndex(p_seg));
+            }
+            r.nodes_begin = (uint32_t)way_nodes.size();
+            r.nodes_count = (uint32_t)way.nodes_.size();
+            for (const auto &p_node : way.nodes_) {
+                way_nodes.push_back(PoolIndex<Node>(p_node, nodes));
+            }
+            r.one_way = way.one_way_ ? 1 : 0;
+            records.push_back(r);
+        }
+        if (!writer.WriteSection(SEC_WAYS, records) ||
+            !writer.WriteSection(SEC_WAY_SEGS, way_segs) ||
+            !writer.WriteSection(SEC_WAY_NODES, way_nodes)) {
+            SetErrorString("SaveSnapshot: error in writing " + pathname);
+            return false;
+        }
+    }
+
+    // segment spatial index
+    if (p_seg_manager_) {
+        const auto &tile_mat = p_seg_manager_->tile_mat_;
+        std::vector<TileRecord> records;
+        std::vector<int32_t> tile_segs;
+        records.reserve(tile_mat.height() * tile_mat.width());
+        for (int y = 0; y < tile_mat.height(); ++y) {
+            for (int x = 0; x < tile_mat.width(); ++x) {
+                const auto &tile = tile_mat(y, x);
+                TileRecord r{};
+                r.segs_begin = (uint32_t)tile_segs.size();
+                r.segs_count = (uint32_t)tile.segments.size();
+                for (const auto &p_seg : tile.segments) {
+                    tile_segs.push_back(seg_indexer.ToIndex(p_seg));
+                }
+                r.nbs_begin = (uint32_t)tile_segs.size();
+                r.nbs_count = (uint32_t)tile.segments_with_neighbours.size();
+                for (const auto &p_seg : tile.segments_with_neighbours) {
+                    tile_segs.push_back(seg_indexer.ToIndex(p_seg));
+                }
+                records.push_back(r);
+            }
+        }
+        if (!writer.WriteSection(SEC_TILES, records) ||
+            !writer.WriteSection(SEC_TILE_SEGS, tile_segs)) {
+            SetErrorString("SaveSnapshot: error in writing " + pathname);
+            return false;
+        }
+    }
+
+    if (p_route_manager_ && !SaveRoutingSnapshot(writer, seg_indexer)) {
+        return false;
+    }
+
+    if (!writer.WriteEnd() || fclose(fp) != 0) {
+        fp = nullptr;
+        SetErrorString("SaveSnapshot: error in writing " + pathname);
+        return false;
+    }
+    fp = nullptr;
+    return true;
+}
+
+bool WayManager::LoadSnapshot(const std::string &pathname)
+{
+    using namespace snapshot;
+#if WAY_MANAGER_HANA_LOG == 1
+    hana::Logger logger("WayManager");
+    auto start = std::chrono::system_clock::now();
+    AT_SCOPE_EXIT(std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+    HANA_SDK_DEBUG(logger) << "WayManager::LoadSnapshot(): run time "
+        << elapsed.count() << " seconds" << hana::endl;);
+#endif
+
+    util::MappedFile file;
+    if (!file.Open(pathname)) {
+        SetErrorString("LoadSnapshot: cannot open file " + pathname);
+        return false;
+    }
+    file.WillNeed();
+
+    Reader reader;
+    std::string err;
+    if (!reader.Init(file.Data(), file.Size(), err)) {
+        SetErrorString("LoadSnapshot: " + err);
+        return false;
+    }
+
+    const MetaRecord *p_meta;
+    const SegRecord *p_seg_records;
+    const NodeRecord *p_node_records;
+    const WayRecord *p_way_records;
+    const int32_t *p_node_segs, *p_way_segs, *p_way_nodes;
+    size_t n_meta, n_segs, n_nodes, n_ways, n_node_segs, n_way_segs, n_way_nodes;
+    if (!reader.GetSection(SEC_META, p_meta, n_meta, err) ||
+        !reader.GetSection(SEC_SEGS, p_seg_records, n_segs, err) ||
+        !reader.GetSection(SEC_NODES, p_node_records, n_nodes, err) ||
+        !reader.GetSection(SEC_NODE_SEGS, p_node_segs, n_node_segs, err) ||
+        !reader.GetSection(SEC_WAYS, p_way_records, n_ways, err) ||
+        !reader.GetSection(SEC_WAY_SEGS, p_way_segs, n_way_segs, err) ||
+        !reader.GetSection(SEC_WAY_NODES, p_way_nodes, n_way_nodes, err)) {
+        SetErrorString("LoadSnapshot: " + err);
+        return false;
+    }
+    const MetaRecord &meta = *p_meta;
+    if (n_meta != 1 || (size_t)meta.seg_count + meta.rev_seg_count != n_segs) {
+        SetErrorString("LoadSnapshot: invalid meta data in " + pathname);
+        return false;
+    }
+
+    // every index is checked before anything is changed, a bad file leaves this object as it was.
+    // the segment indices are global, see SegIndexer
+    auto in_range = [](int32_t index, size_t count) {
+        return index >= 0 && (size_t)index < count;
+    };
+    auto all_in_range = [&](const int32_t *p_indices, uint32_t begin, uint32_t count,
+        size_t n_indices, size_t n_objs) {
+        if ((size_t)begin + count > n_indices) {
+            return false;
+        }
+        for (uint32_t k = 0; k < count; ++k) {
+            if (!in_range(p_indices[begin + k], n_objs)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for (size_t i = 0; i < n_segs; ++i) {
+        const SegRecord &r = p_seg_records[i];
+        if ((r.from_node != -1 && !in_range(r.from_node, n_nodes)) ||
+            (r.to_node != -1 && !in_range(r.to_node, n_nodes)) ||
+            (r.ori_way != -1 && !in_range(r.ori_way, n_ways))) {
+            SetErrorString("LoadSnapshot: invalid segment data in " + pathname);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < n_nodes; ++i) {
+        const NodeRecord &r = p_node_records[i];
+        if (!all_in_range(p_node_segs, r.segs_begin, r.segs_count, n_node_segs, n_segs)) {
+            SetErrorString("LoadSnapshot: invalid node data in " + pathname);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < n_ways; ++i) {
+        const WayRecord &r = p_way_records[i];
+        if ((r.opposite_way != -1 && !in_range(r.opposite_way, n_ways)) ||
+            !all_in_range(p_way_segs, r.segs_begin, r.segs_count, n_way_segs, n_segs) ||
+            !all_in_range(p_way_nodes, r.nodes_begin, r.nodes_count, n_way_nodes, n_nodes)) {
+            SetErrorString("LoadSnapshot: invalid way data in " + pathname);
+            return false;
+        }
+    }
+
+    std::shared_ptr<seg::SegmentManager> p_seg_manager;
+    const TileRecord *p_tile_records = nullptr;
+    const int32_t *p_tile_segs = nullptr;
+    size_t n_tiles = 0, n_tile_segs = 0;
+    if (meta.has_seg_services) {
+        if (!reader.GetSection(SEC_TILES, p_tile_records, n_tiles, err) ||
+            !reader.GetSection(SEC_TILE_SEGS, p_tile_segs, n_tile_segs, err)) {
+            SetErrorString("LoadSnapshot: " + err);
+            return false;
+        }
+        // refers to seg_map_, which is filled below
+        p_seg_manager = std::make_shared<seg::SegmentManager>(seg_map_,
+            Bound(meta.seg_minlat, meta.seg_minlng, meta.seg_maxlat, meta.seg_maxlng),
+            meta.match_priority);
+        const auto &tile_mat = p_seg_manager->tile_mat_;
+        bool tiles_valid = (size_t)tile_mat.height() * tile_mat.width() == n_tiles;
+        for (size_t i = 0; i < n_tiles && tiles_valid; ++i) {
+            const TileRecord &r = p_tile_records[i];
+            tiles_valid = all_in_range(p_tile_segs, r.segs_begin, r.segs_count, n_tile_segs,
+                n_segs) && all_in_range(p_tile_segs, r.nbs_begin, r.nbs_count, n_tile_segs,
+                n_segs);
+        }
+        if (!tiles_valid) {
+            SetErrorString("LoadSnapshot: invalid segment tiles in " + pathname);
+            return false;
+        }
+    }
+    if (meta.has_routing && !CheckRoutingSnapshot(reader, n_nodes, n_segs, err)) {
+        SetErrorString("LoadSnapshot: " + err + " in " + pathname);
+        return false;
+    }
+
+    p_route_manager_.reset();
+    p_seg_manager_.reset();
+    p_node_manager_.reset();
+    seg_map_.clear();
+    node_map_.clear();
+    way_map_.clear();
+    seg_pool_.Clear();
+    seg_pool_rev_.Clear();
+    node_pool_.Clear();
+    ori_way_pool_.Clear();
+
+    bound_ = Bound(meta.minlat, meta.minlng, meta.maxlat, meta.maxlng);
+    drive_on_right_ = meta.drive_on_right != 0;
+    reversed_seg_ = meta.rev_seg_count > 0;
+
+    // pools never grow below, so the pointers are stable
+    seg_pool_.Reserve(meta.seg_count);
+    seg_pool_rev_.Reserve(meta.rev_seg_count);
+    node_pool_.Reserve(n_nodes);
+    ori_way_pool_.Reserve(n_ways);
+    seg_map_.reserve(n_segs);
+    node_map_.reserve(n_nodes);
+    way_map_.reserve(n_ways);
+
+    for (size_t i = 0; i < n_nodes; ++i) {
+        const NodeRecord &r = p_node_records[i];
+        NodePtr p_node = node_pool_.AllocNew(Node(r.nd_id, r.lat, r.lng));
+        p_node->nd_name_ = reader.GetString(r.name_str);
+        p_node->nd_type_ = r.nd_type;
+        p_node->is_way_connector_ = r.is_way_connector != 0;
+        p_node->is_dead_end_ = r.is_dead_end != 0;
+        p_node->is_weak_connected = r.is_weak_connected != 0;
+        node_map_[r.nd_id] = p_node;
+    }
+    for (size_t i = 0; i < n_ways; ++i) {
+        const WayRecord &r = p_way_records[i];
+        OrientedWayPtr p_way = ori_way_pool_.AllocNew(OrientedWay(r.way_id, r.one_way != 0));
+        way_map_[r.way_id] = p_way;
+    }
+
+    auto node_ptr = [&](int32_t index) {
+        return (index >= 0 && (size_t)index < n_nodes) ? node_pool_.ObjPtrByIndex(index) : nullptr;
+    };
+    auto way_ptr = [&](int32_t index) {
+        return (index >= 0 && (size_t)index < n_ways) ? ori_way_pool_.ObjPtrByIndex(index) : nullptr;
+    };
+
+    // consecutive segments of a way usually have the same tags
+    uint32_t last_tags_str = 0;
+    SharedRawTagsPtr p_opt_tags;
+    for (size_t i = 0; i < n_segs; ++i) {
+        const SegRecord &r = p_seg_records[i];
+        if (i == 0 || r.tags_str != last_tags_str) {
+            p_opt_tags = RawTags::Create(reader.GetString(r.tags_str));
+            last_tags_str = r.tags_str;
+        }
+
+        auto &pool = i < meta.seg_count ? seg_pool_ : seg_pool_rev_;
+        SegmentPtr p_seg = pool.AllocNew(Segment(r.seg_id, r.way_id, r.way_sub_seq, r.split_seq,
+            r.from_nd, r.to_nd, r.from_lat, r.from_lng, r.to_lat, r.to_lng, r.one_way != 0,
+            (HIGHWAY_TYPE)r.way_type, reader.GetString(r.highway_str),
+            reader.GetString(r.name_str), (STRUCT_TYPE)r.struct_type, (short)r.layer,
+            p_opt_tags));
+        // saved values, not recalculated
+        p_seg->from_nd_ = r.from_nd;
+        p_seg->to_nd_ = r.to_nd;
+        p_seg->length_ = r.length;
+        p_seg->heading_ = r.heading;
+        p_seg->p_from_nd_ = node_ptr(r.from_node);
+        p_seg->p_to_nd_ = node_ptr(r.to_node);
+        p_seg->p_ori_way_ = way_ptr(r.ori_way);
+        seg_map_[r.seg_id] = p_seg;
+    }
+
+    const SegIndexer seg_indexer(seg_pool_.AllObjs(), seg_pool_rev_.AllObjs());
+    for (size_t i = 0; i < n_nodes; ++i) {
+        const NodeRecord &r = p_node_records[i];
+        auto &conn_segs = node_pool_[(int)i].connected_segments_;
+        conn_segs.reserve(r.segs_count);
+        for (uint32_t k = 0; k < r.segs_count; ++k) {
+            conn_segs.push_back(seg_indexer.ToPtr(p_node_segs[r.segs_begin + k]));
+        }
+    }
+    for (size_t i = 0; i < n_ways; ++i) {
+        const WayRecord &r = p_way_records[i];
+        OrientedWay &way = ori_way_pool_[(int)i];
+        way.name_ = reader.GetString(r.name_str);
+        way.bbox_ = Bound(r.minlat, r.minlng, r.maxlat, r.maxlng);
+        way.p_opposite_way_ = way_ptr(r.opposite_way);
+        way.segments_.reserve(r.segs_count);
+        for (uint32_t k = 0; k < r.segs_count; ++k) {
+            way.segments_.push_back(seg_indexer.ToPtr(p_way_segs[r.segs_begin + k]));
+        }
+        way.nodes_.reserve(r.nodes_count);
+        for (uint32_t k = 0; k < r.nodes_count; ++k) {
+            way.nodes_.push_back(node_ptr(p_way_nodes[r.nodes_begin + k]));
+        }
+    }
+
+    if (p_seg_manager) {
+        auto &tile_mat = p_seg_manager->tile_mat_;
+        size_t i_tile = 0;
+        for (int y = 0; y < tile_mat.height(); ++y) {
+            for (int x = 0; x < tile_mat.width(); ++x, ++i_tile) {
+                const TileRecord &r = p_tile_records[i_tile];
+                auto &tile = tile_mat(y, x);
+                tile.segments.clear();
+                tile.segments.reserve(r.segs_count);
+                for (uint32_t k = 0; k < r.segs_count; ++k) {
+                    tile.segments.push_back(seg_indexer.ToPtr(p_tile_segs[r.segs_begin + k]));
+                }
+                tile.segments_with_neighbours.reserve(r.nbs_count);
+                for (uint32_t k = 0; k < r.nbs_count; ++k) {
+                    tile.segments_with_neighbours.push_back(
+                        seg_indexer.ToPtr(p_tile_segs[r.nbs_begin + k]));
+                }
+#if SEG_FIXED_POINT_FILTER == 1
+                tile.InitFixedCoords();
+#endif
+            }
+        }
+        p_seg_manager_ = p_seg_manager;
+        p_seg_manager_->GetTileMemStats(init_stats_.tile_seg_refs,
+            init_stats_.tile_fixed_coords_bytes);
+    }
+
+    if (meta.has_routing) {
+        LoadRoutingSnapshot(reader, seg_indexer);
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// segment diff
+
+//
+// the segments, nodes, ways, tiles and routing connections all point to each other, so the diff
+// cannot be patched in place while other threads are reading. the unchanged segments are copied
+// (no CSV parsing) together with the diff into a new WayManager, which is built from scratch with
+// the same settings and handed over to be published. i.e., a full rebuild, not a tile patch
+//
+bool WayManager::ReloadWithSegmentDiff(const std::vector<SEGMENT> &added,
+    const std::vector<SEG_ID_T> &removed, const std::vector<SEGMENT> &modified,
+    std::shared_ptr<WayManager> &p_new_version) const
+{
+#if WAY_MANAGER_HANA_LOG == 1
+    hana::Logger logger("WayManager");
+    auto start = std::chrono::system_clock::now();
+    AT_SCOPE_EXIT(std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+    HANA_SDK_DEBUG(logger) << "WayManager::ReloadWithSegmentDiff(): run time "
+        << elapsed.count() << " seconds" << hana::endl;);
+#endif
+
+    p_new_version.reset();
+    if (seg_map_.empty()) {
+        SetErrorString("ReloadWithSegmentDiff: no segments loaded");
+        return false;
+    }
+
+    // no exclusion changes in between, otherwise they would get lost in the new version
+    std::lock_guard<std::mutex> guard(exclusion_update_mutex_);
+
+    // removed segments which are not loaded (e.g., out of bound) are ignored, added segments
+    // replace the loaded ones with the same IDs
+    UNORD_SET<SEG_ID_T> dropped_seg_ids;
+    dropped_seg_ids.reserve(added.size() + removed.size() + modified.size());
+    dropped_seg_ids.insert(removed.begin(), removed.end());
+    for (const auto &seg : modified) {
+        dropped_seg_ids.insert(seg.seg_id);
+    }
+    for (const auto &seg : added) {
+        if (seg.seg_id == 0) {
+            SetErrorString("ReloadWithSegmentDiff: invalid segment ID 0");
+            return false;
+        }
+        dropped_seg_ids.insert(seg.seg_id);
+    }
+
+    auto p_new = std::make_shared<WayManager>(bound_, drive_on_right_);
+    p_new->map_version_ = map_version_ + 1;
+    p_new->init_stats_.thread_count = (int)std::max(1u, std::thread::hardware_concurrency());
+
+    const auto &segs = seg_pool_.AllObjs();
+    p_new->seg_pool_.Reserve(segs.size() + added.size() + modified.size());
+    for (const auto &seg : segs) {
+        if (dropped_seg_ids.find(seg.seg_id_) != dropped_seg_ids.end()) {
+            continue;
+        }
+        auto p_seg = p_new->seg_pool_.AllocNew(seg);
+        p_seg->p_from_nd_ = nullptr;
+        p_seg->p_to_nd_ = nullptr;
+        p_seg->p_ori_way_ = nullptr;
+        p_seg->excluded_flags_.Set(EXTYPE_NONE);
+        // one-way segments were turned into two-way by their fake reversed segments
+        if (reversed_seg_ && seg_map_.find(-seg.seg_id_) != seg_map_.end()) {
+            p_seg->one_way_ = true;
+        }
+    }
+    for (const auto &seg : modified) {
+        p_new->seg_pool_.AllocNew(Segment(seg));
+    }
+    for (const auto &seg : added) {
+        p_new->seg_pool_.AllocNew(Segment(seg));
+    }
+    if (false == p_new->LoadSegmentsFromPool(reversed_seg_)) {
+        SetErrorString("ReloadWithSegmentDiff: " + p_new->GetErrorString());
+        return false;
+    }
+
+    std::vector<SegmentPtr> excluded_segs;
+    if (p_seg_manager_) {
+        if (false == p_new->InitSegServices(p_seg_manager_->bound_,
+            (MATCH_PRI)p_seg_manager_->match_priority_)) {
+            SetErrorString("ReloadWithSegmentDiff: " + p_new->GetErrorString());
+            return false;
+        }
+        p_seg_manager_->CopyExclusionsTo(*p_new->p_seg_manager_, excluded_segs);
+    }
+    if (p_route_manager_) {
+        if (false == p_new->InitForRouting(routing_shortest_mode_)) {
+            SetErrorString("ReloadWithSegmentDiff: " + p_new->GetErrorString());
+            return false;
+        }
+        if (!excluded_segs.empty()) {
+            p_new->SyncExclusionSegsToRoutingNoLock(excluded_segs);
+        }
+    }
+    // node locating does not depend on the segments
+    p_new->p_node_manager_ = p_node_manager_;
+
+    p_new_version = p_new;
+    return true;
+}
+
+bool SharedWayManager::ReloadWithSegmentDiff(const std::vector<SEGMENT> &added,
+    const std::vector<SEG_ID_T> &removed, const std::vector<SEGMENT> &modified)
+{
+    std::lock_guard<std::mutex> guard(update_mutex_);
+    auto p_current = Get();
+    if (!p_current) {
+        threads_err_strs_.Set("SharedWayManager: no map published");
+        return false;
+    }
+
+    std::shared_ptr<WayManager> p_next;
+    if (false == p_current->ReloadWithSegmentDiff(added, removed, modified, p_next)) {
+        threads_err_strs_.Set(p_current->GetErrorString());
+        return false;
+    }
+    Publish(p_next);
+    return true;
+}
+
 }
@@ -17,10 +17,12 @@
 #endif
 
 #include <cstdio>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <memory>
 #include <tuple>
+#include <iterator>
 #include <mutex>
 #include <boost/dynamic_bitset.hpp>
 #if WAY_MANAGER_BOOST_UNORDERRED == 1
@@ -36,14 +38,14 @@
 namespace geo {
 
 #if WAY_MANAGER_BOOST_UNORDERRED == 1
-    template <typename A, typename B>
-    using UNORD_MAP = boost::unordered_map<A, B>;
+    template <typename A, typename B, typename H = boost::hash<A>>
+    using UNORD_MAP = boost::unordered_map<A, B, H>;
 
     template <typename T>
     using UNORD_SET = boost::unordered_set<T>;
 #else
-    template <typename A, typename B>
-    using UNORD_MAP = std::unordered_map<A, B>;
+    template <typename A, typename B, typename H = std::hash<A>>
+    using UNORD_MAP = std::unordered_map<A, B, H>;
 
     template <typename T>
     using UNORD_SET = std::unordered_set<T>;
@@ -401,6 +403,80 @@ struct Tag
 typedef std::vector<Tag> Tags;
 typedef std::shared_ptr<Tags> SharedTagsPtr;
 
+// opt tags string as loaded, shared by the consecutive segments with the same tags. it is
+// parsed into Tags only on demand, since the tags of most segments are never asked for
+class RawTags
+{
+public:
+    explicit RawTags(const std::string& tags_str);
+
+    // nullptr for the empty string
+    static std::shared_ptr<const RawTags> Create(const std::string& tags_str)
+    {
+        return tags_str.empty() ? nullptr : std::make_shared<const RawTags>(tags_str);
+    }
+
+    const std::string& Str() const
+    {
+        return str_;
+    }
+    // parsed on the first call, thread safe
+    const Tags& GetTags() const;
+    // scans the string without parsing it, unless it has quotes
+    bool Find(const std::string& tag_name, std::string* p_tag_value) const;
+
+private:
+    std::string str_;
+    bool has_quotes_;
+    mutable std::once_flag parse_flag_;
+    mutable Tags tags_;
+};
+typedef std::shared_ptr<const RawTags> SharedRawTagsPtr;
+
+// the exclusion flags of a segment. they are updated while other threads are matching or
+// routing, so they are one atomic byte, apart from the bitfields around them. copied with the
+// segment
+class SegExclusionFlags
+{
+public:
+    enum : unsigned char
+    {
+        EXCLUDED = 1,
+        EXCLUDED_ALWAYS = 2,
+        EXCLUDED_NO_GPS = 4,
+    };
+
+    SegExclusionFlags()
+        : bits_(0)
+    {}
+    SegExclusionFlags(const SegExclusionFlags& src)
+        : bits_(src.bits_.load(std::memory_order_relaxed))
+    {}
+    SegExclusionFlags& operator=(const SegExclusionFlags& src)
+    {
+        bits_.store(src.bits_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    bool Test(unsigned char bit) const
+    {
+        return (bits_.load(std::memory_order_acquire) & bit) != 0;
+    }
+    // all the flags at once, EXTYPE_NONE clears them
+    void Set(EXCLUSION_TYPE ex_type)
+    {
+        unsigned char bits = 0;
+        if (ex_type != EXTYPE_NONE) {
+            bits = EXCLUDED | (ex_type == EXTYPE_ALWAYS ? EXCLUDED_ALWAYS : 0) |
+                (ex_type == EXTYPE_NO_GPS ? EXCLUDED_NO_GPS : 0);
+        }
+        bits_.store(bits, std::memory_order_release);
+    }
+
+private:
+    std::atomic<unsigned char> bits_;
+};
+
 class Segment
 {
 public:
@@ -411,8 +487,7 @@ public:
         length_(geo::distance_in_meter(SEG.from_lat, SEG.from_lng, SEG.to_lat, SEG.to_lng)),
         way_name_(SEG.way_name), highway_type_str_(SEG.highway_type_str),
         way_sub_seq_(SEG.way_sub_seq), split_seq_(SEG.split_seq), one_way_(SEG.one_way),
-        way_type_(SEG.way_type), struct_type_(SEG.struct_type), layer_(SEG.layer),
-        excluded_flag_(0), excluded_always_(0), excluded_no_gps_(0)
+        way_type_(SEG.way_type), struct_type_(SEG.struct_type), layer_(SEG.layer)
     {
         // if original node ID is negative, it means it is the node generated from segment splitting
         // NOTE: need to make sure this to_node ID same as next from_node ID
@@ -423,21 +498,20 @@ public:
             to_nd_ = -Node::GenerateSplitSegToNodeID(way_id_, way_sub_seq_, split_seq_);
         }
         heading_ = (int)geo::get_heading_in_degree(from_point_, to_point_);
-        p_opt_tags_ = StrToTags(SEG.opt_tags);
+        p_opt_tags_ = RawTags::Create(SEG.opt_tags);
     }
 
     explicit Segment(SEG_ID_T seg_id, WAY_ID_T way_id, int way_sub_seq, int split_seq,
         NODE_ID_T from_nd, NODE_ID_T to_nd, double from_lat, double from_lng,
         double to_lat, double to_lng, bool one_way, HIGHWAY_TYPE way_type,
         const std::string& highway_type_str, const std::string& way_name,
-        STRUCT_TYPE struct_type, short layer, const SharedTagsPtr &p_opt_tags)
+        STRUCT_TYPE struct_type, short layer, const SharedRawTagsPtr &p_opt_tags)
         : seg_id_(seg_id), way_id_(way_id),
         from_nd_(from_nd), to_nd_(to_nd), from_point_(from_lat, from_lng), to_point_(to_lat, to_lng),
         length_(geo::distance_in_meter(from_lat, from_lng, to_lat, to_lng)),
         way_name_(way_name), highway_type_str_(highway_type_str),
         way_sub_seq_(way_sub_seq), split_seq_(split_seq), one_way_(one_way),
-        way_type_(way_type), struct_type_(struct_type), layer_(layer),
-        excluded_flag_(0), excluded_always_(0), excluded_no_gps_(0), p_opt_tags_(p_opt_tags)
+        way_type_(way_type), struct_type_(struct_type), layer_(layer), p_opt_tags_(p_opt_tags)
     {
         // if original node ID is negative, it means it is the node generated from segment splitting
         // NOTE: need to make sure this to_node ID same as next from_node ID
@@ -506,11 +580,26 @@ public:
 
     std::string GetOptTagsStr() const
     {
-        return p_opt_tags_ ? this->TagsToStr(*p_opt_tags_) : std::string();
+        return p_opt_tags_ ? p_opt_tags_->Str() : std::string();
     }
+    // nullptr without opt tags, the parsed tags otherwise, which can be empty
     const Tags* GetOptTags() const
     {
-        return p_opt_tags_.get();
+        return p_opt_tags_ ? &p_opt_tags_->GetTags() : nullptr;
+    }
+
+    // set by exclusion settings, the details are got by WayManager::IsSegmentExcluded()
+    bool ExcludedFlag() const
+    {
+        return excluded_flags_.Test(SegExclusionFlags::EXCLUDED);
+    }
+    bool ExcludedAlways() const
+    {
+        return excluded_flags_.Test(SegExclusionFlags::EXCLUDED_ALWAYS);
+    }
+    bool ExcludedNoGps() const
+    {
+        return excluded_flags_.Test(SegExclusionFlags::EXCLUDED_NO_GPS);
     }
 
     SEGMENT ToSEGMENT() const
@@ -547,6 +636,10 @@ public:
 
     static void GetOffsetLinestr(const std::vector<SegmentPtr>& segments, double offset,
         std::vector<GeoPoint>& offset_points);
+    // without allocations: points and one_ways have room for n + 1 entries, offset_points for
+    // 2 * (n + 1). returns the offset_points count
+    static size_t GetOffsetLinestr(const SegmentPtr *segments, size_t n, double offset,
+        GeoPoint *points, bool *one_ways, GeoPoint *offset_points);
     static double AdjustOffset(double offset, HIGHWAY_TYPE type);
     static SEG_ID_T GenerateSegID(WAY_ID_T way_id, int way_sub_seq, int split_seq)
     {
@@ -574,14 +667,12 @@ public:
     STRUCT_TYPE struct_type_;
     int heading_ : 12; // generated fields
     int layer_ : 8;
-    unsigned excluded_flag_ : 1;
-    unsigned excluded_always_ : 1;
-    unsigned excluded_no_gps_ : 1;
+    SegExclusionFlags excluded_flags_;
 
 private:
     NodePtr p_from_nd_{}, p_to_nd_{};
     OrientedWayPtr p_ori_way_{};
-    SharedTagsPtr p_opt_tags_{};
+    SharedRawTagsPtr p_opt_tags_{};
 
     friend class WayManager;
     friend class OrientedWay;
@@ -690,6 +781,132 @@ private:
     friend class WayManager;
 };
 
+// route as runs of consecutive segments of oriented ways. a route of a thousand segments usually
+// has only a few dozens of spans. iterated as segments, while the segment list, the polyline and
+// the encoded polyline are only materialized when asked for. valid as long as the WayManager.
+// produced natively by DijkstraShortestPath(), the short nearby routes are compacted from a
+// scratch of the thread. ViaRoute() and the route matching still return segment vectors
+// (RouteMatchingParams::result_route), CompactRoute(segs) converts them
+class CompactRoute
+{
+public:
+    struct Span
+    {
+        OrientedWayPtr p_way;
+        unsigned int i_begin; // [i_begin, i_end) in p_way->Segments()
+        unsigned int i_end;
+    };
+
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef SegmentPtr value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const SegmentPtr* pointer;
+        typedef const SegmentPtr& reference;
+
+        const_iterator(const Span *p_span, const Span *p_end)
+            : p_span_(p_span), p_end_(p_end), i_seg_(p_span != p_end ? p_span->i_begin : 0)
+        {}
+
+        reference operator*() const
+        {
+            return p_span_->p_way->Segments()[i_seg_];
+        }
+        pointer operator->() const
+        {
+            return &**this;
+        }
+        const_iterator& operator++()
+        {
+            if (++i_seg_ >= p_span_->i_end) {
+                ++p_span_;
+                i_seg_ = p_span_ != p_end_ ? p_span_->i_begin : 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator it(*this);
+            ++*this;
+            return it;
+        }
+        bool operator==(const const_iterator& other) const
+        {
+            return p_span_ == other.p_span_ && i_seg_ == other.i_seg_;
+        }
+        bool operator!=(const const_iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        const Span *p_span_;
+        const Span *p_end_;
+        unsigned int i_seg_;
+    };
+
+    CompactRoute()
+    {}
+    explicit CompactRoute(const std::vector<SegmentPtr>& segs)
+    {
+        Append(segs);
+    }
+
+    void Clear()
+    {
+        spans_.clear();
+        seg_count_ = 0;
+    }
+    bool Empty() const
+    {
+        return seg_count_ == 0;
+    }
+    size_t SegCount() const
+    {
+        return seg_count_;
+    }
+    const std::vector<Span>& Spans() const
+    {
+        return spans_;
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(spans_.data(), spans_.data() + spans_.size());
+    }
+    const_iterator end() const
+    {
+        return const_iterator(spans_.data() + spans_.size(), spans_.data() + spans_.size());
+    }
+    SegmentPtr Front() const
+    {
+        return *begin();
+    }
+    SegmentPtr Back() const
+    {
+        return spans_.back().p_way->Segments()[spans_.back().i_end - 1];
+    }
+
+    // false if the segment is not found in its oriented way
+    bool Append(const SegmentPtr& p_seg);
+    bool Append(const std::vector<SegmentPtr>& segs);
+    // segments [i_begin, i_end) of the way, joined to the last span if it continues it
+    void AppendSpan(const OrientedWayPtr& p_way, size_t i_begin, size_t i_end);
+
+    void ToSegs(std::vector<SegmentPtr>& segs) const;
+    void ToSegIds(std::vector<SEG_ID_T>& seg_ids) const;
+    // from point of the first segment, then the to points
+    void ToPolyline(std::vector<GeoPoint>& points) const;
+    std::string ToEncodedPolyline(int precision = 5) const;
+    double Length() const; // in meters
+
+private:
+    std::vector<Span> spans_;
+    size_t seg_count_{};
+};
+
 namespace seg {
     class SegmentManager;
 }
@@ -699,6 +916,11 @@ namespace node {
 namespace route {
     class RouteManager;
 }
+namespace snapshot {
+    class Writer;
+    class Reader;
+    class SegIndexer;
+}
 
 struct SegAssignParams
 {
@@ -738,6 +960,14 @@ struct SegAssignRes
 };
 typedef std::vector<SegAssignRes> SegAssignResults;
 
+struct NodeSearchFilter
+{
+    const NODE_TYPE *types{}; // if specified, only the nodes of the types
+    int type_count{};
+    bool has_name{};
+    double max_radius{}; // in meters, 0 for no limit
+};
+
 
 struct ViaPoint
 {
@@ -807,8 +1037,17 @@ struct RouteMatchingViaPoint
     SegmentPtr  p_seg{};
     // outputs
     int         i_seg{ -1 }; // index of segment the RouteMatchingParams::result_route
-    bool        is_broken{}; // indicate if route is broken at this point
+    bool        is_broken{}; // indicate if route is broken at this point, i.e., to the next one
     bool        entering_no_gps_route{}; // indicate if going to enter no GPS route like tunnel
+    float       match_prob{}; // probability of p_seg being the right match, in [0, 1]
+};
+
+// an alternative of RouteMatchingParams::result_route, from the same candidates lattice
+struct RouteMatchingAlternative
+{
+    std::vector<SegmentPtr> route;
+    int     weight{};   // weighted length (see WayManager::DistanceToWeight), smaller is better
+    float   prob{};     // probability among result_route and all the alternatives
 };
 
 struct RouteMatchingParams;
@@ -826,6 +1065,7 @@ struct RouteMatchingParams
     bool    verfy_result{};         // whether to verfy the result and set the flags
     double  distance_limit{ 0.0 };  // each point in the trace should be in the range. if 0, the methond
                                     // automatically set a limit
+    int     alternative_count{};    // max count of alternatives to output (top-k), 0 for none
 
     // output, can be broken, broken point indicated in RouteMatchingViaPoint
     std::vector<SegmentPtr> result_route;
@@ -834,6 +1074,10 @@ struct RouteMatchingParams
                                 // disconnected segment in result_route[] if found
     int repeated_index{};       // if verfy_result is true, check and set it to the index of first
                                 // repeated segment in result_route[] if found
+    // if alternative_count > 0, the next best routes after result_route, ordered by weight.
+    // NOTE: unlike result_route, the begin/end segments are not fixed
+    std::vector<RouteMatchingAlternative> alternatives;
+    float   result_prob{};          // probability of result_route among the alternatives
 
     // internal use only
     void *p_impl{};
@@ -847,6 +1091,152 @@ struct RouteMatchingParams
     }
 };
 
+// for benchmark purpose: memory allocation statistics of the matcher kept in p_impl
+struct RouteMatchingAllocStats
+{
+    size_t arena_allocs{};          // allocations served by the matcher's arena
+    size_t arena_block_allocs{};    // times the arena itself called malloc
+    size_t arena_capacity{};        // bytes currently held by the arena
+};
+bool RouteMatchingInternalAllocStats(const RouteMatchingParams &params,
+    RouteMatchingAllocStats &stats);
+
+
+// below are for travel times/speeds extracted from the route matching results
+struct SegTraversal
+{
+    SegmentPtr  p_seg{};
+    int         i_seg{};        // index of the segment in RouteMatchingParams::result_route
+    double      entry_time{};   // in seconds, same clock as RouteMatchingViaPoint::record_time
+    double      exit_time{};
+    double      length{};       // traversed length in meters, less than segment length if partial
+    double      speed{};        // in km/h, 0 if unknown
+    bool        partial{};      // true if only part of the segment is covered by the trace
+};
+
+// per segment, per time slot speed statistics accumulated from many trips. thread safe, the
+// statistics are sharded by segment ID so that concurrent Add() seldom wait for each other.
+// time slots are within a period, e.g., 15 minutes slots of a day (default) or a week
+class TravelTimeAggregator
+{
+public:
+    struct SlotStats
+    {
+        SEG_ID_T    seg_id{};
+        int         slot{};
+        long long   count{};
+        double      sum_speed{};
+        double      sum_speed2{};   // sum of speed^2, for the standard deviation
+        double      sum_time{};     // sum of the travel times in seconds
+        float       min_speed{};
+        float       max_speed{};
+
+        double AvgSpeed() const
+        {
+            return count ? sum_speed / count : 0.0;
+        }
+        double StdDevSpeed() const;
+        double AvgTravelTime() const
+        {
+            return count ? sum_time / count : 0.0;
+        }
+    };
+
+    explicit TravelTimeAggregator(int slot_seconds = 15 * 60, int period_seconds = 24 * 3600,
+        int shard_count = 64);
+
+    // thread safe. partial traversals are ignored unless include_partial is true. speeds out
+    // of (0, max_speed] km/h are regarded as noise and ignored
+    void Add(const std::vector<SegTraversal> &traversals, bool include_partial = false,
+        double max_speed = 200.0);
+    bool Get(SEG_ID_T seg_id, int slot, SlotStats &stats) const;
+    void GetAll(std::vector<SlotStats> &all_stats) const;
+    size_t Size() const;
+    void Clear();
+
+    int SlotCount() const
+    {
+        return slot_count_;
+    }
+    int TimeToSlot(double time) const;
+
+private:
+    struct SlotKey
+    {
+        SEG_ID_T    seg_id;
+        int         slot;
+
+        bool operator==(const SlotKey &other) const
+        {
+            return seg_id == other.seg_id && slot == other.slot;
+        }
+    };
+    struct SlotKeyHash
+    {
+        size_t operator()(const SlotKey &key) const
+        {
+            return (size_t)(((unsigned long long)key.seg_id * 0x9E3779B97F4A7C15ULL) ^
+                (unsigned long long)key.slot);
+        }
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        UNORD_MAP<SlotKey, SlotStats, SlotKeyHash> stats_map;
+    };
+
+    size_t ShardIndex(SEG_ID_T seg_id) const;
+
+    const int slot_seconds_;
+    const int period_seconds_;
+    const int slot_count_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+
+// timings in milliseconds of the construction phases of the last LoadSegments(), and of
+// InitForRouting() and InitSegServices() after it
+struct WayManagerInitStats
+{
+    unsigned long long parse_ms{};          // CSV parsing, only by the streaming loader
+    unsigned long long seg_node_maps_ms{};  // bound filtering, segment and node maps
+    unsigned long long node_conn_segs_ms{}; // InitNodeConnectedSegs(), twice with reversed segs
+    unsigned long long reversed_segs_ms{};  // GenerateReversedSegsIntoSegMap()
+    unsigned long long node_flags_ms{};     // node internals and weak connectivity
+    unsigned long long way_map_ms{};        // InitWayMap()
+    unsigned long long routing_ms{};        // InitForRouting()
+    unsigned long long seg_services_ms{};   // InitSegServices()
+    size_t  seg_count{};
+    size_t  node_count{};
+    size_t  way_count{};                    // oriented ways
+    size_t  weak_component_count{};
+    size_t  tile_seg_refs{};                // segment references of the segment tiles
+    size_t  tile_fixed_coords_bytes{};      // fixed point copies of their coordinates, on top
+                                            // of the doubles in the segments
+    int     thread_count{};
+};
+
+
+// error strings of an object (WayManager, SegmentManager, ...) for each thread. the strings
+// are kept in thread local storage keyed by an ID unique to the object, so that Get()/Set()
+// never lock, even with many threads calling AssignSegment() on the same object
+class ThreadErrStrs
+{
+public:
+    ThreadErrStrs();
+    ~ThreadErrStrs();
+    ThreadErrStrs(const ThreadErrStrs&) = delete;
+    ThreadErrStrs& operator=(const ThreadErrStrs&) = delete;
+
+    // the reference stays valid in the current thread, the content changes by next Set()
+    const std::string& Get() const;
+    void Set(const std::string& str) const;
+
+private:
+    const unsigned long long id_; // never reused
+};
+
 
 class WayManager
 {
@@ -871,7 +1261,7 @@ public:
 
     const std::string& GetErrorString() const
     {
-        return GetCurThreadErrStr(threads_err_mutex_, threads_err_strs_);
+        return GetCurThreadErrStr(threads_err_strs_);
     }
     const char *GetErrorCString() const
     {
@@ -886,13 +1276,54 @@ private:
 public:
     // paramteer reverse_seg - true: automatically generated fake reversed segments which are useful for
     //   special vehicles (e.g., bus) assignment and routing
+    // the CSV files (segs_csv can contain '*') are mapped and parsed into the segment pool
+    // directly in parallel, gzipped files are parsed via SEGMENTs. binary segments files are
+    // detected by their content and decoded the same way
     bool LoadSegments(const std::string &segs_csv, bool reversed_seg = false);
     bool LoadSegments(const std::vector<SEGMENT> &segs, bool reversed_seg = false);
     bool LoadSegments(const std::vector<SEGMENT*> &p_segs, bool reversed_seg = false);
     static bool LoadSegmentsFromCsv(const std::string& in_segments_csv, std::vector<SEGMENT> &segs,
         std::string& err);
 
+    // binary segments file, the compact exchange format for the segments CSV: fixed point
+    // coordinates (1e-7 degree), delta and varint encoded, with the strings deduplicated.
+    // the coordinates are rounded to 1e-7 degree, they come back within 0.5e-7 degree (about
+    // 5.6 mm), within 1e-13 degree only when already on that grid. the length is recalculated.
+    // unlike snapshots, it is portable and does not depend on the build
+    static bool SaveSegmentsBinary(const std::vector<SEGMENT> &segs, const std::string &pathname,
+        std::string &err);
+    bool SaveSegmentsBinary(const std::string &pathname) const; // the loaded segments
+
+    // binary snapshot of the loaded segments, nodes and ways, plus the routing tables and the
+    // segment spatial index if they are initialized. LoadSnapshot() replaces LoadSegments(),
+    // InitForRouting() and InitSegServices(). exclusions and node locating are not saved.
+    // a snapshot is only valid for the same build (platform, compiler, version)
+    bool SaveSnapshot(const std::string &pathname) const;
+    bool LoadSnapshot(const std::string &pathname);
+
+    // fast reload: builds the next version of the map from the loaded segments with the segment
+    // diff applied, with the same settings (bound, reversed segments, routing, segment services
+    // and exclusions). this version is not changed and keeps serving the readers meanwhile,
+    // publish the new one with SharedWayManager. removed segments not loaded are ignored, added
+    // ones replace loaded ones of the same IDs.
+    // NOTE: it is a full rebuild, O(map) however small the diff. only the CSV parsing is saved,
+    // nodes, ways, tiles and routing are all built again, there is no per tile or per connection
+    // patching. two versions are in memory until the readers of the old one are done
+    bool ReloadWithSegmentDiff(const std::vector<SEGMENT> &added,
+        const std::vector<SEG_ID_T> &removed, const std::vector<SEGMENT> &modified,
+        std::shared_ptr<WayManager> &p_new_version) const;
+    // increased by each ReloadWithSegmentDiff()
+    unsigned long long MapVersion() const
+    {
+        return map_version_;
+    }
+
 public:
+    const WayManagerInitStats& GetInitStats() const
+    {
+        return init_stats_;
+    }
+
     size_t GetSegCount() const
     {
         return seg_map_.size();
@@ -989,6 +1420,13 @@ public:
     bool SegsToJson(const std::vector<SegmentPtr>& segs, double offset,
         const std::string& seg_color, const std::string& node_color,
         const std::string& pathname) const;
+    // streams the features without building a GeoJSON first
+    bool SegsToJson(const std::vector<SegmentPtr>& segs, double offset,
+        const std::string& seg_color, const std::string& node_color, std::ostream& out) const;
+    // appends the encoded polyline of the route (from point of the first segment, then the to
+    // points) to the stream. see GeoObj_LineString::FromCompressedGeometry() for decoding
+    static bool SegsToEncodedPolyline(const std::vector<SegmentPtr>& route, std::ostream& out,
+        int precision = 5);
 
     bool DriveOnRight() const
     {
@@ -1007,21 +1445,35 @@ public:
         double* p_first_proj_len, double* p_last_proj_len);
 
 private:
+    bool LoadSegmentsStreaming(const std::vector<std::string> &pathnames, bool reversed_seg);
+    bool LoadSegmentsFromPool(bool reversed_seg);
+    bool DoneLoadSegments(bool reversed_seg);
     bool InitWayMap();
     bool InitNodeConnectedSegs();
     bool GenerateReversedSegsIntoSegMap();
-    static void DoneAddNodeMap(util::SimpleObjPool<Node>& node_pool);
+    static size_t DoneAddNodeMap(util::SimpleObjPool<Node>& node_pool);
     static void FlagNodeInternals(util::SimpleObjPool<Node>& node_pool);
-    static void FlagWeakConnectivity(util::SimpleObjPool<Node>& node_pool);
+    static size_t FlagWeakConnectivity(util::SimpleObjPool<Node>& node_pool);
+    void SyncExclusionSegsToRoutingNoLock(const std::vector<SegmentPtr> &segs);
+    bool SaveRoutingSnapshot(snapshot::Writer &writer,
+        const snapshot::SegIndexer &seg_indexer) const;
+    static bool CheckRoutingSnapshot(const snapshot::Reader &reader, size_t n_nodes,
+        size_t n_segs, std::string &err);
+    void LoadRoutingSnapshot(const snapshot::Reader &reader,
+        const snapshot::SegIndexer &seg_indexer);
 
-    static const std::string& GetCurThreadErrStr(std::mutex& threads_err_mutex,
-        UNORD_MAP<std::string, std::string>& threads_err_strs);
-    static void SetCurThreadErrStr(std::mutex& threads_err_mutex,
-        UNORD_MAP<std::string, std::string>& threads_err_strs,
-        const std::string& str);
+    static const std::string& GetCurThreadErrStr(const ThreadErrStrs& threads_err_strs)
+    {
+        return threads_err_strs.Get();
+    }
+    static void SetCurThreadErrStr(const ThreadErrStrs& threads_err_strs,
+        const std::string& str)
+    {
+        threads_err_strs.Set(str);
+    }
     void SetErrorString(const std::string& str) const
     {
-        SetCurThreadErrStr(threads_err_mutex_, threads_err_strs_, str);
+        SetCurThreadErrStr(threads_err_strs_, str);
     }
 
 private:
@@ -1030,9 +1482,13 @@ private:
     SegmentMap      seg_map_;
     OrientedWayMap  way_map_;
     bool            drive_on_right_ = {true};
+    bool            reversed_seg_{};
+    bool            routing_shortest_mode_{true};
+    unsigned long long map_version_{};
+    WayManagerInitStats init_stats_;
 
-    mutable std::mutex threads_err_mutex_;
-    mutable UNORD_MAP<std::string, std::string> threads_err_strs_;
+    ThreadErrStrs   threads_err_strs_;
+    mutable std::mutex exclusion_update_mutex_; // to serialize the exclusion writers
 
     util::SimpleObjPool<Node> node_pool_;
     util::SimpleObjPool<Segment> seg_pool_, seg_pool_rev_;
@@ -1055,6 +1511,9 @@ public:
     bool RoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2, std::vector<SegmentPtr>& route,
         bool exclude_reversed_segs = false, time_t time_point = 0, bool is_localtime = false,
         bool points_reversed = false) const;
+    bool RoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2, CompactRoute& route,
+        bool exclude_reversed_segs = false, time_t time_point = 0, bool is_localtime = false,
+        bool points_reversed = false) const;
     bool RoutingNearby(SEG_ID_T seg_id1, SEG_ID_T seg_id2, std::vector<SegmentPtr>& route,
         bool exclude_reversed_segs = false, time_t time_point = 0, bool is_localtime = false,
         bool points_reversed = false) const
@@ -1138,6 +1597,20 @@ public:
         }
         return ok;
     }
+    bool ShortestPath(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2, CompactRoute& route,
+        bool exclude_reversed_segs = false, time_t time_point = 0, bool is_localtime = false,
+        bool points_reversed = false) const
+    {
+        if (RoutingNearby(p_seg1, p_seg2, route, exclude_reversed_segs, time_point,
+            is_localtime, points_reversed)) {
+            return true;
+        }
+        if (p_seg1->GetDistanceInMeters(*p_seg2) > 200) {
+            return DijkstraShortestPath(p_seg1, p_seg2, route, nullptr, time_point, is_localtime,
+                points_reversed);
+        }
+        return false;
+    }
     bool ShortestPath(SEG_ID_T seg_id1, SEG_ID_T seg_id2, std::vector<SegmentPtr>& route,
         bool exclude_reversed_segs = false, time_t time_point = 0, bool is_localtime = false,
         bool points_reversed = false) const
@@ -1165,6 +1638,11 @@ public:
         std::vector<SegmentPtr>& route, int *seach_steps = nullptr,
         time_t time_point = 0, bool is_localtime = false,
         bool points_reversed = false) const;
+    // the same, returns the route as spans of ways without building the segment list
+    bool DijkstraShortestPath(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
+        CompactRoute& route, int *seach_steps = nullptr,
+        time_t time_point = 0, bool is_localtime = false,
+        bool points_reversed = false) const;
     bool DijkstraShortestPath(SEG_ID_T seg_id1, SEG_ID_T seg_id2, std::vector<SegmentPtr>& route,
         int *seach_steps = nullptr, time_t time_point = 0, bool is_localtime = false,
         bool points_reversed = false) const
@@ -1208,6 +1686,12 @@ public:
         }
     }
 
+    // costs in routing weights from seg1 to each of dst_segs by one Dijkstra search, -1 for the
+    // unreachable ones. seg1 is not counted but the destination segments are, so the costs of
+    // consecutive route sections can be added up
+    bool DijkstraShortestCosts(const SegmentPtr& p_seg1, const std::vector<SegmentPtr>& dst_segs,
+        std::vector<int>& costs, time_t time_point = 0, bool is_localtime = false) const;
+
     // precondition: InitSegServices
     bool ViaRoute(const ViaRouteParams &params, ViaRouteResult &result) const;
 
@@ -1219,6 +1703,11 @@ public:
     bool RouteMatchingResultToJson(const RouteMatchingParams &params,
         const std::string &pathname) const;
 
+    // travel times/speeds on segments of params.result_route, by interpolating record_time of
+    // the matched via points along the route. precondition: RouteMatching() succeeded
+    bool ExtractSegTraversals(const RouteMatchingParams &params,
+        std::vector<SegTraversal> &traversals) const;
+
     //                              A s1
     //           p_seg              |  s2
     //   O------>----->------>----->O---->----->
@@ -1283,7 +1772,12 @@ public:
     // param match_priority: used by segment assignment matching method:
     bool InitSegServices(const Bound& bound, MATCH_PRI match_priority = MATCH_PRI_DEFAULT);
 
+    // exclusions can be set/removed while other threads are assigning segments or routing.
+    // with sync_for_routing, only the routing connections of the segs are updated
     bool SetExclusionSegs(std::vector<SegmentPtr> &segs, const EXCLUSION_SETTING &setting, bool sync_for_routing);
+    bool RemoveExclusionSegs(const std::vector<SegmentPtr> &segs, bool sync_for_routing);
+    // increased each time exclusions are changed
+    unsigned long long ExclusionVersion() const;
     bool IsSegmentExcluded(const SegmentPtr &p_seg, time_t dev_data_time, bool is_localtime) const;
     bool AreSegmentsExcluded(const std::vector<SegmentPtr> &segs, time_t dev_data_time, bool is_localtime) const
     {
@@ -1314,7 +1808,8 @@ public:
         return ok;
     }
     bool ExcludedRoutesToJsons(const std::vector<EXCLUDED_ROUTE> &ex_routes, const std::string &pathname_prefix) const;
-    void SyncExclusionSegsToRouting();
+    void SyncExclusionSegsToRouting(); // for all the routing connections
+    void SyncExclusionSegsToRouting(const std::vector<SegmentPtr> &segs);
 
     SegmentPtr AssignSegment(double lat, double lng, int heading, double radius, int angle_tollerance,
         const char *way_name = nullptr, bool no_road_link = false, bool ignore_reversed_segs = false,
@@ -1339,16 +1834,280 @@ private:
 public:
     // node locating related all put to below
     typedef std::tuple<NodePtr, double> NODE_SEARCH_RESULT;
-    bool InitForNodeLocating(const Bound& bound, const std::vector<NODE>& nodes);
+    // packed_index: only the tiles with nodes are kept, in sorted arrays instead of the tile
+    // matrix of the bound, for the nodes sparse over large bounds (e.g. POIs of a country)
+    bool InitForNodeLocating(const Bound& bound, const std::vector<NODE>& nodes,
+        bool packed_index = false);
     bool FindAdjacentNodes(const geo::GeoPoint& point, double radius, bool has_name,
         std::vector<NODE_SEARCH_RESULT>& results) const;
     bool FindAdjacentNodes(double lat, double lng, double radius, bool has_name,
         std::vector<NODE_SEARCH_RESULT>& results) const;
+    // the k nearest nodes passing the filter, sorted by distance. the tiles are searched ring by
+    // ring around the point, until the next ring cannot have nearer nodes, or all the nodes
+    // passing the filter are seen (counted by type when loaded). if only a few nodes of the
+    // types pass, they are scanned by the per type node lists instead
+    bool FindKNearestNodes(const geo::GeoPoint& point, int k, const NodeSearchFilter& filter,
+        std::vector<NODE_SEARCH_RESULT>& results) const;
 private:
     friend class node::NodeManager;
     std::shared_ptr<node::NodeManager> p_node_manager_;
 };
 
+
+// the current version of the map shared by the reader threads. a reader takes Get() once per
+// request and keeps using that version. ReloadWithSegmentDiff() rebuilds the next version aside
+// and publishes it atomically, the old version is freed after its last reader drops it
+class SharedWayManager
+{
+public:
+    explicit SharedWayManager(const std::shared_ptr<WayManager> &p_way_manager = nullptr)
+        : p_way_manager_(p_way_manager)
+    {}
+
+    SharedWayManager(const SharedWayManager&) = delete;
+    SharedWayManager& operator=(const SharedWayManager&) = delete;
+
+    std::shared_ptr<WayManager> Get() const
+    {
+        return std::atomic_load(&p_way_manager_);
+    }
+    void Publish(const std::shared_ptr<WayManager> &p_way_manager)
+    {
+        std::atomic_store(&p_way_manager_, p_way_manager);
+    }
+
+    // the writers are serialized, the readers are never blocked
+    bool ReloadWithSegmentDiff(const std::vector<SEGMENT> &added,
+        const std::vector<SEG_ID_T> &removed, const std::vector<SEGMENT> &modified);
+
+    const std::string& GetErrorString() const
+    {
+        return threads_err_strs_.Get();
+    }
+
+private:
+    std::shared_ptr<WayManager> p_way_manager_;
+    std::mutex update_mutex_;
+    ThreadErrStrs threads_err_strs_;
+};
+
+
+// the map partitioned into region shards, each one a WayManager with its own spatial index,
+// loaded from its own segments file or snapshot. the ways crossing a region border are kept by
+// the shards on both sides, the segments crossing the border are the transfer points of the
+// overlay graph for the cross-shard routing. shards are loaded on demand, the least recently
+// used ones are unloaded when more than max_loaded_shards are loaded.
+// AddShard() and BuildOverlay() are to be called before the queries
+class ShardedWayManager
+{
+public:
+    // max_loaded_shards 0 for no limit
+    explicit ShardedWayManager(size_t max_loaded_shards = 0)
+        : max_loaded_shards_(max_loaded_shards)
+    {}
+
+    ShardedWayManager(const ShardedWayManager&) = delete;
+    ShardedWayManager& operator=(const ShardedWayManager&) = delete;
+
+    // the regions shall not overlap, a point on the border belongs to the region with the
+    // larger lat/lng. returns the shard index
+    int AddShard(const Bound &bound, const std::string &pathname, bool is_snapshot = false,
+        bool shortest_mode = true);
+    size_t GetShardCount() const
+    {
+        return shards_.size();
+    }
+    const Bound& GetShardBound(int i_shard) const
+    {
+        return shards_[i_shard].bound;
+    }
+    // -1 if no shard covers the point
+    int FindShard(double lat, double lng) const;
+
+    // loaded if not yet, nullptr on error. the shard is valid as long as the pointer is held,
+    // even if it is unloaded meanwhile
+    std::shared_ptr<WayManager> GetShard(int i_shard);
+    bool LoadShard(int i_shard)
+    {
+        return GetShard(i_shard) != nullptr;
+    }
+    void UnloadShard(int i_shard);
+    bool IsShardLoaded(int i_shard) const;
+    size_t GetLoadedShardCount() const;
+
+    // precomputes the costs between the transfer segments within each shard. the shards are
+    // visited one by one, the ones not loaded before are unloaded afterwards
+    bool BuildOverlay();
+    size_t GetTransferCount() const
+    {
+        return transfers_.size();
+    }
+
+    // point query in the shard covering the point, 0 if not assigned
+    SEG_ID_T AssignSegment(double lat, double lng, int heading, double radius,
+        int angle_tollerance, int *p_shard = nullptr);
+
+    // shortest path between segments in any of the shards, through the overlay unless both are
+    // in one shard and the route within it is not more costly. the sections are Dijkstra routes.
+    // precondition: BuildOverlay(). the route is in segment IDs as the shards can be unloaded
+    // meanwhile
+    bool ShortestPath(int i_shard1, SEG_ID_T seg_id1, int i_shard2, SEG_ID_T seg_id2,
+        std::vector<SEG_ID_T> &route);
+
+    const std::string& GetErrorString() const
+    {
+        return threads_err_strs_.Get();
+    }
+
+private:
+    struct Shard
+    {
+        Bound bound;
+        std::string pathname;
+        bool is_snapshot{};
+        bool shortest_mode{ true };
+        std::shared_ptr<WayManager> p_way_manager;
+        unsigned long long last_used{};
+        std::shared_ptr<std::mutex> p_load_mutex; // loading does not block the other shards
+        std::vector<int> transfers; // indices in transfers_
+    };
+
+    struct OverlayEdge
+    {
+        int i_to;   // index in transfers_
+        int cost;   // in routing weights
+        int i_shard;
+    };
+
+    struct Transfer
+    {
+        SEG_ID_T seg_id{};
+        std::vector<OverlayEdge> edges;
+    };
+
+    static bool InRegion(const Bound &bound, double lat, double lng);
+    std::shared_ptr<WayManager> LoadShardFile(const Shard &shard) const;
+    void UnloadLeastUsedShards(int i_keep); // with shards_mutex_ locked
+    bool AppendShardRoute(const std::shared_ptr<WayManager> &p_way_manager, int i_shard,
+        SEG_ID_T seg_id1, SEG_ID_T seg_id2, std::vector<SEG_ID_T> &route);
+
+private:
+    size_t max_loaded_shards_;
+    std::vector<Shard> shards_;
+    mutable std::mutex shards_mutex_; // for p_way_manager and last_used of the shards
+    unsigned long long use_count_{};
+    std::vector<Transfer> transfers_;
+    ThreadErrStrs threads_err_strs_;
+};
+
+
+// z/x/y tile pyramid of the segments and of the aggregated GPS point counts (heat), for the zoom
+// levels [min_zoom, max_zoom]. the heat cells of a tile are the tiles of zoom + heat_cell_bits.
+// Build() bins the segments once at max_zoom in parallel, each lower level is derived from the
+// level below by the parent tiles. the changes after Build() flag the tiles they touch dirty, so
+// that WriteTiles() can regenerate only those. not thread safe, WriteTiles() uses its own threads
+class TilePyramid
+{
+public:
+    enum TILE_FORMAT
+    {
+        TILE_GEOJSON = 0,   // <z>/<x>/<y>.geojson, a FeatureCollection
+        TILE_BINARY = 1,    // <z>/<x>/<y>.bin, see way_manager_tiles.cpp
+    };
+
+    struct TileSeg
+    {
+        SEG_ID_T seg_id{};
+        WAY_ID_T way_id{};
+        HIGHWAY_TYPE way_type{};
+        GeoPoint from_point, to_point;
+    };
+
+    struct HeatCell
+    {
+        int col{}, row{}; // in the tile, [0, 2^heat_cell_bits)
+        unsigned long long count{};
+    };
+
+    struct TileContent
+    {
+        int z{}, x{}, y{};
+        std::vector<TileSeg> segs;
+        std::vector<HeatCell> cells;
+    };
+
+    explicit TilePyramid(int min_zoom, int max_zoom, int heat_cell_bits = 6)
+        : min_zoom_(min_zoom), max_zoom_(max_zoom), heat_cell_bits_(heat_cell_bits)
+    {}
+
+    // replaces all the segments, the reversed ones (negative IDs) are skipped
+    void SetSegments(const WayManager &way_manager);
+    // added, or replaced if the ID exists
+    void SetSegment(const Segment &seg);
+    bool RemoveSegment(SEG_ID_T seg_id);
+    void AddPoint(const GeoPoint &point, unsigned long long count = 1);
+    void AddPoints(const std::vector<GeoPoint> &points)
+    {
+        for (const auto &point : points) {
+            AddPoint(point);
+        }
+    }
+
+    bool Build();
+    size_t GetTileCount(int z) const;
+    size_t GetDirtyTileCount() const;
+
+    // precondition: Build() after the last change. false if the tile is empty
+    bool GetTile(int z, int x, int y, TileContent &content) const;
+    bool EncodeTile(int z, int x, int y, TILE_FORMAT format, std::string &data) const;
+    static bool DecodeBinaryTile(const char *p_data, size_t size, TileContent &content,
+        std::string &err);
+
+    // writes the tiles under dir, all of them or only the dirty ones, built first if needed. the
+    // files of the dirty tiles which became empty are removed. thread_count 0 for the number of
+    // cores. the dirty flags are cleared on success
+    bool WriteTiles(const std::string &dir, TILE_FORMAT format, bool dirty_only,
+        unsigned thread_count = 0);
+
+    const std::string& GetErrorString() const
+    {
+        return threads_err_strs_.Get();
+    }
+
+private:
+    // the tiles of a level sorted by tile_xy, with their ranges in seg_indexes and cells
+    struct Tile
+    {
+        long long tile_xy;
+        unsigned segs_begin, segs_count;
+        unsigned cells_begin, cells_count;
+    };
+
+    struct Level
+    {
+        std::vector<Tile> tiles;
+        std::vector<int> seg_indexes; // in segs_
+        std::vector<HeatCell> cells;
+    };
+
+    // the tiles of max_zoom the segment crosses
+    void CoverTiles(const TileSeg &seg, std::vector<long long> &tiles) const;
+    void MarkDirty(const TileSeg &seg);
+    const Tile* FindTile(int z, int x, int y) const;
+
+private:
+    const int min_zoom_, max_zoom_, heat_cell_bits_;
+    std::vector<TileSeg> segs_;
+    UNORD_MAP<SEG_ID_T, size_t> seg_indexes_;
+    UNORD_MAP<long long, unsigned long long> heat_; // by tile_xy at max_zoom + heat_cell_bits
+    std::vector<Level> levels_; // from min_zoom
+    std::vector<UNORD_SET<long long>> dirty_tiles_; // from min_zoom, since the last WriteTiles()
+    bool all_dirty_{ true };
+    bool built_{};      // levels_ are valid, even if outdated
+    bool need_build_{ true };
+    ThreadErrStrs threads_err_strs_;
+};
+
 }
 
 #endif // _WAY_MANAGER_H_
@@ -1,5 +1,6 @@
 
 #include <algorithm>
+#include <cmath>
 #include <memory>
 #include "way_manager.h"
 #include "common/simple_matrix.hpp"
@@ -15,12 +16,36 @@ namespace node {
 typedef long long TILE_XY;
 
 static const double CELL_SIZE = 200; // in meters
+// the distances to the tile rings are taken shorter by this factor, for the local approximation of
+// the tile borders in meters
+static const double RING_DISTANCE_FACTOR = 0.99;
+// FindKNearestNodes() scans the nodes passing the filter by their type lists instead of the tiles
+// around the point, if there are no more of them than this
+static const size_t SCAN_MAX_NODES = 1024;
+
+// compiling switch for filtering the nodes near a point by a fixed point (microdegree) copy of
+// their coordinates in the node tiles, before the nodes themselves are touched.
+// NOTE: a speed filter only, not a memory mode. the nodes keep their doubles, so the copy adds
+// 8 bytes per node reference of the tiles (each node is referenced by its tile and, in the dense
+// index, by the 8 neighbour ones too)
+#define NODE_FIXED_POINT_FILTER 1
+
+#if NODE_FIXED_POINT_FILTER == 1
+// within the neighbour tiles, the fixed point distances are never more than the haversine ones
+// by FIXED_FILTER_FACTOR times plus FIXED_FILTER_MARGIN meters
+static const double FIXED_FILTER_FACTOR = 1.01;
+static const double FIXED_FILTER_MARGIN = 0.5;
+#endif
 
 struct NodeTile
 {
     TILE_XY tile_id;
     std::vector<NodePtr> nodes;
     std::vector<NodePtr> nodes_with_neighbours;
+#if NODE_FIXED_POINT_FILTER == 1
+    // the coordinates of nodes_with_neighbours in microdegrees, lats then lngs
+    std::vector<int> fixed_coords;
+#endif
 
     NodeTile() : tile_id(0)
     {
@@ -36,17 +61,38 @@ struct NodeTile
     {
         nodes.push_back(p_node);
     }
+
+#if NODE_FIXED_POINT_FILTER == 1
+    void InitFixedCoords()
+    {
+        const size_t n = nodes_with_neighbours.size();
+        std::vector<int>(n * 2).swap(fixed_coords);
+        for (size_t i = 0; i < n; ++i) {
+            fixed_coords[i] = FixedGeoPoint::Lat2FixedLat(nodes_with_neighbours[i]->geo_point_.lat);
+            fixed_coords[n + i] =
+                FixedGeoPoint::Lng2FixedLng(nodes_with_neighbours[i]->geo_point_.lng);
+        }
+    }
+#endif
 };
 typedef NodeTile* NodeTilePtr;
 
+// the nodes of a tile in either index
+struct TileNodes
+{
+    const NodePtr *nodes{};
+    const int *fixed_coords{}; // lats then lngs, null if not available
+    size_t size{};
+};
+
 
 class NodeManager
 {
 public:
     typedef WayManager::NODE_SEARCH_RESULT NODE_SEARCH_RESULT;
 
-    explicit NodeManager(const Bound& bound)
-        : bound_(bound)
+    explicit NodeManager(const Bound& bound, bool packed_index)
+        : bound_(bound), packed_index_(packed_index)
     {
         GRID_CELL_ZOOM_LEVEL = geo::span_to_zoom_level(CELL_SIZE,
             (bound.minlat + bound.maxlat) / 2);
@@ -57,6 +103,9 @@ public:
         int max_tile_y = geo::lat2tiley(bound.minlat, GRID_CELL_ZOOM_LEVEL);
         mat_width_ = max_tile_x - min_tile_x_ + 1;
         mat_height_ = max_tile_y - min_tile_y_ + 1;
+        if (packed_index_) {
+            return;
+        }
 
         node_tile_mat_.SetSize(mat_height_, mat_width_);
         for (int y = 0; y < mat_height_; ++y) {
@@ -71,20 +120,35 @@ public:
     {
         this->node_pool_.Reserve(nodes.size());
 
+        std::vector<NodePtr> p_nodes;
         for (const auto& nd : nodes) {
             if (InMaxMin(nd.geo_point.lat, nd.geo_point.lng)) {
                 auto&& p_node = this->node_pool_.AllocNew(Node(nd));
-                AddNode(p_node);
+                auto& type_nodes = type_nodes_[p_node->nd_type_];
+                type_nodes.nodes.push_back(p_node);
+                type_nodes.named += p_node->nd_name_.empty() ? 0 : 1;
+                if (packed_index_) {
+                    all_nodes_map_.insert(NodeMap::value_type(p_node->nd_id_, p_node));
+                    p_nodes.push_back(p_node);
+                }
+                else {
+                    AddNode(p_node);
+                }
             }
         }
 
-        InitNeighbourNodes();
+        if (packed_index_) {
+            InitPackedTiles(p_nodes);
+        }
+        else {
+            InitNeighbourNodes();
+        }
         return true;
     }
 
     const std::string& GetErrorString() const
     {
-        return WayManager::GetCurThreadErrStr(threads_err_mutex_, threads_err_strs_);
+        return WayManager::GetCurThreadErrStr(threads_err_strs_);
     }
 
     bool FindAdjacentNodes(const geo::GeoPoint& pos, double radius, bool has_name,
@@ -92,14 +156,194 @@ public:
     {
         results.clear();
 
-        NodeTilePtr p_tile = GetTileByPos(pos);
-        if (!p_tile) {
-            WayManager::SetCurThreadErrStr(threads_err_mutex_, threads_err_strs_,
+        int x0, y0;
+        if (!PosToTile(pos, x0, y0)) {
+            WayManager::SetCurThreadErrStr(threads_err_strs_,
                 "FindAdjacentNodes: tile not found");
             return true;
         }
 
-        for (const auto& p_node : p_tile->nodes_with_neighbours) {
+        std::vector<float> fixed_distances;
+        if (packed_index_) {
+            // the tile and its neighbours
+            for (int y = y0 - 1; y <= y0 + 1; ++y) {
+                for (int x = x0 - 1; x <= x0 + 1; ++x) {
+                    AddAdjacentNodes(GetPackedTileNodes(x, y), pos, radius, has_name,
+                        fixed_distances, results);
+                }
+            }
+        }
+        else {
+            const NodeTile& tile = node_tile_mat_(y0 - min_tile_y_, x0 - min_tile_x_);
+            TileNodes tile_nodes;
+            tile_nodes.nodes = tile.nodes_with_neighbours.data();
+            tile_nodes.size = tile.nodes_with_neighbours.size();
+#if NODE_FIXED_POINT_FILTER == 1
+            tile_nodes.fixed_coords = tile.fixed_coords.data();
+#endif
+            AddAdjacentNodes(tile_nodes, pos, radius, has_name, fixed_distances, results);
+        }
+
+        // sort by distance
+        std::sort(results.begin(), results.end(),
+            [](const NODE_SEARCH_RESULT& i, const NODE_SEARCH_RESULT& j) {
+            return std::get<1>(i) < std::get<1>(j);
+        });
+
+        return true;
+    }
+
+    bool FindKNearestNodes(const geo::GeoPoint& pos, int k, const NodeSearchFilter& filter,
+        std::vector<NODE_SEARCH_RESULT>& results) const
+    {
+        results.clear();
+        if (k <= 0) {
+            return true;
+        }
+
+        int x0, y0;
+        if (!PosToTile(pos, x0, y0)) {
+            WayManager::SetCurThreadErrStr(threads_err_strs_,
+                "FindKNearestNodes: tile not found");
+            return true;
+        }
+
+        // done once all the nodes passing the filter are seen, e.g. fewer than k or none at all
+        const size_t filter_count = FilterNodeCount(filter);
+        size_t seen_count = 0;
+        if (filter_count == 0) {
+            return true;
+        }
+
+        // a max heap by distance of the k nearest nodes so far
+        auto nearer = [](const NODE_SEARCH_RESULT& i, const NODE_SEARCH_RESULT& j) {
+            return std::get<1>(i) < std::get<1>(j);
+        };
+        auto add_node = [&](const NodePtr& p_node) {
+            const double distance = geo::distance_in_meter(pos, p_node->geo_point_);
+            if ((filter.max_radius > 0 && distance > filter.max_radius) ||
+                ((int)results.size() == k && distance >= std::get<1>(results.front()))) {
+                return;
+            }
+            if ((int)results.size() == k) {
+                std::pop_heap(results.begin(), results.end(), nearer);
+                results.pop_back();
+            }
+            results.push_back(std::make_tuple(p_node, distance));
+            std::push_heap(results.begin(), results.end(), nearer);
+        };
+
+        // a few nodes anywhere in the map, e.g. of a rare type: the rings would walk most tiles
+        if (filter_count <= SCAN_MAX_NODES && filter.type_count > 0) {
+            for (int i = 0; i < filter.type_count; ++i) {
+                // the types given twice are scanned once
+                if (std::find(filter.types, filter.types + i, filter.types[i]) !=
+                    filter.types + i) {
+                    continue;
+                }
+                auto it = type_nodes_.find(filter.types[i]);
+                if (it == type_nodes_.end()) {
+                    continue;
+                }
+                for (const auto& p_node : it->second.nodes) {
+                    if (!filter.has_name || !p_node->nd_name_.empty()) {
+                        add_node(p_node);
+                    }
+                }
+            }
+            std::sort_heap(results.begin(), results.end(), nearer);
+            return true;
+        }
+
+        auto add_tile_nodes = [&](int x, int y) {
+            const TileNodes tile_nodes = GetTileNodes(x, y);
+            for (size_t i = 0; i < tile_nodes.size; ++i) {
+                const auto& p_node = tile_nodes.nodes[i];
+                if (NodePassesFilter(*p_node, filter)) {
+                    ++seen_count;
+                    add_node(p_node);
+                }
+            }
+        };
+
+        const int max_ring = std::max(std::max(x0 - min_tile_x_, min_tile_x_ + mat_width_ - 1 - x0),
+            std::max(y0 - min_tile_y_, min_tile_y_ + mat_height_ - 1 - y0));
+        for (int r = 0; r <= max_ring && seen_count < filter_count; ++r) {
+            if (r > 0) {
+                const double ring_distance = RingDistance(pos, x0, y0, r);
+                if (((int)results.size() == k && ring_distance > std::get<1>(results.front())) ||
+                    (filter.max_radius > 0 && ring_distance > filter.max_radius)) {
+                    break;
+                }
+            }
+            // the top and bottom rows, then the left and right columns between them
+            for (int x = x0 - r; x <= x0 + r; ++x) {
+                add_tile_nodes(x, y0 - r);
+                if (r > 0) {
+                    add_tile_nodes(x, y0 + r);
+                }
+            }
+            for (int y = y0 - r + 1; y <= y0 + r - 1; ++y) {
+                add_tile_nodes(x0 - r, y);
+                add_tile_nodes(x0 + r, y);
+            }
+        }
+
+        std::sort_heap(results.begin(), results.end(), nearer);
+        return true;
+    }
+
+private:
+    // the number of the loaded nodes passing the type and name filters
+    size_t FilterNodeCount(const NodeSearchFilter& filter) const
+    {
+        size_t count = 0;
+        for (const auto& type_nodes : type_nodes_) {
+            if (filter.type_count > 0 && std::find(filter.types,
+                filter.types + filter.type_count, type_nodes.first) ==
+                filter.types + filter.type_count) {
+                continue;
+            }
+            count += filter.has_name ? type_nodes.second.named : type_nodes.second.nodes.size();
+        }
+        return count;
+    }
+
+    static bool NodePassesFilter(const Node& node, const NodeSearchFilter& filter)
+    {
+        if (filter.has_name && node.nd_name_.empty()) {
+            return false;
+        }
+        if (filter.type_count > 0 && std::find(filter.types, filter.types + filter.type_count,
+            node.nd_type_) == filter.types + filter.type_count) {
+            return false;
+        }
+        return true;
+    }
+
+    void AddAdjacentNodes(const TileNodes& tile_nodes, const geo::GeoPoint& pos, double radius,
+        bool has_name, std::vector<float>& fixed_distances,
+        std::vector<NODE_SEARCH_RESULT>& results) const
+    {
+#if NODE_FIXED_POINT_FILTER == 1
+        fixed_distances.resize(tile_nodes.size);
+        const int *p = tile_nodes.fixed_coords;
+        const size_t n = tile_nodes.size;
+        // zero length segments
+        geo::distance_point_to_segments_square(FixedGeoPoint(pos), p, p + n, p, p + n,
+            fixed_distances.data(), n);
+        const double fixed_radius = (radius + FIXED_FILTER_MARGIN) * FIXED_FILTER_FACTOR;
+        const float fixed_radius2 = (float)(fixed_radius * fixed_radius);
+#else
+        (void)fixed_distances;
+#endif
+        for (size_t i = 0; i < tile_nodes.size; ++i) {
+#if NODE_FIXED_POINT_FILTER == 1
+            if (fixed_distances[i] >= fixed_radius2) {
+                continue;
+            }
+#endif
+            const auto& p_node = tile_nodes.nodes[i];
             if (has_name) {
                 if (p_node->nd_name_.empty()) {
                     continue;
@@ -111,17 +355,57 @@ public:
                 results.push_back(std::make_tuple(p_node, distance));
             }
         }
+    }
 
-        // sort by distance
-        std::sort(results.begin(), results.end(),
-            [](const NODE_SEARCH_RESULT& i, const NODE_SEARCH_RESULT& j) {
-            return std::get<1>(i) < std::get<1>(j);
-        });
+    // the nodes in the tile itself, without the neighbours
+    TileNodes GetTileNodes(int x, int y) const
+    {
+        if (packed_index_) {
+            return GetPackedTileNodes(x, y);
+        }
+        TileNodes tile_nodes;
+        if (InTileRange(x, y)) {
+            const NodeTile& tile = node_tile_mat_(y - min_tile_y_, x - min_tile_x_);
+            tile_nodes.nodes = tile.nodes.data();
+            tile_nodes.size = tile.nodes.size();
+        }
+        return tile_nodes;
+    }
 
-        return true;
+    TileNodes GetPackedTileNodes(int x, int y) const
+    {
+        TileNodes tile_nodes;
+        const TILE_XY tile_id = geo::make_tilexy(x, y);
+        auto it = std::lower_bound(packed_tile_ids_.begin(), packed_tile_ids_.end(), tile_id);
+        if (it != packed_tile_ids_.end() && *it == tile_id) {
+            const size_t i_tile = it - packed_tile_ids_.begin();
+            const unsigned begin = packed_tile_begins_[i_tile];
+            tile_nodes.nodes = packed_nodes_.data() + begin;
+            tile_nodes.size = packed_tile_begins_[i_tile + 1] - begin;
+#if NODE_FIXED_POINT_FILTER == 1
+            tile_nodes.fixed_coords = packed_fixed_coords_.data() + 2 * begin;
+#endif
+        }
+        return tile_nodes;
+    }
+
+    // no node of the tiles of ring r around (x0, y0) is nearer to pos than this. the ring is out
+    // of the box of the inner rings, whose sides are taken in meters at the latitudes where the
+    // box is narrowest
+    double RingDistance(const geo::GeoPoint& pos, int x0, int y0, int r) const
+    {
+        const double west = geo::tilex2long(x0 - r + 1, GRID_CELL_ZOOM_LEVEL);
+        const double east = geo::tilex2long(x0 + r, GRID_CELL_ZOOM_LEVEL);
+        const double north = geo::tiley2lat(y0 - r + 1, GRID_CELL_ZOOM_LEVEL);
+        const double south = geo::tiley2lat(y0 + r, GRID_CELL_ZOOM_LEVEL);
+        const double max_abs_lat = std::max(std::fabs(north), std::fabs(south));
+        const double d_lat = std::min(north - pos.lat, pos.lat - south);
+        const double d_lng = std::min(pos.lng - west, east - pos.lng);
+        const double d = std::min(geo::distance_in_meter_same_lng(0, d_lat),
+            geo::distance_in_meter_same_lat(max_abs_lat, 0, d_lng));
+        return d * RING_DISTANCE_FACTOR;
     }
 
-private:
     void AddNode(const NodePtr &p_node)
     {
         all_nodes_map_.insert(NodeMap::value_type(p_node->nd_id_, p_node));
@@ -139,21 +423,28 @@ private:
             lng >= bound_.minlng && lng <= bound_.maxlng);
     }
 
+    bool InTileRange(int x, int y) const
+    {
+        return x >= min_tile_x_ && x < min_tile_x_ + mat_width_ &&
+            y >= min_tile_y_ && y < min_tile_y_ + mat_height_;
+    }
+
     NodeTilePtr GetTileById(TILE_XY tile_id) const
     {
         int x = geo::tilexy2tilex(tile_id);
         int y = geo::tilexy2tiley(tile_id);
-        if (x >= min_tile_x_ && x < min_tile_x_ + mat_width_ &&
-            y >= min_tile_y_ && y < min_tile_y_ + mat_height_) {
+        if (InTileRange(x, y)) {
             return (NodeTilePtr)&node_tile_mat_(y - min_tile_y_, x - min_tile_x_);
         }
         return nullptr;
     }
 
-    NodeTilePtr GetTileByPos(const geo::GeoPoint& pos) const
+    // false if out of the tiles of the bound
+    bool PosToTile(const geo::GeoPoint& pos, int& x, int& y) const
     {
-        TILE_XY tile_id = PosToTileId(pos);
-        return GetTileById(tile_id);
+        x = geo::long2tilex(pos.lng, GRID_CELL_ZOOM_LEVEL);
+        y = geo::lat2tiley(pos.lat, GRID_CELL_ZOOM_LEVEL);
+        return InTileRange(x, y);
     }
 
     TILE_XY PosToTileId(const geo::GeoPoint& pos) const
@@ -213,19 +504,76 @@ private:
                         tile.nodes_with_neighbours.push_back(nodes_with_neighbours[i]);
                     }
                 }
+#if NODE_FIXED_POINT_FILTER == 1
+                tile.InitFixedCoords();
+#endif
             }
         }
     }
 
+    // the nodes sorted by tile, the order in each tile kept
+    void InitPackedTiles(const std::vector<NodePtr>& p_nodes)
+    {
+        std::vector<std::pair<TILE_XY, unsigned>> tile_nodes(p_nodes.size());
+        for (size_t i = 0; i < p_nodes.size(); ++i) {
+            tile_nodes[i] = std::make_pair(PosToTileId(p_nodes[i]->geo_point_), (unsigned)i);
+        }
+        std::sort(tile_nodes.begin(), tile_nodes.end());
+
+        packed_tile_ids_.clear();
+        packed_tile_begins_.clear();
+        packed_nodes_.resize(tile_nodes.size());
+        for (size_t i = 0; i < tile_nodes.size(); ++i) {
+            if (i == 0 || tile_nodes[i].first != tile_nodes[i - 1].first) {
+                packed_tile_ids_.push_back(tile_nodes[i].first);
+                packed_tile_begins_.push_back((unsigned)i);
+            }
+            packed_nodes_[i] = p_nodes[tile_nodes[i].second];
+        }
+        packed_tile_begins_.push_back((unsigned)tile_nodes.size());
+        packed_tile_ids_.shrink_to_fit();
+        packed_tile_begins_.shrink_to_fit();
+
+#if NODE_FIXED_POINT_FILTER == 1
+        packed_fixed_coords_.resize(packed_nodes_.size() * 2);
+        for (size_t i_tile = 0; i_tile < packed_tile_ids_.size(); ++i_tile) {
+            const unsigned begin = packed_tile_begins_[i_tile];
+            const unsigned n = packed_tile_begins_[i_tile + 1] - begin;
+            int *p = packed_fixed_coords_.data() + 2 * begin;
+            for (unsigned i = 0; i < n; ++i) {
+                p[i] = FixedGeoPoint::Lat2FixedLat(packed_nodes_[begin + i]->geo_point_.lat);
+                p[n + i] = FixedGeoPoint::Lng2FixedLng(packed_nodes_[begin + i]->geo_point_.lng);
+            }
+        }
+#endif
+    }
+
 private:
+    struct TypeNodes
+    {
+        std::vector<NodePtr> nodes;
+        size_t named{};
+    };
+
     NodeMap all_nodes_map_;
     util::SimpleObjPool<Node> node_pool_;
+    UNORD_MAP<NODE_TYPE, TypeNodes> type_nodes_; // by node type, of the loaded nodes
 
     Bound bound_;
     int min_tile_x_, min_tile_y_, mat_width_, mat_height_;
     SimpleMatrix<NodeTile> node_tile_mat_;
-    mutable std::mutex threads_err_mutex_;
-    mutable UNORD_MAP<std::string, std::string> threads_err_strs_;
+
+    // packed index: the tiles with nodes sorted by id, the nodes of tile i in
+    // packed_nodes_[packed_tile_begins_[i], packed_tile_begins_[i + 1])
+    const bool packed_index_;
+    std::vector<TILE_XY> packed_tile_ids_;
+    std::vector<unsigned> packed_tile_begins_;
+    std::vector<NodePtr> packed_nodes_;
+#if NODE_FIXED_POINT_FILTER == 1
+    // the coordinates of the nodes of each tile in microdegrees, lats then lngs
+    std::vector<int> packed_fixed_coords_;
+#endif
+    ThreadErrStrs threads_err_strs_;
 
     double GRID_CELL_ZOOM_LEVEL;
     friend class WayManager;
@@ -235,9 +583,10 @@ private:
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // class WayManager
 
-bool WayManager::InitForNodeLocating(const Bound& bound, const std::vector<NODE>& nodes)
+bool WayManager::InitForNodeLocating(const Bound& bound, const std::vector<NODE>& nodes,
+    bool packed_index)
 {
-    p_node_manager_ = std::make_shared<node::NodeManager>(bound);
+    p_node_manager_ = std::make_shared<node::NodeManager>(bound, packed_index);
 
     if (false == p_node_manager_->LoadToTileMatrix(nodes)) {
         SetErrorString(p_node_manager_->GetErrorString());
@@ -267,4 +616,14 @@ bool WayManager::FindAdjacentNodes(double lat, double lng, double radius, bool h
     return true;
 }
 
+bool WayManager::FindKNearestNodes(const geo::GeoPoint& point, int k,
+    const NodeSearchFilter& filter, std::vector<NODE_SEARCH_RESULT>& results) const
+{
+    if (false == p_node_manager_->FindKNearestNodes(point, k, filter, results)) {
+        SetErrorString(p_node_manager_->GetErrorString());
+        return false;
+    }
+    return true;
+}
+
 } // namespace geo
@@ -3,9 +3,12 @@
 #include <algorithm>
 #include <memory>
 #include <climits>
+#include <cmath>
 #include <set>
 #include <array>
+#include <fstream>
 #include "common/common_utils.h"
+#include "common/simple_arena.hpp"
 #if WAY_MANAGER_HANA_LOG == 1
 #include <hana/logging.h>
 #endif
@@ -22,28 +25,33 @@ namespace route_match {
 struct GraphEdge;
 typedef GraphEdge *GraphEdgePtr;
 
+// graph nodes/edges are allocated from the arena in Graph, never destructed
 struct GraphNode
 {
-    explicit GraphNode(SegmentPtr p_seg)
-        : p_seg_(p_seg)
+    explicit GraphNode(SegmentPtr p_seg, int index, util::SimpleArena *p_arena)
+        : p_seg_(p_seg), index_(index),
+        edges_(util::ArenaAllocator<GraphEdgePtr>(p_arena))
     {}
 
     SegmentPtr p_seg_;
-    std::vector<GraphEdgePtr> edges_;
+    int index_; // index in Graph::all_g_nodes
+    util::ArenaVector<GraphEdgePtr> edges_;
 };
 typedef GraphNode *GraphNodePtr;
 
 struct GraphEdge
 {
-    explicit GraphEdge(GraphNodePtr p_from_g_node, GraphNodePtr p_to_g_node, int distance)
-        : p_from_g_node_(p_from_g_node), p_to_g_node_(p_to_g_node), distance_(distance)
+    explicit GraphEdge(GraphNodePtr p_from_g_node, GraphNodePtr p_to_g_node, int distance,
+        util::SimpleArena *p_arena)
+        : p_from_g_node_(p_from_g_node), p_to_g_node_(p_to_g_node), distance_(distance),
+        segs_(util::ArenaAllocator<SegmentPtr>(p_arena))
     {}
 
     GraphNodePtr p_from_g_node_;
     GraphNodePtr p_to_g_node_;
     int distance_;
     // segs path between two GraphNodePtr, including the 1st and the last
-    std::vector<SegmentPtr> segs_;
+    util::ArenaVector<SegmentPtr> segs_;
 };
 
 struct NodeData
@@ -61,18 +69,16 @@ struct NodeData
 typedef NodeData *NodeDataPtr;
 
 // map from GraphNodePtr to NodeDataPtr for inserted nodes
-// NOTE: the class assumes GraphNode objects are linearly allocated
 class InsertedNodeMap
 {
 public:
     InsertedNodeMap()
     {}
 
-    void Init(int max_node, const util::SimpleObjPool<GraphNode> *p_gnode_pool)
+    void Init(int max_node)
     {
         max_node_ = max_node;
-        inserted_.resize(max_node);
-        p_gnode_pool_ = const_cast<util::SimpleObjPool<GraphNode> *>(p_gnode_pool);
+        inserted_.assign(max_node, nullptr); // capacity kept for the next time
     }
 
     void Clear()
@@ -83,39 +89,42 @@ public:
 
     NodeDataPtr& operator[](GraphNodePtr p_gnode)
     {
-        auto p_gnode0 = p_gnode_pool_->ObjPtrByIndex(0);
-        if (p_gnode >= p_gnode0 && p_gnode < p_gnode0 + max_node_) {
-            return inserted_[p_gnode - p_gnode0];
+        if (p_gnode->index_ >= 0 && p_gnode->index_ < max_node_) {
+            return inserted_[p_gnode->index_];
         }
         throw std::range_error("out of bound");
     }
     NodeDataPtr operator[](GraphNodePtr p_gnode) const
     {
-        auto p_gnode0 = p_gnode_pool_->ObjPtrByIndex(0);
-        if (p_gnode >= p_gnode0 && p_gnode < p_gnode0 + max_node_) {
-            return inserted_[p_gnode - p_gnode0];
+        if (p_gnode->index_ >= 0 && p_gnode->index_ < max_node_) {
+            return inserted_[p_gnode->index_];
         }
         throw std::range_error("out of bound");
     }
 
 private:
     int max_node_{};
-    util::SimpleObjPool<GraphNode> *p_gnode_pool_{};
-    // as the key objects are linearly allocated, the map is optimized to use vector
-    // instead of hash map
+    // as the graph nodes are indexed by GraphNode::index_, the map is optimized to use
+    // vector instead of hash map
     std::vector<NodeDataPtr> inserted_;
 };
 
 struct RouteMatchingImpl;
+// reused by all the Dijkstra runs of a matcher to avoid repeated memory allocations
 class BinHeap
 {
 public:
-    explicit BinHeap(int max_node, const util::SimpleObjPool<GraphNode> &gnode_pool)
-        : max_node_(max_node)
+    BinHeap()
+    {}
+
+    void Reset(int max_node)
     {
+        max_node_ = max_node;
+        node_pool_.Clear();
         node_pool_.Reserve(max_node);
+        heap_.clear();
         heap_.reserve(max_node);
-        inserted_.Init(max_node, &gnode_pool);
+        inserted_.Init(max_node);
     }
 
     bool Empty() const
@@ -200,7 +209,7 @@ public:
     }
 
 private:
-    const int max_node_;
+    int max_node_{};
     util::SimpleObjPool<NodeData> node_pool_;
     vector<NodeDataPtr> heap_;
     InsertedNodeMap inserted_;
@@ -210,23 +219,40 @@ private:
 
 struct Graph
 {
-    util::SimpleObjPool<GraphNode> g_node_pool;
-    util::SimpleObjPool<GraphEdge> g_edge_pool;
+    util::SimpleArena arena; // for GraphNode, GraphEdge objects and their vectors
     std::vector<GraphNodePtr> all_g_nodes;
     std::vector<GraphEdgePtr> all_g_edges;
 
+    GraphNodePtr NewNode(SegmentPtr p_seg)
+    {
+        auto p_g_node = arena.New<GraphNode>(p_seg, (int)all_g_nodes.size(), &arena);
+        all_g_nodes.push_back(p_g_node);
+        return p_g_node;
+    }
+
+    GraphEdgePtr NewEdge(GraphNodePtr p_from_g_node, GraphNodePtr p_to_g_node, int distance)
+    {
+        auto p_g_edge = arena.New<GraphEdge>(p_from_g_node, p_to_g_node, distance, &arena);
+        all_g_edges.push_back(p_g_edge);
+        p_from_g_node->edges_.push_back(p_g_edge);
+        return p_g_edge;
+    }
+
+    // all GraphNodePtr/GraphEdgePtr are invalid afterwards
     void Clear()
     {
-        g_node_pool.Clear();
-        g_edge_pool.Clear();
         all_g_nodes.clear();
         all_g_edges.clear();
+        arena.Reset();
     }
 };
 
 static const size_t MAX_CANDIATES_COUNT = 3;
 static const int INVALID_WEIGHT = std::numeric_limits<int>::max();
 static const double MAX_SEGMENT_LEN = 200.0;
+// for the route probabilities, weight difference of 300 (about 30 seconds of driving) makes
+// a route e times less likely
+static const double WEIGHT_TEMPERATURE = 300.0;
 
 // below are used by RouteMatching
 struct RouteMatchingImpl
@@ -237,10 +263,35 @@ public:
         RouteMatchingViaPoint *p_via_point{};
         std::array<SegmentPtr, MAX_CANDIATES_COUNT>   p_segs{};
         std::array<GraphNodePtr, MAX_CANDIATES_COUNT> p_gnodes{};
+        std::array<float, MAX_CANDIATES_COUNT>        scores{}; // normalized assignment scores
 
         void SetToNonMatched()
         {
             p_segs.fill(nullptr);
+            scores.fill(0.0f);
+        }
+
+        float CandidateScore(SegmentPtr p_seg) const
+        {
+            for (size_t i = 0; i < p_segs.size(); ++i) {
+                if (p_segs[i] == p_seg) {
+                    // avoid zero to keep the route weights still working
+                    return scores[i] > 0.01f ? scores[i] : 0.01f;
+                }
+            }
+            return 0.0f;
+        }
+
+        // score share of the candidate among all the candidates
+        float CandidateShare(SegmentPtr p_seg) const
+        {
+            float sum = 0.0f;
+            for (size_t i = 0; i < p_segs.size(); ++i) {
+                if (p_segs[i]) {
+                    sum += CandidateScore(p_segs[i]);
+                }
+            }
+            return (sum > 0.0f) ? CandidateScore(p_seg) / sum : 0.0f;
         }
 
         // return true if only has one matched segment
@@ -283,6 +334,15 @@ public:
         int group_index{};
         int from_index{};
         int to_index{};
+        float route_prob{}; // probability of the selected route, 0 if no route found
+    };
+
+    // for RouteMatchingParams::alternatives
+    struct GroupCandidate
+    {
+        int weight;
+        float prob;
+        std::vector<SegmentPtr> seg_route;
     };
 
     struct RoutingPair
@@ -292,6 +352,7 @@ public:
         GraphNodePtr p_gnode_from{}, p_gnode_to{};
         std::vector<SegmentPtr> seg_route;
         int route_weight{ INVALID_WEIGHT }; // weighted length
+        float route_prob{}; // probability among all the pairs of the group
 
         void Init(MatchingPoint* p_from_mat_pt, MatchingPoint* p_to_mat_pt,
             SegmentPtr p_seg_from, SegmentPtr p_seg_to,
@@ -306,6 +367,7 @@ public:
 
             seg_route.clear();
             route_weight = INVALID_WEIGHT;
+            route_prob = 0.0f;
         }
     };
 
@@ -314,11 +376,17 @@ private:
     Graph g_;
     mutable std::vector<ViaPoint> temp_via_points_;
     mutable std::vector<SegmentPtr> temp_segs_;
+    mutable BinHeap temp_heap_;
+    mutable std::vector<GraphNodePtr> temp_gnode_path_;
+    mutable std::vector<tuple<NodeDataPtr, int>> temp_decrease_pairs_;
 
     const WayManager &way_manager_;
     RouteMatchingParams &matching_params_;
     std::vector<MatchingPoint> matching_points_;
     std::vector<MatchingPointGroup> groups_;
+    std::vector<float> point_probs_; // for RouteMatchingViaPoint::match_prob, -1 if not set
+    std::vector<std::vector<GroupCandidate>> group_cands_; // candidate routes of each group
+    size_t group_cand_count_{};
 
 public:
     explicit RouteMatchingImpl(const WayManager &way_manager, RouteMatchingParams &matching_params)
@@ -331,6 +399,7 @@ public:
     {
         // input parameters from matching_params => matching_points
         MatchingPointsCopyFromParams(matching_params_, matching_points_);
+        g_.Clear(); // reset the graph arena for the new trace
 
         // div by 4.0 instead of 2.0, as we also check the distance to the mid-points
         // of long segments
@@ -348,9 +417,13 @@ public:
         matching_params_.result_route.clear();
         // a guessed number based on observation, should be OK for most
         matching_params_.result_route.reserve(256);
+        matching_params_.alternatives.clear();
+        matching_params_.result_prob = 0.0f;
+        point_probs_.assign(matching_points_.size(), -1.0f);
+        group_cand_count_ = 0;
 
         // find route for each group
-        for (const auto &group : groups_) {
+        for (auto &group : groups_) {
             if (group.from_index >= group.to_index) { // invalid case
                 continue;
             }
@@ -359,12 +432,21 @@ public:
 
         FixBeginEndPoints();
         FixOutputsInResultRoute();
+        CalcMatchProbabilities();
+        if (matching_params_.alternative_count > 0) {
+            BuildAlternatives();
+        }
 
         if (matching_params_.verfy_result) {
             VerifyResult(matching_params_);
         }
     }
 
+    const util::SimpleArena& GraphArena() const
+    {
+        return g_.arena;
+    }
+
     static bool ResultToJson(const WayManager &way_manager,
         const RouteMatchingParams &matching_params,
         const std::string &json_pathname)
@@ -386,60 +468,58 @@ public:
         }
 #endif
 
-        geo::GeoJSON geo_json;
-        if (!SegsToJson(way_manager, matching_params.result_route, 4.0, "blue", "black",
-            geo_json)) {
+        std::ofstream out(json_pathname.c_str(), std::ios::binary);
+        if (!out.good()) {
             return false;
         }
+        geo::GeoJsonStreamWriter writer(out);
+        SegsToJson(way_manager, matching_params.result_route, 4.0, "blue", "black", writer);
 
         auto trace_color = "green";
-        std::shared_ptr<GeoObj_LineString> p_line = std::make_shared<GeoObj_LineString>();
+        writer.BeginLineString();
         for (auto &via_point : matching_params.via_points) {
-            p_line->AddPoint(via_point.geo_point);
+            writer.AddPoint(via_point.geo_point);
         }
-        p_line->AddProp("disconnected_index", matching_params.disconnected_index);
-        p_line->AddProp("repeated_index", matching_params.repeated_index);
-        p_line->AddProp("color", trace_color);
-
-        geo_json.AddObj(p_line);
+        writer.AddProp("disconnected_index", matching_params.disconnected_index);
+        writer.AddProp("repeated_index", matching_params.repeated_index);
+        writer.AddProp("color", trace_color);
+        writer.EndFeature();
 
         int index = 0;
         for (auto &point : matching_params.via_points) {
-            std::shared_ptr<GeoObj_Point> p_point = std::make_shared<GeoObj_Point>(
-                point.geo_point);
-            p_point->AddProp("index", index);
-            p_point->AddProp("heading", point.heading);
-            p_point->AddProp("speed", point.speed);
-            p_point->AddProp("record_time", util::TimeTToStr(point.record_time));
-            p_point->AddProp("relative_time(sec)",
+            writer.BeginPoint(point.geo_point);
+            writer.AddProp("index", index);
+            writer.AddProp("heading", point.heading);
+            writer.AddProp("speed", point.speed);
+            writer.AddProp("record_time", util::TimeTToStr(point.record_time));
+            writer.AddProp("relative_time(sec)",
                 (long long)(point.record_time - matching_params.via_points[0].record_time));
-            p_point->AddProp("seg_id", (point.p_seg ? point.p_seg->seg_id_ : 0));
-            p_point->AddProp("broken", point.is_broken);
-            p_point->AddProp("entering_no_gps", point.entering_no_gps_route);
-            p_point->AddProp("color", trace_color);
-            geo_json.AddObj(p_point);
+            writer.AddProp("seg_id", (point.p_seg ? point.p_seg->seg_id_ : 0));
+            writer.AddProp("broken", point.is_broken);
+            writer.AddProp("entering_no_gps", point.entering_no_gps_route);
+            writer.AddProp("match_prob", (double)point.match_prob);
+            writer.AddProp("color", trace_color);
+            writer.EndFeature();
 
             // for the direction
             if (point.heading >= 0) {
-                auto p_line = std::make_shared<GeoObj_LineString>();
-                p_line->AddPoint(point.geo_point);
                 geo::GeoPoint to = geo::get_point_degree(point.geo_point, 12.0, point.heading);
-                p_line->AddPoint(to);
-                p_line->AddProp("index", index);
-                p_line->AddProp("color", trace_color);
-                geo_json.AddObj(p_line);
+                writer.BeginLineString(point.geo_point, to);
+                writer.AddProp("index", index);
+                writer.AddProp("color", trace_color);
+                writer.EndFeature();
             }
 
             index++;
         }
 
-        return geo_json.ToJsonFile(json_pathname);
+        return writer.Close();
     }
 
 private:
     std::array<RoutingPair, MAX_CANDIATES_COUNT * MAX_CANDIATES_COUNT> routing_pairs_;
     size_t routing_pair_count_{};
-    void AppendResultRouteForGroup(const MatchingPointGroup &group)
+    void AppendResultRouteForGroup(MatchingPointGroup &group)
     {
         MatchingPoint &from_pt = matching_points_[group.from_index];
         MatchingPoint &to_pt = matching_points_[group.to_index];
@@ -513,6 +593,199 @@ private:
                     to_point.i_seg = i;
                 }
             }
+
+            CalcGroupProbabilities(group);
+            if (matching_params_.alternative_count > 0) {
+                SaveGroupCandidates();
+            }
+        }
+    }
+
+    // posterior of each routing pair in routing_pairs_[] as the product of the assignment
+    // scores of both ends and the likelihood of the route weight
+    void CalcGroupProbabilities(MatchingPointGroup &group)
+    {
+        const auto &the_pair = routing_pairs_.front();
+        double total = 0.0, from_sum = 0.0, to_sum = 0.0;
+        for (size_t i = 0; i < routing_pair_count_; ++i) {
+            auto &pair = routing_pairs_[i];
+            if (pair.route_weight == INVALID_WEIGHT) {
+                continue;
+            }
+            double post = pair.p_from_mat_pt->CandidateScore(pair.p_seg_from)
+                * pair.p_to_mat_pt->CandidateScore(pair.p_seg_to)
+                * std::exp(-(pair.route_weight - the_pair.route_weight) / WEIGHT_TEMPERATURE);
+            pair.route_prob = (float)post; // normalized below
+            total += post;
+            if (pair.p_seg_from == the_pair.p_seg_from) {
+                from_sum += post;
+            }
+            if (pair.p_seg_to == the_pair.p_seg_to) {
+                to_sum += post;
+            }
+        }
+        if (total <= 0.0) {
+            return;
+        }
+
+        for (size_t i = 0; i < routing_pair_count_; ++i) {
+            routing_pairs_[i].route_prob = float(routing_pairs_[i].route_prob / total);
+        }
+        group.route_prob = the_pair.route_prob;
+        MergePointProb(group.from_index, float(from_sum / total));
+        MergePointProb(group.to_index, float(to_sum / total));
+    }
+
+    // a point shared by two groups keeps the lower probability
+    void MergePointProb(int index, float prob)
+    {
+        float &point_prob = point_probs_[index];
+        if (point_prob < 0.0f || prob < point_prob) {
+            point_prob = prob;
+        }
+    }
+
+    // keep the best (alternative_count + 2) routes of the group for BuildAlternatives()
+    void SaveGroupCandidates()
+    {
+        if (group_cand_count_ >= group_cands_.size()) {
+            group_cands_.resize(group_cand_count_ + 1);
+        }
+        auto &cands = group_cands_[group_cand_count_++];
+        const size_t max_count = (size_t)matching_params_.alternative_count + 2;
+
+        cands.clear();
+        for (size_t i = 0; i < routing_pair_count_ && cands.size() < max_count; ++i) {
+            const auto &pair = routing_pairs_[i];
+            if (pair.route_weight == INVALID_WEIGHT) {
+                break; // sorted by weight, no more valid ones
+            }
+            bool duplicated = false;
+            for (const auto &cand : cands) {
+                if (cand.seg_route == pair.seg_route) {
+                    duplicated = true;
+                    break;
+                }
+            }
+            if (!duplicated) {
+                cands.push_back(GroupCandidate{ pair.route_weight, pair.route_prob,
+                    pair.seg_route });
+            }
+        }
+    }
+
+    // outputs RouteMatchingViaPoint::match_prob and RouteMatchingParams::result_prob
+    void CalcMatchProbabilities()
+    {
+        auto &via_points = matching_params_.via_points;
+        double result_prob = 1.0;
+        bool has_route = false;
+
+        for (const auto &group : groups_) {
+            if (group.from_index >= group.to_index || group.route_prob <= 0.0f) {
+                continue;
+            }
+            has_route = true;
+            result_prob *= group.route_prob;
+
+            // points in the middle: the selected route times the point's own assignment
+            for (int i = group.from_index + 1; i < group.to_index; ++i) {
+                const auto &p_seg = via_points[i].p_seg;
+                if (p_seg) {
+                    MergePointProb(i, group.route_prob *
+                        matching_points_[i].CandidateShare(p_seg));
+                }
+            }
+        }
+
+        const int point_count = (int)via_points.size();
+        for (int i = 0; i < point_count; ++i) {
+            auto &via_point = via_points[i];
+            if (via_point.p_seg == nullptr || via_point.is_broken || point_probs_[i] < 0.0f) {
+                via_point.match_prob = 0.0f;
+            }
+            else {
+                via_point.match_prob = point_probs_[i];
+            }
+        }
+        matching_params_.result_prob = (has_route && !matching_params_.result_route.empty()) ?
+            (float)result_prob : 0.0f;
+    }
+
+    // top-k combinations of the groups' candidate routes. the groups are independent as
+    // they are split at exclusively matched points, so keeping the k best partial
+    // combinations group by group gives the k best routes. the partial combinations with the
+    // same route as a better one are dropped in the beam, as all their extensions would be
+    // duplicates too, so the k kept are distinct. the best one is result_route before
+    // FixBeginEndPoints(), the alternatives are compared with it as they are not fixed.
+    // one more is kept in case an alternative is the same as the fixed result_route
+    void BuildAlternatives()
+    {
+        struct Combination
+        {
+            int weight;
+            double prob;
+            std::vector<int> choices;       // candidate index of each group
+            std::vector<SegmentPtr> route;  // the groups' routes joined
+            size_t prev;                    // index in the combinations of the group before
+        };
+        const size_t k = (size_t)matching_params_.alternative_count + 2;
+        std::vector<Combination> combs(1, Combination{ 0, 1.0, {}, {}, 0 }), next_combs;
+
+        // same weight: lexicographic choices, so that all 0s (result_route) is the 1st
+        auto comp = [](const Combination &i, const Combination &j) {
+            if (i.weight != j.weight) {
+                return i.weight < j.weight;
+            }
+            return i.choices < j.choices;
+        };
+        for (size_t g = 0; g < group_cand_count_; ++g) {
+            const auto &cands = group_cands_[g];
+            next_combs.clear();
+            for (size_t i = 0; i < combs.size(); ++i) {
+                const auto &comb = combs[i];
+                for (size_t c = 0; c < cands.size(); ++c) {
+                    next_combs.push_back(Combination{ comb.weight + cands[c].weight,
+                        comb.prob * cands[c].prob, comb.choices, {}, i });
+                    next_combs.back().choices.push_back((int)c);
+                }
+            }
+            std::sort(next_combs.begin(), next_combs.end(), comp);
+
+            // the routes are only joined for the ones kept
+            size_t count = 0;
+            for (size_t i = 0; i < next_combs.size() && count < k; ++i) {
+                auto &comb = next_combs[i];
+                comb.route = combs[comb.prev].route;
+                for (const auto &p_seg : cands[comb.choices.back()].seg_route) {
+                    AppendSegRoute(comb.route, p_seg);
+                }
+                bool duplicated = false;
+                for (size_t j = 0; !duplicated && j < count; ++j) {
+                    duplicated = next_combs[j].route == comb.route;
+                }
+                if (!duplicated) {
+                    if (count != i) {
+                        next_combs[count] = std::move(comb);
+                    }
+                    ++count;
+                }
+            }
+            next_combs.resize(count);
+            combs.swap(next_combs);
+        }
+
+        auto &alternatives = matching_params_.alternatives;
+        for (size_t i = 1; i < combs.size() &&
+            (int)alternatives.size() < matching_params_.alternative_count; ++i) {
+            if (combs[i].route == matching_params_.result_route) {
+                continue;
+            }
+            alternatives.push_back(RouteMatchingAlternative());
+            auto &alternative = alternatives.back();
+            alternative.weight = combs[i].weight;
+            alternative.prob = (float)combs[i].prob;
+            alternative.route.swap(combs[i].route);
         }
     }
 
@@ -564,7 +837,7 @@ private:
                     }
                 }
                 else {
-                    vector<SegmentPtr> route;
+                    vector<SegmentPtr>& route = temp_segs_;
                     way_manager_.RoutingNearby(p_seg1, p_seg2, route);
                     if (route.size() == 3) {
                         matching_params_.result_route.insert(matching_params_.result_route.begin(),
@@ -665,7 +938,7 @@ private:
                     }
                 }
                 else {
-                    vector<SegmentPtr> route;
+                    vector<SegmentPtr>& route = temp_segs_;
                     way_manager_.RoutingNearby(p_seg1, p_seg2, route);
                     if (route.size() == 3) {
                         if (!seg_in_route_back(matching_params_.result_route, route[1])) {
@@ -804,7 +1077,7 @@ private:
 
             for (int k = via_point1.i_seg + 1; k < via_point2.i_seg; ++k) {
                 const SegmentPtr &p_seg = matching_params_.result_route[k];
-                if (p_seg->excluded_no_gps_) {
+                if (p_seg->ExcludedNoGps()) {
                     via_point1.entering_no_gps_route = true;
                     break;
                 }
@@ -1051,11 +1324,12 @@ private:
     {
         const int max_node_count = (int)g.all_g_nodes.size();
 
-        BinHeap fwd_heap(max_node_count, g.g_node_pool);
+        BinHeap &fwd_heap = temp_heap_;
+        fwd_heap.Reset(max_node_count);
         fwd_heap.Insert(g_node1, 0, 0);
 
         bool success = false;
-        vector<tuple<NodeDataPtr, int>> pairs;;
+        auto &pairs = temp_decrease_pairs_;
 
         while (!fwd_heap.Empty()) {
             NodeDataPtr p_min_node = fwd_heap.DeleteMin();
@@ -1120,7 +1394,7 @@ private:
     bool RunDijkstra(const Graph &g, const GraphNodePtr g_node1, const GraphNodePtr g_node2,
         vector<SegmentPtr> &seg_route) const
     {
-        vector<GraphNodePtr> gnode_path;
+        vector<GraphNodePtr> &gnode_path = temp_gnode_path_;
         seg_route.clear();
         bool ok = RunDijkstra(g, g_node1, g_node2, gnode_path);
         if (!ok) return false;
@@ -1161,12 +1435,10 @@ private:
             return;
         }
 
-        g.g_node_pool.Reserve(max_node);
         g.all_g_nodes.reserve(max_node);
 
         size_t edge_reserve_size = (to_index - from_index + 1) *
             (MAX_CANDIATES_COUNT * MAX_CANDIATES_COUNT);
-        g.g_edge_pool.Reserve(edge_reserve_size);
         g.all_g_edges.reserve(edge_reserve_size);
 
         // build g_nodes
@@ -1175,9 +1447,7 @@ private:
             for (size_t j = 0; j < mat_point.p_segs.size(); ++j) {
                 auto& p_seg = mat_point.p_segs[j];
                 if (p_seg) {
-                    auto p_new_g_node = g.g_node_pool.AllocNew(GraphNode(p_seg));
-                    g.all_g_nodes.push_back(p_new_g_node);
-                    (GraphNodePtr&)mat_point.p_gnodes[j] = p_new_g_node;
+                    (GraphNodePtr&)mat_point.p_gnodes[j] = g.NewNode(p_seg);
                 }
             }
         }
@@ -1200,11 +1470,8 @@ private:
                     }
 
                     int distance = CalculateRouteWeight(seg_route);
-                    auto p_new_g_edge = g.g_edge_pool.AllocNew(
-                        GraphEdge(p_from_g_node, p_to_g_node, distance));
-                    p_new_g_edge->segs_ = seg_route;
-                    g.all_g_edges.push_back(p_new_g_edge);
-                    p_from_g_node->edges_.push_back(p_new_g_edge);
+                    auto p_new_g_edge = g.NewEdge(p_from_g_node, p_to_g_node, distance);
+                    p_new_g_edge->segs_.assign(seg_route.begin(), seg_route.end());
                 }
                 return ok;
             };
@@ -1317,11 +1584,12 @@ private:
         assign_params.check_no_gps_route = matching_params_.check_no_gps_route;
 
         for (auto &mat_pt : matching_points_) {
-            mat_pt.p_segs.fill(nullptr);
+            mat_pt.SetToNonMatched();
 
             if (mat_pt.p_via_point->p_seg) {
                 // if already has exclusive matched segment
                 mat_pt.p_segs[0] = mat_pt.p_via_point->p_seg;
+                mat_pt.scores[0] = 1.0f;
             }
             else {
                 // if assignments are not provided, do it here
@@ -1333,6 +1601,8 @@ private:
                     size_t res_size = assign_results.size();
                     for (size_t i = 0; i < mat_pt.p_segs.size() && i < res_size; ++i) {
                         mat_pt.p_segs[i] = assign_results[i].p_seg;
+                        // score of single result is not normalized
+                        mat_pt.scores[i] = (res_size == 1) ? 1.0f : assign_results[i].score;
                     }
                 }
             }
@@ -1409,69 +1679,61 @@ private:
         }
     }
 
-    static bool SegsToJson(const WayManager &way_manager, const std::vector<SegmentPtr>& segs,
+    static void SegsToJson(const WayManager &way_manager, const std::vector<SegmentPtr>& segs,
         double offset, const std::string& seg_color, const std::string& node_color,
-        geo::GeoJSON &geo_json)
+        geo::GeoJsonStreamWriter &writer)
     {
-        std::set<NODE_ID_T> nodes_set;
+        UNORD_SET<NODE_ID_T> nodes_set;
 
         int index = 0;
         for (const auto& p_seg : segs) {
-            std::shared_ptr<GeoObj_LineString> p_line = std::make_shared<GeoObj_LineString>();
             if (p_seg->one_way_) {
-                p_line->AddPoint(p_seg->from_point_);
-                p_line->AddPoint(p_seg->to_point_);
+                writer.BeginLineString(p_seg->from_point_, p_seg->to_point_);
             }
             else {
                 GeoPoint off_from, off_to;
                 geo::get_offset_segment(p_seg->from_point_, p_seg->to_point_,
                     offset, off_from, off_to);
-                p_line->AddPoint(off_from);
-                p_line->AddPoint(off_to);
-            }
-            p_line->AddProp("seg_id", p_seg->seg_id_);
-            p_line->AddProp("index", index++);
-            p_line->AddProp("way_id", p_seg->way_id_);
-            p_line->AddProp("one_way", (int)p_seg->one_way_);
-            p_line->AddProp("length", p_seg->length_);
-            p_line->AddProp("heading", p_seg->heading_);
-            p_line->AddProp("way_name/type",
+                writer.BeginLineString(off_from, off_to);
+            }
+            writer.AddProp("seg_id", p_seg->seg_id_);
+            writer.AddProp("index", index++);
+            writer.AddProp("way_id", p_seg->way_id_);
+            writer.AddProp("one_way", (int)p_seg->one_way_);
+            writer.AddProp("length", p_seg->length_);
+            writer.AddProp("heading", (int)p_seg->heading_);
+            writer.AddProp("way_name/type",
                 (p_seg->way_name_.empty() ? "<null>" : p_seg->way_name_)
                 + '/' + std::to_string(p_seg->way_type_));
-            p_line->AddProp("from/to nodes", std::to_string(p_seg->from_nd_) + '/' +
+            writer.AddProp("from/to nodes", std::to_string(p_seg->from_nd_) + '/' +
                 std::to_string(p_seg->to_nd_));
-            p_line->AddProp("structure/layer", std::to_string(p_seg->struct_type_) + '/' +
+            writer.AddProp("structure/layer", std::to_string(p_seg->struct_type_) + '/' +
                 std::to_string(p_seg->layer_));
-
-            p_line->AddProp("color", seg_color);
-            geo_json.AddObj(p_line);
+            writer.AddProp("color", seg_color);
+            writer.EndFeature();
 
             NODE_ID_T nodes[2] {p_seg->from_nd_, p_seg->to_nd_};
             for (int i = 0; i < 2; ++i) {
-                if (nodes_set.find(nodes[i]) == nodes_set.end()) {
-                    nodes_set.insert(nodes[i]);
-
+                if (nodes_set.insert(nodes[i]).second) {
                     auto p_node = way_manager.GetNodeById(nodes[i]);
-                    auto p_point = std::make_shared<geo::GeoObj_Point>(p_node->geo_point_);
-                    p_point->AddProp("node", p_node->nd_id_);
-                    p_point->AddProp("name", p_node->nd_name_);
-                    p_point->AddProp("coord", std::to_string(p_node->geo_point_.lat) + ',' +
+                    writer.BeginPoint(p_node->geo_point_);
+                    writer.AddProp("node", p_node->nd_id_);
+                    writer.AddProp("name", p_node->nd_name_);
+                    writer.AddProp("coord", std::to_string(p_node->geo_point_.lat) + ',' +
                         std::to_string(p_node->geo_point_.lng));
-                    p_point->AddProp("way_connector", p_node->IsWayConnector());
-                    p_point->AddProp("connected_segs", (int)p_node->ConnectedSegments().size());
-                    p_point->AddProp("crossroad", p_node->IsCorssroad());
+                    writer.AddProp("way_connector", p_node->IsWayConnector());
+                    writer.AddProp("connected_segs", (int)p_node->ConnectedSegments().size());
+                    writer.AddProp("crossroad", p_node->IsCorssroad());
                     if (p_node->IsRoutingNode()) {
-                        p_point->AddProp("color", "gold");
+                        writer.AddProp("color", "gold");
                     }
                     else {
-                        p_point->AddProp("color", node_color);
+                        writer.AddProp("color", node_color);
                     }
-                    geo_json.AddObj(p_point);
+                    writer.EndFeature();
                 }
             }
         }
-
-        return true;
     }
 };
 
@@ -1551,4 +1813,17 @@ void RouteMatchingInternalCleanup(RouteMatchingParams &params)
     }
 }
 
+bool RouteMatchingInternalAllocStats(const RouteMatchingParams &params,
+    RouteMatchingAllocStats &stats)
+{
+    if (params.p_impl == nullptr) {
+        return false;
+    }
+    const auto &arena = static_cast<const RouteMatchingImpl *>(params.p_impl)->GraphArena();
+    stats.arena_allocs = arena.AllocCount();
+    stats.arena_block_allocs = arena.BlockAllocCount();
+    stats.arena_capacity = arena.Capacity();
+    return true;
+}
+
 } // end of namespace
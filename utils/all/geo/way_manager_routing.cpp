@@ -13,6 +13,7 @@
 #include <stdexcept>
 #include "common/common_utils.h"
 #include "common/at_scope_exit.h"
+#include "way_manager_snapshot.h"
 #if WAY_MANAGER_HANA_LOG == 1
 #include <hana/logging.h>
 #endif
@@ -41,6 +42,10 @@
 // should be disabled in product release version
 #define ROUTING_STEPS_TO_JSON   0
 
+// compiling switch for indexing the multi-step connections by the way they lead to, so that the
+// nearby routing does not scan the whole connection lists of the routing node
+#define NEARBY_CONN_INDEX       1
+
 // for Dijkstra statistics
 #define DIJKSTRA_STATISTICS     1
 #ifndef _WIN32
@@ -70,6 +75,36 @@ typedef int CONN2_INDEX;
 typedef int CONN4_INDEX;
 typedef int CONN6_INDEX;
 
+// the excluded flag of a connection. it is updated while other threads are routing, so it is
+// atomic, copied with the connection
+class ConnExcludedFlag
+{
+public:
+    ConnExcludedFlag()
+        : flag_(false)
+    {}
+    ConnExcludedFlag(const ConnExcludedFlag& src)
+        : flag_(src.Get())
+    {}
+    ConnExcludedFlag& operator=(const ConnExcludedFlag& src)
+    {
+        Set(src.Get());
+        return *this;
+    }
+
+    bool Get() const
+    {
+        return flag_.load(std::memory_order_acquire);
+    }
+    void Set(bool flag)
+    {
+        flag_.store(flag, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> flag_;
+};
+
 struct Connection
 {
     ROUTING_NODE_INDEX i_from_rn_;
@@ -81,7 +116,7 @@ struct Connection
     WAY_ID_T conn_way_id_{}; // signed way ID
     int weight_{}; // modified weight considering length, way type, etc.
     vector<SegmentPtr> segs_;
-    bool excluded_flag_{}; // true if any of the segs' flag is set
+    ConnExcludedFlag excluded_flag_; // true if any of the segs' flag is set
 };
 
 // From RN1 via RN2, to RN3, is TwoStepConnection
@@ -132,6 +167,153 @@ public:
     vector<WAY_ID_T>    out_oriented_ways_; // ways starting from this node
 };
 
+// a range of connection indexes, a whole connection list or an entry of NearbyConnIndex
+class ConnRange
+{
+public:
+    ConnRange(const int *p_begin, const int *p_end)
+        : p_begin_(p_begin), p_end_(p_end)
+    {}
+    explicit ConnRange(const vector<int>& conns)
+        : p_begin_(conns.data()), p_end_(conns.data() + conns.size()), whole_list_(true)
+    {}
+
+    // true if the range is a whole connection list, not the part of it found by an index
+    bool WholeList() const
+    {
+        return whole_list_;
+    }
+
+    size_t size() const
+    {
+        return p_end_ - p_begin_;
+    }
+    int operator[](size_t i) const
+    {
+        return p_begin_[i];
+    }
+    const int* begin() const
+    {
+        return p_begin_;
+    }
+    const int* end() const
+    {
+        return p_end_;
+    }
+
+private:
+    const int *p_begin_;
+    const int *p_end_;
+    bool whole_list_{};
+};
+
+// (routing node, signed way ID) => the connections of one of the multi-step connection lists
+// of the routing node, which go along the way at a given step. the connections of the same key
+// are kept in the list order, so the nearby routing finds the same candidates in the same order.
+// the ways of a routing node are few, they are binary searched in a flat array
+class NearbyConnIndex
+{
+public:
+    void Clear()
+    {
+        node_entries_.clear();
+        entries_.clear();
+        conns_.clear();
+        built_ = false;
+    }
+
+    // the lists are added in the order of the routing node index
+    void BeginAddList(size_t routing_node_count)
+    {
+        Clear();
+        node_entries_.reserve(routing_node_count + 1);
+    }
+
+    // get_way_ids(conns, i, way_ids) adds the way IDs of conns[i] to index by, none to leave
+    // it out
+    template <typename GetWayIds>
+    void AddList(ROUTING_NODE_INDEX i_rn, const vector<int>& conns, const GetWayIds& get_way_ids)
+    {
+        while (node_entries_.size() <= (size_t)i_rn) {
+            node_entries_.push_back((unsigned int)entries_.size());
+        }
+
+        items_.clear();
+        for (size_t i = 0; i < conns.size(); ++i) {
+            way_ids_.clear();
+            get_way_ids(conns, i, way_ids_);
+            for (size_t k = 0; k < way_ids_.size(); ++k) {
+                if (way_ids_[k] != 0 &&
+                    std::find(way_ids_.begin(), way_ids_.begin() + k, way_ids_[k]) ==
+                    way_ids_.begin() + k) {
+                    items_.emplace_back(way_ids_[k], conns[i]);
+                }
+            }
+        }
+        // group by the way ID, in the list order
+        std::stable_sort(items_.begin(), items_.end(),
+            [](const pair<WAY_ID_T, int>& a, const pair<WAY_ID_T, int>& b) {
+            return a.first < b.first;
+        });
+        for (size_t i = 0; i < items_.size(); ++i) {
+            if (i == 0 || items_[i].first != items_[i - 1].first) {
+                entries_.push_back(Entry{ items_[i].first, (unsigned int)conns_.size(), 0 });
+            }
+            ++entries_.back().count;
+            conns_.push_back(items_[i].second);
+        }
+    }
+
+    void EndAddList()
+    {
+        node_entries_.push_back((unsigned int)entries_.size());
+        items_.clear();
+        items_.shrink_to_fit();
+        way_ids_.clear();
+        way_ids_.shrink_to_fit();
+        entries_.shrink_to_fit();
+        conns_.shrink_to_fit();
+        built_ = true;
+    }
+
+    // the connections of the key, the whole list if the index is not built
+    ConnRange Find(ROUTING_NODE_INDEX i_rn, WAY_ID_T way_id, const vector<int>& conns) const
+    {
+        if (!built_) {
+            return ConnRange(conns);
+        }
+        if (i_rn < 0 || (size_t)i_rn + 1 >= node_entries_.size()) {
+            return ConnRange(nullptr, nullptr);
+        }
+        const Entry *p_begin = entries_.data() + node_entries_[i_rn];
+        const Entry *p_end = entries_.data() + node_entries_[i_rn + 1];
+        const Entry *p_entry = std::lower_bound(p_begin, p_end, way_id,
+            [](const Entry& entry, WAY_ID_T id) {
+            return entry.way_id < id;
+        });
+        if (p_entry == p_end || p_entry->way_id != way_id) {
+            return ConnRange(nullptr, nullptr);
+        }
+        const int *p_conns = conns_.data() + p_entry->begin;
+        return ConnRange(p_conns, p_conns + p_entry->count);
+    }
+
+private:
+    struct Entry
+    {
+        WAY_ID_T way_id;
+        unsigned int begin; // in conns_
+        unsigned int count;
+    };
+
+    vector<unsigned int> node_entries_; // [i_rn] => the first entry of the routing node
+    vector<Entry> entries_;
+    vector<int> conns_;
+    vector<pair<WAY_ID_T, int>> items_; // only used in adding lists
+    vector<WAY_ID_T> way_ids_; // only used in adding lists
+    bool built_{};
+};
+
 class RouteManager;
 
 namespace dijkstra {
@@ -410,8 +592,7 @@ public:
 
     void SetError(const string& err)
     {
-        way_manager_.SetCurThreadErrStr(way_manager_.threads_err_mutex_,
-            way_manager_.threads_err_strs_, err);
+        way_manager_.SetCurThreadErrStr(way_manager_.threads_err_strs_, err);
     }
 
     bool InitForRouting(bool shortest_mode)
@@ -491,6 +672,7 @@ public:
         InitConnsTwoSteps();
         InitConnsFourSteps();
         InitConnsSixSteps();
+        InitNearbyConnIndexes();
 
         WayManagerDbg("Exits RouteManager::InitForRouting()");
 #if WAY_MANAGER_HANA_LOG == 1
@@ -501,18 +683,65 @@ public:
         return !routing_node_map_.empty();
     }
 
+    static void SyncConnExcludedFlag(Connection& conn)
+    {
+        bool excluded_flag = false;
+        for (const auto& p_seg : conn.segs_) {
+            if (p_seg->ExcludedFlag()) {
+                excluded_flag = true;
+                break;
+            }
+        }
+        conn.excluded_flag_.Set(excluded_flag);
+    }
+
     void SyncExclusionSegsToRouting()
     {
         // recalculate all the edges' excluded_flag_
         const int size = (int)conn_pool_.Size();
         for (int i = 0; i < size; ++i) {
-            auto p_conn = conn_pool_.ObjPtrByIndex(i);
+            SyncConnExcludedFlag(*conn_pool_.ObjPtrByIndex(i));
+        }
+    }
 
-            p_conn->excluded_flag_ = false;
-            for (const auto& p_seg : p_conn->segs_) {
-                if (p_seg->excluded_flag_) {
-                    p_conn->excluded_flag_ = true;
-                    break;
+    // only the connections containing segs are recalculated.
+    // NOTE: callers need to serialize the calls, see WayManager::exclusion_update_mutex_
+    void SyncExclusionSegsToRouting(const vector<SegmentPtr>& segs)
+    {
+        if (seg_conn_map_.empty()) {
+            InitSegConnMap(); // lazily, not needed if no exclusion at all
+        }
+
+        for (const auto& p_seg : segs) {
+            auto it = seg_conn_map_.find(p_seg->seg_id_);
+            if (it == seg_conn_map_.end()) {
+                continue;
+            }
+            SyncConnExcludedFlag(conn_pool_[it->second]);
+
+            auto it_more = seg_more_conns_map_.find(p_seg->seg_id_);
+            if (it_more != seg_more_conns_map_.end()) {
+                for (auto i_conn : it_more->second) {
+                    SyncConnExcludedFlag(conn_pool_[i_conn]);
+                }
+            }
+        }
+    }
+
+    //     seg ID => connection index
+    // typically a segment is in only one connection, the rare others are in seg_more_conns_map_
+    void InitSegConnMap()
+    {
+        seg_conn_map_.clear();
+        seg_more_conns_map_.clear();
+
+        const int size = (int)conn_pool_.Size();
+        seg_conn_map_.reserve(size * 4); // rough estimate
+        for (CONN_INDEX i_conn = 1; i_conn < size; ++i_conn) {
+            for (const auto& p_seg : conn_pool_[i_conn].segs_) {
+                auto result = seg_conn_map_.insert({ p_seg->seg_id_, i_conn });
+                if (!result.second && result.first->second != i_conn) {
+                    seg_more_conns_map_[p_seg->seg_id_].push_back(i_conn);
                 }
             }
         }
@@ -1033,6 +1262,11 @@ public:
     }
 
 private:
+    ROUTING_NODE_INDEX RoutingNodeIndex(const RoutingNode* p_rn) const
+    {
+        return (ROUTING_NODE_INDEX)(p_rn - routing_node_pool_.AllObjs().data());
+    }
+
     static bool HasReverseSegs(const vector<SegmentPtr>& route)
     {
         bool found_reverse = false;
@@ -1050,8 +1284,8 @@ private:
         bool is_localtime) const
     {
         for (const auto& p_seg : route) {
-            if (p_seg->excluded_flag_) {
-                if (p_seg->excluded_always_) {
+            if (p_seg->ExcludedFlag()) {
+                if (p_seg->ExcludedAlways()) {
                     return true;
                 }
                 else {
@@ -1217,13 +1451,7 @@ private:
                                 p_conn->weight_ = DistanceToWeight(distance, p_way->HighwayType());
                             }
 
-                            p_conn->excluded_flag_ = false;
-                            for (const auto& p_seg : p_conn->segs_) {
-                                if (p_seg->excluded_flag_) {
-                                    p_conn->excluded_flag_ = true;
-                                    break;
-                                }
-                            }
+                            SyncConnExcludedFlag(*p_conn);
 
                             routing_node_pool_[p_conn->i_to_rn_].conn_froms_.push_back(i_conn);
                             routing_node_pool_[i_routing_node].conn_tos_.push_back(i_conn);
@@ -1598,9 +1826,129 @@ private:
         return true;
     }
 
+    // the indexes used by AppendAllTwoStepRoutes() to AppendAllSixStepRoutes(). for the three
+    // and five step routes, only the first connection of each group sharing the first nodes is
+    // indexed, as the scans of the lists skip the others. the groups are found by comparing with
+    // the previous connection of the whole list (sorted by the hash), as the scans do, so the
+    // scans skip nothing more in the indexed ranges
+    bool InitNearbyConnIndexes()
+    {
+        NearbyConnIndex* indexes[] = { &conn2_way2_index_, &conn4_way2_index_,
+            &conn4_way3_index_, &conn6_way4_index_, &conn6_way5_index_, &conn2_out_way_index_,
+            &conn4_mid2_out_way_index_, &conn4_out_way_index_, &conn6_out_way_index_ };
+        for (auto p_index : indexes) {
+            p_index->Clear();
+        }
+#if (NEARBY_CONN_INDEX == 1)
+        try {
+            const size_t rn_count = routing_node_pool_.Size();
+            for (auto p_index : indexes) {
+                p_index->BeginAddList(rn_count);
+            }
+            auto add_out_ways = [this](ROUTING_NODE_INDEX i_rn, vector<WAY_ID_T>& way_ids) {
+                const auto& out_ways = RoutingNodeOutWays(i_rn);
+                way_ids.insert(way_ids.end(), out_ways.begin(), out_ways.end());
+            };
+
+            for (ROUTING_NODE_INDEX i_rn = 1; i_rn < (ROUTING_NODE_INDEX)rn_count; ++i_rn) {
+                const RoutingNode& rn = routing_node_pool_[i_rn];
+
+                conn2_way2_index_.AddList(i_rn, rn.two_step_conn_tos_,
+                    [this](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    way_ids.push_back(conn2_pool_[conns[i]].conn_way_id2_);
+                });
+                conn2_out_way_index_.AddList(i_rn, rn.two_step_conn_tos_,
+                    [&](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    add_out_ways(conn2_pool_[conns[i]].i_to_rn_, way_ids);
+                });
+
+                // the connections sharing the 1st three nodes with the previous one are skipped
+                conn4_way2_index_.AddList(i_rn, rn.four_step_conn_tos_,
+                    [this](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    const auto& conn = conn4_pool_[conns[i]];
+                    if (i == 0 || conn.hash_three_ != conn4_pool_[conns[i - 1]].hash_three_) {
+                        way_ids.push_back(conn.conn_way_ids_[2]);
+                    }
+                });
+                conn4_mid2_out_way_index_.AddList(i_rn, rn.four_step_conn_tos_,
+                    [&](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    const auto& conn = conn4_pool_[conns[i]];
+                    if (i == 0 || conn.hash_three_ != conn4_pool_[conns[i - 1]].hash_three_) {
+                        add_out_ways(conn.mid_rns_[2], way_ids);
+                    }
+                });
+                conn4_way3_index_.AddList(i_rn, rn.four_step_conn_tos_,
+                    [this](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    way_ids.push_back(conn4_pool_[conns[i]].conn_way_ids_[3]);
+                });
+                conn4_out_way_index_.AddList(i_rn, rn.four_step_conn_tos_,
+                    [&](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    add_out_ways(conn4_pool_[conns[i]].i_to_rn_, way_ids);
+                });
+
+                // the connections sharing the 1st five nodes with the previous one are skipped
+                conn6_way4_index_.AddList(i_rn, rn.six_step_conn_tos_,
+                    [this](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    const auto& conn = conn6_pool_[conns[i]];
+                    if (i == 0 || conn.hash_five_ != conn6_pool_[conns[i - 1]].hash_five_) {
+                        way_ids.push_back(conn.conn_way_ids_[4]);
+                    }
+                });
+                conn6_way5_index_.AddList(i_rn, rn.six_step_conn_tos_,
+                    [this](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    way_ids.push_back(conn6_pool_[conns[i]].conn_way_ids_[5]);
+                });
+                conn6_out_way_index_.AddList(i_rn, rn.six_step_conn_tos_,
+                    [&](const vector<int>& conns, size_t i, vector<WAY_ID_T>& way_ids) {
+                    add_out_ways(conn6_pool_[conns[i]].i_to_rn_, way_ids);
+                });
+            }
+            for (auto p_index : indexes) {
+                p_index->EndAddList();
+            }
+        }
+        catch (const std::bad_alloc&) {
+            // falls back to scanning the lists
+            for (auto p_index : indexes) {
+                p_index->Clear();
+            }
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    // appends segments [it_1, it_2) of the way to the route, in either route representation
+    static void AppendWaySegs(vector<SegmentPtr>& route, const OrientedWayPtr&,
+        vector<SegmentPtr>::const_iterator it_1, vector<SegmentPtr>::const_iterator it_2)
+    {
+        route.insert(route.end(), it_1, it_2);
+    }
+    static void AppendWaySegs(CompactRoute& route, const OrientedWayPtr& p_way,
+        vector<SegmentPtr>::const_iterator it_1, vector<SegmentPtr>::const_iterator it_2)
+    {
+        const auto it_begin = p_way->Segments().begin();
+        route.AppendSpan(p_way, it_1 - it_begin, it_2 - it_begin);
+    }
+    static void ClearRoute(vector<SegmentPtr>& route)
+    {
+        route.clear();
+    }
+    static void ClearRoute(CompactRoute& route)
+    {
+        route.Clear();
+    }
+    static void ReserveRoute(vector<SegmentPtr>& route, size_t capacity)
+    {
+        route.reserve(capacity);
+    }
+    static void ReserveRoute(CompactRoute&, size_t)
+    {}
+
     // same way ID and same direction, from segment to segment
+    template <typename RouteT>
     bool RoutingSameOrientedWay(const Segment* p_seg1, const Segment* p_seg2,
-        vector<SegmentPtr>& route) const
+        RouteT& route) const
     {
         if (!p_seg1 || !p_seg2) {
             return false;
@@ -1618,13 +1966,14 @@ private:
             return false;
         }
 
-        route.insert(route.end(), it_1, it_2 + 1);
+        AppendWaySegs(route, p_way, it_1, it_2 + 1);
         return true;
     }
 
     // same way ID and same direction, from segment to node
+    template <typename RouteT>
     bool RoutingSameOrientedWay(const Segment* p_seg1, const Node* p_node2,
-        vector<SegmentPtr>& route) const
+        RouteT& route) const
     {
         if (!p_seg1 || !p_node2) {
             return false;
@@ -1643,13 +1992,14 @@ private:
             return false;
         }
 
-        route.insert(route.end(), it_1, it_2 + 1);
+        AppendWaySegs(route, p_way, it_1, it_2 + 1);
         return true;
     }
 
     // same way ID and same direction, from node to segment
+    template <typename RouteT>
     bool RoutingSameOrientedWay(const Node* p_node1, const Segment* p_seg2,
-        vector<SegmentPtr>& route) const
+        RouteT& route) const
     {
         if (!p_node1 || !p_seg2) {
             return false;
@@ -1675,14 +2025,15 @@ private:
             return false;
         }
 
-        route.insert(route.end(), it_1, it_2 + 1);
+        AppendWaySegs(route, p_way, it_1, it_2 + 1);
         return true;
     }
 
     // same way ID and same direction, from node to node
+    template <typename RouteT>
     bool RoutingSameOrientedWay(const OrientedWayPtr &p_way,
         const Node* p_node1, const Node* p_node2,
-        vector<SegmentPtr>& route) const
+        RouteT& route) const
     {
         if (!p_way || !p_node1 || !p_node2) {
             return false;
@@ -1702,9 +2053,10 @@ private:
     }
 
     // same way ID and same direction, from node to node
+    template <typename RouteT>
     bool RoutingSameOrientedWay(WAY_ID_T oriented_way_id,
         const Node* p_node1, const Node* p_node2,
-        vector<SegmentPtr>& route) const
+        RouteT& route) const
     {
         OrientedWayPtr p_way = way_manager_.GetWayById(oriented_way_id);
         if (!p_way) {
@@ -1753,7 +2105,9 @@ private:
         vector<route_info_tuple>& candidate_routes) const
     {
         int routes_added = 0;
-        for (const auto& i_conn2 : p_routing_node1->two_step_conn_tos_) {
+        const auto conns_to_way2 = conn2_way2_index_.Find(RoutingNodeIndex(p_routing_node1),
+            signed_seg2_way_id, p_routing_node1->two_step_conn_tos_);
+        for (const auto& i_conn2 : conns_to_way2) {
             auto two_step_conn = conn2_pool_.ObjPtrByIndex(i_conn2);
             if (signed_seg2_way_id == two_step_conn->conn_way_id2_) {
                 route_info_tuple route_info;
@@ -1825,14 +2179,16 @@ private:
         const RoutingNode* p_routing_node1, const WAY_ID_T& signed_seg2_way_id,
         vector<route_info_tuple>& candidate_routes) const
     {
-        const auto& four_step_conns = p_routing_node1->four_step_conn_tos_;
+        const auto four_step_conns = conn4_way2_index_.Find(RoutingNodeIndex(p_routing_node1),
+            signed_seg2_way_id, p_routing_node1->four_step_conn_tos_);
         int routes_added = 0;
 
         for (size_t i = 0; i < four_step_conns.size(); ++i) {
             const auto four_step_conn = conn4_pool_.ObjPtrByIndex(four_step_conns[i]);
 
-            // check the 1st three nodes are same as the previous one
-            if (i != 0) {
+            // check the 1st three nodes are same as the previous one of the list. the index
+            // only holds the 1st connection of each group, see InitNearbyConnIndexes()
+            if (i != 0 && four_step_conns.WholeList()) {
                 if (four_step_conn->hash_three_ ==
                     conn4_pool_[four_step_conns[i - 1]].hash_three_) {
                     continue;
@@ -1870,7 +2226,8 @@ private:
 
         // if not found the seg's way on the last connection, try outing ways
         if (routes_added == 0) {
-            for (const auto i_conn2 : p_routing_node1->two_step_conn_tos_) {
+            for (const auto i_conn2 : conn2_out_way_index_.Find(RoutingNodeIndex(p_routing_node1),
+                signed_seg2_way_id, p_routing_node1->two_step_conn_tos_)) {
                 auto two_step_conn = conn2_pool_.ObjPtrByIndex(i_conn2);
                 const auto& to_nd_out_ways = RoutingNodeOutWays(two_step_conn->i_to_rn_);
                 if (to_nd_out_ways.empty()) {
@@ -1918,10 +2275,12 @@ private:
         vector<route_info_tuple>& candidate_routes) const
     {
         const auto& four_step_conns = p_routing_node1->four_step_conn_tos_;
+        const auto conns_to_way3 = conn4_way3_index_.Find(RoutingNodeIndex(p_routing_node1),
+            signed_seg2_way_id, four_step_conns);
         int routes_added = 0;
 
-        for (size_t i = 0; i < four_step_conns.size(); ++i) {
-            const auto four_step_conn = conn4_pool_.ObjPtrByIndex(four_step_conns[i]);
+        for (const auto i_conn4 : conns_to_way3) {
+            const auto four_step_conn = conn4_pool_.ObjPtrByIndex(i_conn4);
 
             if (signed_seg2_way_id == four_step_conn->conn_way_ids_[3]) {
                 route_info_tuple route_info;
@@ -1959,13 +2318,17 @@ private:
 
         // if not found the seg's way on the last connection, try outing ways
         if (routes_added == 0) {
-            for (size_t i = 0; i < four_step_conns.size(); ++i) {
-                const auto four_step_conn = conn4_pool_.ObjPtrByIndex(four_step_conns[i]);
-
-                // check the 1st three nodes are same as the previous one
-                if (i != 0) {
+            const auto conns_out_way = conn4_mid2_out_way_index_.Find(
+                RoutingNodeIndex(p_routing_node1), signed_seg2_way_id,
+                p_routing_node1->four_step_conn_tos_);
+            for (size_t i = 0; i < conns_out_way.size(); ++i) {
+                const auto four_step_conn = conn4_pool_.ObjPtrByIndex(conns_out_way[i]);
+
+                // check the 1st three nodes are same as the previous one of the list. the
+                // index only holds the 1st connection of each group
+                if (i != 0 && conns_out_way.WholeList()) {
                     if (four_step_conn->hash_three_ ==
-                        conn4_pool_[four_step_conns[i - 1]].hash_three_) {
+                        conn4_pool_[conns_out_way[i - 1]].hash_three_) {
                         continue;
                     }
                 }
@@ -2022,14 +2385,16 @@ private:
         const RoutingNode* p_routing_node1, const WAY_ID_T& signed_seg2_way_id,
         vector<route_info_tuple>& candidate_routes) const
     {
-        const auto& six_step_conns = p_routing_node1->six_step_conn_tos_;
+        const auto six_step_conns = conn6_way4_index_.Find(RoutingNodeIndex(p_routing_node1),
+            signed_seg2_way_id, p_routing_node1->six_step_conn_tos_);
         int routes_added = 0;
 
         for (size_t i = 0; i < six_step_conns.size(); ++i) {
             const auto six_step_conn = conn6_pool_.ObjPtrByIndex(six_step_conns[i]);
 
-            // check the 1st six nodes are same as the previous one
-            if (i != 0) {
+            // check the 1st six nodes are same as the previous one of the list. the index only
+            // holds the 1st connection of each group
+            if (i != 0 && six_step_conns.WholeList()) {
                 if (six_step_conn->hash_five_ == conn6_pool_[six_step_conns[i - 1]].hash_five_) {
                     continue;
                 }
@@ -2076,7 +2441,8 @@ private:
 
         // if not found the seg's way on the last connection, try outing ways
         if (routes_added == 0) {
-            for (const auto i_conn4 : p_routing_node1->four_step_conn_tos_) {
+            for (const auto i_conn4 : conn4_out_way_index_.Find(RoutingNodeIndex(p_routing_node1),
+                signed_seg2_way_id, p_routing_node1->four_step_conn_tos_)) {
                 auto four_step_conn = conn4_pool_.ObjPtrByIndex(i_conn4);
                 const auto& to_nd_out_ways = RoutingNodeOutWays(four_step_conn->i_to_rn_);
                 if (to_nd_out_ways.empty()) {
@@ -2131,7 +2497,8 @@ private:
         const RoutingNode* p_routing_node1, const WAY_ID_T& signed_seg2_way_id,
         vector<route_info_tuple>& candidate_routes) const
     {
-        const auto& six_step_conn_tos = p_routing_node1->six_step_conn_tos_;
+        const auto six_step_conn_tos = conn6_way5_index_.Find(RoutingNodeIndex(p_routing_node1),
+            signed_seg2_way_id, p_routing_node1->six_step_conn_tos_);
         int routes_added = 0;
 
         for (size_t i = 0; i < six_step_conn_tos.size(); ++i) {
@@ -2192,9 +2559,9 @@ private:
     {
         int routes_added = 0;
 
-        for (size_t i = 0; i < p_routing_node1->six_step_conn_tos_.size(); ++i) {
-            const auto six_step_conn = conn6_pool_.ObjPtrByIndex(
-                p_routing_node1->six_step_conn_tos_[i]);
+        for (const auto i_conn6 : conn6_out_way_index_.Find(RoutingNodeIndex(p_routing_node1),
+            signed_seg2_way_id, p_routing_node1->six_step_conn_tos_)) {
+            const auto six_step_conn = conn6_pool_.ObjPtrByIndex(i_conn6);
             const auto& to_nd_out_ways = RoutingNodeOutWays(six_step_conn->i_to_rn_);
             if (to_nd_out_ways.empty()) {
                 continue;
@@ -2260,16 +2627,61 @@ private:
         return routing_node_pool_[i_rn].out_oriented_ways_;
     }
 
+    // position of the segment in its oriented way, -1 if not found
+    static int SegPosInWay(const SegmentPtr& p_seg)
+    {
+        if (p_seg->GetWayOriented() == nullptr) {
+            return -1;
+        }
+        const auto& segs = p_seg->GetWayOriented()->Segments();
+        for (size_t i = 0; i < segs.size(); ++i) {
+            if (segs[i] == p_seg) {
+                return (int)i;
+            }
+        }
+        for (size_t i = 0; i < segs.size(); ++i) {
+            if (segs[i]->seg_id_ == p_seg->seg_id_) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    // if the some segs of the connection are excluded at the time point
+    bool IsConnExcluded(const Connection& edge, time_t time_point, bool is_localtime) const
+    {
+        for (const auto &p_seg : edge.segs_) {
+            if (p_seg->ExcludedFlag() && (p_seg->ExcludedAlways() ||
+                this->way_manager_.IsSegmentExcluded(p_seg, time_point, is_localtime))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the nearby routes are short, built as segments in a scratch of the thread then compacted
+    bool RoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
+        CompactRoute& result_route, bool exclude_reverse_segs, time_t time_point,
+        bool is_localtime, bool points_reversed) const
+    {
+        static thread_local vector<SegmentPtr> route;
+        result_route.Clear();
+        return RoutingNearby(p_seg1, p_seg2, route, exclude_reverse_segs, time_point,
+            is_localtime, points_reversed) && result_route.Append(route);
+    }
+
 public:
+    // RouteT is vector<SegmentPtr> or CompactRoute
+    template <typename RouteT>
     bool DijkstraShortestPath(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
-        vector<SegmentPtr>& route, int *seach_steps, time_t time_point, bool is_localtime,
+        RouteT& route, int *seach_steps, time_t time_point, bool is_localtime,
         bool points_reversed) const
     {
         //                              (source)        (destination)
         //               seg1              RN1              RN2             seg2
         //    --------->--------->--------->O----> ... ----->O------>------>----->---->
         //
-        route.clear();
+        ClearRoute(route);
         if (p_seg1 == p_seg2 || p_seg1->seg_id_ == p_seg2->seg_id_) {
             if (seach_steps) {
                 *seach_steps = 0;
@@ -2318,7 +2730,7 @@ public:
         }
 
         // estimated capacity
-        route.reserve((routing_nodes_path.size() + 2) * 6);
+        ReserveRoute(route, (routing_nodes_path.size() + 2) * 6);
 
         // from seg1 to first routing node
         RoutingSameOrientedWay(p_seg1, routing_node_pool_[i_rn1].p_node_, route);
@@ -2341,7 +2753,7 @@ public:
                 }
             }
             if (!found) {
-                route.clear();
+                ClearRoute(route);
                 return false;
             }
         }
@@ -2463,6 +2875,121 @@ public:
         return true;
     }
 
+    // costs in routing weights from seg1 to each of the dst_segs by one Dijkstra search, -1 for
+    // the unreachable ones. seg1 itself is not counted, the destination segments are, so that
+    // the costs of the consecutive sections of a route can be added up
+    bool DijkstraShortestCosts(const SegmentPtr& p_seg1, const vector<SegmentPtr>& dst_segs,
+        vector<int>& costs, time_t time_point, bool is_localtime) const
+    {
+        costs.assign(dst_segs.size(), -1);
+        const int i_seg1 = SegPosInWay(p_seg1);
+        if (i_seg1 < 0) {
+            return false;
+        }
+        const auto& segs1 = p_seg1->GetWayOriented()->Segments();
+
+        //               seg1      lead      RN1 ... RN2      trail      seg2
+        //    --------->--------->--------->O---> ... --->O--------->--------->
+        int lead_weight = 0;
+        ROUTING_NODE_INDEX i_rn1 = 0;
+        double lead_length = 0;
+        for (int i = i_seg1; i < (int)segs1.size(); ++i) {
+            if (i > i_seg1) {
+                lead_length += segs1[i]->length_;
+            }
+            if (segs1[i]->GetToNode()->IsRoutingNode()) {
+                i_rn1 = routing_node_map_.at(segs1[i]->GetToNode()->nd_id_);
+                lead_weight = WayManager::DistanceToWeight(lead_length,
+                    p_seg1->GetWayOriented()->HighwayType());
+                break;
+            }
+        }
+
+        // destination routing node => the destinations ending there, with the trail weights
+        UNORD_MAP<ROUTING_NODE_INDEX, vector<std::pair<size_t, int>>> dst_rns;
+        for (size_t k = 0; k < dst_segs.size(); ++k) {
+            const SegmentPtr& p_seg2 = dst_segs[k];
+            const int i_seg2 = p_seg2 ? SegPosInWay(p_seg2) : -1;
+            if (i_seg2 < 0) {
+                continue;
+            }
+            const auto& segs2 = p_seg2->GetWayOriented()->Segments();
+            const HIGHWAY_TYPE highway_type = p_seg2->GetWayOriented()->HighwayType();
+            if (&segs2 == &segs1 && i_seg1 < i_seg2) {
+                // same way, seg2 is ahead of seg1
+                double length = 0;
+                for (int i = i_seg1 + 1; i <= i_seg2; ++i) {
+                    length += segs2[i]->length_;
+                }
+                costs[k] = WayManager::DistanceToWeight(length, highway_type);
+            }
+
+            double trail_length = 0;
+            for (int i = i_seg2; i >= 0; --i) {
+                trail_length += segs2[i]->length_;
+                if (segs2[i]->GetFromNode()->IsRoutingNode()) {
+                    const auto i_rn2 = routing_node_map_.at(segs2[i]->GetFromNode()->nd_id_);
+                    dst_rns[i_rn2].emplace_back(k,
+                        WayManager::DistanceToWeight(trail_length, highway_type));
+                    break;
+                }
+            }
+        }
+        if (0 == i_rn1 || dst_rns.empty()) {
+            return true;
+        }
+
+        using namespace dijkstra;
+        BinHeap fwd_heap(routing_node_pool_, (int)routing_node_map_.size());
+        auto& node_pool = fwd_heap.NodePool();
+        fwd_heap.Insert(i_rn1, 0, 0);
+
+        size_t dst_rns_left = dst_rns.size();
+        vector<HeapData> pairs;
+        while (!fwd_heap.Empty() && dst_rns_left > 0) {
+            HeapData min_heap_node = fwd_heap.DeleteMin();
+            NodeData& min_node = node_pool[min_heap_node.pool_index_];
+            min_node.finished = true;
+
+            auto it_dst = dst_rns.find(min_node.i_rn);
+            if (it_dst != dst_rns.end()) {
+                for (const auto& dst : it_dst->second) {
+                    const int cost = lead_weight + min_node.distance + dst.second;
+                    if (costs[dst.first] < 0 || cost < costs[dst.first]) {
+                        costs[dst.first] = cost;
+                    }
+                }
+                --dst_rns_left;
+            }
+
+            pairs.clear();
+            for (auto i_conn : routing_node_pool_[min_node.i_rn].conn_tos_) {
+                const auto& edge = conn_pool_[i_conn];
+                if (time_point != 0 && edge.excluded_flag_.Get() &&
+                    IsConnExcluded(edge, time_point, is_localtime)) {
+                    continue;
+                }
+
+                NODE_DATA_INDEX i_to_node_data = fwd_heap.GetIfInserted(edge.i_to_rn_);
+                if (i_to_node_data != 0 && node_pool[i_to_node_data].finished) {
+                    continue;
+                }
+                const int distance = min_node.distance + edge.weight_;
+                if (i_to_node_data == 0) {
+                    i_to_node_data = fwd_heap.Insert(edge.i_to_rn_, min_node.i_rn, distance);
+                }
+                if (distance < node_pool[i_to_node_data].distance) {
+                    pairs.emplace_back(i_to_node_data, distance);
+                    node_pool[i_to_node_data].i_pre_rn = min_node.i_rn;
+                }
+            }
+            if (!pairs.empty()) {
+                fwd_heap.DecreaseKeys(pairs);
+            }
+        }
+        return true;
+    }
+
     bool ViaRoute(const ViaRouteParams& params, ViaRouteResult& result)
     {
         result.Clear();
@@ -2606,11 +3133,11 @@ public:
                 const auto& i_to_rn = edge.i_to_rn_;
 
                 // if the some segs are excluded, e.g., closed tunnel in the midnight
-                if (time_point != 0 && edge.excluded_flag_) {
+                if (time_point != 0 && edge.excluded_flag_.Get()) {
                     bool is_excluded = false;
                     for (const auto &p_seg : edge.segs_) {
-                        if (p_seg->excluded_flag_) {
-                            if (p_seg->excluded_always_ ||
+                        if (p_seg->ExcludedFlag()) {
+                            if (p_seg->ExcludedAlways() ||
                                 this->way_manager_.IsSegmentExcluded(p_seg, time_point,
                                     is_localtime)) {
                                 is_excluded = true;
@@ -2909,11 +3436,11 @@ private:
             const auto& i_to_rn = edge.i_to_rn_;
 
             // if the some segs are excluded, e.g., closed tunnel in the midnight
-            if (time_point != 0 && edge.excluded_flag_) {
+            if (time_point != 0 && edge.excluded_flag_.Get()) {
                 bool is_excluded = false;
                 for (const auto &p_seg : edge.segs_) {
-                    if (p_seg->excluded_flag_) {
-                        if (p_seg->excluded_always_ ||
+                    if (p_seg->ExcludedFlag()) {
+                        if (p_seg->ExcludedAlways() ||
                             this->way_manager_.IsSegmentExcluded(p_seg, time_point,
                                 is_localtime)) {
                             is_excluded = true;
@@ -2985,11 +3512,11 @@ private:
             const auto& i_from_rn = edge.i_from_rn_;
 
             // if the some segs are excluded, e.g., closed tunnel in the midnight
-            if (time_point != 0 && edge.excluded_flag_) {
+            if (time_point != 0 && edge.excluded_flag_.Get()) {
                 bool is_excluded = false;
                 for (const auto &p_seg : edge.segs_) {
-                    if (p_seg->excluded_flag_) {
-                        if (p_seg->excluded_always_ ||
+                    if (p_seg->ExcludedFlag()) {
+                        if (p_seg->ExcludedAlways() ||
                             this->way_manager_.IsSegmentExcluded(p_seg, time_point,
                                 is_localtime)) {
                             is_excluded = true;
@@ -3135,6 +3662,21 @@ private:
     util::SimpleObjPool<FourStepConnection> conn4_pool_;
     util::SimpleObjPool<SixStepConnection>  conn6_pool_;
 
+    UNORD_MAP<SEG_ID_T, CONN_INDEX>         seg_conn_map_;
+    UNORD_MAP<SEG_ID_T, vector<CONN_INDEX>> seg_more_conns_map_;
+
+    // by the way of the step of the multi-step connections, see InitNearbyConnIndexes()
+    NearbyConnIndex conn2_way2_index_; // conn_way_id2_ of two_step_conn_tos_
+    NearbyConnIndex conn4_way2_index_; // conn_way_ids_[2] of four_step_conn_tos_
+    NearbyConnIndex conn4_way3_index_; // conn_way_ids_[3] of four_step_conn_tos_
+    NearbyConnIndex conn6_way4_index_; // conn_way_ids_[4] of six_step_conn_tos_
+    NearbyConnIndex conn6_way5_index_; // conn_way_ids_[5] of six_step_conn_tos_
+    // by the out ways of the connection's node, for trying out ways
+    NearbyConnIndex conn2_out_way_index_; // i_to_rn_ of two_step_conn_tos_
+    NearbyConnIndex conn4_mid2_out_way_index_; // mid_rns_[2] of four_step_conn_tos_
+    NearbyConnIndex conn4_out_way_index_; // i_to_rn_ of four_step_conn_tos_
+    NearbyConnIndex conn6_out_way_index_; // i_to_rn_ of six_step_conn_tos_
+
     friend class geo::WayManager;
 };
 
@@ -3147,17 +3689,37 @@ using namespace route;
 
 bool WayManager::InitForRouting(bool shortest_mode /*= true*/)
 {
+    const auto start = util::GetTimeInMs64();
     p_route_manager_ = make_shared<RouteManager>(*this);
-    return p_route_manager_->InitForRouting(shortest_mode);
+    if (false == p_route_manager_->InitForRouting(shortest_mode)) {
+        return false;
+    }
+    init_stats_.routing_ms = util::GetTimeInMs64() - start;
+    routing_shortest_mode_ = shortest_mode;
+    return true;
 }
 
 void WayManager::SyncExclusionSegsToRouting()
 {
+    std::lock_guard<std::mutex> guard(exclusion_update_mutex_);
     if (p_route_manager_) {
         p_route_manager_->SyncExclusionSegsToRouting();
     }
 }
 
+void WayManager::SyncExclusionSegsToRouting(const std::vector<SegmentPtr> &segs)
+{
+    std::lock_guard<std::mutex> guard(exclusion_update_mutex_);
+    SyncExclusionSegsToRoutingNoLock(segs);
+}
+
+void WayManager::SyncExclusionSegsToRoutingNoLock(const std::vector<SegmentPtr> &segs)
+{
+    if (p_route_manager_) {
+        p_route_manager_->SyncExclusionSegsToRouting(segs);
+    }
+}
+
 bool WayManager::RoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
     vector<SegmentPtr>& result_route, bool exclude_reversed_segs /*= false*/,
     time_t time_point /*= 0*/, bool is_localtime /*= false*/,
@@ -3167,6 +3729,15 @@ bool WayManager::RoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg
         exclude_reversed_segs, time_point, is_localtime, points_reversed);
 }
 
+bool WayManager::RoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
+    CompactRoute& result_route, bool exclude_reversed_segs /*= false*/,
+    time_t time_point /*= 0*/, bool is_localtime /*= false*/,
+    bool points_reversed /*= false*/) const
+{
+    return p_route_manager_->RoutingNearby(p_seg1, p_seg2, result_route,
+        exclude_reversed_segs, time_point, is_localtime, points_reversed);
+}
+
 bool WayManager::SimilarRoutingNearby(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
     const vector<GeoPoint>& trace, vector<SegmentPtr>& result_route, double& distance,
     bool exclude_reverse_segs /*= false*/) const
@@ -3192,6 +3763,23 @@ bool WayManager::DijkstraShortestPath(const SegmentPtr& p_seg1, const SegmentPtr
         time_point, is_localtime, points_reversed);
 }
 
+bool WayManager::DijkstraShortestPath(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
+    CompactRoute& result_route, int *search_steps/*= nullptr*/,
+    time_t time_point/* = 0*/, bool is_localtime/*= false*/,
+    bool points_reversed /*= false*/) const
+{
+    return p_route_manager_->DijkstraShortestPath(p_seg1, p_seg2, result_route, search_steps,
+        time_point, is_localtime, points_reversed);
+}
+
+bool WayManager::DijkstraShortestCosts(const SegmentPtr& p_seg1,
+    const std::vector<SegmentPtr>& dst_segs, std::vector<int>& costs, time_t time_point,
+    bool is_localtime) const
+{
+    return p_route_manager_->DijkstraShortestCosts(p_seg1, dst_segs, costs, time_point,
+        is_localtime);
+}
+
 bool WayManager::DijkstraShortestEdgePath(const SegmentPtr& p_seg1, const SegmentPtr& p_seg2,
     vector<EDGE_ID_T>& result_route) const
 {
@@ -3224,4 +3812,259 @@ SegmentPtr WayManager::GetLeadSeg(const SegmentPtr& p_seg) const
     return p_route_manager_->GetLeadSeg(p_seg);
 }
 
+bool WayManager::SaveRoutingSnapshot(snapshot::Writer &writer,
+    const snapshot::SegIndexer &seg_indexer) const
+{
+    using namespace snapshot;
+    const RouteManager &rm = *p_route_manager_;
+    const auto &nodes = node_pool_.AllObjs();
+
+    RoutingMetaRecord meta{};
+    meta.shortest_mode = rm.shortest_mode_ ? 1 : 0;
+
+    std::vector<RoutingNodeRecord> rn_records;
+    std::vector<int32_t> rn_conns;
+    std::vector<int64_t> rn_ways;
+    rn_records.reserve(rm.routing_node_pool_.Size());
+    for (const auto &rn : rm.routing_node_pool_.AllObjs()) {
+        RoutingNodeRecord r{};
+        r.node = PoolIndex<Node>(rn.p_node_, nodes);
+
+        const vector<int> *lists[] = { &rn.conn_froms_, &rn.conn_tos_, &rn.two_step_conn_tos_,
+            &rn.four_step_conn_tos_, &rn.six_step_conn_tos_ };
+        for (int i = 0; i < 5; ++i) {
+            r.begins[i] = (uint32_t)rn_conns.size();
+            r.counts[i] = (uint32_t)lists[i]->size();
+            rn_conns.insert(rn_conns.end(), lists[i]->begin(), lists[i]->end());
+        }
+        r.begins[5] = (uint32_t)rn_ways.size();
+        r.counts[5] = (uint32_t)rn.out_oriented_ways_.size();
+        rn_ways.insert(rn_ways.end(), rn.out_oriented_ways_.begin(), rn.out_oriented_ways_.end());
+        rn_records.push_back(r);
+    }
+
+    std::vector<ConnRecord> conn_records;
+    std::vector<int32_t> conn_segs;
+    conn_records.reserve(rm.conn_pool_.Size());
+    for (const auto &conn : rm.conn_pool_.AllObjs()) {
+        ConnRecord r{};
+        r.i_from_rn = conn.i_from_rn_;
+        r.i_to_rn = conn.i_to_rn_;
+        r.conn_way_id = conn.conn_way_id_;
+        r.weight = conn.weight_;
+        r.segs_begin = (uint32_t)conn_segs.size();
+        r.segs_count = (uint32_t)conn.segs_.size();
+        for (const auto &p_seg : conn.segs_) {
+            conn_segs.push_back(seg_indexer.ToIndex(p_seg));
+        }
+        conn_records.push_back(r);
+    }
+
+    // multi-step connections are POD, saved as they are
+    if (!writer.WriteSection(SEC_ROUTING_META, &meta, 1) ||
+        !writer.WriteSection(SEC_ROUTING_NODES, rn_records) ||
+        !writer.WriteSection(SEC_ROUTING_NODE_CONNS, rn_conns) ||
+        !writer.WriteSection(SEC_ROUTING_NODE_WAYS, rn_ways) ||
+        !writer.WriteSection(SEC_CONNS, conn_records) ||
+        !writer.WriteSection(SEC_CONN_SEGS, conn_segs) ||
+        !writer.WriteSection(SEC_CONNS2, rm.conn2_pool_.AllObjs()) ||
+        !writer.WriteSection(SEC_CONNS4, rm.conn4_pool_.AllObjs()) ||
+        !writer.WriteSection(SEC_CONNS6, rm.conn6_pool_.AllObjs())) {
+        SetErrorString("SaveSnapshot: error in writing routing data");
+        return false;
+    }
+    return true;
+}
+
+// the routing sections in place
+struct RoutingSnapshotSections
+{
+    const snapshot::RoutingMetaRecord *p_meta;
+    const snapshot::RoutingNodeRecord *p_rn_records;
+    const int32_t *p_rn_conns, *p_conn_segs;
+    const int64_t *p_rn_ways;
+    const snapshot::ConnRecord *p_conn_records;
+    const TwoStepConnection *p_conns2;
+    const FourStepConnection *p_conns4;
+    const SixStepConnection *p_conns6;
+    size_t n_meta, n_rns, n_rn_conns, n_rn_ways, n_conns, n_conn_segs, n_conns2, n_conns4,
+        n_conns6;
+
+    bool Get(const snapshot::Reader &reader, std::string &err)
+    {
+        using namespace snapshot;
+        if (!reader.GetSection(SEC_ROUTING_META, p_meta, n_meta, err) ||
+            !reader.GetSection(SEC_ROUTING_NODES, p_rn_records, n_rns, err) ||
+            !reader.GetSection(SEC_ROUTING_NODE_CONNS, p_rn_conns, n_rn_conns, err) ||
+            !reader.GetSection(SEC_ROUTING_NODE_WAYS, p_rn_ways, n_rn_ways, err) ||
+            !reader.GetSection(SEC_CONNS, p_conn_records, n_conns, err) ||
+            !reader.GetSection(SEC_CONN_SEGS, p_conn_segs, n_conn_segs, err) ||
+            !reader.GetSection(SEC_CONNS2, p_conns2, n_conns2, err) ||
+            !reader.GetSection(SEC_CONNS4, p_conns4, n_conns4, err) ||
+            !reader.GetSection(SEC_CONNS6, p_conns6, n_conns6, err)) {
+            return false;
+        }
+        if (n_meta != 1) {
+            err = "invalid routing meta data";
+            return false;
+        }
+        return true;
+    }
+};
+
+bool WayManager::CheckRoutingSnapshot(const snapshot::Reader &reader, size_t n_nodes,
+    size_t n_segs, std::string &err)
+{
+    RoutingSnapshotSections sec;
+    if (!sec.Get(reader, err)) {
+        return false;
+    }
+    auto in_range = [](int64_t index, size_t count) {
+        return index >= 0 && (uint64_t)index < count;
+    };
+
+    // the lists of a routing node index conn_pool_ (froms and tos), then conn2_pool_,
+    // conn4_pool_ and conn6_pool_
+    const size_t n_list_objs[5] = { sec.n_conns, sec.n_conns, sec.n_conns2, sec.n_conns4,
+        sec.n_conns6 };
+    for (size_t i = 0; i < sec.n_rns; ++i) {
+        const snapshot::RoutingNodeRecord &r = sec.p_rn_records[i];
+        if (r.node != -1 && !in_range(r.node, n_nodes)) {
+            err = "invalid routing node data";
+            return false;
+        }
+        for (int k = 0; k < 6; ++k) {
+            const size_t n_total = k < 5 ? sec.n_rn_conns : sec.n_rn_ways;
+            if ((size_t)r.begins[k] + r.counts[k] > n_total) {
+                err = "invalid routing node data";
+                return false;
+            }
+        }
+        for (int k = 0; k < 5; ++k) {
+            for (uint32_t j = 0; j < r.counts[k]; ++j) {
+                if (!in_range(sec.p_rn_conns[r.begins[k] + j], n_list_objs[k])) {
+                    err = "invalid routing node data";
+                    return false;
+                }
+            }
+        }
+    }
+
+    // the one at index 0 is a dummy, index 0 is the invalid connection
+    for (size_t i = 0; i < sec.n_conns; ++i) {
+        const snapshot::ConnRecord &r = sec.p_conn_records[i];
+        bool valid = (size_t)r.segs_begin + r.segs_count <= sec.n_conn_segs &&
+            (i == 0 || (in_range(r.i_from_rn, sec.n_rns) && in_range(r.i_to_rn, sec.n_rns)));
+        for (uint32_t k = 0; k < r.segs_count && valid; ++k) {
+            valid = in_range(sec.p_conn_segs[r.segs_begin + k], n_segs);
+        }
+        if (!valid) {
+            err = "invalid routing connection data";
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < sec.n_conns2; ++i) {
+        const TwoStepConnection &conn = sec.p_conns2[i];
+        if (!in_range(conn.i_from_rn_, sec.n_rns) || !in_range(conn.i_mid_rn_, sec.n_rns) ||
+            !in_range(conn.i_to_rn_, sec.n_rns)) {
+            err = "invalid routing connection data";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < sec.n_conns4; ++i) {
+        const FourStepConnection &conn = sec.p_conns4[i];
+        bool valid = in_range(conn.i_from_rn_, sec.n_rns) && in_range(conn.i_to_rn_, sec.n_rns);
+        for (int k = 0; k < 3 && valid; ++k) {
+            valid = in_range(conn.mid_rns_[k], sec.n_rns);
+        }
+        if (!valid) {
+            err = "invalid routing connection data";
+            return false;
+        }
+    }
+    for (size_t i = 0; i < sec.n_conns6; ++i) {
+        const SixStepConnection &conn = sec.p_conns6[i];
+        bool valid = in_range(conn.i_from_rn_, sec.n_rns) && in_range(conn.i_to_rn_, sec.n_rns);
+        for (int k = 0; k < 5 && valid; ++k) {
+            valid = in_range(conn.mid_rns_[k], sec.n_rns);
+        }
+        if (!valid) {
+            err = "invalid routing connection data";
+            return false;
+        }
+    }
+    return true;
+}
+
+// the sections are checked by CheckRoutingSnapshot() before
+void WayManager::LoadRoutingSnapshot(const snapshot::Reader &reader,
+    const snapshot::SegIndexer &seg_indexer)
+{
+    using namespace snapshot;
+    RoutingSnapshotSections sec;
+    std::string err;
+    sec.Get(reader, err);
+    const RoutingMetaRecord *p_meta = sec.p_meta;
+    const RoutingNodeRecord *p_rn_records = sec.p_rn_records;
+    const int32_t *p_rn_conns = sec.p_rn_conns, *p_conn_segs = sec.p_conn_segs;
+    const int64_t *p_rn_ways = sec.p_rn_ways;
+    const ConnRecord *p_conn_records = sec.p_conn_records;
+    const size_t n_rns = sec.n_rns, n_conns = sec.n_conns;
+
+    auto p_route_manager = make_shared<RouteManager>(*this);
+    RouteManager &rm = *p_route_manager;
+    rm.shortest_mode_ = p_meta->shortest_mode != 0;
+    routing_shortest_mode_ = rm.shortest_mode_;
+
+    rm.routing_node_pool_.Reserve(n_rns);
+    rm.routing_node_map_.reserve(n_rns);
+    for (size_t i = 0; i < n_rns; ++i) {
+        const RoutingNodeRecord &r = p_rn_records[i];
+        const NodePtr p_node = (r.node >= 0 && (size_t)r.node < node_pool_.Size()) ?
+            node_pool_.ObjPtrByIndex(r.node) : nullptr;
+        const int i_rn = rm.routing_node_pool_.AllocNewIndex(RoutingNode(p_node));
+        RoutingNode &rn = rm.routing_node_pool_[i_rn];
+        if (p_node) {
+            rm.routing_node_map_[p_node->nd_id_] = i_rn;
+        }
+
+        vector<int> *lists[] = { &rn.conn_froms_, &rn.conn_tos_, &rn.two_step_conn_tos_,
+            &rn.four_step_conn_tos_, &rn.six_step_conn_tos_ };
+        for (int k = 0; k < 5; ++k) {
+            lists[k]->assign(p_rn_conns + r.begins[k], p_rn_conns + r.begins[k] + r.counts[k]);
+        }
+        rn.out_oriented_ways_.assign(p_rn_ways + r.begins[5],
+            p_rn_ways + r.begins[5] + r.counts[5]);
+    }
+
+    rm.conn_pool_.Reserve(n_conns);
+    for (size_t i = 0; i < n_conns; ++i) {
+        const ConnRecord &r = p_conn_records[i];
+        Connection &conn = rm.conn_pool_[rm.conn_pool_.AllocNewIndex()];
+        conn.i_from_rn_ = r.i_from_rn;
+        conn.i_to_rn_ = r.i_to_rn;
+        conn.conn_way_id_ = r.conn_way_id;
+        conn.weight_ = r.weight;
+        conn.excluded_flag_.Set(false); // exclusions are not saved
+        conn.segs_.reserve(r.segs_count);
+        for (uint32_t k = 0; k < r.segs_count; ++k) {
+            conn.segs_.push_back(seg_indexer.ToPtr(p_conn_segs[r.segs_begin + k]));
+        }
+#if (EASY_NODE_DEBUG == 1)
+        if (i > 0) {
+            conn.p_from_nd_ = rm.routing_node_pool_[conn.i_from_rn_].p_node_;
+            conn.p_to_nd_ = rm.routing_node_pool_[conn.i_to_rn_].p_node_;
+        }
+#endif
+    }
+
+    rm.conn2_pool_.AllObjs().assign(sec.p_conns2, sec.p_conns2 + sec.n_conns2);
+    rm.conn4_pool_.AllObjs().assign(sec.p_conns4, sec.p_conns4 + sec.n_conns4);
+    rm.conn6_pool_.AllObjs().assign(sec.p_conns6, sec.p_conns6 + sec.n_conns6);
+    rm.InitNearbyConnIndexes();
+
+    p_route_manager_ = p_route_manager;
+}
+
 } // end of namespace
@@ -0,0 +1,307 @@
+#ifndef _WAY_MANAGER_SEGBIN_H_
+#define _WAY_MANAGER_SEGBIN_H_
+
+// internal header, only for the way_manager*.cpp files
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "way_manager.h"
+
+namespace geo {
+namespace segbin {
+
+// compact binary segments file, the exchange format replacing the segments CSV:
+//
+//  FileHeader | BlockRecord * block_count | string table | block data ...
+//
+// each block holds up to BLOCK_SEGS segments as varints, protobuf style. the values are encoded
+// as deltas to the previous segment of the same block, zigzag encoded if signed, so that the
+// blocks can be decoded in parallel. coordinates are fixed point, consecutive segments usually
+// share the point and the node, which are then flagged instead of encoded. strings are saved
+// once in the string table, referred by offsets. offset 0 is the empty string
+static const char MAGIC[8] = { 'W', 'M', 'S', 'E', 'G', 'B', 'I', 'N' };
+static const uint32_t VERSION = 1;
+static const uint32_t ENDIAN_CHECK = 0x01020304;
+static const size_t BLOCK_SEGS = 4096;
+static const double COORD_PRECISION = 1e7; // about 1 cm
+
+struct FileHeader
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    endian_check;
+    double      coord_precision;
+    uint64_t    seg_count;
+    uint64_t    block_count;
+    uint64_t    strs_size;
+};
+
+struct BlockRecord
+{
+    uint64_t    offset; // from the beginning of the file
+    uint64_t    size;
+    uint64_t    seg_count;
+};
+
+// flags of a segment record
+enum SEG_FLAGS : uint32_t
+{
+    SEGF_ONE_WAY = 0x01,
+    SEGF_FROM_ND_IS_PREV_TO_ND = 0x02,
+    SEGF_FROM_PT_IS_PREV_TO_PT = 0x04,
+};
+
+inline uint64_t ZigZag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline int64_t ToFixed(double coord, double precision)
+{
+    return (int64_t)std::llround(coord * precision);
+}
+
+inline void PutVarint(std::vector<char> &buff, uint64_t value)
+{
+    while (value >= 0x80) {
+        buff.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    buff.push_back((char)value);
+}
+
+inline void PutSVarint(std::vector<char> &buff, int64_t value)
+{
+    PutVarint(buff, ZigZag(value));
+}
+
+// false if the varint is truncated or too long
+inline bool GetVarint(const char *&p, const char *p_end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && p < p_end; shift += 7) {
+        const uint8_t byte = (uint8_t)*p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool GetSVarint(const char *&p, const char *p_end, int64_t &value)
+{
+    uint64_t u;
+    if (!GetVarint(p, p_end, u)) {
+        return false;
+    }
+    value = UnZigZag(u);
+    return true;
+}
+
+// the state the deltas refer to, reset at the beginning of each block
+struct DeltaState
+{
+    int64_t     seg_id{};
+    int64_t     way_id{};
+    int64_t     to_nd{};
+    int64_t     to_lat{};
+    int64_t     to_lng{};
+};
+
+class Writer
+{
+public:
+    Writer()
+    {
+        str_offsets_[std::string()] = 0;
+        strs_.push_back('\0');
+    }
+
+    void AddSegment(const SEGMENT &seg)
+    {
+        if (block_seg_count_ == 0) {
+            blocks_.emplace_back();
+            state_ = DeltaState();
+        }
+        std::vector<char> &buff = blocks_.back();
+
+        const int64_t from_lat = ToFixed(seg.from_lat, COORD_PRECISION);
+        const int64_t from_lng = ToFixed(seg.from_lng, COORD_PRECISION);
+        const int64_t to_lat = ToFixed(seg.to_lat, COORD_PRECISION);
+        const int64_t to_lng = ToFixed(seg.to_lng, COORD_PRECISION);
+
+        uint32_t flags = 0;
+        if (seg.one_way) {
+            flags |= SEGF_ONE_WAY;
+        }
+        if (seg.from_nd == state_.to_nd) {
+            flags |= SEGF_FROM_ND_IS_PREV_TO_ND;
+        }
+        if (from_lat == state_.to_lat && from_lng == state_.to_lng) {
+            flags |= SEGF_FROM_PT_IS_PREV_TO_PT;
+        }
+
+        PutSVarint(buff, seg.seg_id - state_.seg_id);
+        PutSVarint(buff, seg.way_id - state_.way_id);
+        PutVarint(buff, flags);
+        if ((flags & SEGF_FROM_ND_IS_PREV_TO_ND) == 0) {
+            PutSVarint(buff, seg.from_nd - state_.to_nd);
+        }
+        PutSVarint(buff, seg.to_nd - seg.from_nd);
+        if ((flags & SEGF_FROM_PT_IS_PREV_TO_PT) == 0) {
+            PutSVarint(buff, from_lat - state_.to_lat);
+            PutSVarint(buff, from_lng - state_.to_lng);
+        }
+        PutSVarint(buff, to_lat - from_lat);
+        PutSVarint(buff, to_lng - from_lng);
+        PutSVarint(buff, seg.way_sub_seq);
+        PutSVarint(buff, seg.split_seq);
+        PutVarint(buff, (uint64_t)seg.way_type);
+        PutVarint(buff, (uint64_t)seg.struct_type);
+        PutSVarint(buff, seg.layer);
+        PutVarint(buff, AddString(seg.way_name));
+        PutVarint(buff, AddString(seg.highway_type_str));
+        PutVarint(buff, AddString(seg.opt_tags));
+
+        state_.seg_id = seg.seg_id;
+        state_.way_id = seg.way_id;
+        state_.to_nd = seg.to_nd;
+        state_.to_lat = to_lat;
+        state_.to_lng = to_lng;
+        ++seg_count_;
+        if (++block_seg_count_ == BLOCK_SEGS) {
+            block_seg_count_ = 0;
+        }
+    }
+
+    bool Save(FILE *fp) const
+    {
+        FileHeader header{};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.endian_check = ENDIAN_CHECK;
+        header.coord_precision = COORD_PRECISION;
+        header.seg_count = seg_count_;
+        header.block_count = blocks_.size();
+        header.strs_size = strs_.size();
+
+        std::vector<BlockRecord> block_records(blocks_.size());
+        uint64_t offset = sizeof(FileHeader) + sizeof(BlockRecord) * blocks_.size() + strs_.size();
+        for (size_t i = 0; i < blocks_.size(); ++i) {
+            block_records[i].offset = offset;
+            block_records[i].size = blocks_[i].size();
+            block_records[i].seg_count = (i + 1 < blocks_.size() || seg_count_ % BLOCK_SEGS == 0) ?
+                BLOCK_SEGS : seg_count_ % BLOCK_SEGS;
+            offset += blocks_[i].size();
+        }
+
+        if (!Write(fp, &header, sizeof(header)) ||
+            !Write(fp, block_records.data(), sizeof(BlockRecord) * block_records.size()) ||
+            !Write(fp, strs_.data(), strs_.size())) {
+            return false;
+        }
+        for (const auto &block : blocks_) {
+            if (!Write(fp, block.data(), block.size())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    uint32_t AddString(const std::string &str)
+    {
+        auto it = str_offsets_.find(str);
+        if (it != str_offsets_.end()) {
+            return it->second;
+        }
+        const uint32_t offset = (uint32_t)strs_.size();
+        strs_.insert(strs_.end(), str.c_str(), str.c_str() + str.size() + 1);
+        str_offsets_[str] = offset;
+        return offset;
+    }
+
+    static bool Write(FILE *fp, const void *p, size_t size)
+    {
+        return size == 0 || fwrite(p, 1, size, fp) == size;
+    }
+
+private:
+    std::vector<std::vector<char>> blocks_;
+    std::vector<char> strs_;
+    UNORD_MAP<std::string, uint32_t> str_offsets_;
+    DeltaState state_;
+    size_t block_seg_count_{};
+    uint64_t seg_count_{};
+};
+
+// true if the data begins like a binary segments file
+inline bool IsSegBin(const char *p_data, size_t size)
+{
+    return size >= sizeof(MAGIC) && memcmp(p_data, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// validates the header and the block index, all in place in the (mapped) data
+inline bool ReadHeader(const char *p_data, size_t size, FileHeader &header,
+    const BlockRecord *&p_blocks, const char *&p_strs, std::string &err)
+{
+    if (size < sizeof(FileHeader)) {
+        err = "binary segments file too small";
+        return false;
+    }
+    memcpy(&header, p_data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        err = "not a binary segments file";
+        return false;
+    }
+    if (header.version != VERSION || header.endian_check != ENDIAN_CHECK ||
+        !(header.coord_precision > 0)) {
+        err = "incompatible binary segments file version " + std::to_string(header.version);
+        return false;
+    }
+    // each size is checked against what is left, so that the sums cannot wrap
+    const uint64_t rest_size = size - sizeof(FileHeader);
+    if (header.block_count > rest_size / sizeof(BlockRecord) || header.strs_size == 0 ||
+        header.strs_size > rest_size - header.block_count * sizeof(BlockRecord)) {
+        err = "truncated binary segments file";
+        return false;
+    }
+    const uint64_t index_size = header.block_count * sizeof(BlockRecord);
+    p_blocks = reinterpret_cast<const BlockRecord *>(p_data + sizeof(FileHeader));
+    p_strs = p_data + sizeof(FileHeader) + index_size;
+    if (p_strs[header.strs_size - 1] != '\0') {
+        err = "invalid string table in binary segments file";
+        return false;
+    }
+    uint64_t seg_count = 0;
+    for (uint64_t i = 0; i < header.block_count; ++i) {
+        if (p_blocks[i].offset > size || p_blocks[i].size > size - p_blocks[i].offset) {
+            err = "truncated block in binary segments file";
+            return false;
+        }
+        if (p_blocks[i].seg_count > BLOCK_SEGS) {
+            err = "invalid block segment count in binary segments file";
+            return false;
+        }
+        seg_count += p_blocks[i].seg_count; // no wrap, block_count is bound by size
+    }
+    if (seg_count != header.seg_count) {
+        err = "segment count mismatch in binary segments file";
+        return false;
+    }
+    return true;
+}
+
+} // namespace segbin
+} // namespace geo
+
+#endif // _WAY_MANAGER_SEGBIN_H_
@@ -0,0 +1,455 @@
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <queue>
+#include <thread>
+#include "way_manager.h"
+
+
+namespace geo {
+
+// half open, so that a point on the border belongs to one region only
+bool ShardedWayManager::InRegion(const Bound &bound, double lat, double lng)
+{
+    return lat >= bound.minlat && lat < bound.maxlat && lng >= bound.minlng && lng < bound.maxlng;
+}
+
+int ShardedWayManager::AddShard(const Bound &bound, const std::string &pathname,
+    bool is_snapshot, bool shortest_mode)
+{
+    Shard shard;
+    shard.bound = bound;
+    shard.pathname = pathname;
+    shard.is_snapshot = is_snapshot;
+    shard.shortest_mode = shortest_mode;
+    shard.p_load_mutex = std::make_shared<std::mutex>();
+    shards_.push_back(shard);
+    return (int)shards_.size() - 1;
+}
+
+int ShardedWayManager::FindShard(double lat, double lng) const
+{
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        if (InRegion(shards_[i].bound, lat, lng)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+std::shared_ptr<WayManager> ShardedWayManager::LoadShardFile(const Shard &shard) const
+{
+    auto p_way_manager = std::make_shared<WayManager>();
+    if (shard.is_snapshot) {
+        if (false == p_way_manager->LoadSnapshot(shard.pathname)) {
+            threads_err_strs_.Set("LoadShard: " + p_way_manager->GetErrorString());
+            return nullptr;
+        }
+        return p_way_manager;
+    }
+
+    p_way_manager->SetBoundries(shard.bound);
+    if (false == p_way_manager->LoadSegments(shard.pathname) ||
+        false == p_way_manager->InitForRouting(shard.shortest_mode) ||
+        false == p_way_manager->InitSegServices(shard.bound)) {
+        threads_err_strs_.Set("LoadShard: " + p_way_manager->GetErrorString());
+        return nullptr;
+    }
+    return p_way_manager;
+}
+
+std::shared_ptr<WayManager> ShardedWayManager::GetShard(int i_shard)
+{
+    if (i_shard < 0 || i_shard >= (int)shards_.size()) {
+        threads_err_strs_.Set("Invalid shard index " + std::to_string(i_shard));
+        return nullptr;
+    }
+
+    Shard &shard = shards_[i_shard];
+    {
+        std::lock_guard<std::mutex> lock(shards_mutex_);
+        if (shard.p_way_manager) {
+            shard.last_used = ++use_count_;
+            return shard.p_way_manager;
+        }
+    }
+
+    // other threads wanting the same shard wait here, the other shards are not blocked
+    std::lock_guard<std::mutex> load_lock(*shard.p_load_mutex);
+    {
+        std::lock_guard<std::mutex> lock(shards_mutex_);
+        if (shard.p_way_manager) {
+            shard.last_used = ++use_count_;
+            return shard.p_way_manager;
+        }
+    }
+
+    auto p_way_manager = LoadShardFile(shard);
+    if (!p_way_manager) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(shards_mutex_);
+    shard.p_way_manager = p_way_manager;
+    shard.last_used = ++use_count_;
+    UnloadLeastUsedShards(i_shard);
+    return p_way_manager;
+}
+
+void ShardedWayManager::UnloadLeastUsedShards(int i_keep)
+{
+    if (max_loaded_shards_ == 0) {
+        return;
+    }
+
+    while (true) {
+        size_t loaded_count = 0;
+        int i_least_used = -1;
+        for (int i = 0; i < (int)shards_.size(); ++i) {
+            if (!shards_[i].p_way_manager) {
+                continue;
+            }
+            ++loaded_count;
+            if (i != i_keep &&
+                (i_least_used < 0 || shards_[i].last_used < shards_[i_least_used].last_used)) {
+                i_least_used = i;
+            }
+        }
+        if (loaded_count <= max_loaded_shards_ || i_least_used < 0) {
+            break;
+        }
+        // freed after the last user drops it
+        shards_[i_least_used].p_way_manager.reset();
+    }
+}
+
+void ShardedWayManager::UnloadShard(int i_shard)
+{
+    if (i_shard >= 0 && i_shard < (int)shards_.size()) {
+        std::lock_guard<std::mutex> lock(shards_mutex_);
+        shards_[i_shard].p_way_manager.reset();
+    }
+}
+
+bool ShardedWayManager::IsShardLoaded(int i_shard) const
+{
+    if (i_shard < 0 || i_shard >= (int)shards_.size()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(shards_mutex_);
+    return shards_[i_shard].p_way_manager != nullptr;
+}
+
+size_t ShardedWayManager::GetLoadedShardCount() const
+{
+    std::lock_guard<std::mutex> lock(shards_mutex_);
+    size_t count = 0;
+    for (const auto &shard : shards_) {
+        if (shard.p_way_manager) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool ShardedWayManager::BuildOverlay()
+{
+    transfers_.clear();
+    for (auto &shard : shards_) {
+        shard.transfers.clear();
+    }
+
+    // costs between the candidates within each shard. a candidate is a segment crossing the
+    // region border, it becomes a transfer if the shard on the other side has it as well
+    struct ShardEdge
+    {
+        SEG_ID_T from_seg_id;
+        SEG_ID_T to_seg_id;
+        int cost;
+    };
+    std::vector<std::vector<SEG_ID_T>> shard_candidates(shards_.size());
+    std::vector<std::vector<ShardEdge>> shard_edges(shards_.size());
+    UNORD_MAP<SEG_ID_T, int> candidate_shard_counts;
+
+    for (int i_shard = 0; i_shard < (int)shards_.size(); ++i_shard) {
+        const bool was_loaded = IsShardLoaded(i_shard);
+        auto p_way_manager = GetShard(i_shard);
+        if (!p_way_manager) {
+            return false;
+        }
+
+        const Bound &bound = shards_[i_shard].bound;
+        std::vector<SegmentPtr> candidates;
+        for (const auto &seg : p_way_manager->GetAllSegs()) {
+            if (InRegion(bound, seg.from_point_.lat, seg.from_point_.lng) !=
+                InRegion(bound, seg.to_point_.lat, seg.to_point_.lng)) {
+                candidates.push_back(p_way_manager->GetSegById(seg.seg_id_));
+            }
+        }
+
+        // one search per candidate, in parallel
+        std::vector<std::vector<ShardEdge>> thread_edges(
+            std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+            std::max<size_t>(1, candidates.size())));
+        auto search = [&](size_t i_thread) {
+            std::vector<int> costs;
+            for (size_t i = i_thread; i < candidates.size(); i += thread_edges.size()) {
+                p_way_manager->DijkstraShortestCosts(candidates[i], candidates, costs);
+                for (size_t j = 0; j < candidates.size(); ++j) {
+                    if (j != i && costs[j] >= 0) {
+                        thread_edges[i_thread].push_back(ShardEdge{ candidates[i]->seg_id_,
+                            candidates[j]->seg_id_, costs[j] });
+                    }
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t i_thread = 1; i_thread < thread_edges.size(); ++i_thread) {
+            threads.emplace_back(search, i_thread);
+        }
+        search(0);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+
+        for (const auto &edges : thread_edges) {
+            shard_edges[i_shard].insert(shard_edges[i_shard].end(), edges.begin(), edges.end());
+        }
+        for (const auto &p_seg : candidates) {
+            shard_candidates[i_shard].push_back(p_seg->seg_id_);
+            ++candidate_shard_counts[p_seg->seg_id_];
+        }
+
+        p_way_manager.reset();
+        if (!was_loaded) {
+            UnloadShard(i_shard);
+        }
+    }
+
+    UNORD_MAP<SEG_ID_T, int> transfer_indices;
+    for (int i_shard = 0; i_shard < (int)shards_.size(); ++i_shard) {
+        for (const auto seg_id : shard_candidates[i_shard]) {
+            if (candidate_shard_counts[seg_id] < 2) {
+                continue;
+            }
+            auto it = transfer_indices.find(seg_id);
+            if (it == transfer_indices.end()) {
+                it = transfer_indices.insert({ seg_id, (int)transfers_.size() }).first;
+                transfers_.emplace_back();
+                transfers_.back().seg_id = seg_id;
+            }
+            shards_[i_shard].transfers.push_back(it->second);
+        }
+    }
+    for (int i_shard = 0; i_shard < (int)shards_.size(); ++i_shard) {
+        for (const auto &edge : shard_edges[i_shard]) {
+            auto it_from = transfer_indices.find(edge.from_seg_id);
+            auto it_to = transfer_indices.find(edge.to_seg_id);
+            if (it_from != transfer_indices.end() && it_to != transfer_indices.end()) {
+                transfers_[it_from->second].edges.push_back(
+                    OverlayEdge{ it_to->second, edge.cost, i_shard });
+            }
+        }
+    }
+    return true;
+}
+
+SEG_ID_T ShardedWayManager::AssignSegment(double lat, double lng, int heading, double radius,
+    int angle_tollerance, int *p_shard)
+{
+    const int i_shard = FindShard(lat, lng);
+    if (p_shard) {
+        *p_shard = i_shard;
+    }
+    if (i_shard < 0) {
+        threads_err_strs_.Set("No shard covers the point");
+        return 0;
+    }
+    auto p_way_manager = GetShard(i_shard);
+    if (!p_way_manager) {
+        return 0;
+    }
+    SegmentPtr p_seg = p_way_manager->AssignSegment(lat, lng, heading, radius, angle_tollerance);
+    return p_seg ? p_seg->seg_id_ : 0;
+}
+
+bool ShardedWayManager::AppendShardRoute(const std::shared_ptr<WayManager> &p_way_manager,
+    int i_shard, SEG_ID_T seg_id1, SEG_ID_T seg_id2, std::vector<SEG_ID_T> &route)
+{
+    // by Dijkstra as the costs of the overlay. ShortestPath() does not search beyond the nearby
+    // routing for the near segments, nor is the nearby route always the cheapest one
+    std::vector<SegmentPtr> seg_route;
+    const SegmentPtr p_seg1 = p_way_manager->GetSegById(seg_id1);
+    const SegmentPtr p_seg2 = p_way_manager->GetSegById(seg_id2);
+    if (p_seg1 != nullptr && p_seg1 == p_seg2) {
+        seg_route.push_back(p_seg1);
+    }
+    else if (p_seg1 == nullptr || p_seg2 == nullptr ||
+        false == p_way_manager->DijkstraShortestPath(p_seg1, p_seg2, seg_route) ||
+        seg_route.empty()) {
+        threads_err_strs_.Set("No route from " + std::to_string(seg_id1) + " to " +
+            std::to_string(seg_id2) + " in shard " + std::to_string(i_shard));
+        return false;
+    }
+    // the first segment is the last one of the previous section
+    auto it_begin = seg_route.begin();
+    if (!route.empty() && route.back() == seg_route.front()->seg_id_) {
+        ++it_begin;
+    }
+    for (auto it = it_begin; it != seg_route.end(); ++it) {
+        route.push_back((*it)->seg_id_);
+    }
+    return true;
+}
+
+//
+//  shard1: seg1 ----> T1      overlay: T1 ----> T2 ----> T3      shard2: T3 ----> seg2
+//
+// the costs from seg1 to the transfers of shard1, and from the transfers of shard2 to seg2 are
+// searched on demand, the rest are precomputed by BuildOverlay()
+bool ShardedWayManager::ShortestPath(int i_shard1, SEG_ID_T seg_id1, int i_shard2,
+    SEG_ID_T seg_id2, std::vector<SEG_ID_T> &route)
+{
+    route.clear();
+    auto p_way_manager1 = GetShard(i_shard1);
+    auto p_way_manager2 = GetShard(i_shard2);
+    if (!p_way_manager1 || !p_way_manager2) {
+        return false;
+    }
+    const SegmentPtr p_seg1 = p_way_manager1->GetSegById(seg_id1);
+    const SegmentPtr p_seg2 = p_way_manager2->GetSegById(seg_id2);
+    if (p_seg1 == nullptr || p_seg2 == nullptr) {
+        threads_err_strs_.Set("Segment not found in the shard");
+        return false;
+    }
+
+    if (i_shard1 == i_shard2 && (seg_id1 == seg_id2 || transfers_.empty())) {
+        return AppendShardRoute(p_way_manager1, i_shard1, seg_id1, seg_id2, route);
+    }
+    if (transfers_.empty()) {
+        threads_err_strs_.Set("No route within the shard and no overlay built");
+        return false;
+    }
+
+    const int n = (int)transfers_.size(); // n is the destination seg2
+    const auto &transfers1 = shards_[i_shard1].transfers;
+    const auto &transfers2 = shards_[i_shard2].transfers;
+
+    std::vector<SegmentPtr> transfer_segs;
+    std::vector<int> costs;
+    for (const auto i_transfer : transfers1) {
+        transfer_segs.push_back(p_way_manager1->GetSegById(transfers_[i_transfer].seg_id));
+    }
+    p_way_manager1->DijkstraShortestCosts(p_seg1, transfer_segs, costs);
+    for (size_t k = 0; k < transfer_segs.size(); ++k) {
+        if (transfer_segs[k] == p_seg1) { // seg1 is a transfer itself
+            costs[k] = 0;
+        }
+    }
+
+    std::vector<long long> dists(n + 1, LLONG_MAX);
+    std::vector<int> pre_transfers(n + 1, -1);
+    std::vector<int> pre_shards(n + 1, -1);
+    std::vector<bool> finished(n + 1);
+    typedef std::pair<long long, int> HeapItem;
+    std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap;
+    auto relax = [&](int i_pre, int i_to, long long dist, int i_shard) {
+        if (dist < dists[i_to]) {
+            dists[i_to] = dist;
+            pre_transfers[i_to] = i_pre;
+            pre_shards[i_to] = i_shard;
+            heap.emplace(dist, i_to);
+        }
+    };
+    for (size_t k = 0; k < transfers1.size(); ++k) {
+        if (costs[k] >= 0 && transfer_segs[k]) {
+            relax(-1, transfers1[k], costs[k], i_shard1);
+        }
+    }
+
+    std::vector<int> dst_costs(n, -1);
+    for (const auto i_transfer : transfers2) {
+        const SegmentPtr p_seg = p_way_manager2->GetSegById(transfers_[i_transfer].seg_id);
+        if (p_seg == p_seg2) { // seg2 is a transfer itself
+            dst_costs[i_transfer] = 0;
+        }
+        else if (p_seg && p_way_manager2->DijkstraShortestCosts(p_seg, { p_seg2 }, costs)) {
+            dst_costs[i_transfer] = costs[0];
+        }
+    }
+
+    while (!heap.empty()) {
+        const HeapItem top = heap.top();
+        heap.pop();
+        const int i = top.second;
+        if (finished[i]) {
+            continue;
+        }
+        finished[i] = true;
+        if (i == n) {
+            break;
+        }
+        if (dst_costs[i] >= 0) {
+            relax(i, n, top.first + dst_costs[i], i_shard2);
+        }
+        for (const auto &edge : transfers_[i].edges) {
+            if (!finished[edge.i_to]) {
+                relax(i, edge.i_to, top.first + edge.cost, edge.i_shard);
+            }
+        }
+    }
+
+    // within one shard, the route through the other shards only if it is cheaper
+    if (i_shard1 == i_shard2) {
+        p_way_manager1->DijkstraShortestCosts(p_seg1, { p_seg2 }, costs);
+        if (!finished[n] || (costs[0] >= 0 && costs[0] <= dists[n])) {
+            return AppendShardRoute(p_way_manager1, i_shard1, seg_id1, seg_id2, route);
+        }
+    }
+    if (!finished[n]) {
+        threads_err_strs_.Set("No route between the shards");
+        return false;
+    }
+
+    std::vector<int> path;
+    for (int i = n; i >= 0; i = pre_transfers[i]) {
+        path.push_back(i);
+    }
+    std::reverse(path.begin(), path.end());
+
+    // the shards of the sections are pinned till the route is done, so that the LRU unloading
+    // one of them meanwhile does not make it loaded again
+    std::vector<std::shared_ptr<WayManager>> pinned_shards(shards_.size());
+    pinned_shards[i_shard1] = p_way_manager1;
+    pinned_shards[i_shard2] = p_way_manager2;
+    for (const int i : path) {
+        auto &p_way_manager = pinned_shards[pre_shards[i]];
+        if (!p_way_manager) {
+            p_way_manager = GetShard(pre_shards[i]);
+            if (!p_way_manager) {
+                return false;
+            }
+        }
+    }
+
+    SEG_ID_T from_seg_id = seg_id1;
+    for (const int i : path) {
+        const SEG_ID_T to_seg_id = (i == n) ? seg_id2 : transfers_[i].seg_id;
+        if (to_seg_id == from_seg_id) { // seg1 or seg2 is the transfer
+            continue;
+        }
+        if (false == AppendShardRoute(pinned_shards[pre_shards[i]], pre_shards[i], from_seg_id,
+            to_seg_id, route)) {
+            route.clear();
+            return false;
+        }
+        from_seg_id = to_seg_id;
+    }
+    if (route.empty()) {
+        route.push_back(seg_id1);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,370 @@
+#ifndef _WAY_MANAGER_SNAPSHOT_H_
+#define _WAY_MANAGER_SNAPSHOT_H_
+
+// internal header, only for the way_manager*.cpp files
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "way_manager.h"
+
+namespace geo {
+namespace snapshot {
+
+// file layout, all little endian as written by the host, 8 bytes aligned:
+//
+//  FileHeader | SectionHeader | elements | SectionHeader | elements | ... | SEC_END
+//
+// sections are pointer free, pointers are saved as indices of the pools, so that the
+// elements can be read in place from the mapped file
+static const char MAGIC[8] = { 'W', 'M', 'S', 'N', 'A', 'P', '\0', '\0' };
+static const uint32_t VERSION = 1;
+static const uint32_t ENDIAN_CHECK = 0x01020304;
+
+enum SECTION_ID : uint32_t
+{
+    SEC_END = 0,
+    SEC_META,
+    SEC_STRS,           // '\0' terminated strings, offset 0 is the empty string
+    SEC_SEGS,
+    SEC_NODES,
+    SEC_NODE_SEGS,
+    SEC_WAYS,
+    SEC_WAY_SEGS,
+    SEC_WAY_NODES,
+    SEC_TILES,
+    SEC_TILE_SEGS,
+    SEC_ROUTING_META,
+    SEC_ROUTING_NODES,
+    SEC_ROUTING_NODE_CONNS,
+    SEC_ROUTING_NODE_WAYS,
+    SEC_CONNS,
+    SEC_CONN_SEGS,
+    SEC_CONNS2,
+    SEC_CONNS4,
+    SEC_CONNS6,
+};
+
+struct FileHeader
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    endian_check;
+};
+
+struct SectionHeader
+{
+    uint32_t    id;
+    uint32_t    elem_size; // to detect incompatible layout, e.g., built by another compiler
+    uint64_t    count;
+};
+
+struct MetaRecord
+{
+    double      minlat, minlng, maxlat, maxlng;
+    double      seg_minlat, seg_minlng, seg_maxlat, seg_maxlng; // of InitSegServices()
+    int32_t     match_priority;
+    uint8_t     drive_on_right;
+    uint8_t     has_seg_services;
+    uint8_t     has_routing;
+    uint8_t     pad;
+    uint32_t    seg_count;      // in seg_pool_, the reversed ones follow
+    uint32_t    rev_seg_count;  // in seg_pool_rev_
+};
+
+struct SegRecord
+{
+    int64_t     seg_id, way_id, from_nd, to_nd;
+    double      from_lat, from_lng, to_lat, to_lng, length;
+    int32_t     way_sub_seq, split_seq, way_type, struct_type, heading, layer;
+    uint32_t    name_str, highway_str, tags_str;
+    int32_t     from_node, to_node, ori_way; // -1 for nullptr
+    uint8_t     one_way;
+    uint8_t     pad[3];
+};
+
+struct NodeRecord
+{
+    int64_t     nd_id;
+    double      lat, lng;
+    uint32_t    name_str;
+    uint16_t    nd_type;
+    uint8_t     is_way_connector, is_dead_end;
+    uint8_t     is_weak_connected;
+    uint8_t     pad[3];
+    uint32_t    segs_begin, segs_count; // in SEC_NODE_SEGS
+};
+
+struct WayRecord
+{
+    int64_t     way_id;
+    double      minlat, minlng, maxlat, maxlng;
+    uint32_t    name_str;
+    int32_t     opposite_way;
+    uint32_t    segs_begin, segs_count;   // in SEC_WAY_SEGS
+    uint32_t    nodes_begin, nodes_count; // in SEC_WAY_NODES
+    uint8_t     one_way;
+    uint8_t     pad[7];
+};
+
+struct TileRecord
+{
+    uint32_t    segs_begin, segs_count;   // in SEC_TILE_SEGS
+    uint32_t    nbs_begin, nbs_count;     // segments_with_neighbours, in SEC_TILE_SEGS
+};
+
+struct RoutingMetaRecord
+{
+    uint8_t     shortest_mode;
+    uint8_t     pad[7];
+};
+
+// ranges of the lists of RoutingNode, in order: conn_froms_, conn_tos_, two_step_conn_tos_,
+// four_step_conn_tos_, six_step_conn_tos_ in SEC_ROUTING_NODE_CONNS, and out_oriented_ways_
+// in SEC_ROUTING_NODE_WAYS
+struct RoutingNodeRecord
+{
+    int32_t     node; // -1 for the dummy one
+    uint32_t    begins[6];
+    uint32_t    counts[6];
+};
+
+struct ConnRecord
+{
+    int32_t     i_from_rn, i_to_rn;
+    int64_t     conn_way_id;
+    int32_t     weight;
+    uint32_t    segs_begin, segs_count; // in SEC_CONN_SEGS
+    uint8_t     pad[4];
+};
+
+// segments are in two pools, seg_pool_ and seg_pool_rev_, global index is the index in
+// seg_pool_, or its size + index in seg_pool_rev_
+class SegIndexer
+{
+public:
+    explicit SegIndexer(const std::vector<Segment>& segs, const std::vector<Segment>& rev_segs)
+        : p_segs_(segs.data()), n_segs_(segs.size()),
+        p_rev_segs_(rev_segs.data()), n_rev_segs_(rev_segs.size())
+    {}
+
+    int32_t ToIndex(const Segment* p_seg) const
+    {
+        if (p_seg == nullptr) {
+            return -1;
+        }
+        if (n_segs_ && p_seg >= p_segs_ && p_seg < p_segs_ + n_segs_) {
+            return (int32_t)(p_seg - p_segs_);
+        }
+        if (n_rev_segs_ && p_seg >= p_rev_segs_ && p_seg < p_rev_segs_ + n_rev_segs_) {
+            return (int32_t)(n_segs_ + (p_seg - p_rev_segs_));
+        }
+        return -1;
+    }
+
+    SegmentPtr ToPtr(int32_t index) const
+    {
+        if (index < 0) {
+            return nullptr;
+        }
+        if ((size_t)index < n_segs_) {
+            return (SegmentPtr)(p_segs_ + index);
+        }
+        if ((size_t)index - n_segs_ < n_rev_segs_) {
+            return (SegmentPtr)(p_rev_segs_ + (index - n_segs_));
+        }
+        return nullptr;
+    }
+
+private:
+    const Segment *p_segs_;
+    size_t n_segs_;
+    const Segment *p_rev_segs_;
+    size_t n_rev_segs_;
+};
+
+template<typename T>
+inline int32_t PoolIndex(const T* p, const std::vector<T>& pool)
+{
+    return p ? (int32_t)(p - pool.data()) : -1;
+}
+
+class Writer
+{
+public:
+    explicit Writer(FILE *fp)
+        : fp_(fp)
+    {
+        str_offsets_[std::string()] = 0;
+        strs_.push_back('\0');
+    }
+
+    bool WriteHeader()
+    {
+        FileHeader header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.endian_check = ENDIAN_CHECK;
+        return Write(&header, sizeof(header));
+    }
+
+    template<typename T>
+    bool WriteSection(SECTION_ID id, const std::vector<T>& elems)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot elements must be POD");
+        return WriteSection(id, elems.data(), elems.size());
+    }
+
+    template<typename T>
+    bool WriteSection(SECTION_ID id, const T* p_elems, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot elements must be POD");
+        SectionHeader header;
+        header.id = id;
+        header.elem_size = (uint32_t)sizeof(T);
+        header.count = count;
+        if (!Write(&header, sizeof(header))) {
+            return false;
+        }
+        return Write(p_elems, sizeof(T) * count) && Pad(sizeof(T) * count);
+    }
+
+    // string table and the end mark
+    bool WriteEnd()
+    {
+        if (!WriteSection(SEC_STRS, strs_)) {
+            return false;
+        }
+        SectionHeader header{ SEC_END, 0, 0 };
+        return Write(&header, sizeof(header));
+    }
+
+    // identical strings are saved only once
+    uint32_t AddString(const std::string& str)
+    {
+        auto it = str_offsets_.find(str);
+        if (it != str_offsets_.end()) {
+            return it->second;
+        }
+        const uint32_t offset = (uint32_t)strs_.size();
+        strs_.insert(strs_.end(), str.c_str(), str.c_str() + str.size() + 1);
+        str_offsets_[str] = offset;
+        return offset;
+    }
+
+private:
+    bool Write(const void *p, size_t size)
+    {
+        return size == 0 || fwrite(p, 1, size, fp_) == size;
+    }
+
+    bool Pad(size_t size)
+    {
+        static const char ZEROS[8] = {};
+        const size_t padding = (8 - size % 8) % 8;
+        return Write(ZEROS, padding);
+    }
+
+private:
+    FILE *fp_;
+    std::vector<char> strs_;
+    UNORD_MAP<std::string, uint32_t> str_offsets_;
+};
+
+class Reader
+{
+public:
+    // p_data is typically the mapped file, it has to outlive the reader
+    bool Init(const char *p_data, size_t size, std::string& err)
+    {
+        sections_.clear();
+        if (size < sizeof(FileHeader)) {
+            err = "snapshot file too small";
+            return false;
+        }
+        FileHeader header;
+        memcpy(&header, p_data, sizeof(header));
+        if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            err = "not a snapshot file";
+            return false;
+        }
+        if (header.version != VERSION || header.endian_check != ENDIAN_CHECK) {
+            err = "incompatible snapshot version " + std::to_string(header.version);
+            return false;
+        }
+
+        size_t pos = sizeof(FileHeader);
+        while (true) {
+            if (pos + sizeof(SectionHeader) > size) {
+                err = "truncated snapshot file";
+                return false;
+            }
+            Section section;
+            memcpy(&section.header, p_data + pos, sizeof(SectionHeader));
+            pos += sizeof(SectionHeader);
+            if (section.header.id == SEC_END) {
+                break;
+            }
+
+            const uint64_t bytes = section.header.count * section.header.elem_size;
+            if (bytes > size - pos) {
+                err = "truncated snapshot section " + std::to_string(section.header.id);
+                return false;
+            }
+            section.p_data = p_data + pos;
+            sections_.push_back(section);
+            pos += (size_t)(bytes + (8 - bytes % 8) % 8);
+        }
+
+        const char *p_strs;
+        if (!GetSection(SEC_STRS, p_strs, strs_size_, err) || strs_size_ == 0 ||
+            p_strs[strs_size_ - 1] != '\0') {
+            err = "invalid string table in snapshot";
+            return false;
+        }
+        p_strs_ = p_strs;
+        return true;
+    }
+
+    // elements are used in place, no copy
+    template<typename T>
+    bool GetSection(SECTION_ID id, const T*& p_elems, size_t& count, std::string& err) const
+    {
+        for (const auto& section : sections_) {
+            if (section.header.id == id) {
+                if (section.header.elem_size != sizeof(T)) {
+                    err = "incompatible element size in snapshot section " + std::to_string(id);
+                    return false;
+                }
+                p_elems = reinterpret_cast<const T*>(section.p_data);
+                count = (size_t)section.header.count;
+                return true;
+            }
+        }
+        err = "missing snapshot section " + std::to_string(id);
+        return false;
+    }
+
+    const char *GetString(uint32_t offset) const
+    {
+        return offset < strs_size_ ? p_strs_ + offset : "";
+    }
+
+private:
+    struct Section
+    {
+        SectionHeader header;
+        const char *p_data;
+    };
+    std::vector<Section> sections_;
+    const char *p_strs_{};
+    size_t strs_size_{};
+};
+
+} // namespace snapshot
+} // namespace geo
+
+#endif // _WAY_MANAGER_SNAPSHOT_H_
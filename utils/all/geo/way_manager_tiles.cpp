@@ -0,0 +1,682 @@
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include "way_manager.h"
+#include "way_manager_segbin.h"
+#include "common/common_utils.h"
+#include "common/simple_thread_pool.hpp"
+#include "common/simple_par_algorithm.hpp"
+
+#ifndef M_PI
+#define M_PI       3.14159265358979323846
+#endif
+
+
+namespace geo {
+
+//
+// binary tile, varints as in the binary segments file (way_manager_segbin.h):
+//
+//  "WMVT" | version | z | x | y | heat_cell_bits | seg_count | cell_count | segments | cells
+//
+// the points are quantized to TILE_EXTENT units per tile side in web mercator, from the top left
+// corner of the tile, so the points outside of the tile are negative or beyond TILE_EXTENT. a
+// segment is the seg_id and way_id as deltas to the previous segment, the way_type, the from point
+// as delta to the previous to point and the to point as delta to the from point. a cell is its
+// index row * 2^heat_cell_bits + col as delta to the previous cell, and its count
+static const char TILE_MAGIC[4] = { 'W', 'M', 'V', 'T' };
+static const uint64_t TILE_VERSION = 1;
+static const int TILE_EXTENT = 4096;
+static const int MAX_TILE_ZOOM = 30; // of the heat cells as well, tile x and y fit in int
+static const double MAX_MERCATOR_LAT = 85.0511287798;
+
+// fractional tile coordinates, floored by geo::long2tilex() and geo::lat2tiley()
+static inline double lng_to_tile_x(double lng, int z)
+{
+    return (lng + 180.0) / 360.0 * (double)(1LL << z);
+}
+
+static inline double lat_to_tile_y(double lat, int z)
+{
+    lat = std::min(std::max(lat, -MAX_MERCATOR_LAT), MAX_MERCATOR_LAT);
+    const double rad_lat = lat * M_PI / 180.0;
+    return (1.0 - std::log(std::tan(rad_lat) + 1.0 / std::cos(rad_lat)) / M_PI) / 2.0 *
+        (double)(1LL << z);
+}
+
+static inline double tile_x_to_lng(double x, int z)
+{
+    return x / (double)(1LL << z) * 360.0 - 180.0;
+}
+
+static inline double tile_y_to_lat(double y, int z)
+{
+    const double n = M_PI - 2.0 * M_PI * y / (double)(1LL << z);
+    return 180.0 / M_PI * std::atan(std::sinh(n));
+}
+
+// the tile of the fractional coordinate, within [0, 2^z)
+static inline int to_tile(double v, int z)
+{
+    return (int)std::floor(std::min(std::max(v, 0.0), (double)((1LL << z) - 1)));
+}
+
+static inline long long parent_tile(long long tile_xy, int levels)
+{
+    return make_tilexy(tilexy2tilex(tile_xy) >> levels, tilexy2tiley(tile_xy) >> levels);
+}
+
+static bool write_file(const std::string &pathname, const std::string &data)
+{
+    FILE *fp = fopen(pathname.c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    const bool ok = data.empty() || fwrite(data.data(), 1, data.size(), fp) == data.size();
+    return fclose(fp) == 0 && ok;
+}
+
+static bool make_dir(const std::string &pathname)
+{
+    return util::DirExists(pathname) || util::MakeDir(pathname);
+}
+
+void TilePyramid::SetSegments(const WayManager &way_manager)
+{
+    // the tiles written before are to be removed if they become empty
+    if (built_) {
+        for (size_t i = 0; i < levels_.size(); ++i) {
+            for (const auto &tile : levels_[i].tiles) {
+                dirty_tiles_[i].insert(tile.tile_xy);
+            }
+        }
+    }
+    all_dirty_ = true;
+    need_build_ = true;
+
+    segs_.clear();
+    seg_indexes_.clear();
+    for (const auto &seg : way_manager.GetAllSegs()) {
+        if (seg.seg_id_ < 0) {
+            continue;
+        }
+        TileSeg tile_seg;
+        tile_seg.seg_id = seg.seg_id_;
+        tile_seg.way_id = seg.way_id_;
+        tile_seg.way_type = seg.way_type_;
+        tile_seg.from_point = seg.from_point_;
+        tile_seg.to_point = seg.to_point_;
+        seg_indexes_[seg.seg_id_] = segs_.size();
+        segs_.push_back(tile_seg);
+    }
+}
+
+void TilePyramid::SetSegment(const Segment &seg)
+{
+    TileSeg tile_seg;
+    tile_seg.seg_id = seg.seg_id_;
+    tile_seg.way_id = seg.way_id_;
+    tile_seg.way_type = seg.way_type_;
+    tile_seg.from_point = seg.from_point_;
+    tile_seg.to_point = seg.to_point_;
+
+    auto it = seg_indexes_.find(seg.seg_id_);
+    if (it != seg_indexes_.end()) {
+        MarkDirty(segs_[it->second]);
+        segs_[it->second] = tile_seg;
+    }
+    else {
+        seg_indexes_[seg.seg_id_] = segs_.size();
+        segs_.push_back(tile_seg);
+    }
+    MarkDirty(tile_seg);
+    need_build_ = true;
+}
+
+bool TilePyramid::RemoveSegment(SEG_ID_T seg_id)
+{
+    auto it = seg_indexes_.find(seg_id);
+    if (it == seg_indexes_.end()) {
+        threads_err_strs_.Set("RemoveSegment: segment " + std::to_string(seg_id) + " not found");
+        return false;
+    }
+    const size_t index = it->second;
+    MarkDirty(segs_[index]);
+    seg_indexes_.erase(it);
+    if (index + 1 < segs_.size()) {
+        segs_[index] = segs_.back();
+        seg_indexes_[segs_[index].seg_id] = index;
+    }
+    segs_.pop_back();
+    need_build_ = true;
+    return true;
+}
+
+void TilePyramid::AddPoint(const GeoPoint &point, unsigned long long count)
+{
+    if (point.lat < -MAX_MERCATOR_LAT || point.lat > MAX_MERCATOR_LAT || max_zoom_ < 0 ||
+        heat_cell_bits_ < 0 || max_zoom_ + heat_cell_bits_ > MAX_TILE_ZOOM) {
+        return;
+    }
+    const int z_cell = max_zoom_ + heat_cell_bits_;
+    const long long cell_xy = make_tilexy(to_tile(lng_to_tile_x(point.lng, z_cell), z_cell),
+        to_tile(lat_to_tile_y(point.lat, z_cell), z_cell));
+    heat_[cell_xy] += count;
+    need_build_ = true;
+
+    if (built_) {
+        for (int z = max_zoom_; z >= min_zoom_; --z) {
+            dirty_tiles_[z - min_zoom_].insert(parent_tile(cell_xy, z_cell - z));
+        }
+    }
+}
+
+// grid traversal (Amanatides & Woo) of the tiles crossed by the segment, taken as straight in
+// web mercator, which is close enough for the lengths of road segments
+void TilePyramid::CoverTiles(const TileSeg &seg, std::vector<long long> &tiles) const
+{
+    tiles.clear();
+    const int z = max_zoom_;
+    const double fx1 = lng_to_tile_x(seg.from_point.lng, z);
+    const double fy1 = lat_to_tile_y(seg.from_point.lat, z);
+    const double fx2 = lng_to_tile_x(seg.to_point.lng, z);
+    const double fy2 = lat_to_tile_y(seg.to_point.lat, z);
+    int x = to_tile(fx1, z), y = to_tile(fy1, z);
+    const int x_end = to_tile(fx2, z), y_end = to_tile(fy2, z);
+    const int step_x = (x_end > x) ? 1 : -1;
+    const int step_y = (y_end > y) ? 1 : -1;
+
+    // in the fraction of the segment, when the next tile border is crossed
+    const double t_delta_x = (fx2 != fx1) ? 1.0 / std::fabs(fx2 - fx1) : HUGE_VAL;
+    const double t_delta_y = (fy2 != fy1) ? 1.0 / std::fabs(fy2 - fy1) : HUGE_VAL;
+    double t_max_x = (fx2 != fx1) ? ((step_x > 0) ? x + 1 - fx1 : fx1 - x) * t_delta_x : HUGE_VAL;
+    double t_max_y = (fy2 != fy1) ? ((step_y > 0) ? y + 1 - fy1 : fy1 - y) * t_delta_y : HUGE_VAL;
+
+    tiles.push_back(make_tilexy(x, y));
+    // each step moves one tile towards the end, so that the end tile is always reached
+    for (int n = std::abs(x_end - x) + std::abs(y_end - y); n > 0; --n) {
+        if (y == y_end || (x != x_end && t_max_x < t_max_y)) {
+            x += step_x;
+            t_max_x += t_delta_x;
+        }
+        else {
+            y += step_y;
+            t_max_y += t_delta_y;
+        }
+        tiles.push_back(make_tilexy(x, y));
+    }
+}
+
+void TilePyramid::MarkDirty(const TileSeg &seg)
+{
+    if (!built_) {
+        return; // all dirty
+    }
+    std::vector<long long> tiles;
+    CoverTiles(seg, tiles);
+    for (int z = max_zoom_; z >= min_zoom_; --z) {
+        auto &dirty_tiles = dirty_tiles_[z - min_zoom_];
+        for (auto &tile_xy : tiles) {
+            dirty_tiles.insert(tile_xy);
+            tile_xy = parent_tile(tile_xy, 1);
+        }
+    }
+}
+
+bool TilePyramid::Build()
+{
+    if (min_zoom_ < 0 || min_zoom_ > max_zoom_ || heat_cell_bits_ < 0 ||
+        max_zoom_ + heat_cell_bits_ > MAX_TILE_ZOOM) {
+        threads_err_strs_.Set("TilePyramid: invalid zoom levels or heat cell bits");
+        return false;
+    }
+
+    // the tiles of max_zoom crossed by the segments, by blocks of segments in parallel
+    typedef std::pair<long long, int> TileSegPair; // tile_xy, index in segs_
+    const size_t BLOCK_SEGS = 16384;
+    std::vector<std::vector<TileSegPair>> block_pairs((segs_.size() + BLOCK_SEGS - 1) / BLOCK_SEGS);
+    util::SimpleDataQueue<size_t> blocks;
+    for (size_t i = 0; i < block_pairs.size(); ++i) {
+        blocks.Add(i);
+    }
+    util::CreateSimpleThreadPool("TilePyramid_Build", 0, [this, &blocks, &block_pairs]() {
+        std::vector<long long> tiles;
+        size_t i_block;
+        while (blocks.Get(i_block)) {
+            auto &pairs = block_pairs[i_block];
+            const size_t end = std::min(segs_.size(), (i_block + 1) * BLOCK_SEGS);
+            for (size_t i = i_block * BLOCK_SEGS; i < end; ++i) {
+                CoverTiles(segs_[i], tiles);
+                for (auto tile_xy : tiles) {
+                    pairs.push_back(TileSegPair(tile_xy, (int)i));
+                }
+            }
+        }
+    }).JoinAll();
+
+    std::vector<TileSegPair> pairs;
+    size_t pair_count = 0;
+    for (const auto &block : block_pairs) {
+        pair_count += block.size();
+    }
+    pairs.reserve(pair_count);
+    for (auto &block : block_pairs) {
+        pairs.insert(pairs.end(), block.begin(), block.end());
+        std::vector<TileSegPair>().swap(block);
+    }
+
+    // the heat cells of max_zoom, x and y at max_zoom + heat_cell_bits
+    struct CellCount
+    {
+        int x, y;
+        unsigned long long count;
+    };
+    std::vector<CellCount> cells;
+    cells.reserve(heat_.size());
+    for (const auto &entry : heat_) {
+        cells.push_back(CellCount{ tilexy2tilex(entry.first), tilexy2tiley(entry.first),
+            entry.second });
+    }
+
+    // each level from the one below, by the parent tiles and cells
+    const int bits = heat_cell_bits_;
+    const int cell_mask = (1 << bits) - 1;
+    auto cell_tile = [bits](const CellCount &cell) {
+        return make_tilexy(cell.x >> bits, cell.y >> bits);
+    };
+    levels_.assign(max_zoom_ - min_zoom_ + 1, Level());
+    dirty_tiles_.resize(levels_.size());
+    for (int z = max_zoom_; z >= min_zoom_; --z) {
+        if (z < max_zoom_) {
+            for (auto &pair : pairs) {
+                pair.first = parent_tile(pair.first, 1);
+            }
+            for (auto &cell : cells) {
+                cell.x >>= 1;
+                cell.y >>= 1;
+            }
+        }
+        util::ParSort(pairs.begin(), pairs.end(), std::less<TileSegPair>());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+        // by tile, then row by row
+        std::sort(cells.begin(), cells.end(), [&cell_tile](const CellCount &a, const CellCount &b) {
+            const long long tile_a = cell_tile(a), tile_b = cell_tile(b);
+            if (tile_a != tile_b) {
+                return tile_a < tile_b;
+            }
+            return (a.y != b.y) ? a.y < b.y : a.x < b.x;
+        });
+        size_t n_cells = 0;
+        for (size_t i = 0; i < cells.size(); ++i) {
+            if (n_cells > 0 && cells[n_cells - 1].x == cells[i].x &&
+                cells[n_cells - 1].y == cells[i].y) {
+                cells[n_cells - 1].count += cells[i].count;
+            }
+            else {
+                cells[n_cells++] = cells[i];
+            }
+        }
+        cells.resize(n_cells);
+
+        Level &level = levels_[z - min_zoom_];
+        level.seg_indexes.resize(pairs.size());
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            level.seg_indexes[i] = pairs[i].second;
+        }
+        level.cells.resize(cells.size());
+        for (size_t i = 0; i < cells.size(); ++i) {
+            level.cells[i].col = cells[i].x & cell_mask;
+            level.cells[i].row = cells[i].y & cell_mask;
+            level.cells[i].count = cells[i].count;
+        }
+
+        // the tiles with segments or cells, merging the two sorted lists
+        size_t i = 0, j = 0;
+        while (i < pairs.size() || j < cells.size()) {
+            Tile tile;
+            tile.tile_xy = std::min(i < pairs.size() ? pairs[i].first : LLONG_MAX,
+                j < cells.size() ? cell_tile(cells[j]) : LLONG_MAX);
+            tile.segs_begin = (unsigned)i;
+            while (i < pairs.size() && pairs[i].first == tile.tile_xy) {
+                ++i;
+            }
+            tile.segs_count = (unsigned)i - tile.segs_begin;
+            tile.cells_begin = (unsigned)j;
+            while (j < cells.size() && cell_tile(cells[j]) == tile.tile_xy) {
+                ++j;
+            }
+            tile.cells_count = (unsigned)j - tile.cells_begin;
+            level.tiles.push_back(tile);
+        }
+    }
+
+    built_ = true;
+    need_build_ = false;
+    return true;
+}
+
+size_t TilePyramid::GetTileCount(int z) const
+{
+    if (!built_ || z < min_zoom_ || z > max_zoom_) {
+        return 0;
+    }
+    return levels_[z - min_zoom_].tiles.size();
+}
+
+size_t TilePyramid::GetDirtyTileCount() const
+{
+    if (!built_) {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < levels_.size(); ++i) {
+        count += all_dirty_ ? levels_[i].tiles.size() : dirty_tiles_[i].size();
+    }
+    return count;
+}
+
+const TilePyramid::Tile* TilePyramid::FindTile(int z, int x, int y) const
+{
+    if (!built_ || z < min_zoom_ || z > max_zoom_) {
+        return nullptr;
+    }
+    const auto &tiles = levels_[z - min_zoom_].tiles;
+    const long long tile_xy = make_tilexy(x, y);
+    auto it = std::lower_bound(tiles.begin(), tiles.end(), tile_xy,
+        [](const Tile &tile, long long tile_xy) {
+        return tile.tile_xy < tile_xy;
+    });
+    return (it != tiles.end() && it->tile_xy == tile_xy) ? &*it : nullptr;
+}
+
+bool TilePyramid::GetTile(int z, int x, int y, TileContent &content) const
+{
+    if (need_build_) {
+        threads_err_strs_.Set("GetTile: Build() needed after the changes");
+        return false;
+    }
+    const Tile *p_tile = FindTile(z, x, y);
+    if (p_tile == nullptr) {
+        threads_err_strs_.Set("GetTile: empty tile");
+        return false;
+    }
+
+    const Level &level = levels_[z - min_zoom_];
+    content.z = z;
+    content.x = x;
+    content.y = y;
+    content.segs.resize(p_tile->segs_count);
+    for (unsigned i = 0; i < p_tile->segs_count; ++i) {
+        content.segs[i] = segs_[level.seg_indexes[p_tile->segs_begin + i]];
+    }
+    content.cells.assign(level.cells.begin() + p_tile->cells_begin,
+        level.cells.begin() + p_tile->cells_begin + p_tile->cells_count);
+    return true;
+}
+
+bool TilePyramid::EncodeTile(int z, int x, int y, TILE_FORMAT format, std::string &data) const
+{
+    TileContent content;
+    if (!GetTile(z, x, y, content)) {
+        return false;
+    }
+
+    if (format == TILE_GEOJSON) {
+        std::ostringstream out;
+        GeoJsonStreamWriter writer(out);
+        for (const auto &seg : content.segs) {
+            writer.BeginLineString(seg.from_point, seg.to_point);
+            writer.AddProp("seg_id", (long long)seg.seg_id);
+            writer.AddProp("way_id", (long long)seg.way_id);
+            writer.AddProp("highway", (int)seg.way_type);
+            writer.EndFeature();
+        }
+        // the heat cells as their center points
+        const int z_cell = z + heat_cell_bits_;
+        for (const auto &cell : content.cells) {
+            const double cell_x = ((long long)x << heat_cell_bits_) + cell.col + 0.5;
+            const double cell_y = ((long long)y << heat_cell_bits_) + cell.row + 0.5;
+            writer.BeginPoint(GeoPoint(tile_y_to_lat(cell_y, z_cell),
+                tile_x_to_lng(cell_x, z_cell)));
+            writer.AddProp("count", cell.count);
+            writer.EndFeature();
+        }
+        if (!writer.Close()) {
+            threads_err_strs_.Set("EncodeTile: error in writing GeoJSON");
+            return false;
+        }
+        data = out.str();
+        return true;
+    }
+
+    std::vector<char> buff(TILE_MAGIC, TILE_MAGIC + sizeof(TILE_MAGIC));
+    segbin::PutVarint(buff, TILE_VERSION);
+    segbin::PutVarint(buff, (uint64_t)z);
+    segbin::PutVarint(buff, (uint64_t)x);
+    segbin::PutVarint(buff, (uint64_t)y);
+    segbin::PutVarint(buff, (uint64_t)heat_cell_bits_);
+    segbin::PutVarint(buff, content.segs.size());
+    segbin::PutVarint(buff, content.cells.size());
+
+    auto quantize_x = [z, x](double lng) {
+        return (int64_t)std::llround((lng_to_tile_x(lng, z) - x) * TILE_EXTENT);
+    };
+    auto quantize_y = [z, y](double lat) {
+        return (int64_t)std::llround((lat_to_tile_y(lat, z) - y) * TILE_EXTENT);
+    };
+    segbin::DeltaState state;
+    for (const auto &seg : content.segs) {
+        const int64_t from_x = quantize_x(seg.from_point.lng);
+        const int64_t from_y = quantize_y(seg.from_point.lat);
+        const int64_t to_x = quantize_x(seg.to_point.lng);
+        const int64_t to_y = quantize_y(seg.to_point.lat);
+        segbin::PutSVarint(buff, seg.seg_id - state.seg_id);
+        segbin::PutSVarint(buff, seg.way_id - state.way_id);
+        segbin::PutVarint(buff, (uint64_t)seg.way_type);
+        segbin::PutSVarint(buff, from_x - state.to_lng);
+        segbin::PutSVarint(buff, from_y - state.to_lat);
+        segbin::PutSVarint(buff, to_x - from_x);
+        segbin::PutSVarint(buff, to_y - from_y);
+        state.seg_id = seg.seg_id;
+        state.way_id = seg.way_id;
+        state.to_lng = to_x;
+        state.to_lat = to_y;
+    }
+    // row by row, so the indexes are increasing
+    uint64_t prev_index = 0;
+    for (const auto &cell : content.cells) {
+        const uint64_t index = ((uint64_t)cell.row << heat_cell_bits_) + cell.col;
+        segbin::PutVarint(buff, index - prev_index);
+        segbin::PutVarint(buff, cell.count);
+        prev_index = index;
+    }
+    data.assign(buff.begin(), buff.end());
+    return true;
+}
+
+bool TilePyramid::DecodeBinaryTile(const char *p_data, size_t size, TileContent &content,
+    std::string &err)
+{
+    content = TileContent();
+    if (size < sizeof(TILE_MAGIC) || memcmp(p_data, TILE_MAGIC, sizeof(TILE_MAGIC)) != 0) {
+        err = "not a binary tile";
+        return false;
+    }
+    const char *p = p_data + sizeof(TILE_MAGIC);
+    const char *p_end = p_data + size;
+    uint64_t version, z, x, y, bits, seg_count, cell_count;
+    if (!segbin::GetVarint(p, p_end, version) || !segbin::GetVarint(p, p_end, z) ||
+        !segbin::GetVarint(p, p_end, x) || !segbin::GetVarint(p, p_end, y) ||
+        !segbin::GetVarint(p, p_end, bits) || !segbin::GetVarint(p, p_end, seg_count) ||
+        !segbin::GetVarint(p, p_end, cell_count)) {
+        err = "truncated binary tile";
+        return false;
+    }
+    if (version != TILE_VERSION) {
+        err = "incompatible binary tile version " + std::to_string(version);
+        return false;
+    }
+    if (z + bits > (uint64_t)MAX_TILE_ZOOM || x >> z != 0 || y >> z != 0) {
+        err = "invalid binary tile z/x/y";
+        return false;
+    }
+    // at least one byte per value, so that the counts cannot make reserve() explode
+    if (seg_count > size || cell_count > size) {
+        err = "truncated binary tile";
+        return false;
+    }
+    content.z = (int)z;
+    content.x = (int)x;
+    content.y = (int)y;
+
+    auto to_lng = [&content](int64_t v) {
+        return tile_x_to_lng(content.x + (double)v / TILE_EXTENT, content.z);
+    };
+    auto to_lat = [&content](int64_t v) {
+        return tile_y_to_lat(content.y + (double)v / TILE_EXTENT, content.z);
+    };
+    segbin::DeltaState state;
+    content.segs.reserve((size_t)seg_count);
+    for (uint64_t i = 0; i < seg_count; ++i) {
+        int64_t d_seg_id, d_way_id, d_from_x, d_from_y, d_to_x, d_to_y;
+        uint64_t way_type;
+        if (!segbin::GetSVarint(p, p_end, d_seg_id) || !segbin::GetSVarint(p, p_end, d_way_id) ||
+            !segbin::GetVarint(p, p_end, way_type) || !segbin::GetSVarint(p, p_end, d_from_x) ||
+            !segbin::GetSVarint(p, p_end, d_from_y) || !segbin::GetSVarint(p, p_end, d_to_x) ||
+            !segbin::GetSVarint(p, p_end, d_to_y)) {
+            err = "truncated binary tile";
+            return false;
+        }
+        const int64_t from_x = state.to_lng + d_from_x;
+        const int64_t from_y = state.to_lat + d_from_y;
+        state.seg_id += d_seg_id;
+        state.way_id += d_way_id;
+        state.to_lng = from_x + d_to_x;
+        state.to_lat = from_y + d_to_y;
+
+        TileSeg seg;
+        seg.seg_id = (SEG_ID_T)state.seg_id;
+        seg.way_id = (WAY_ID_T)state.way_id;
+        seg.way_type = (HIGHWAY_TYPE)way_type;
+        seg.from_point = GeoPoint(to_lat(from_y), to_lng(from_x));
+        seg.to_point = GeoPoint(to_lat(state.to_lat), to_lng(state.to_lng));
+        content.segs.push_back(seg);
+    }
+
+    const uint64_t cell_mask = (1ULL << bits) - 1;
+    uint64_t index = 0;
+    content.cells.reserve((size_t)cell_count);
+    for (uint64_t i = 0; i < cell_count; ++i) {
+        uint64_t d_index, count;
+        if (!segbin::GetVarint(p, p_end, d_index) || !segbin::GetVarint(p, p_end, count)) {
+            err = "truncated binary tile";
+            return false;
+        }
+        index += d_index;
+        if (index >> (bits * 2) != 0) {
+            err = "invalid heat cell in binary tile";
+            return false;
+        }
+        HeatCell cell;
+        cell.col = (int)(index & cell_mask);
+        cell.row = (int)(index >> bits);
+        cell.count = count;
+        content.cells.push_back(cell);
+    }
+    return true;
+}
+
+bool TilePyramid::WriteTiles(const std::string &dir, TILE_FORMAT format, bool dirty_only,
+    unsigned thread_count)
+{
+    if (need_build_ && !Build()) {
+        return false;
+    }
+
+    // the dirty tiles not in the levels any more are removed
+    std::vector<std::pair<int, long long>> writes, removes;
+    for (int z = min_zoom_; z <= max_zoom_; ++z) {
+        const Level &level = levels_[z - min_zoom_];
+        const auto &dirty_tiles = dirty_tiles_[z - min_zoom_];
+        for (auto tile_xy : dirty_tiles) {
+            const bool exists = FindTile(z, tilexy2tilex(tile_xy), tilexy2tiley(tile_xy)) != nullptr;
+            if (!exists) {
+                removes.push_back(std::make_pair(z, tile_xy));
+            }
+            else if (dirty_only && !all_dirty_) {
+                writes.push_back(std::make_pair(z, tile_xy));
+            }
+        }
+        if (!dirty_only || all_dirty_) {
+            for (const auto &tile : level.tiles) {
+                writes.push_back(std::make_pair(z, tile.tile_xy));
+            }
+        }
+    }
+
+    const char *ext = (format == TILE_GEOJSON) ? ".geojson" : ".bin";
+    auto tile_pathname = [&dir, ext](int z, long long tile_xy) {
+        return dir + '/' + std::to_string(z) + '/' + std::to_string(tilexy2tilex(tile_xy)) + '/' +
+            std::to_string(tilexy2tiley(tile_xy)) + ext;
+    };
+
+    // the directories <dir>/<z>/<x> first, in this thread
+    std::set<std::pair<int, int>> xs;
+    for (const auto &write : writes) {
+        xs.insert(std::make_pair(write.first, tilexy2tilex(write.second)));
+    }
+    int dir_z = -1;
+    for (const auto &z_x : xs) {
+        const std::string z_dir = dir + '/' + std::to_string(z_x.first);
+        if ((dir_z == -1 && !make_dir(dir)) || (dir_z != z_x.first && !make_dir(z_dir)) ||
+            !make_dir(z_dir + '/' + std::to_string(z_x.second))) {
+            threads_err_strs_.Set("WriteTiles: cannot create the directories in " + dir);
+            return false;
+        }
+        dir_z = z_x.first;
+    }
+
+    // encoded and written in parallel, each file by one thread
+    util::SimpleDataQueue<size_t> jobs;
+    for (size_t i = 0; i < writes.size(); ++i) {
+        jobs.Add(i);
+    }
+    std::vector<char> oks(writes.size());
+    util::CreateSimpleThreadPool("TilePyramid_Write", thread_count,
+        [this, &jobs, &writes, &oks, &tile_pathname, format]() {
+        std::string data;
+        size_t i;
+        while (jobs.Get(i)) {
+            const int z = writes[i].first;
+            const long long tile_xy = writes[i].second;
+            oks[i] = EncodeTile(z, tilexy2tilex(tile_xy), tilexy2tiley(tile_xy), format, data) &&
+                write_file(tile_pathname(z, tile_xy), data);
+        }
+    }).JoinAll();
+    for (size_t i = 0; i < writes.size(); ++i) {
+        if (!oks[i]) {
+            threads_err_strs_.Set("WriteTiles: error in writing " +
+                tile_pathname(writes[i].first, writes[i].second));
+            return false;
+        }
+    }
+
+    // the file may not exist if the tile was added and removed since the last writing
+    for (const auto &remove : removes) {
+        ::remove(tile_pathname(remove.first, remove.second).c_str());
+    }
+
+    for (auto &dirty_tiles : dirty_tiles_) {
+        dirty_tiles.clear();
+    }
+    all_dirty_ = false;
+    return true;
+}
+
+}
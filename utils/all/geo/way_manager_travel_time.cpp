@@ -0,0 +1,295 @@
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include "way_manager.h"
+
+
+namespace geo {
+
+// the anchors are matched via points projected along the result route
+struct TravelAnchor
+{
+    double  pos;        // distance in meters from the start of the result route
+    double  time;       // record_time
+    bool    broken;     // route is broken between this anchor and the next one
+};
+
+// time of position pos, interpolated between anchors[k] and anchors[k + 1].
+// positions have to be queried in non-decreasing order, k is moved forward accordingly.
+// if the vehicle stops at pos (several anchors at the same position), latest decides
+// whether the leaving time or the arriving time is returned
+static double InterpolateTime(const std::vector<TravelAnchor> &anchors, size_t end,
+    size_t &k, double pos, bool latest)
+{
+    if (latest) {
+        while (k + 1 < end && anchors[k + 1].pos <= pos) {
+            ++k;
+        }
+    } else {
+        while (k + 1 < end && anchors[k + 1].pos < pos) {
+            ++k;
+        }
+    }
+    if (k + 1 >= end) {
+        return anchors[k].time;
+    }
+
+    const TravelAnchor &a = anchors[k];
+    const TravelAnchor &b = anchors[k + 1];
+    const double delta_pos = b.pos - a.pos;
+    if (delta_pos < 1e-6) {
+        return latest ? b.time : a.time;
+    }
+    return a.time + (pos - a.pos) / delta_pos * (b.time - a.time);
+}
+
+//
+//  anchors:        a0          a1                a2              a3
+//  result_route: --|----->-------|------->---------|------>--------|---->
+//  traversals:     |<-partial->|<-- full -->|<---- full ---->|<-partial->|
+//
+// one pass over the route and one pass over the anchors, no search
+bool WayManager::ExtractSegTraversals(const RouteMatchingParams &params,
+    std::vector<SegTraversal> &traversals) const
+{
+    traversals.clear();
+
+    const auto &route = params.result_route;
+    if (route.empty() || params.via_points.size() < 2) {
+        SetErrorString("Empty result route or too few via points");
+        return false;
+    }
+
+    // offsets of segment starts along the route
+    std::vector<double> seg_offsets(route.size() + 1);
+    seg_offsets[0] = 0;
+    for (size_t i = 0; i < route.size(); ++i) {
+        seg_offsets[i + 1] = seg_offsets[i] + route[i]->length_;
+    }
+
+    // is_broken: no route from the via point to the next one. a dropped point passes its flag
+    // to the last anchor, as the route from that anchor to the next one goes through it
+    std::vector<TravelAnchor> anchors;
+    anchors.reserve(params.via_points.size());
+    for (const auto &via_point : params.via_points) {
+        if (via_point.i_seg < 0 || via_point.i_seg >= (int)route.size() ||
+            via_point.record_time == 0) {
+            if (via_point.is_broken && !anchors.empty()) {
+                anchors.back().broken = true;
+            }
+            continue;
+        }
+
+        const auto &p_seg = route[via_point.i_seg];
+        double proj_length = get_projection_distance_in_meter(via_point.geo_point,
+            p_seg->from_point_, p_seg->to_point_, true);
+        proj_length = std::min(std::max(proj_length, 0.0), p_seg->length_);
+
+        TravelAnchor anchor;
+        anchor.pos = seg_offsets[via_point.i_seg] + proj_length;
+        anchor.time = (double)via_point.record_time;
+        anchor.broken = via_point.is_broken;
+
+        if (!anchors.empty() && !anchors.back().broken) {
+            // GPS jitter backwards, or records out of order
+            if (anchor.pos < anchors.back().pos || anchor.time <= anchors.back().time) {
+                anchors.back().broken = anchor.broken;
+                continue;
+            }
+        }
+        anchors.push_back(anchor);
+    }
+    if (anchors.size() < 2) {
+        SetErrorString("Too few matched via points with record time");
+        return false;
+    }
+
+    traversals.reserve(route.size());
+    size_t i_seg = 0;
+    size_t run_begin = 0;
+    while (run_begin < anchors.size()) {
+        // a run is a range of anchors without broken route in between
+        size_t run_end = run_begin + 1;
+        while (run_end < anchors.size() && !anchors[run_end - 1].broken) {
+            ++run_end;
+        }
+
+        const double run_from = anchors[run_begin].pos;
+        const double run_to = anchors[run_end - 1].pos;
+        if (run_end - run_begin >= 2 && run_to > run_from) {
+            while (i_seg < route.size() && seg_offsets[i_seg + 1] <= run_from) {
+                ++i_seg;
+            }
+
+            size_t k = run_begin;
+            for (; i_seg < route.size() && seg_offsets[i_seg] < run_to; ++i_seg) {
+                const double from = std::max(seg_offsets[i_seg], run_from);
+                const double to = std::min(seg_offsets[i_seg + 1], run_to);
+                if (to <= from) {
+                    continue;
+                }
+
+                SegTraversal traversal;
+                traversal.p_seg = route[i_seg];
+                traversal.i_seg = (int)i_seg;
+                traversal.entry_time = InterpolateTime(anchors, run_end, k, from, true);
+                traversal.exit_time = InterpolateTime(anchors, run_end, k, to, false);
+                traversal.length = to - from;
+                traversal.partial = from > seg_offsets[i_seg] || to < seg_offsets[i_seg + 1];
+                const double travel_time = traversal.exit_time - traversal.entry_time;
+                traversal.speed = travel_time > 0 ? traversal.length / travel_time * 3.6 : 0;
+                traversals.push_back(traversal);
+            }
+            // the last segment of this run can be shared by the next run
+            if (i_seg > 0) {
+                --i_seg;
+            }
+        }
+        run_begin = run_end;
+    }
+
+    return true;
+}
+
+double TravelTimeAggregator::SlotStats::StdDevSpeed() const
+{
+    if (count < 2) {
+        return 0.0;
+    }
+    const double avg = sum_speed / count;
+    const double variance = sum_speed2 / count - avg * avg;
+    return variance > 0 ? std::sqrt(variance) : 0.0;
+}
+
+TravelTimeAggregator::TravelTimeAggregator(int slot_seconds, int period_seconds,
+    int shard_count)
+    : slot_seconds_(slot_seconds > 0 ? slot_seconds : 15 * 60),
+    period_seconds_(period_seconds >= slot_seconds_ ? period_seconds : slot_seconds_),
+    slot_count_((period_seconds_ + slot_seconds_ - 1) / slot_seconds_)
+{
+    if (shard_count <= 0) {
+        shard_count = 1;
+    }
+    shards_.reserve(shard_count);
+    for (int i = 0; i < shard_count; ++i) {
+        shards_.emplace_back(new Shard());
+    }
+}
+
+int TravelTimeAggregator::TimeToSlot(double time) const
+{
+    long long seconds = (long long)std::floor(time) % period_seconds_;
+    if (seconds < 0) {
+        seconds += period_seconds_;
+    }
+    return (int)(seconds / slot_seconds_);
+}
+
+size_t TravelTimeAggregator::ShardIndex(SEG_ID_T seg_id) const
+{
+    // fibonacci hashing, segment IDs of the same way are usually consecutive
+    const unsigned long long hash = (unsigned long long)seg_id * 0x9E3779B97F4A7C15ULL;
+    return (size_t)((hash >> 32) % shards_.size());
+}
+
+void TravelTimeAggregator::Add(const std::vector<SegTraversal> &traversals,
+    bool include_partial, double max_speed)
+{
+    // group by shard so that each shard is locked only once per call
+    std::vector<std::pair<size_t, const SegTraversal *>> items;
+    items.reserve(traversals.size());
+    for (const auto &traversal : traversals) {
+        if (!traversal.p_seg || (traversal.partial && !include_partial)) {
+            continue;
+        }
+        if (traversal.speed <= 0 || traversal.speed > max_speed) {
+            continue;
+        }
+        items.emplace_back(ShardIndex(traversal.p_seg->seg_id_), &traversal);
+    }
+    std::stable_sort(items.begin(), items.end(),
+        [](const std::pair<size_t, const SegTraversal *> &a,
+            const std::pair<size_t, const SegTraversal *> &b) {
+        return a.first < b.first;
+    });
+
+    size_t i = 0;
+    while (i < items.size()) {
+        Shard &shard = *shards_[items[i].first];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const size_t i_shard = items[i].first;
+            i < items.size() && items[i].first == i_shard; ++i) {
+            const SegTraversal &traversal = *items[i].second;
+            const SEG_ID_T seg_id = traversal.p_seg->seg_id_;
+            const int slot = TimeToSlot(traversal.entry_time);
+
+            SlotStats &stats = shard.stats_map[SlotKey{ seg_id, slot }];
+            const float speed = (float)traversal.speed;
+            if (stats.count == 0) {
+                stats.seg_id = seg_id;
+                stats.slot = slot;
+                stats.min_speed = speed;
+                stats.max_speed = speed;
+            } else {
+                stats.min_speed = std::min(stats.min_speed, speed);
+                stats.max_speed = std::max(stats.max_speed, speed);
+            }
+            ++stats.count;
+            stats.sum_speed += traversal.speed;
+            stats.sum_speed2 += traversal.speed * traversal.speed;
+            stats.sum_time += traversal.exit_time - traversal.entry_time;
+        }
+    }
+}
+
+bool TravelTimeAggregator::Get(SEG_ID_T seg_id, int slot, SlotStats &stats) const
+{
+    if (slot < 0 || slot >= slot_count_) {
+        return false;
+    }
+
+    const Shard &shard = *shards_[ShardIndex(seg_id)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.stats_map.find(SlotKey{ seg_id, slot });
+    if (it == shard.stats_map.end()) {
+        return false;
+    }
+    stats = it->second;
+    return true;
+}
+
+void TravelTimeAggregator::GetAll(std::vector<SlotStats> &all_stats) const
+{
+    all_stats.clear();
+    for (const auto &p_shard : shards_) {
+        std::lock_guard<std::mutex> lock(p_shard->mutex);
+        for (const auto &pair : p_shard->stats_map) {
+            all_stats.push_back(pair.second);
+        }
+    }
+    std::sort(all_stats.begin(), all_stats.end(),
+        [](const SlotStats &a, const SlotStats &b) {
+        return a.seg_id != b.seg_id ? a.seg_id < b.seg_id : a.slot < b.slot;
+    });
+}
+
+size_t TravelTimeAggregator::Size() const
+{
+    size_t size = 0;
+    for (const auto &p_shard : shards_) {
+        std::lock_guard<std::mutex> lock(p_shard->mutex);
+        size += p_shard->stats_map.size();
+    }
+    return size;
+}
+
+void TravelTimeAggregator::Clear()
+{
+    for (const auto &p_shard : shards_) {
+        std::lock_guard<std::mutex> lock(p_shard->mutex);
+        p_shard->stats_map.clear();
+    }
+}
+
+}